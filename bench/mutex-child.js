@@ -0,0 +1,22 @@
+// Child process side of the contended mutex benchmark in run.js
+//   <mutex> <mapping>   take and release the mutex until the first word of
+//                       the mapping is set
+const addon = require('..');
+
+const lock = new addon.Mutex();
+lock.open(process.argv[2]);
+
+const map = new addon.FileMapping();
+map.openMapping(process.argv[3], 0);
+const flag = new Int32Array(map.sharedBuffer(0, 4));
+
+process.send('ready');
+
+while (Atomics.load(flag, 0) === 0) {
+  lock.wait();
+  lock.release();
+}
+
+map.closeMapping();
+lock.close();
+process.disconnect();
@@ -0,0 +1,396 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Native microbenchmarks of the mapping and locking primitives node_filemap
+// is built on, without Node or V8 in the way. Prints JSON for bench/run.js.
+// -----------------------------------------------------------------------------
+
+#include "platform.h"
+#include "deadline.h"
+#ifdef __linux__
+#include "futex.h"
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    typedef std::chrono::steady_clock clock;
+
+    uint64_t scale = 1; // Divides the iteration counts, for --quick
+
+    uint64_t iterations(uint64_t count)
+    {
+      return std::max<uint64_t>(count / scale, 1);
+    }
+
+    uint64_t elapsed_ns(clock::time_point start)
+    {
+      return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+    }
+
+    // -------------------------------------------------------------------------
+
+    // The results, as JSON objects without the braces
+    std::vector<std::string> results;
+
+    void report(const char *name, uint64_t count, uint64_t totalNs, uint64_t bytesPerOp = 0)
+    {
+      char line[512];
+      double nsPerOp = static_cast<double>(totalNs) / static_cast<double>(count);
+
+      if (bytesPerOp != 0)
+      {
+        double bytesPerSec = static_cast<double>(bytesPerOp) * static_cast<double>(count) * 1e9 / static_cast<double>(totalNs);
+        snprintf(line, sizeof(line), "\"name\": \"%s\", \"iterations\": %llu, \"nsPerOp\": %.2f, \"bytes\": %llu, \"bytesPerSec\": %.0f",
+          name, static_cast<unsigned long long>(count), nsPerOp, static_cast<unsigned long long>(bytesPerOp), bytesPerSec);
+      }
+      else
+      {
+        snprintf(line, sizeof(line), "\"name\": \"%s\", \"iterations\": %llu, \"nsPerOp\": %.2f",
+          name, static_cast<unsigned long long>(count), nsPerOp);
+      }
+
+      results.push_back(line);
+    }
+
+    void report_latency(const char *name, std::vector<uint64_t> &samples)
+    {
+      std::sort(samples.begin(), samples.end());
+
+      auto at = [&samples](double fraction)
+      {
+        auto index = static_cast<size_t>(fraction * static_cast<double>(samples.size() - 1));
+        return static_cast<unsigned long long>(samples[index]);
+      };
+
+      char line[512];
+      snprintf(line, sizeof(line), "\"name\": \"%s\", \"iterations\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu",
+        name, static_cast<unsigned long long>(samples.size()), at(0.5), at(0.9), at(0.99), at(1.0));
+
+      results.push_back(line);
+    }
+
+    // -------------------------------------------------------------------------
+
+    // Named shared memory, made the way file_mapping makes it
+    class shared_region
+    {
+    public:
+      explicit shared_region(size_t size) :
+        m_ptr(nullptr),
+        m_size(size)
+      {
+        static int counter = 0;
+        m_name = "node_filemap_bench_" + std::to_string(current_pid()) + "_" + std::to_string(counter++);
+
+#ifdef _WIN32
+        m_handle = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+          static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), m_name.c_str());
+        if (m_handle != nullptr)
+          m_ptr = MapViewOfFile(m_handle, FILE_MAP_ALL_ACCESS, 0, 0, size);
+#else
+        m_name = "/" + m_name;
+        int fd = shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0)
+        {
+          if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+          {
+            m_ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (m_ptr == MAP_FAILED)
+              m_ptr = nullptr;
+          }
+
+          close(fd);
+        }
+#endif
+      }
+
+      ~shared_region()
+      {
+#ifdef _WIN32
+        if (m_ptr != nullptr)
+          UnmapViewOfFile(m_ptr);
+        if (m_handle != nullptr)
+          CloseHandle(m_handle);
+#else
+        if (m_ptr != nullptr)
+          munmap(m_ptr, m_size);
+        shm_unlink(m_name.c_str());
+#endif
+      }
+
+      char *data() const { return reinterpret_cast<char *>(m_ptr); }
+
+    private:
+      void *m_ptr;
+      size_t m_size;
+      std::string m_name;
+#ifdef _WIN32
+      HANDLE m_handle;
+#endif
+    };
+
+    // -------------------------------------------------------------------------
+
+    void bench_map_unmap()
+    {
+      const size_t SIZE = 1 << 20;
+      auto count = iterations(2000);
+
+      auto start = clock::now();
+      for (uint64_t i = 0; i < count; ++i)
+        shared_region region(SIZE);
+
+      report("map_unmap_1MB", count, elapsed_ns(start));
+    }
+
+    void bench_first_touch()
+    {
+      const size_t SIZE = 64 << 20;
+      auto page = page_size();
+      shared_region region(SIZE);
+
+      auto start = clock::now();
+      for (size_t offset = 0; offset < SIZE; offset += page)
+        region.data()[offset] = 1;
+
+      report("first_touch_per_page", SIZE / page, elapsed_ns(start));
+    }
+
+    void bench_memcpy(size_t size, const char *name)
+    {
+      shared_region region(size);
+      std::vector<char> source(size, 'x');
+
+      // Fault it all in first, so this is just the copy
+      memset(region.data(), 0, size);
+
+      auto count = iterations(std::max<uint64_t>((256ull << 20) / size, 10));
+      auto start = clock::now();
+      for (uint64_t i = 0; i < count; ++i)
+      {
+        memcpy(region.data(), source.data(), size);
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+      }
+
+      report(name, count, elapsed_ns(start), size);
+    }
+
+    // -------------------------------------------------------------------------
+
+#if defined(__linux__)
+
+    // The robust futex lock MappedMutex and Mutex use on Linux
+    void bench_lock()
+    {
+      shared_region region(robust_lock::SIZE);
+      auto lock = reinterpret_cast<robust_lock *>(region.data());
+      lock->init();
+
+      auto count = iterations(2000000);
+      auto start = clock::now();
+      for (uint64_t i = 0; i < count; ++i)
+      {
+        lock->acquire(INFINITE);
+        lock->release();
+      }
+      report("lock_uncontended", count, elapsed_ns(start));
+
+      count = iterations(500000);
+      auto hammer = [lock, count]()
+      {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+          lock->acquire(INFINITE);
+          lock->release();
+        }
+      };
+
+      start = clock::now();
+      std::thread other(hammer);
+      hammer();
+      other.join();
+      report("lock_contended_2_threads", count * 2, elapsed_ns(start));
+    }
+
+    // Two threads handing a turn back and forth through process shared
+    // futexes, the way a waiter in another process would be woken
+    void bench_wake()
+    {
+      shared_region region(64);
+      auto turn = reinterpret_cast<std::atomic<uint32_t> *>(region.data());
+      turn->store(0);
+
+      auto count = iterations(50000);
+      auto forever = wait_deadline::after(INFINITE);
+
+      std::thread other([turn, count, forever]()
+      {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+          while (turn->load() != 1)
+            futex_wait(turn, 0, forever);
+          turn->store(0);
+          futex_wake(turn, 1);
+        }
+      });
+
+      std::vector<uint64_t> samples;
+      samples.reserve(static_cast<size_t>(count));
+
+      for (uint64_t i = 0; i < count; ++i)
+      {
+        auto start = clock::now();
+        turn->store(1);
+        futex_wake(turn, 1);
+        while (turn->load() != 0)
+          futex_wait(turn, 1, forever);
+        samples.push_back(elapsed_ns(start));
+      }
+
+      other.join();
+      report_latency("wake_round_trip", samples);
+    }
+
+#elif defined(_WIN32)
+
+    // The named Win32 mutex Mutex uses on Windows
+    void bench_lock()
+    {
+      auto name = "node_filemap_bench_lock_" + std::to_string(current_pid());
+      HANDLE lock = CreateMutexA(nullptr, FALSE, name.c_str());
+
+      auto count = iterations(1000000);
+      auto start = clock::now();
+      for (uint64_t i = 0; i < count; ++i)
+      {
+        WaitForSingleObject(lock, INFINITE);
+        ReleaseMutex(lock);
+      }
+      report("lock_uncontended", count, elapsed_ns(start));
+
+      count = iterations(200000);
+      auto hammer = [lock, count]()
+      {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+          WaitForSingleObject(lock, INFINITE);
+          ReleaseMutex(lock);
+        }
+      };
+
+      start = clock::now();
+      std::thread other(hammer);
+      hammer();
+      other.join();
+      report("lock_contended_2_threads", count * 2, elapsed_ns(start));
+
+      CloseHandle(lock);
+    }
+
+    void bench_wake()
+    {
+      HANDLE ping = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+      HANDLE pong = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+      auto count = iterations(50000);
+
+      std::thread other([ping, pong, count]()
+      {
+        for (uint64_t i = 0; i < count; ++i)
+        {
+          WaitForSingleObject(ping, INFINITE);
+          SetEvent(pong);
+        }
+      });
+
+      std::vector<uint64_t> samples;
+      samples.reserve(static_cast<size_t>(count));
+
+      for (uint64_t i = 0; i < count; ++i)
+      {
+        auto start = clock::now();
+        SetEvent(ping);
+        WaitForSingleObject(pong, INFINITE);
+        samples.push_back(elapsed_ns(start));
+      }
+
+      other.join();
+      report_latency("wake_round_trip", samples);
+
+      CloseHandle(ping);
+      CloseHandle(pong);
+    }
+
+#else
+
+    // Mutex has no native lock of its own here
+    void bench_lock()
+    {
+    }
+
+    void bench_wake()
+    {
+    }
+
+#endif
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+int main(int argc, char **argv)
+{
+  using namespace node_filemap;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--quick") == 0)
+      scale = 10;
+  }
+
+  bench_map_unmap();
+  bench_first_touch();
+  bench_memcpy(4096, "memcpy_to_mapping_4KB");
+  bench_memcpy(1 << 20, "memcpy_to_mapping_1MB");
+  bench_lock();
+  bench_wake();
+
+#if defined(_WIN32)
+  const char *platform = "win32";
+#elif defined(__linux__)
+  const char *platform = "linux";
+#elif defined(__APPLE__)
+  const char *platform = "darwin";
+#else
+  const char *platform = "other";
+#endif
+
+  printf("{\n  \"suite\": \"native\",\n  \"platform\": \"%s\",\n  \"results\": [\n", platform);
+  for (size_t i = 0; i < results.size(); ++i)
+    printf("    { %s }%s\n", results[i].c_str(), i + 1 < results.size() ? "," : "");
+  printf("  ]\n}\n");
+
+  return 0;
+}
+
+// -----------------------------------------------------------------------------
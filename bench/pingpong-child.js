@@ -0,0 +1,21 @@
+// Child process side of the ping-pong benchmark in run.js
+//   <mapping> <count>   wait for the first word of the mapping to be 1, set
+//                       it back to 0, count times
+const addon = require('..');
+
+const map = new addon.FileMapping();
+map.openMapping(process.argv[2], 0);
+const turn = new Int32Array(map.sharedBuffer(0, 4));
+const count = Number(process.argv[3]);
+
+process.send('ready');
+
+for (let i = 0; i < count; ++i) {
+  while (Atomics.load(turn, 0) !== 1)
+    map.atomicWait(0, 0);
+  Atomics.store(turn, 0, 0);
+  map.atomicNotify(0, 1);
+}
+
+map.closeMapping();
+process.disconnect();
@@ -0,0 +1,375 @@
+// Benchmarks for node_filemap. Prints the results as JSON, and a readable
+// summary on stderr.
+//
+//   node bench/run.js [--quick] [--out file] [suite...]
+//
+// Suites are native, copy, mutex, rwlock, pingpong, scalar and struct; all of
+// them by default.
+// --quick runs a tenth of the iterations, for a smoke test.
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const { fork, spawnSync } = require('child_process');
+const addon = require('..');
+
+const args = process.argv.slice(2);
+const quick = args.indexOf('--quick') >= 0;
+const outIndex = args.indexOf('--out');
+const outFile = outIndex >= 0 ? args[outIndex + 1] : null;
+const chosen = args.filter(function (arg, i) { return arg[0] !== '-' && (outIndex < 0 || i !== outIndex + 1); });
+
+const scale = quick ? 10 : 1;
+
+function iterations(count) {
+  return Math.max(Math.floor(count / scale), 1);
+}
+
+function uniqueName(prefix) {
+  return 'node_filemap_bench_' + prefix + '_' + process.pid + '_' + Math.floor(Math.random() * 1e9);
+}
+
+function now() {
+  return process.hrtime.bigint();
+}
+
+function since(start) {
+  return Number(process.hrtime.bigint() - start);
+}
+
+function percentiles(samples) {
+  samples.sort(function (a, b) { return a - b; });
+  const at = function (fraction) { return samples[Math.floor(fraction * (samples.length - 1))]; };
+  const total = samples.reduce(function (sum, x) { return sum + x; }, 0);
+
+  return {
+    iterations: samples.length,
+    mean: Math.round(total / samples.length),
+    p50: at(0.5),
+    p90: at(0.9),
+    p99: at(0.99),
+    max: samples[samples.length - 1]
+  };
+}
+
+function log(line) {
+  process.stderr.write(line + '\n');
+}
+
+function sleep(ms) {
+  return new Promise(function (resolve) { setTimeout(resolve, ms); });
+}
+
+// -----------------------------------------------------------------------------
+
+// The C++ microbenchmarks, built by the "bench" target in binding.gyp
+function native() {
+  const exe = path.join(__dirname, '..', 'build', 'Release', process.platform === 'win32' ? 'bench.exe' : 'bench');
+  if (!fs.existsSync(exe)) {
+    log('native: ' + exe + ' not built, skipping');
+    return [];
+  }
+
+  const run = spawnSync(exe, quick ? ['--quick'] : [], { encoding: 'utf8' });
+  if (run.status !== 0)
+    throw new Error('native benchmarks failed: ' + run.stderr);
+
+  const results = JSON.parse(run.stdout).results;
+  results.forEach(function (result) {
+    if (result.p50 !== undefined)
+      log('native ' + result.name + ': p50 ' + result.p50 + ' ns, p99 ' + result.p99 + ' ns');
+    else
+      log('native ' + result.name + ': ' + result.nsPerOp + ' ns/op');
+  });
+  return results;
+}
+
+// writeBuffer/readInto throughput from 4 B to 64 MB
+function copy() {
+  const MAX = 64 << 20;
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('copy'), MAX);
+
+  const source = Buffer.alloc(MAX, 0x5a);
+  const dest = Buffer.alloc(MAX);
+
+  // Fault everything in, so the first size doesn't pay for it
+  map.writeBuffer(source, 0, 0, MAX);
+  map.readInto(0, MAX, dest);
+
+  const results = [];
+
+  for (let size = 4; size <= MAX; size *= 4) {
+    const count = iterations(Math.min(1000000, Math.max(20, Math.floor((1 << 30) / size))));
+
+    [['writeBuffer', function () { map.writeBuffer(source, 0, 0, size); }],
+     ['readInto', function () { map.readInto(0, size, dest); }]].forEach(function (op) {
+      for (let i = 0; i < Math.min(count, 1000); ++i)
+        op[1]();
+
+      const start = now();
+      for (let i = 0; i < count; ++i)
+        op[1]();
+      const ns = since(start);
+
+      const result = {
+        name: op[0],
+        bytes: size,
+        iterations: count,
+        nsPerOp: +(ns / count).toFixed(2),
+        bytesPerSec: Math.round(size * count * 1e9 / ns)
+      };
+      results.push(result);
+      log('copy ' + op[0] + ' ' + size + ' B: ' + result.nsPerOp + ' ns/op, ' + (result.bytesPerSec / (1 << 20)).toFixed(0) + ' MB/s');
+    });
+  }
+
+  map.closeMapping();
+  return results;
+}
+
+// Mutex wait + release latency, alone and against another process
+async function mutex() {
+  const name = uniqueName('mutex');
+  const lock = new addon.Mutex();
+  lock.create(name);
+
+  const results = [];
+  const measure = function (label) {
+    const count = iterations(200000);
+    const samples = new Array(count);
+
+    for (let i = 0; i < count; ++i) {
+      const start = now();
+      lock.wait();
+      lock.release();
+      samples[i] = since(start);
+    }
+
+    const result = Object.assign({ name: label }, percentiles(samples));
+    results.push(result);
+    log('mutex ' + label + ': p50 ' + result.p50 + ' ns, p99 ' + result.p99 + ' ns, max ' + result.max + ' ns');
+  };
+
+  measure('uncontended');
+
+  // The child takes and releases the same mutex in a tight loop until the
+  // flag in the mapping is set
+  const flagName = uniqueName('mutexflag');
+  const map = new addon.FileMapping();
+  map.createMapping(null, flagName, 64);
+  const flag = new Int32Array(map.sharedBuffer(0, 4));
+
+  const child = fork(path.join(__dirname, 'mutex-child.js'), [name, flagName]);
+  const exited = new Promise(function (resolve) { child.on('exit', resolve); });
+  await new Promise(function (resolve) { child.once('message', resolve); });
+
+  measure('contended');
+
+  Atomics.store(flag, 0, 1);
+  await exited;
+
+  map.closeMapping();
+  lock.close();
+  return results;
+}
+
+// RwLock read lock throughput with more and more reader processes, which
+// should go up in step with the number of readers
+async function rwlock() {
+  const name = uniqueName('rwlock');
+  const map = new addon.FileMapping();
+  map.createMapping(null, name, addon.RwLock.size() + 64);
+
+  const lock = new addon.RwLock();
+  lock.create(map, 0);
+
+  const go = new Int32Array(map.sharedBuffer(addon.RwLock.size(), 4));
+  const count = iterations(1000000);
+  const results = [];
+
+  for (let readers = 1; readers <= Math.min(8, os.cpus().length); readers *= 2) {
+    Atomics.store(go, 0, 0);
+
+    const children = [];
+    for (let i = 0; i < readers; ++i)
+      children.push(fork(path.join(__dirname, 'rwlock-child.js'), [name, String(count)]));
+
+    await Promise.all(children.map(function (child) {
+      return new Promise(function (resolve) { child.once('message', resolve); });
+    }));
+
+    const times = children.map(function (child) {
+      return new Promise(function (resolve) { child.once('message', resolve); });
+    });
+
+    Atomics.store(go, 0, 1);
+    map.atomicNotify(addon.RwLock.size());
+
+    const ns = Math.max.apply(null, await Promise.all(times));
+    await Promise.all(children.map(function (child) {
+      return new Promise(function (resolve) { child.on('exit', resolve); });
+    }));
+
+    const result = {
+      name: 'read_' + readers + '_processes',
+      readers: readers,
+      iterations: count * readers,
+      opsPerSec: Math.round(count * readers * 1e9 / ns)
+    };
+    results.push(result);
+    log('rwlock ' + readers + ' readers: ' + (result.opsPerSec / 1e6).toFixed(2) + 'M read locks/s');
+  }
+
+  lock.close();
+  map.closeMapping();
+  return results;
+}
+
+// Round trips between two processes, handing a turn back and forth through
+// atomicWait/atomicNotify on a word in the mapping
+async function pingpong() {
+  const name = uniqueName('pingpong');
+  const map = new addon.FileMapping();
+  map.createMapping(null, name, 64);
+  const turn = new Int32Array(map.sharedBuffer(0, 4));
+
+  const count = iterations(20000);
+  const child = fork(path.join(__dirname, 'pingpong-child.js'), [name, String(count)]);
+  const exited = new Promise(function (resolve) { child.on('exit', resolve); });
+  await new Promise(function (resolve) { child.once('message', resolve); });
+
+  const samples = new Array(count);
+
+  for (let i = 0; i < count; ++i) {
+    const start = now();
+    Atomics.store(turn, 0, 1);
+    map.atomicNotify(0, 1);
+    while (Atomics.load(turn, 0) !== 0)
+      map.atomicWait(0, 1);
+    samples[i] = since(start);
+  }
+
+  await exited;
+  map.closeMapping();
+
+  const result = Object.assign({ name: 'atomics_round_trip' }, percentiles(samples));
+  log('pingpong ' + result.name + ': p50 ' + result.p50 + ' ns, p99 ' + result.p99 + ' ns, max ' + result.max + ' ns');
+  return [result];
+}
+
+// One Int32 each way, with the scalar accessors and through a Buffer
+function scalar() {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('scalar'), 4096);
+
+  const buffer = Buffer.alloc(4);
+  const count = iterations(2000000);
+  const results = [];
+  let sink = 0;
+
+  [['writeInt32', function (i) { map.writeInt32(64, i); }],
+   ['readInt32', function () { sink += map.readInt32(64); }],
+   ['writeBuffer_int32', function (i) { buffer.writeInt32LE(i, 0); map.writeBuffer(buffer, 64, 0, 4); }],
+   ['readInto_int32', function () { map.readInto(64, 4, buffer); sink += buffer.readInt32LE(0); }]].forEach(function (op) {
+    // Warm up, so the call sites are optimized before we time them
+    for (let i = 0; i < Math.min(count, 100000); ++i)
+      op[1](i);
+
+    const start = now();
+    for (let i = 0; i < count; ++i)
+      op[1](i);
+    const ns = since(start);
+
+    const result = { name: op[0], iterations: count, nsPerOp: +(ns / count).toFixed(2) };
+    results.push(result);
+    log('scalar ' + op[0] + ': ' + result.nsPerOp + ' ns/op');
+  });
+
+  map.closeMapping();
+  return sink === -1 ? [] : results;
+}
+
+// Updating and reading back a small record, through a StructView and encoded
+// into a Buffer
+function struct() {
+  const schema = { id: 'uint32', x: 'float64', y: 'float64' };
+  const map = new addon.FileMapping();
+  const view = new addon.StructView();
+  map.createMapping(null, uniqueName('struct'), 4096);
+  view.open(map, 0, schema, 16);
+
+  const record = view.at(3);
+  const buffer = Buffer.alloc(addon.StructView.size(schema));
+  const offset = view.offsetOf('id', 3);
+  const count = iterations(1000000);
+  const results = [];
+  let sink = 0;
+
+  [['record_write', function (i) { record.id = i; record.x = i * 0.5; record.y = -i; }],
+   ['record_read', function () { sink += record.id + record.x + record.y; }],
+   ['buffer_write', function (i) {
+     buffer.writeUInt32LE(i, 0);
+     buffer.writeDoubleLE(i * 0.5, 8);
+     buffer.writeDoubleLE(-i, 16);
+     map.writeBuffer(buffer, offset, 0, buffer.length);
+   }],
+   ['buffer_read', function () {
+     map.readInto(offset, buffer.length, buffer);
+     sink += buffer.readUInt32LE(0) + buffer.readDoubleLE(8) + buffer.readDoubleLE(16);
+   }]].forEach(function (op) {
+    for (let i = 0; i < Math.min(count, 100000); ++i)
+      op[1](i);
+
+    const start = now();
+    for (let i = 0; i < count; ++i)
+      op[1](i);
+    const ns = since(start);
+
+    const result = { name: op[0], iterations: count, nsPerOp: +(ns / count).toFixed(2) };
+    results.push(result);
+    log('struct ' + op[0] + ': ' + result.nsPerOp + ' ns/op');
+  });
+
+  view.close();
+  map.closeMapping();
+  return Number.isNaN(sink) ? [] : results;
+}
+
+// -----------------------------------------------------------------------------
+
+const suites = { native: native, copy: copy, mutex: mutex, rwlock: rwlock, pingpong: pingpong, scalar: scalar, struct: struct };
+
+async function main() {
+  const names = chosen.length > 0 ? chosen : Object.keys(suites);
+  const unknown = names.filter(function (name) { return !suites[name]; });
+  if (unknown.length > 0)
+    throw new Error('Unknown suite ' + unknown.join(', ') + ', pick from ' + Object.keys(suites).join(', '));
+
+  const report = {
+    version: require('../package.json').version,
+    node: process.version,
+    platform: process.platform,
+    arch: process.arch,
+    cpu: os.cpus().length > 0 ? os.cpus()[0].model : 'unknown',
+    cpus: os.cpus().length,
+    date: new Date().toISOString(),
+    quick: quick,
+    suites: {}
+  };
+
+  for (const name of names) {
+    report.suites[name] = await suites[name]();
+    await sleep(10);
+  }
+
+  const json = JSON.stringify(report, null, 2) + '\n';
+  if (outFile)
+    fs.writeFileSync(outFile, json);
+  else
+    process.stdout.write(json);
+}
+
+main().catch(function (err) {
+  log(err && err.stack ? err.stack : String(err));
+  process.exit(1);
+});
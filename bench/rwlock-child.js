@@ -0,0 +1,29 @@
+// Child process side of the rwlock benchmark in run.js
+//   <mapping> <count>   take and release a read lock count times, starting
+//                       once the word after the lock is set, and send back
+//                       how many nanoseconds it took
+const addon = require('..');
+
+const map = new addon.FileMapping();
+map.openMapping(process.argv[2], 0);
+
+const lock = new addon.RwLock();
+lock.open(map, 0);
+
+const count = Number(process.argv[3]);
+const go = new Int32Array(map.sharedBuffer(addon.RwLock.size(), 4));
+
+process.send('ready');
+while (Atomics.load(go, 0) === 0)
+  map.atomicWait(addon.RwLock.size(), 0);
+
+const start = process.hrtime.bigint();
+for (let i = 0; i < count; ++i) {
+  lock.waitRead();
+  lock.releaseRead();
+}
+const ns = Number(process.hrtime.bigint() - start);
+
+process.send(ns);
+map.closeMapping();
+process.disconnect();
@@ -3,9 +3,60 @@
     {
       "target_name": "addon",
       "sources": [
+        "src/addon_data.cpp",
+        "src/arena.cpp",
         "src/filemap.cpp",
-        "src/addon.cpp",
-        "src/mutex.cpp"
+        "src/frame_buffer.cpp",
+        "src/hash_table.cpp",
+        "src/mapped_object.cpp",
+        "src/mutex.cpp",
+        "src/ring_buffer.cpp",
+        "src/rw_lock.cpp",
+        "src/seq_lock.cpp",
+        "src/stats.cpp",
+        "src/struct_view.cpp",
+        "src/triple_buffer.cpp",
+        "src/waiter.cpp",
+        "src/windowed_file.cpp",
+        "src/work_queue.cpp",
+        "src/addon.cpp"
+      ],
+      "conditions": [
+        ["OS=='win' or OS=='linux'", {
+          "sources": [
+            "src/mapped_event.cpp"
+          ]
+        }],
+        ["OS=='linux'", {
+          "sources": [
+            "src/futex.cpp",
+            "src/mapped_mutex.cpp"
+          ],
+          "libraries": [
+            "-lrt"
+          ]
+        }]
+      ]
+    },
+    {
+      "target_name": "bench",
+      "type": "executable",
+      "win_delay_load_hook": "false",
+      "include_dirs": [
+        "src"
+      ],
+      "sources": [
+        "bench/native/bench.cpp"
+      ],
+      "conditions": [
+        ["OS=='linux'", {
+          "sources": [
+            "src/futex.cpp"
+          ],
+          "libraries": [
+            "-lrt"
+          ]
+        }]
       ]
     }
   ]
@@ -1,7 +1,8 @@
-const { FileMapping, Mutex } = require('./build/Release/addon');
+const { FileMapping, Mutex, MappedEvent } = require('./build/Release/addon');
 
 map = new FileMapping();
 lock = new Mutex();
+changed = new MappedEvent();
 
 async function waitFor(ms) {
   return new Promise(function (resolve, reject) {
@@ -13,8 +14,8 @@ async function waitFor(ms) {
 
 function main() {
   return new Promise(async function(resolve, reject) {
-    buffer = Buffer.alloc(4) // 4 byte buffer to write to a 4 byte shared storage
-    map.openMapping('howard_mem_map', 4)
+    map.openMapping('howard_mem_map', 68)
+    changed.open(map, 0);
     lock.open('howard_mem_map_lock');
 
     for (var i = 0; i < 60; ++i)
@@ -23,15 +24,15 @@ function main() {
       await waitFor(10);
 
       // Write the new value
-      buffer.writeInt32LE(i);
-
       lock.wait();
-      map.writeBuffer(buffer, 0, 0, 4);
+      map.writeInt32(64, i);
       lock.release();
+      changed.signal();
 
       console.log('Wrote ' + i);
     }
 
+    changed.close();
     map.closeMapping()
     lock.close();
     resolve();
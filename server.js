@@ -1,23 +1,30 @@
 const addon = require('./build/Release/addon');
 
-buffer = Buffer.alloc(4)
 map = new addon.FileMapping();
 lock = new addon.Mutex();
+changed = new addon.MappedEvent();
 
-map.createMapping(null, 'howard_mem_map', 4);
+// The event takes the first 64 bytes, the value goes after it
+map.createMapping(null, 'howard_mem_map', 68);
+changed.create(map, 0);
 lock.create('howard_mem_map_lock');
 
+var generation = 0;
+
 while(1)
 {
+  // Sleep until the client writes something new
+  generation = changed.waitForChange(generation);
+
   lock.waitMultiple([lock], true, addon.INFINITE);
-  map.readInto(0, 4, buffer);
+  var i = map.readInt32(64);
   lock.release();
 
-  var i = buffer.readInt32LE(0);
   console.log ('Read: ' + i);
 
   if (i == 59) break;
 }
 
+changed.close();
 map.closeMapping();
 lock.close();
@@ -4,8 +4,26 @@
 // -----------------------------------------------------------------------------
 
 #include <node.h>
+#include "addon_data.h"
+#include "arena.h"
 #include "filemap.h"
+#include "frame_buffer.h"
+#include "hash_table.h"
 #include "mutex.h"
+#include "ring_buffer.h"
+#include "rw_lock.h"
+#include "seq_lock.h"
+#include "stats.h"
+#include "struct_view.h"
+#include "triple_buffer.h"
+#include "windowed_file.h"
+#include "work_queue.h"
+#if defined(_WIN32) || defined(__linux__)
+#include "mapped_event.h"
+#endif
+#ifdef __linux__
+#include "mapped_mutex.h"
+#endif
 
 // -----------------------------------------------------------------------------
 
@@ -17,8 +35,27 @@ namespace node_filemap
 
   void init(Local<Object> exports)
   {
+    addon_data::init(exports->GetIsolate());
+
     file_mapping::Init(exports);
+    arena::Init(exports);
+    frame_buffer::Init(exports);
+    hash_table::Init(exports);
     mutex::Init(exports);
+    ring_buffer::Init(exports);
+    rw_lock::Init(exports);
+    seq_lock::Init(exports);
+    stats_ref::Init(exports);
+    struct_view::Init(exports);
+    triple_buffer::Init(exports);
+    windowed_file::Init(exports);
+    work_queue::Init(exports);
+#if defined(_WIN32) || defined(__linux__)
+    mapped_event::Init(exports);
+#endif
+#ifdef __linux__
+    mapped_mutex::Init(exports);
+#endif
 
     exports->Set(String::NewFromUtf8(exports->GetIsolate(), "INFINITE"), Integer::New(exports->GetIsolate(), INFINITE));
     exports->Set(String::NewFromUtf8(exports->GetIsolate(), "WAIT_ABANDONED"), Integer::New(exports->GetIsolate(), WAIT_ABANDONED));
@@ -27,9 +64,13 @@ namespace node_filemap
     exports->Set(String::NewFromUtf8(exports->GetIsolate(), "WAIT_TIMEOUT"), Integer::New(exports->GetIsolate(), WAIT_TIMEOUT));
   }
 
-  NODE_MODULE(NODE_GYP_MODULE_NAME, init)
-
   // ---------------------------------------------------------------------------
 }
 
 // -----------------------------------------------------------------------------
+
+// Context aware, so worker_threads can load it too
+NODE_MODULE_INIT()
+{
+  node_filemap::init(exports);
+}
@@ -0,0 +1,90 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Per isolate state for node_filemap, so it can be loaded in worker_threads
+// -----------------------------------------------------------------------------
+
+#include "addon_data.h"
+#include "waiter.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  thread_local addon_data *addon_data::t_current = nullptr;
+
+  addon_data::addon_data(Isolate *isolate) :
+    m_isolate(isolate),
+    m_port(nullptr)
+  {
+  }
+
+  addon_data::~addon_data()
+  {
+    for (auto &it : m_templates)
+      it.Reset();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  addon_data &addon_data::init(Isolate *isolate)
+  {
+    // Requiring the addon again, from another context on the same thread,
+    // shares the instance
+    if (t_current == nullptr)
+    {
+      t_current = new addon_data(isolate);
+      node::AddEnvironmentCleanupHook(isolate, Cleanup, t_current);
+    }
+
+    return *t_current;
+  }
+
+  addon_data &addon_data::current()
+  {
+    return *t_current;
+  }
+
+  // The environment is going away: the main thread exiting or a worker
+  // stopping. Async waits still in flight are dropped without settling, as
+  // there's no JS left to run them.
+  void addon_data::Cleanup(void *arg)
+  {
+    auto data = reinterpret_cast<addon_data *>(arg);
+
+    if (data->m_port != nullptr)
+      data->m_port->close();
+
+    if (t_current == data)
+      t_current = nullptr;
+
+    delete data;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void addon_data::set_template(class_id id, Local<FunctionTemplate> tpl)
+  {
+    m_templates[id].Reset(m_isolate, tpl);
+  }
+
+  bool addon_data::has_instance(class_id id, Local<Value> value) const
+  {
+    return Local<FunctionTemplate>::New(m_isolate, m_templates[id])->HasInstance(value);
+  }
+
+  wait_port &addon_data::port()
+  {
+    if (m_port == nullptr)
+      m_port = new wait_port(node::GetCurrentEventLoop(m_isolate));
+
+    return *m_port;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,80 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Per isolate state for node_filemap, so it can be loaded in worker_threads
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_ADDON_DATA_H
+#define NODEJS_ADDON_DATA_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <uv.h>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  class wait_port;
+
+  // Classes whose instances other calls have to recognize
+  enum class_id
+  {
+    CLASS_FILE_MAPPING,
+    CLASS_MUTEX,
+    CLASS_MAPPED_MUTEX,
+    CLASS_MAPPED_EVENT,
+    CLASS_COUNT
+  };
+
+  // The addon's state for one isolate. Node initializes the addon once for
+  // the main thread and again for every worker_thread that requires it, each
+  // with its own isolate and event loop, so anything holding V8 handles or
+  // belonging to a loop lives here rather than in a static. An isolate only
+  // ever runs on the thread that created it, so the current instance is a
+  // thread local.
+  class addon_data
+  {
+  public:
+    // The calling thread's instance, made the first time the addon is
+    // initialized there. It goes away with the thread's Node environment.
+    static addon_data &init(v8::Isolate *isolate);
+
+    // The calling thread's instance. JS threads only, after init.
+    static addon_data &current();
+
+    v8::Isolate *isolate() const { return m_isolate; }
+
+    void set_template(class_id id, v8::Local<v8::FunctionTemplate> tpl);
+
+    // Whether value is an instance of class id in this isolate
+    bool has_instance(class_id id, v8::Local<v8::Value> value) const;
+
+    // Where the waiter pool hands back this isolate's async waits. Opened on
+    // first use, so threads that never wait asynchronously don't keep a
+    // handle on their loop.
+    wait_port &port();
+
+  private:
+    explicit addon_data(v8::Isolate *isolate);
+    ~addon_data();
+
+    static void Cleanup(void *arg);
+
+    v8::Isolate *m_isolate;
+    v8::Persistent<v8::FunctionTemplate> m_templates[CLASS_COUNT];
+    wait_port *m_port;
+
+    static thread_local addon_data *t_current;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,669 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Lock-free allocator for a region of a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#include "arena.h"
+#include <cstring>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    // Everything before the page map
+    const uint64_t META_SIZE = sizeof(arena_header) + (arena_heap::CLASS_COUNT + arena_heap::RUN_ORDERS) * sizeof(arena_list);
+
+    // Granule indexes have to fit in 32 bits, without reaching NONE
+    const uint64_t MAX_SIZE = (static_cast<uint64_t>(1) << 36) - arena_heap::PAGE_BYTES;
+
+    std::atomic<uint32_t> *Link(char *block)
+    {
+      return reinterpret_cast<std::atomic<uint32_t> *>(block);
+    }
+
+    uint64_t Available(const arena_list &list)
+    {
+      auto total = list.total.load(std::memory_order_relaxed);
+      auto used = list.used.load(std::memory_order_relaxed);
+      return total > used ? total - used : 0;
+    }
+
+    Local<Object> ListStats(Isolate *isolate, uint64_t size, const arena_list &list)
+    {
+      auto result = Object::New(isolate);
+      result->Set(String::NewFromUtf8(isolate, "size"), Number::New(isolate, static_cast<double>(size)));
+      result->Set(String::NewFromUtf8(isolate, "allocated"), Number::New(isolate, static_cast<double>(list.used.load(std::memory_order_relaxed))));
+      result->Set(String::NewFromUtf8(isolate, "free"), Number::New(isolate, static_cast<double>(Available(list))));
+      return result;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // Roughly four classes per doubling, up to half a page
+  const uint32_t arena_heap::CLASS_SIZES[arena_heap::CLASS_COUNT] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 2048
+  };
+
+  bool arena_heap::layout::make(uint64_t size, layout &result)
+  {
+    if (size > MAX_SIZE || size < META_SIZE + 2 * PAGE_BYTES)
+      return false;
+
+    // The slab bits and a byte of page map for each page, and the pages
+    // start on a page boundary after them
+    const uint64_t perPage = SLAB_WORDS * sizeof(uint32_t) + 1;
+    uint64_t pages = (size - META_SIZE) / (PAGE_BYTES + perPage);
+    uint64_t start;
+    for (;;)
+    {
+      start = (META_SIZE + pages * perPage + PAGE_BYTES - 1) & ~static_cast<uint64_t>(PAGE_BYTES - 1);
+      if (start + pages * PAGE_BYTES <= size)
+        break;
+      --pages;
+    }
+
+    if (pages == 0)
+      return false;
+
+    result.size = size;
+    result.pageCount = static_cast<uint32_t>(pages);
+    result.pagesOffset = static_cast<uint32_t>(start);
+    result.maxOrder = 0;
+    while ((static_cast<uint64_t>(2) << result.maxOrder) <= pages)
+      ++result.maxOrder;
+
+    return true;
+  }
+
+  bool arena_heap::layout::describe(const arena_header *header, layout &result)
+  {
+    return header->magic == arena_header::MAGIC && header->version == arena_header::VERSION &&
+      make(header->size, result) &&
+      result.pageCount == header->pageCount && result.pagesOffset == header->pagesOffset;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  arena_heap::arena_heap(arena_header *header, const layout &shape) :
+    m_header(header),
+    m_layout(shape)
+  {
+  }
+
+  void arena_heap::init()
+  {
+    memset(static_cast<void *>(m_header), 0, META_SIZE + static_cast<uint64_t>(m_layout.pageCount) * (SLAB_WORDS * sizeof(uint32_t) + 1));
+    for (int i = 0; i < CLASS_COUNT + RUN_ORDERS; ++i)
+      classes()[i].head.store(NONE, std::memory_order_relaxed);
+
+    m_header->size = m_layout.size;
+    m_header->pageCount = m_layout.pageCount;
+    m_header->pagesOffset = m_layout.pagesOffset;
+    m_header->magic = arena_header::MAGIC;
+    m_header->version = arena_header::VERSION;
+    m_header->untouched.store(0, std::memory_order_release);
+  }
+
+  arena_list *arena_heap::classes() const
+  {
+    return reinterpret_cast<arena_list *>(m_header + 1);
+  }
+
+  arena_list *arena_heap::runs() const
+  {
+    return classes() + CLASS_COUNT;
+  }
+
+  uint32_t arena_heap::touched_pages() const
+  {
+    auto touched = m_header->untouched.load(std::memory_order_relaxed);
+    return touched < m_layout.pageCount ? touched : m_layout.pageCount;
+  }
+
+  std::atomic<uint32_t> *arena_heap::slab_bits(uint32_t page) const
+  {
+    return reinterpret_cast<std::atomic<uint32_t> *>(runs() + RUN_ORDERS) + static_cast<uint64_t>(page) * SLAB_WORDS;
+  }
+
+  std::atomic<uint8_t> *arena_heap::page_map() const
+  {
+    return reinterpret_cast<std::atomic<uint8_t> *>(slab_bits(m_layout.pageCount));
+  }
+
+  char *arena_heap::granule(uint32_t index) const
+  {
+    return at(static_cast<uint64_t>(index) * GRANULE);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  uint32_t arena_heap::pop(arena_list *list) const
+  {
+    // The next link may be stale if someone else pops the block first and
+    // starts using it, but then the generation has moved on and the CAS
+    // fails. The block is still mapped, so reading it is harmless.
+    auto head = list->head.load(std::memory_order_acquire);
+
+    for (;;)
+    {
+      auto index = static_cast<uint32_t>(head);
+      if (index == NONE)
+        return NONE;
+
+      auto next = Link(granule(index))->load(std::memory_order_relaxed);
+      auto replacement = ((head >> 32) + 1) << 32 | next;
+      if (list->head.compare_exchange_weak(head, replacement, std::memory_order_acquire))
+        return index;
+    }
+  }
+
+  void arena_heap::push(arena_list *list, uint32_t first, uint32_t last) const
+  {
+    auto head = list->head.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+      Link(granule(last))->store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+      auto replacement = ((head >> 32) + 1) << 32 | first;
+      if (list->head.compare_exchange_weak(head, replacement, std::memory_order_release))
+        return;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  uint32_t arena_heap::alloc_run(int order)
+  {
+    auto list = runs() + order;
+    auto map = page_map();
+    uint32_t pages = 1u << order;
+    uint32_t granulesPerPage = PAGE_BYTES / GRANULE;
+    uint32_t firstGranule = m_layout.pagesOffset / GRANULE;
+
+    auto block = pop(list);
+
+    // Nothing free of that length, so carve one off the untouched pages
+    if (block == NONE)
+    {
+      auto first = m_header->untouched.load(std::memory_order_relaxed);
+
+      while (first < m_layout.pageCount)
+      {
+        auto left = m_layout.pageCount - first;
+
+        if (left >= pages)
+        {
+          if (!m_header->untouched.compare_exchange_weak(first, first + pages, std::memory_order_relaxed))
+            continue;
+
+          list->total.fetch_add(1, std::memory_order_relaxed);
+          block = firstGranule + first * granulesPerPage;
+          break;
+        }
+
+        // Not enough left for this run. Hand the rest out as shorter runs
+        // rather than leave it for a request that may never come.
+        if (!m_header->untouched.compare_exchange_weak(first, m_layout.pageCount, std::memory_order_relaxed))
+          continue;
+
+        while (left > 0)
+        {
+          int tailOrder = 0;
+          while ((2u << tailOrder) <= left)
+            ++tailOrder;
+
+          map[first].store(PAGE_RUN | tailOrder, std::memory_order_relaxed);
+          runs()[tailOrder].total.fetch_add(1, std::memory_order_relaxed);
+          auto tail = firstGranule + first * granulesPerPage;
+          push(runs() + tailOrder, tail, tail);
+
+          first += 1u << tailOrder;
+          left -= 1u << tailOrder;
+        }
+        break;
+      }
+    }
+
+    // Still nothing, so split the shortest longer run there is
+    for (int bigger = order + 1; block == NONE && bigger <= m_layout.maxOrder; ++bigger)
+    {
+      auto found = pop(runs() + bigger);
+      if (found == NONE)
+        continue;
+
+      runs()[bigger].total.fetch_sub(1, std::memory_order_relaxed);
+
+      // Keep the front, and give back the rest as one run of each length
+      // from ours up, each twice as long as the one before
+      auto page = (found - firstGranule) / granulesPerPage;
+      for (int o = order; o < bigger; ++o)
+      {
+        auto piece = page + (1u << o);
+        map[piece].store(PAGE_RUN | o, std::memory_order_relaxed);
+        runs()[o].total.fetch_add(1, std::memory_order_relaxed);
+        auto pieceGranule = firstGranule + piece * granulesPerPage;
+        push(runs() + o, pieceGranule, pieceGranule);
+      }
+
+      list->total.fetch_add(1, std::memory_order_relaxed);
+      block = found;
+    }
+
+    if (block != NONE)
+    {
+      map[(block - firstGranule) / granulesPerPage].store(PAGE_RUN | PAGE_USED | order, std::memory_order_relaxed);
+      list->used.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return block;
+  }
+
+  uint32_t arena_heap::alloc_small(int sizeClass)
+  {
+    auto list = classes() + sizeClass;
+    uint32_t firstGranule = m_layout.pagesOffset / GRANULE;
+    uint32_t granulesPerPage = PAGE_BYTES / GRANULE;
+    uint32_t step = CLASS_SIZES[sizeClass] / GRANULE;
+
+    auto block = pop(list);
+
+    if (block != NONE)
+    {
+      auto page = (block - firstGranule) / granulesPerPage;
+      auto slot = (block - firstGranule) % granulesPerPage / step;
+      slab_bits(page)[slot / 32].fetch_or(1u << (slot % 32), std::memory_order_relaxed);
+    }
+    else
+    {
+      // Nothing free in this class, so make a new slab out of a page
+      block = alloc_run(0);
+      if (block == NONE)
+        return NONE;
+
+      // Slabs belong to their class for good, so they aren't runs any more
+      runs()[0].used.fetch_sub(1, std::memory_order_relaxed);
+      runs()[0].total.fetch_sub(1, std::memory_order_relaxed);
+
+      auto page = (block - firstGranule) / granulesPerPage;
+      page_map()[page].store(PAGE_SLAB | sizeClass, std::memory_order_relaxed);
+
+      // Only the first block is allocated
+      auto bits = slab_bits(page);
+      for (uint32_t i = 0; i < SLAB_WORDS; ++i)
+        bits[i].store(i == 0 ? 1 : 0, std::memory_order_relaxed);
+
+      uint32_t count = PAGE_BYTES / CLASS_SIZES[sizeClass];
+
+      // Keep the first block and link the others up before anyone can see
+      // them, so they go on the free list in one push
+      for (uint32_t i = 1; i + 1 < count; ++i)
+        Link(granule(block + i * step))->store(block + (i + 1) * step, std::memory_order_relaxed);
+
+      list->total.fetch_add(count, std::memory_order_relaxed);
+      if (count > 1)
+        push(list, block + step, block + (count - 1) * step);
+    }
+
+    list->used.fetch_add(1, std::memory_order_relaxed);
+    return block;
+  }
+
+  uint64_t arena_heap::alloc(uint64_t size)
+  {
+    uint32_t block = NONE;
+
+    int sizeClass = 0;
+    while (sizeClass < CLASS_COUNT && CLASS_SIZES[sizeClass] < size)
+      ++sizeClass;
+
+    if (sizeClass < CLASS_COUNT)
+    {
+      block = alloc_small(sizeClass);
+    }
+    else
+    {
+      int order = 0;
+      while (order <= m_layout.maxOrder && (static_cast<uint64_t>(PAGE_BYTES) << order) < size)
+        ++order;
+
+      if (order <= m_layout.maxOrder)
+        block = alloc_run(order);
+    }
+
+    return block == NONE ? 0 : static_cast<uint64_t>(block) * GRANULE;
+  }
+
+  bool arena_heap::find_block(uint64_t offset, bool &small, int &index, uint32_t &page, uint32_t &slot) const
+  {
+    if (offset < m_layout.pagesOffset || offset % GRANULE != 0)
+      return false;
+
+    auto pageIndex = (offset - m_layout.pagesOffset) / PAGE_BYTES;
+    if (pageIndex >= m_layout.pageCount)
+      return false;
+
+    page = static_cast<uint32_t>(pageIndex);
+    auto within = static_cast<uint32_t>((offset - m_layout.pagesOffset) % PAGE_BYTES);
+    auto mark = page_map()[page].load(std::memory_order_relaxed);
+
+    if (mark & PAGE_SLAB)
+    {
+      index = mark & ~PAGE_SLAB;
+      small = true;
+      if (index >= CLASS_COUNT || within % CLASS_SIZES[index] != 0)
+        return false;
+
+      slot = within / CLASS_SIZES[index];
+      return slot < PAGE_BYTES / CLASS_SIZES[index];
+    }
+
+    if (mark & PAGE_RUN)
+    {
+      index = mark & ~(PAGE_RUN | PAGE_USED);
+      small = false;
+      slot = 0;
+      return index <= m_layout.maxOrder && within == 0;
+    }
+
+    return false;
+  }
+
+  bool arena_heap::free(uint64_t offset)
+  {
+    bool small;
+    int index;
+    uint32_t page, slot;
+    if (!find_block(offset, small, index, page, slot))
+      return false;
+
+    // Clearing the allocated mark is what decides which of two frees of the
+    // same block wins, so the loser never reaches the free list
+    if (small)
+    {
+      uint32_t bit = 1u << (slot % 32);
+      if ((slab_bits(page)[slot / 32].fetch_and(~bit, std::memory_order_relaxed) & bit) == 0)
+        return false;
+    }
+    else
+    {
+      uint8_t mark = PAGE_RUN | PAGE_USED | index;
+      if (!page_map()[page].compare_exchange_strong(mark, static_cast<uint8_t>(PAGE_RUN | index), std::memory_order_relaxed))
+        return false;
+    }
+
+    auto list = small ? classes() + index : runs() + index;
+    auto block = static_cast<uint32_t>(offset / GRANULE);
+
+    push(list, block, block);
+    list->used.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  uint64_t arena_heap::size_of(uint64_t offset) const
+  {
+    bool small;
+    int index;
+    uint32_t page, slot;
+    if (!find_block(offset, small, index, page, slot))
+      return 0;
+
+    if (small)
+      return (slab_bits(page)[slot / 32].load(std::memory_order_relaxed) & (1u << (slot % 32))) != 0 ? CLASS_SIZES[index] : 0;
+
+    return (page_map()[page].load(std::memory_order_relaxed) & PAGE_USED) != 0 ? static_cast<uint64_t>(PAGE_BYTES) << index : 0;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  arena::arena()
+  {
+    memset(&m_layout, 0, sizeof(m_layout));
+  }
+
+  arena_header *arena::header(Isolate *isolate, const char *method) const
+  {
+    return reinterpret_cast<arena_header *>(memory(isolate, method));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void arena::Create(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<arena>(args.Holder());
+
+    if (!read_mapping_args(args, 3, "Arena.create"))
+      return;
+
+    uint64_t size;
+    if (!read_uint(args[2], UINT64_MAX, size))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to Arena.create")));
+      return;
+    }
+
+    arena_heap::layout shape;
+    if (!arena_heap::layout::make(size, shape))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Size out of range in Arena.create")));
+      return;
+    }
+
+    if (!obj->attach(isolate, args[0], args[1], size, 64, "Arena.create"))
+      return;
+
+    arena_heap(obj->header(isolate, "Arena.create"), shape).init();
+    obj->m_layout = shape;
+  }
+
+  void arena::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<arena>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "Arena.open"))
+      return;
+
+    auto describe = [](const arena_header &header, arena_heap::layout &result) -> uint64_t
+    {
+      return arena_heap::layout::describe(&header, result) ? result.size : 0;
+    };
+
+    arena_heap::layout shape;
+    if (!obj->attach_existing<arena_header>(isolate, args[0], args[1], shape, describe, "Arena.open"))
+      return;
+
+    obj->m_layout = shape;
+  }
+
+  void arena::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<arena>(args.Holder());
+
+    obj->detach();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void arena::Alloc(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<arena>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to Arena.alloc")));
+      return;
+    }
+
+    uint64_t size;
+    if (!read_uint(args[0], UINT64_MAX, size))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to Arena.alloc")));
+      return;
+    }
+
+    auto header = obj->header(isolate, "Arena.alloc");
+    if (header == nullptr)
+      return;
+
+    auto block = arena_heap(header, obj->m_layout).alloc(size);
+    if (block == 0)
+    {
+      args.GetReturnValue().SetNull();
+      return;
+    }
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(obj->offset() + block)));
+  }
+
+  void arena::Free(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<arena>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to Arena.free")));
+      return;
+    }
+
+    uint64_t offset;
+    if (!read_uint(args[0], UINT64_MAX, offset))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to Arena.free")));
+      return;
+    }
+
+    auto header = obj->header(isolate, "Arena.free");
+    if (header == nullptr)
+      return;
+
+    if (offset < obj->offset() || !arena_heap(header, obj->m_layout).free(offset - obj->offset()))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Not a block allocated from this arena in Arena.free")));
+      return;
+    }
+  }
+
+  void arena::SizeOf(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<arena>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to Arena.sizeOf")));
+      return;
+    }
+
+    uint64_t offset;
+    if (!read_uint(args[0], UINT64_MAX, offset))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to Arena.sizeOf")));
+      return;
+    }
+
+    auto header = obj->header(isolate, "Arena.sizeOf");
+    if (header == nullptr)
+      return;
+
+    uint64_t size = 0;
+    if (offset >= obj->offset())
+      size = arena_heap(header, obj->m_layout).size_of(offset - obj->offset());
+
+    if (size == 0)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Not a block allocated from this arena in Arena.sizeOf")));
+      return;
+    }
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(size)));
+  }
+
+  void arena::Stats(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<arena>(args.Holder());
+
+    auto header = obj->header(isolate, "Arena.stats");
+    if (header == nullptr)
+      return;
+
+    arena_heap heap(header, obj->m_layout);
+
+    // The counters are updated separately from the lists, so this is only a
+    // close guess while other processes are busy
+    uint64_t allocated = 0;
+    uint64_t available = 0;
+
+    auto classList = Array::New(isolate, arena_heap::CLASS_COUNT);
+    for (int i = 0; i < arena_heap::CLASS_COUNT; ++i)
+    {
+      auto &list = heap.classes()[i];
+      auto size = arena_heap::CLASS_SIZES[i];
+      allocated += list.used.load(std::memory_order_relaxed) * size;
+      available += Available(list) * size;
+      classList->Set(i, ListStats(isolate, size, list));
+    }
+
+    auto runList = Array::New(isolate, obj->m_layout.maxOrder + 1);
+    for (int i = 0; i <= obj->m_layout.maxOrder; ++i)
+    {
+      auto &list = heap.runs()[i];
+      auto size = static_cast<uint64_t>(arena_heap::PAGE_BYTES) << i;
+      allocated += list.used.load(std::memory_order_relaxed) * size;
+      available += Available(list) * size;
+      runList->Set(i, ListStats(isolate, size, list));
+    }
+
+    uint64_t untouched = static_cast<uint64_t>(obj->m_layout.pageCount - heap.touched_pages()) * arena_heap::PAGE_BYTES;
+    double fragmentation = available + untouched > 0 ? static_cast<double>(available) / (available + untouched) : 0;
+
+    auto result = Object::New(isolate);
+    result->Set(String::NewFromUtf8(isolate, "size"), Number::New(isolate, static_cast<double>(static_cast<uint64_t>(obj->m_layout.pageCount) * arena_heap::PAGE_BYTES)));
+    result->Set(String::NewFromUtf8(isolate, "allocated"), Number::New(isolate, static_cast<double>(allocated)));
+    result->Set(String::NewFromUtf8(isolate, "free"), Number::New(isolate, static_cast<double>(available)));
+    result->Set(String::NewFromUtf8(isolate, "untouched"), Number::New(isolate, static_cast<double>(untouched)));
+    result->Set(String::NewFromUtf8(isolate, "fragmentation"), Number::New(isolate, fragmentation));
+    result->Set(String::NewFromUtf8(isolate, "classes"), classList);
+    result->Set(String::NewFromUtf8(isolate, "runs"), runList);
+    args.GetReturnValue().Set(result);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void arena::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<arena>, String::NewFromUtf8(isolate, "Arena"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "Arena"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "PAGE_SIZE"), Integer::New(isolate, arena_heap::PAGE_BYTES));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "alloc", Alloc);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "free", Free);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "sizeOf", SizeOf);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "stats", Stats);
+
+    exports->Set(
+      String::NewFromUtf8(isolate, "Arena"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,181 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Lock-free allocator for a region of a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_ARENA_H
+#define NODEJS_ARENA_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <atomic>
+#include <cstdint>
+#include "mapped_object.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // The region is split into pages. Small allocations come from slabs - a
+  // page cut into equal blocks of one size class - and anything bigger than
+  // the largest class takes a run of pages, rounded up to a power of two.
+  // Every size class and every run length has its own free list, a Treiber
+  // stack with a generation count against ABA, so alloc and free are a CAS
+  // or two and never take a lock. A page map with a byte per page tells free
+  // what it's been given, and whether a run is allocated. Slab pages have a
+  // bit per block for that instead, so free can turn down a block that's
+  // already free rather than push it on its list twice.
+  //
+  // Free runs aren't merged back together. New runs come off the untouched
+  // end of the region first, then from splitting bigger free runs.
+  //
+  // Offsets inside the arena are kept in 16 byte granules, so they fit in 32
+  // bits and the region can be up to 64 GB.
+  struct arena_header
+  {
+    static const uint32_t MAGIC = 0x4172656e; // 'Aren'
+    static const uint32_t VERSION = 2;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint32_t pageCount;
+    uint32_t pagesOffset; // Where the first page starts, from the header
+    std::atomic<uint32_t> untouched; // Index of the first page never handed out
+    char pad[36];
+  };
+
+  static_assert(sizeof(arena_header) == 64, "arena_header must take exactly one cache line");
+
+  // A free list, with counters for stats. One per size class and one per run
+  // length, each on its own cache line.
+  struct arena_list
+  {
+    std::atomic<uint64_t> head; // Generation in the top 32 bits, granule below
+    std::atomic<uint64_t> used; // Blocks handed out
+    std::atomic<uint64_t> total; // Blocks made, used or free
+    char pad[40];
+  };
+
+  static_assert(sizeof(arena_list) == 64, "arena_list must take exactly one cache line");
+
+  // ---------------------------------------------------------------------------
+
+  // The allocator itself, over an arena that's already mapped in. Offsets
+  // are from the start of the arena_header. arena wraps one for JS, and other
+  // structures can keep one for their own variable sized data.
+  class arena_heap
+  {
+  public:
+    static const uint32_t PAGE_BYTES = 4096;
+    static const uint32_t GRANULE = 16;
+    static const int CLASS_COUNT = 13;
+    static const int RUN_ORDERS = 32;
+
+    // The size classes, smallest first
+    static const uint32_t CLASS_SIZES[CLASS_COUNT];
+
+    // Where things are, worked out from the size alone so a corrupt header
+    // can't send us outside the region
+    struct layout
+    {
+      uint64_t size;
+      uint32_t pageCount;
+      uint32_t pagesOffset;
+      int maxOrder;
+
+      // false if size is too small or too big for an arena
+      static bool make(uint64_t size, layout &result);
+
+      // Checks an existing header and works out its layout. Only reads
+      // sizeof(arena_header) bytes.
+      static bool describe(const arena_header *header, layout &result);
+    };
+
+    arena_heap(arena_header *header, const layout &shape);
+
+    // Sets up a new, empty arena
+    void init();
+
+    // The offset of a block of at least size bytes, or 0 if there's no room
+    uint64_t alloc(uint64_t size);
+
+    // false if offset isn't the start of a block we handed out, or the
+    // block has already been freed
+    bool free(uint64_t offset);
+
+    // How big the block at offset really is, or 0 if it isn't an allocated
+    // block
+    uint64_t size_of(uint64_t offset) const;
+
+    char *at(uint64_t offset) const { return reinterpret_cast<char *>(m_header) + offset; }
+
+    arena_list *classes() const;
+    arena_list *runs() const;
+    uint32_t touched_pages() const;
+
+  private:
+    static const uint32_t NONE = 0xFFFFFFFF;
+
+    // Page map entries. Zero means the page isn't the first of anything.
+    static const uint8_t PAGE_SLAB = 0x40; // | size class
+    static const uint8_t PAGE_RUN = 0x80;  // | run order, | PAGE_USED while allocated
+    static const uint8_t PAGE_USED = 0x20;
+
+    // Words of allocated bits for each slab, a bit per block
+    static const uint32_t SLAB_WORDS = PAGE_BYTES / GRANULE / 32;
+
+    std::atomic<uint8_t> *page_map() const;
+    std::atomic<uint32_t> *slab_bits(uint32_t page) const;
+    char *granule(uint32_t index) const;
+
+    uint32_t pop(arena_list *list) const;
+    void push(arena_list *list, uint32_t first, uint32_t last) const;
+
+    // Return the granule index of a new block, or NONE if there's no room
+    uint32_t alloc_run(int order);
+    uint32_t alloc_small(int sizeClass);
+
+    // What the page map says about the block at offset: its class or run
+    // order, its page, and for a small block which one in the slab it is
+    bool find_block(uint64_t offset, bool &small, int &index, uint32_t &page, uint32_t &slot) const;
+
+    arena_header *m_header;
+    layout m_layout;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  class arena : public mapped_object
+  {
+  public:
+    arena();
+
+    static void Create(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Alloc(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Free(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void SizeOf(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Stats(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+  private:
+    arena_header *header(v8::Isolate *isolate, const char *method) const;
+
+    arena_heap::layout m_layout; // Read once when we attach, the header isn't trusted after that
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,89 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Win32 style millisecond timeouts turned into deadlines, for node_filemap's
+// waits that loop or get split up
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_DEADLINE_H
+#define NODEJS_DEADLINE_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <chrono>
+#include <ctime>
+#include "platform.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // When a timeout runs out. INFINITE never does.
+  struct wait_deadline
+  {
+    typedef std::chrono::steady_clock clock;
+
+    static wait_deadline after(DWORD ms)
+    {
+      wait_deadline deadline;
+      deadline.infinite = ms == INFINITE;
+      deadline.at = clock::now() + std::chrono::milliseconds(deadline.infinite ? 0 : ms);
+      return deadline;
+    }
+
+    // Whichever of the two comes first
+    static wait_deadline earliest(const wait_deadline &a, const wait_deadline &b)
+    {
+      if (a.infinite)
+        return b;
+      if (b.infinite)
+        return a;
+      return a.at < b.at ? a : b;
+    }
+
+    bool expired() const
+    {
+      return !infinite && clock::now() >= at;
+    }
+
+    // Milliseconds left, rounded up, for APIs that take a relative timeout
+    DWORD remaining_ms() const
+    {
+      if (infinite)
+        return INFINITE;
+
+      auto left = std::chrono::duration_cast<std::chrono::microseconds>(at - clock::now()).count();
+      if (left <= 0)
+        return 0;
+
+      auto ms = (left + 999) / 1000;
+      return ms >= INFINITE ? INFINITE - 1 : static_cast<DWORD>(ms);
+    }
+
+#ifdef __linux__
+    // steady_clock is CLOCK_MONOTONIC on Linux, which is what the futex
+    // bitset waits take as an absolute time
+    timespec monotonic() const
+    {
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(at.time_since_epoch()).count();
+
+      timespec ts;
+      ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+      ts.tv_nsec = static_cast<long>(ns % 1000000000);
+      return ts;
+    }
+#endif
+
+    bool infinite;
+    clock::time_point at;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -4,286 +4,2431 @@
 // -----------------------------------------------------------------------------
 
 #include "filemap.h"
+#include "js_helpers.h"
+#include "addon_data.h"
+#include "deadline.h"
+#include "waiter.h"
+#ifdef __linux__
+#include "futex.h"
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#define PSAPI_VERSION 2 // QueryWorkingSetEx from kernel32, no psapi.lib
+#include <psapi.h>
+#endif
+
+// -----------------------------------------------------------------------------
+
+#if defined(_WIN32) && !defined(FILE_MAP_LARGE_PAGES)
+#define FILE_MAP_LARGE_PAGES 0x20000000
+#endif
+
+// Linux 5.14, newer than some of the headers we build against
+#if defined(__linux__) && !defined(MADV_POPULATE_READ)
+#define MADV_POPULATE_READ 22
+#define MADV_POPULATE_WRITE 23
+#endif
 
 // -----------------------------------------------------------------------------
 
-namespace node_filemap
-{
-  using namespace v8;
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    // Sizes and offsets into the mapping are 64 bit. JS numbers are exact up
+    // to 2^53, which is plenty.
+    bool ToSize(Local<Value> value, uint64_t &size)
+    {
+      // Small offsets and lengths are Smis, which need no conversion
+      if (value->IsUint32())
+      {
+        size = value.As<Uint32>()->Value();
+        return true;
+      }
+
+      auto asInt = value->IntegerValue();
+      if (asInt < 0)
+        return false;
+
+      size = static_cast<uint64_t>(asInt);
+      return true;
+    }
+
+    // The same, for a number that's already been read out of a Float64Array
+    bool ToSize(double value, uint64_t &size)
+    {
+      if (!(value >= 0 && value <= 9007199254740992.0) || value != static_cast<double>(static_cast<uint64_t>(value)))
+        return false;
+
+      size = static_cast<uint64_t>(value);
+      return true;
+    }
+
+    // What a scalar write stores, converted like a DataView would: integers
+    // wrap around, floats round
+    template <typename T>
+    T ToScalar(Local<Value> value)
+    {
+      return std::is_signed<T>::value ? static_cast<T>(value->Int32Value()) : static_cast<T>(value->Uint32Value());
+    }
+
+    template <>
+    float ToScalar<float>(Local<Value> value)
+    {
+      return static_cast<float>(value.As<Number>()->Value());
+    }
+
+    template <>
+    double ToScalar<double>(Local<Value> value)
+    {
+      return value.As<Number>()->Value();
+    }
+
+    // An optional size: undefined leaves size as it was
+    bool ToOptionalSize(Local<Value> value, uint64_t &size)
+    {
+      if (value->IsUndefined())
+        return true;
+
+      return value->IsNumber() && ToSize(value, size);
+    }
+
+    bool ReadMappingOptions(Isolate *isolate, Local<Value> value, mapping_options &options)
+    {
+      if (value->IsUndefined() || value->IsNull())
+        return true;
+
+      if (!value->IsObject())
+        return false;
+
+      auto obj = value->ToObject();
+
+      auto hugePages = obj->Get(String::NewFromUtf8(isolate, "hugePages"));
+      if (hugePages->IsString())
+      {
+        auto mode = ToCString(hugePages->ToString());
+        if (mode == "transparent")
+          options.hugePages = HUGE_PAGES_TRANSPARENT;
+        else if (mode == "explicit")
+          options.hugePages = HUGE_PAGES_EXPLICIT;
+        else
+          return false;
+      }
+      else if (!(hugePages->IsUndefined() || hugePages->IsFalse()))
+      {
+        return false;
+      }
+
+      auto hugetlbfs = obj->Get(String::NewFromUtf8(isolate, "hugetlbfs"));
+      if (hugetlbfs->IsString())
+        options.hugetlbfsPath = ToCString(hugetlbfs->ToString());
+      else if (!hugetlbfs->IsUndefined())
+        return false;
+
+      auto populate = obj->Get(String::NewFromUtf8(isolate, "populate"));
+      if (populate->IsBoolean())
+        options.populate = populate->IsTrue();
+      else if (!populate->IsUndefined())
+        return false;
+
+      auto growable = obj->Get(String::NewFromUtf8(isolate, "growable"));
+      if (growable->IsBoolean())
+        options.growable = growable->IsTrue();
+      else if (!growable->IsUndefined())
+        return false;
+
+      // Explicit huge pages only grow a whole huge page at a time, and the
+      // header would take one to itself
+      return !(options.growable && options.hugePages == HUGE_PAGES_EXPLICIT);
+    }
+
+    bool ReadFlushMode(Local<Value> value, flush_mode &mode)
+    {
+      if (value->IsUndefined())
+      {
+        mode = FLUSH_SYNC;
+        return true;
+      }
+
+      if (!value->IsString())
+        return false;
+
+      auto name = ToCString(value.As<String>());
+      if (name == "none")
+        mode = FLUSH_NONE;
+      else if (name == "async")
+        mode = FLUSH_ASYNC;
+      else if (name == "sync")
+        mode = FLUSH_SYNC;
+      else
+        return false;
+
+      return true;
+    }
+
+    enum advice
+    {
+      ADVICE_NORMAL,
+      ADVICE_SEQUENTIAL,
+      ADVICE_RANDOM,
+      ADVICE_WILLNEED,
+      ADVICE_DONTNEED
+    };
+
+    bool ReadAdvice(Local<Value> value, advice &hint)
+    {
+      if (!value->IsString())
+        return false;
+
+      auto name = ToCString(value.As<String>());
+      if (name == "normal")
+        hint = ADVICE_NORMAL;
+      else if (name == "sequential")
+        hint = ADVICE_SEQUENTIAL;
+      else if (name == "random")
+        hint = ADVICE_RANDOM;
+      else if (name == "willneed")
+        hint = ADVICE_WILLNEED;
+      else if (name == "dontneed")
+        hint = ADVICE_DONTNEED;
+      else
+        return false;
+
+      return true;
+    }
+
+#ifdef _WIN32
+    // Windows 8 and up. Looked up at runtime so the addon still loads on 7.
+    struct memory_range_entry
+    {
+      PVOID VirtualAddress;
+      SIZE_T NumberOfBytes;
+    };
+
+    typedef BOOL (WINAPI *prefetch_fn)(HANDLE process, ULONG_PTR count, memory_range_entry *ranges, ULONG flags);
+
+    bool Prefetch(char *start, size_t length)
+    {
+      static auto prefetch = reinterpret_cast<prefetch_fn>(GetProcAddress(GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory"));
+      memory_range_entry range = { start, length };
+      return prefetch == nullptr || prefetch(GetCurrentProcess(), 1, &range, 0);
+    }
+#endif
+
+#ifndef _WIN32
+    std::string ShmName(const char *mappingName)
+    {
+      return std::string("/") + mappingName;
+    }
+
+    std::string HugetlbfsName(const mapping_options &options, const char *mappingName)
+    {
+      return options.hugetlbfsPath + "/" + mappingName;
+    }
+
+    // What the mapped_section registry knows a mapping by: the shm_open name
+    // or hugetlbfs path, which is also what the last user unlinks
+    std::string SectionKey(const char *mappingName, const mapping_options &options)
+    {
+      return options.hugePages == HUGE_PAGES_EXPLICIT ? HugetlbfsName(options, mappingName) : ShmName(mappingName);
+    }
+
+    // Windows drops a named section once the last handle to it closes. POSIX
+    // names stay until they're unlinked, so every open of a name holds a
+    // shared OFD lock on its first byte, and whoever can turn theirs into an
+    // exclusive one on the way out is the last user and removes the name.
+    // The kernel drops the locks of a process that dies, so a crash doesn't
+    // leave the name held. Without OFD locks the creator removes it instead.
+#ifdef F_OFD_SETLK
+    bool LockName(int fd, short type, bool wait)
+    {
+      struct flock lock = {};
+      lock.l_type = type;
+      lock.l_whence = SEEK_SET;
+      lock.l_start = 0;
+      lock.l_len = 1;
+
+      return fcntl(fd, wait ? F_OFD_SETLKW : F_OFD_SETLK, &lock) == 0;
+    }
+
+    // Whether the name still refers to what fd has open
+    bool NameRefersTo(int fd, const std::string &path, bool shm)
+    {
+      int other = shm ? shm_open(path.c_str(), O_RDONLY, 0) : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      if (other < 0)
+        return false;
+
+      struct stat ours, theirs;
+      bool same = fstat(fd, &ours) == 0 && fstat(other, &theirs) == 0 && ours.st_dev == theirs.st_dev && ours.st_ino == theirs.st_ino;
+
+      close(other);
+      return same;
+    }
+#endif
+
+#else
+    // Large page sections are mapped with different access, so they're kept
+    // apart from plain ones
+    std::string SectionKey(const char *mappingName, const mapping_options &options)
+    {
+      return (options.hugePages == HUGE_PAGES_EXPLICIT ? "large:" : "normal:") + std::string(mappingName);
+    }
+#endif
+  }
+
+  // ---------------------------------------------------------------------------
+
+#ifndef _WIN32
+  int OpenName(const std::string &path, bool shm, bool create)
+  {
+    int flags = O_RDWR | (create ? O_CREAT : 0);
+
+    for (;;)
+    {
+      int fd = shm ? shm_open(path.c_str(), flags, 0666) : open(path.c_str(), flags | O_CLOEXEC, 0666);
+      if (fd < 0)
+        return -1;
+
+#ifdef F_OFD_SETLK
+      if (!LockName(fd, F_RDLCK, true))
+      {
+        int lastErr = errno;
+        close(fd);
+
+        if (lastErr == EINTR)
+          continue;
+
+        errno = lastErr;
+        return -1;
+      }
+
+      // The last user may have removed the name between our open and our
+      // lock, leaving us an object no one else can find. Go again, which
+      // creates a fresh one or fails to open like it would have anyway.
+      if (NameRefersTo(fd, path, shm))
+        return fd;
+
+      close(fd);
+#else
+      return fd;
+#endif
+    }
+  }
+
+  void ReleaseName(int fd, const std::string &path, bool shm, bool created)
+  {
+#ifdef F_OFD_SETLK
+    bool last = LockName(fd, F_WRLCK, false) && NameRefersTo(fd, path, shm);
+    (void)created;
+#else
+    bool last = created;
+#endif
+
+    if (last)
+    {
+      if (shm)
+        shm_unlink(path.c_str());
+      else
+        unlink(path.c_str());
+    }
+
+    close(fd);
+  }
+#endif
+
+  // ---------------------------------------------------------------------------
+
+  mapping_options::mapping_options() :
+    hugePages(HUGE_PAGES_NONE),
+    hugetlbfsPath("/dev/hugepages"),
+    populate(false),
+    growable(false)
+  {
+  }
+
+  // ---------------------------------------------------------------------------
+
+  struct mapped_section
+  {
+    std::string key;
+    std::shared_ptr<void> memory; // The view. Pins keep it mapped after the section closes.
+    uint64_t size;
+    size_t users;                 // file_mappings using it, under the registry's lock
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int fd;
+    std::string namePath;
+    bool nameShm;
+    bool nameCreated; // Anyone in the process created it
+#endif
+  };
+
+  namespace
+  {
+    struct section_registry
+    {
+      std::mutex lock;
+      std::unordered_map<std::string, mapped_section *> sections;
+    };
+
+    // Never destroyed, as mappings can still be closed while the process
+    // exits
+    section_registry &Sections()
+    {
+      static auto registry = new section_registry();
+      return *registry;
+    }
+  }
+
+  bool file_mapping::share_section(const std::string &key, uint64_t size, bool created, const mapping_options &options)
+  {
+    {
+      auto &registry = Sections();
+      std::lock_guard<std::mutex> guard(registry.lock);
+
+      auto it = registry.sections.find(key);
+      if (it == registry.sections.end() || size > it->second->size)
+        return false;
+
+      m_section = it->second;
+      ++m_section->users;
+
+#ifndef _WIN32
+      if (created)
+        m_section->nameCreated = true;
+#else
+      (void)created;
+#endif
+    }
+
+    m_memory = m_section->memory;
+    m_ptr = m_memory.get();
+    m_size = size != 0 ? size : m_section->size;
+
+    if (options.populate)
+      prefault(0, m_size);
+
+    return true;
+  }
+
+  void file_mapping::publish_section(const std::string &key)
+  {
+    auto section = new mapped_section();
+    section->key = key;
+    section->memory = m_memory;
+    section->size = m_size;
+    section->users = 1;
+
+#ifdef _WIN32
+    section->handle = m_mappingHandle;
+    m_mappingHandle = INVALID_HANDLE_VALUE;
+#else
+    section->fd = m_fd;
+    section->namePath = m_namePath;
+    section->nameShm = m_nameShm;
+    section->nameCreated = m_nameCreated;
+    m_fd = -1;
+    m_namePath.clear();
+#endif
+
+    m_section = section;
+
+    // Replaces a smaller section under the same name, which stays open
+    // until its own users are done with it
+    auto &registry = Sections();
+    std::lock_guard<std::mutex> guard(registry.lock);
+    registry.sections[key] = section;
+  }
+
+  void file_mapping::release_section()
+  {
+    auto section = m_section;
+    m_section = nullptr;
+
+    {
+      auto &registry = Sections();
+      std::lock_guard<std::mutex> guard(registry.lock);
+
+      if (--section->users > 0)
+        return;
+
+      auto it = registry.sections.find(section->key);
+      if (it != registry.sections.end() && it->second == section)
+        registry.sections.erase(it);
+    }
+
+#ifdef _WIN32
+    CloseHandle(section->handle);
+#else
+    ReleaseName(section->fd, section->namePath, section->nameShm, section->nameCreated);
+#endif
+
+    delete section;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // A flush on a pool thread. Holds on to the mapped memory, and on Windows
+  // its own handle to the file, so closing the mapping doesn't pull them out
+  // from under it. The pool only runs one block() per request, which does
+  // the whole flush.
+  class file_mapping::flush_request : public promise_request
+  {
+  public:
+    flush_request(Isolate *isolate, file_mapping *owner, uint64_t offset, uint64_t length, flush_mode mode, Local<Promise::Resolver> resolver) :
+      promise_request(isolate, "node_filemap:FileMapping.flush", INFINITE, resolver),
+      m_owner(owner),
+      m_memory(owner->pin()),
+      m_base(reinterpret_cast<char *>(owner->m_ptr)),
+      m_start(offset),
+      m_end(offset + length),
+      m_mode(mode),
+      m_error(0)
+    {
+      m_promise.Reset(isolate, resolver->GetPromise());
+
+#ifdef _WIN32
+      m_file = INVALID_HANDLE_VALUE;
+      if (owner->m_fileHandle != INVALID_HANDLE_VALUE)
+        DuplicateHandle(GetCurrentProcess(), owner->m_fileHandle, GetCurrentProcess(), &m_file, 0, FALSE, DUPLICATE_SAME_ACCESS);
+#endif
+    }
+
+    ~flush_request()
+    {
+      m_promise.Reset();
+
+#ifdef _WIN32
+      if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+#endif
+    }
+
+    // JS thread, before we're submitted. Widens the range to cover another
+    // flush and takes the stronger of the two modes.
+    void merge(uint64_t offset, uint64_t length, flush_mode mode)
+    {
+      if (offset < m_start)
+        m_start = offset;
+      if (offset + length > m_end)
+        m_end = offset + length;
+      if (mode > m_mode)
+        m_mode = mode;
+    }
+
+    Local<Promise> promise() const
+    {
+      return Local<Promise>::New(isolate(), m_promise);
+    }
+
+    bool block(const wait_deadline &) override
+    {
+#ifdef _WIN32
+      if (!FlushViewOfFile(m_base + m_start, static_cast<SIZE_T>(m_end - m_start)))
+        m_error = GetLastError();
+      else if (m_mode == FLUSH_SYNC && m_file != INVALID_HANDLE_VALUE && !FlushFileBuffers(m_file))
+        m_error = GetLastError();
+#else
+      // msync wants a page aligned start
+      auto page = static_cast<uint64_t>(page_size());
+      auto start = m_start / page * page;
+
+      if (msync(m_base + start, static_cast<size_t>(m_end - start), m_mode == FLUSH_SYNC ? MS_SYNC : MS_ASYNC) != 0)
+        m_error = errno;
+#endif
+      return true;
+    }
+
+    void finished(bool) override
+    {
+      // We're called straight from the event loop, not from JS
+      auto isolate = this->isolate();
+      HandleScope scope(isolate);
+      Context::Scope contextScope(context());
+
+      // Let the next flush start before we settle, since settling runs JS
+      // that can flush again or close the mapping
+      if (m_owner != nullptr)
+      {
+        m_owner->m_flushing = nullptr;
+        m_owner->start_next_flush();
+        m_owner = nullptr;
+      }
+
+      if (m_error != 0)
+      {
+        auto message = String::Concat(String::NewFromUtf8(isolate, "Failed to flush mapping, error code: "), Integer::New(isolate, m_error)->ToString(isolate));
+        reject(Exception::Error(message));
+      }
+      else
+      {
+        resolve(Undefined(isolate));
+      }
+
+      delete this;
+    }
+
+    // JS thread. The mapping is closing, it can't hear about us any more.
+    void disown()
+    {
+      m_owner = nullptr;
+    }
+
+  private:
+    file_mapping *m_owner;
+    std::shared_ptr<void> m_memory;
+    char *m_base;
+    uint64_t m_start;
+    uint64_t m_end;
+    flush_mode m_mode;
+    int m_error;
+    Persistent<Promise> m_promise;
+#ifdef _WIN32
+    HANDLE m_file;
+#endif
+  };
+
+  // ---------------------------------------------------------------------------
+
+  Local<Promise> file_mapping::queue_flush(Isolate *isolate, uint64_t offset, uint64_t length, flush_mode mode)
+  {
+    // Flushes asked for while one is running all go into the next one, so a
+    // burst of them costs two trips to the kernel rather than one each
+    if (m_nextFlush != nullptr)
+    {
+      m_nextFlush->merge(offset, length, mode);
+      return m_nextFlush->promise();
+    }
+
+    auto resolver = Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked();
+    auto request = new flush_request(isolate, this, offset, length, mode, resolver);
+
+    if (m_flushing != nullptr)
+    {
+      m_nextFlush = request;
+    }
+    else
+    {
+      m_flushing = request;
+      waiter_pool::instance().submit(request);
+    }
+
+    return resolver->GetPromise();
+  }
+
+  void file_mapping::start_next_flush()
+  {
+    if (m_nextFlush == nullptr)
+      return;
+
+    m_flushing = m_nextFlush;
+    m_nextFlush = nullptr;
+    waiter_pool::instance().submit(m_flushing);
+  }
+
+  void file_mapping::disown_flushes()
+  {
+    // Both keep the memory they flush pinned, so they can still finish
+    if (m_flushing != nullptr)
+    {
+      m_flushing->disown();
+      m_flushing = nullptr;
+    }
+
+    if (m_nextFlush != nullptr)
+    {
+      m_nextFlush->disown();
+      waiter_pool::instance().submit(m_nextFlush);
+      m_nextFlush = nullptr;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool file_mapping::read_range(const v8::FunctionCallbackInfo<v8::Value> &args, int index, uint64_t &offset, uint64_t &length, const char *method)
+  {
+    auto isolate = args.GetIsolate();
+    bool ranged = args.Length() > index && args[index]->IsNumber();
+
+    if (ranged && !(args[index + 1]->IsNumber() && ToSize(args[index], offset) && ToSize(args[index + 1], length)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, (std::string("Wrong type arguments to ") + method).c_str())));
+      return false;
+    }
+
+    refresh();
+
+    if (m_ptr == nullptr)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, (std::string(method) + " called on a closed mapping").c_str())));
+      return false;
+    }
+
+    if (!ranged)
+    {
+      offset = 0;
+      length = m_size;
+    }
+    else if (offset > m_size || length > m_size - offset)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, (std::string(method) + " range is outside of the mapping").c_str())));
+      return false;
+    }
+
+    return true;
+  }
+
+  void file_mapping::prefault(uint64_t offset, uint64_t length)
+  {
+    if (length == 0)
+      return;
+
+    auto page = static_cast<uint64_t>(page_size());
+    auto start = reinterpret_cast<char *>(m_ptr) + offset / page * page;
+    auto end = reinterpret_cast<char *>(m_ptr) + offset + length;
+    auto bytes = static_cast<uint64_t>(end - start);
+
+#ifdef __linux__
+    // One call does it on newer kernels. Pages of a file are only faulted in
+    // for reading, since faulting them in for writing would dirty them all.
+    if (madvise(start, static_cast<size_t>(bytes), m_fileBacked ? MADV_POPULATE_READ : MADV_POPULATE_WRITE) == 0)
+      return;
+#endif
+
+    // Otherwise touch every page. Adding zero is a write that doesn't change
+    // anything, even with other processes writing at the same time.
+    bool write = !m_fileBacked;
+    auto touch = [page, write](char *from, char *to)
+    {
+      for (auto it = from; it < to; it += page)
+      {
+        auto byte = reinterpret_cast<std::atomic<char> *>(it);
+        if (write)
+          byte->fetch_add(0, std::memory_order_relaxed);
+        else
+          byte->load(std::memory_order_relaxed);
+      }
+    };
+
+    // Faults on different pages hardly contend, so big ranges go faster on a
+    // few threads
+    const uint64_t BYTES_PER_THREAD = 64 << 20;
+    const uint64_t MAX_THREADS = 16;
+
+    uint64_t threads = std::min<uint64_t>({ std::thread::hardware_concurrency(), MAX_THREADS, bytes / BYTES_PER_THREAD });
+    if (threads <= 1)
+    {
+      touch(start, end);
+      return;
+    }
+
+    auto chunk = ((bytes + page - 1) / page + threads - 1) / threads * page;
+    std::vector<std::thread> workers;
+
+    for (uint64_t i = 1; i < threads && i * chunk < bytes; ++i)
+      workers.emplace_back(touch, start + i * chunk, start + std::min(bytes, (i + 1) * chunk));
+
+    touch(start, start + chunk);
+
+    for (auto &worker : workers)
+      worker.join();
+  }
+
+  // ---------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+  file_mapping::file_mapping() :
+    m_fileHandle(INVALID_HANDLE_VALUE),
+    m_mappingHandle(INVALID_HANDLE_VALUE),
+    m_ptr(nullptr),
+    m_size(0),
+    m_fileBacked(false),
+    m_section(nullptr),
+    m_growHeader(nullptr),
+    m_headerSize(0),
+    m_generation(0),
+    m_flushing(nullptr),
+    m_nextFlush(nullptr),
+    m_stats(STATS_MAPPING)
+  {
+  }
+
+#else
+
+  file_mapping::file_mapping() :
+    m_fd(-1),
+    m_nameShm(false),
+    m_nameCreated(false),
+    m_ptr(nullptr),
+    m_size(0),
+    m_fileBacked(false),
+    m_section(nullptr),
+    m_growHeader(nullptr),
+    m_headerSize(0),
+    m_generation(0),
+    m_flushing(nullptr),
+    m_nextFlush(nullptr),
+    m_stats(STATS_MAPPING)
+  {
+  }
+
+#endif
+
+  file_mapping::~file_mapping()
+  {
+    // We're being collected, so any views left are unreachable too (they keep
+    // us alive otherwise) and their weak callbacks may already be queued. Let
+    // those callbacks clean them up.
+    orphan_views();
+    close_mapping();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool file_mapping::HasInstance(Isolate *isolate, Local<Value> value)
+  {
+    return addon_data::current().has_instance(CLASS_FILE_MAPPING, value);
+  }
+
+  char *file_mapping::at(uint64_t offset, uint64_t length)
+  {
+    refresh();
+
+    if (m_ptr == nullptr || offset > m_size || length > m_size - offset)
+      return nullptr;
+
+    return reinterpret_cast<char *>(m_ptr) + offset;
+  }
+
+  int file_mapping::refresh()
+  {
+#ifndef _WIN32
+    if (m_growHeader == nullptr)
+      return 0;
+
+    auto generation = m_growHeader->generation.load(std::memory_order_acquire);
+    if (generation == m_generation)
+      return 0;
+
+    // We can have mapped more than the header says, if we opened the mapping
+    // while it was being grown
+    auto size = m_growHeader->size.load(std::memory_order_relaxed);
+    if (size > m_size)
+    {
+      int error = remap(size);
+      if (error != 0)
+        return error;
+    }
+
+    m_generation = generation;
+#endif
+    return 0;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::ViewCollected(const WeakCallbackInfo<mapping_view> &data)
+  {
+    auto view = data.GetParameter();
+
+    view->handle.Reset();
+    if (view->owner != nullptr)
+      view->owner->m_views.erase(view);
+    delete view;
+  }
+
+  void file_mapping::detach_views()
+  {
+    // Neutering sets the length of the ArrayBuffer and every view on it to 0,
+    // so JS can't reach the memory after we unmap it
+    for (auto view : m_views)
+    {
+      auto isolate = Isolate::GetCurrent();
+      HandleScope scope(isolate);
+
+      auto buffer = Local<ArrayBuffer>::New(isolate, view->handle);
+      if (buffer->IsNeuterable())
+        buffer->Neuter();
+
+      view->handle.Reset();
+      delete view;
+    }
+
+    m_views.clear();
+  }
+
+  void file_mapping::orphan_views()
+  {
+    for (auto view : m_views)
+      view->owner = nullptr;
+
+    m_views.clear();
+  }
+
+  // ---------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+  void file_mapping::create_mapping(const char *fileName, const char *mappingName, uint64_t mappingSize, const mapping_options &options, Isolate *isolate)
+  {
+    close_mapping();
+
+    // A pagefile backed section can't be extended once it's created
+    if (options.growable)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Growable mappings aren't supported on this platform")));
+      return;
+    }
+
+    std::string key;
+    if (fileName == nullptr && mappingName != nullptr)
+    {
+      key = SectionKey(mappingName, options);
+      if (share_section(key, mappingSize, true, options))
+        return;
+    }
+
+    if (fileName == nullptr)
+    {
+      m_fileHandle = INVALID_HANDLE_VALUE; // Used for plain shared memory, with no backing file
+    }
+    else
+    {
+      m_fileHandle = CreateFile(
+        fileName,
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        nullptr,
+        OPEN_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        nullptr);
+
+      if (m_fileHandle == INVALID_HANDLE_VALUE)
+      {
+        ThrowErrorCode(isolate, "Failed to create file, error code: ", GetLastError());
+        return;
+      }
+    }
+
+    DWORD protect = PAGE_READWRITE;
+    DWORD access = FILE_MAP_ALL_ACCESS;
+
+    // Large pages are only available for pagefile backed sections, and need
+    // the SeLockMemoryPrivilege
+    if (options.hugePages == HUGE_PAGES_EXPLICIT && fileName == nullptr)
+    {
+      uint64_t largePage = GetLargePageMinimum();
+      if (largePage != 0)
+        mappingSize = (mappingSize + largePage - 1) / largePage * largePage;
+
+      protect |= SEC_COMMIT | SEC_LARGE_PAGES;
+      access |= FILE_MAP_LARGE_PAGES;
+    }
+
+    m_mappingHandle = CreateFileMapping(
+      m_fileHandle,
+      nullptr,
+      protect,
+      static_cast<DWORD>(mappingSize >> 32),
+      static_cast<DWORD>(mappingSize & 0xFFFFFFFF),
+      mappingName);
+
+    if (m_mappingHandle == nullptr)
+    {
+      int lastErr = GetLastError();
+      m_mappingHandle = INVALID_HANDLE_VALUE;
+      close_mapping();
+
+      ThrowErrorCode(isolate, "Failed to create file mapping, error code: ", lastErr);
+      return;
+    }
+
+    m_ptr = MapViewOfFile(
+      m_mappingHandle,
+      access,
+      0,
+      0,
+      static_cast<SIZE_T>(mappingSize));
+
+    if (m_ptr == nullptr)
+    {
+      int lastErr = GetLastError();
+      close_mapping();
+
+      ThrowErrorCode(isolate, "Failed to map view of file, error code: ", lastErr);
+      return;
+    }
+
+    m_memory.reset(m_ptr, [](void *ptr) { UnmapViewOfFile(ptr); });
+
+    m_size = mappingSize;
+    m_fileBacked = fileName != nullptr;
+
+    if (!key.empty())
+      publish_section(key);
+
+    if (options.populate)
+      prefault(0, m_size);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::open_mapping(const char *mappingName, uint64_t mappingSize, const mapping_options &options, Isolate *isolate)
+  {
+    close_mapping();
+
+    if (options.growable)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Growable mappings aren't supported on this platform")));
+      return;
+    }
+
+    auto key = SectionKey(mappingName, options);
+    if (share_section(key, mappingSize, false, options))
+      return;
+
+    m_mappingHandle = OpenFileMapping(
+      FILE_MAP_ALL_ACCESS,
+      FALSE,
+      mappingName);
+
+    if (m_mappingHandle == nullptr)
+    {
+      m_mappingHandle = INVALID_HANDLE_VALUE;
+
+      ThrowErrorCode(isolate, "Failed to open file mapping, error code: ", GetLastError());
+      return;
+    }
+
+    DWORD access = FILE_MAP_ALL_ACCESS;
+    if (options.hugePages == HUGE_PAGES_EXPLICIT)
+      access |= FILE_MAP_LARGE_PAGES;
+
+    m_ptr = MapViewOfFile(
+      m_mappingHandle,
+      access,
+      0,
+      0,
+      static_cast<SIZE_T>(mappingSize));
+
+    if (m_ptr == nullptr)
+    {
+      int lastErr = GetLastError();
+      close_mapping();
+
+      ThrowErrorCode(isolate, "Failed to map view of file, error code: ", lastErr);
+      return;
+    }
+
+    m_memory.reset(m_ptr, [](void *ptr) { UnmapViewOfFile(ptr); });
+
+    if (mappingSize == 0)
+    {
+      MEMORY_BASIC_INFORMATION info;
+      VirtualQuery(m_ptr, &info, sizeof(info));
+      mappingSize = info.RegionSize;
+    }
+
+    m_size = mappingSize;
+    publish_section(key);
+
+    if (options.populate)
+      prefault(0, m_size);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::close_mapping()
+  {
+    detach_views();
+    disown_flushes();
+
+    if (m_ptr != nullptr)
+    {
+      m_memory.reset();
+      m_ptr = nullptr;
+      m_size = 0;
+    }
+    if (m_section != nullptr)
+      release_section();
+    m_fileBacked = false;
+    if (m_fileHandle != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(m_fileHandle);
+      m_fileHandle = INVALID_HANDLE_VALUE;
+    }
+    if (m_mappingHandle != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(m_mappingHandle);
+      m_mappingHandle = INVALID_HANDLE_VALUE;
+    }
+  }
+
+#else
+
+  // ---------------------------------------------------------------------------
+  // POSIX backend. Plain shared memory lives in a shm_open object named after
+  // the mapping, explicit huge page shared memory in a file on hugetlbfs, and
+  // file backed mappings map the file itself. The last process to close a
+  // shared memory object removes its name, see OpenName.
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::create_mapping(const char *fileName, const char *mappingName, uint64_t mappingSize, const mapping_options &options, Isolate *isolate)
+  {
+    close_mapping();
+
+    std::string key;
+    if (fileName == nullptr && !options.growable)
+    {
+      key = SectionKey(mappingName, options);
+      if (share_section(key, mappingSize, true, options))
+        return;
+    }
+
+    if (fileName != nullptr)
+    {
+      m_fd = open(fileName, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+
+      if (m_fd < 0)
+      {
+        ThrowErrorCode(isolate, "Failed to create file, error code: ", errno);
+        return;
+      }
+    }
+    else
+    {
+      bool shm = options.hugePages != HUGE_PAGES_EXPLICIT;
+      auto path = shm ? ShmName(mappingName) : HugetlbfsName(options, mappingName);
+      m_fd = OpenName(path, shm, true);
+
+      if (m_fd < 0)
+      {
+        ThrowErrorCode(isolate, "Failed to create file mapping, error code: ", errno);
+        return;
+      }
+
+      m_namePath = path;
+      m_nameShm = shm;
+      m_nameCreated = true;
+    }
+
+    // hugetlbfs only accepts whole huge pages, and reports the page size as
+    // its block size
+    if (options.hugePages == HUGE_PAGES_EXPLICIT)
+    {
+      struct statfs fsInfo;
+      if (fstatfs(m_fd, &fsInfo) == 0 && fsInfo.f_bsize > 0)
+      {
+        uint64_t pageSize = static_cast<uint64_t>(fsInfo.f_bsize);
+        mappingSize = (mappingSize + pageSize - 1) / pageSize * pageSize;
+      }
+    }
+
+    // A growable mapping's header goes in front of what was asked for. Hold
+    // the lock until the header is set up, so a grow() in another process
+    // can't see it half done.
+    if (options.growable)
+    {
+      m_headerSize = page_size();
+      mappingSize += m_headerSize;
+      flock(m_fd, LOCK_EX);
+    }
+
+    // Like CreateFileMapping, grow the backing object to the mapping size but
+    // never shrink it
+    struct stat fileInfo;
+    if (fstat(m_fd, &fileInfo) != 0)
+    {
+      int lastErr = errno;
+      close_mapping();
+
+      ThrowErrorCode(isolate, "Failed to create file mapping, error code: ", lastErr);
+      return;
+    }
+
+    if (static_cast<uint64_t>(fileInfo.st_size) < mappingSize && ftruncate(m_fd, static_cast<off_t>(mappingSize)) != 0)
+    {
+      int lastErr = errno;
+      close_mapping();
+
+      ThrowErrorCode(isolate, "Failed to create file mapping, error code: ", lastErr);
+      return;
+    }
+
+    // Someone may have grown it already, and the whole of it is ours
+    if (options.growable && static_cast<uint64_t>(fileInfo.st_size) > mappingSize)
+      mappingSize = static_cast<uint64_t>(fileInfo.st_size);
+
+    if (!map_fd(mappingSize, options, isolate))
+      return;
+
+    m_fileBacked = fileName != nullptr;
+
+    if (!key.empty())
+      publish_section(key);
+
+    if (options.growable)
+    {
+      auto header = m_growHeader;
+
+      if (header->magic != grow_header::MAGIC || header->version != grow_header::VERSION)
+      {
+        header->size.store(m_size, std::memory_order_relaxed);
+        header->generation.store(1, std::memory_order_relaxed);
+        header->version = grow_header::VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = grow_header::MAGIC;
+      }
+      else if (header->size.load(std::memory_order_relaxed) < m_size)
+      {
+        header->size.store(m_size, std::memory_order_relaxed);
+        header->generation.fetch_add(1, std::memory_order_release);
+      }
+
+      m_generation = header->generation.load(std::memory_order_acquire);
+      flock(m_fd, LOCK_UN);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::open_mapping(const char *mappingName, uint64_t mappingSize, const mapping_options &options, Isolate *isolate)
+  {
+    close_mapping();
+
+    auto key = SectionKey(mappingName, options);
+    if (!options.growable && share_section(key, mappingSize, false, options))
+      return;
+
+    bool shm = options.hugePages != HUGE_PAGES_EXPLICIT;
+    m_fd = OpenName(key, shm, false);
+
+    if (m_fd < 0)
+    {
+      ThrowErrorCode(isolate, "Failed to open file mapping, error code: ", errno);
+      return;
+    }
+
+    m_namePath = key;
+    m_nameShm = shm;
+    m_nameCreated = false;
+
+    struct stat fileInfo;
+    if (fstat(m_fd, &fileInfo) != 0)
+    {
+      int lastErr = errno;
+      close_mapping();
+
+      ThrowErrorCode(isolate, "Failed to open file mapping, error code: ", lastErr);
+      return;
+    }
+
+    // A size of 0 maps the whole object, like MapViewOfFile. Mapping past the
+    // end of the object would only fault later, so refuse it up front.
+    auto objectSize = static_cast<uint64_t>(fileInfo.st_size);
+
+    // A growable mapping is mapped whole, header and all, since it can only
+    // get bigger
+    if (options.growable)
+    {
+      m_headerSize = page_size();
+      mappingSize = objectSize < m_headerSize || mappingSize > objectSize - m_headerSize ? UINT64_MAX : objectSize;
+    }
+
+    if (mappingSize == 0)
+      mappingSize = objectSize;
+
+    if (mappingSize > objectSize)
+    {
+      close_mapping();
+
+      ThrowErrorCode(isolate, "Failed to map view of file, error code: ", EINVAL);
+      return;
+    }
+
+    if (!map_fd(mappingSize, options, isolate))
+      return;
+
+    if (!options.growable)
+    {
+      publish_section(key);
+      return;
+    }
+
+    auto header = m_growHeader;
+    if (header->magic != grow_header::MAGIC || header->version != grow_header::VERSION)
+    {
+      close_mapping();
+
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Mapping isn't growable in FileMapping.openMapping")));
+      return;
+    }
+
+    m_generation = header->generation.load(std::memory_order_acquire);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool file_mapping::map_fd(uint64_t mappingSize, const mapping_options &options, Isolate *isolate)
+  {
+    int flags = MAP_SHARED;
+
+#ifdef MAP_HUGETLB
+    // Only valid on hugetlbfs files; anything else fails with EINVAL rather
+    // than silently falling back to small pages
+    if (options.hugePages == HUGE_PAGES_EXPLICIT)
+      flags |= MAP_HUGETLB;
+#endif
+
+#ifdef MAP_POPULATE
+    if (options.populate)
+      flags |= MAP_POPULATE;
+#endif
+
+    void *ptr = mmap(nullptr, static_cast<size_t>(mappingSize), PROT_READ | PROT_WRITE, flags, m_fd, 0);
+
+    if (ptr == MAP_FAILED)
+    {
+      int lastErr = errno;
+      close_mapping();
+
+      ThrowErrorCode(isolate, "Failed to map view of file, error code: ", lastErr);
+      return false;
+    }
+
+#ifdef MADV_HUGEPAGE
+    // Just a hint - the kernel may not have THP enabled for shmem
+    if (options.hugePages == HUGE_PAGES_TRANSPARENT)
+      madvise(ptr, static_cast<size_t>(mappingSize), MADV_HUGEPAGE);
+#endif
+
+    auto length = std::make_shared<size_t>(static_cast<size_t>(mappingSize));
+    m_memory.reset(ptr, [length](void *ptr) { munmap(ptr, *length); });
+    m_mappedLength = length;
+    m_ptr = reinterpret_cast<char *>(ptr) + m_headerSize;
+    m_size = mappingSize - m_headerSize;
+
+    if (m_headerSize != 0)
+      m_growHeader = reinterpret_cast<grow_header *>(ptr);
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  int file_mapping::remap(uint64_t size)
+  {
+    auto base = reinterpret_cast<char *>(m_growHeader);
+    auto oldLength = static_cast<size_t>(m_headerSize + m_size);
+    auto newLength = static_cast<size_t>(m_headerSize + size);
+
+#ifdef __linux__
+    // Without MREMAP_MAYMOVE, so views, pins and pointers on other threads
+    // all stay where they are
+    if (mremap(base, oldLength, newLength, 0) != MAP_FAILED)
+    {
+      *m_mappedLength = newLength;
+      m_size = size;
+      return 0;
+    }
+#endif
+
+    // Something else is mapped right after us. Map the whole thing again
+    // somewhere else, and keep the old mapping for whatever still points
+    // into it - both are the same shared pages.
+    void *ptr = mmap(nullptr, newLength, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (ptr == MAP_FAILED)
+      return errno;
+
+    m_retired.emplace_back(m_memory, oldLength);
+
+    auto length = std::make_shared<size_t>(newLength);
+    m_memory.reset(ptr, [length](void *ptr) { munmap(ptr, *length); });
+    m_mappedLength = length;
+    m_growHeader = reinterpret_cast<grow_header *>(ptr);
+    m_ptr = reinterpret_cast<char *>(ptr) + m_headerSize;
+    m_size = size;
+    return 0;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::close_mapping()
+  {
+    detach_views();
+    disown_flushes();
+
+#ifdef __linux__
+    // A MappedMutex this thread still holds in here is on its robust list,
+    // which mustn't be left pointing into memory that's about to go
+    if (m_ptr != nullptr)
+      robust_lock::abandon_range(m_ptr, static_cast<size_t>(m_size));
+    for (auto &it : m_retired)
+      robust_lock::abandon_range(it.first.get(), it.second);
+#endif
+
+    if (m_ptr != nullptr)
+    {
+      m_memory.reset();
+      m_mappedLength.reset();
+      m_ptr = nullptr;
+      m_size = 0;
+    }
+    if (m_section != nullptr)
+      release_section();
+    m_retired.clear();
+    m_growHeader = nullptr;
+    m_headerSize = 0;
+    m_generation = 0;
+    m_fileBacked = false;
+    if (m_fd >= 0)
+    {
+      if (!m_namePath.empty())
+        ReleaseName(m_fd, m_namePath, m_nameShm, m_nameCreated);
+      else
+        close(m_fd);
+
+      m_fd = -1;
+    }
+    m_namePath.clear();
+  }
+
+#endif
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::New(const FunctionCallbackInfo<Value>& args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.IsConstructCall())
+    {
+      auto obj = new file_mapping();
+      obj->Wrap(args.This());
+      args.GetReturnValue().Set(args.This());
+    }
+    else
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Must create FileMapping with new")));
+      return;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::CreateMapping(const FunctionCallbackInfo<Value>& args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    if (args.Length() < 3)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.createMapping")));
+      return;
+    }
+
+    uint64_t mappingSize;
+    mapping_options options;
+
+    if (!((args[0]->IsNull() || args[0]->IsString()) &&
+           args[1]->IsString() &&
+           args[2]->IsNumber() && ToSize(args[2], mappingSize) &&
+           ReadMappingOptions(isolate, args[3], options)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.createMapping")));
+      return;
+    }
+
+    std::string filename = args[0]->IsNull() ? std::string() : ToCString(args[0]->ToString());
+    std::string mappingName = ToCString(args[1]->ToString());
+
+    obj->create_mapping(args[0]->IsNull() ? nullptr : filename.c_str(), mappingName.c_str(), mappingSize, options, isolate);
+    if (obj->m_ptr != nullptr)
+      obj->m_stats.reset(mappingName.c_str());
+  }
+
+  void file_mapping::OpenMapping(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    if (args.Length() < 2)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.openMapping")));
+      return;
+    }
+
+    uint64_t mappingSize;
+    mapping_options options;
+
+    if (!(args[0]->IsString() &&
+          args[1]->IsNumber() && ToSize(args[1], mappingSize) &&
+          ReadMappingOptions(isolate, args[2], options)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.openMapping")));
+      return;
+    }
+
+    std::string mappingName = ToCString(args[0]->ToString());
+
+    obj->open_mapping(mappingName.c_str(), mappingSize, options, isolate);
+    if (obj->m_ptr != nullptr)
+      obj->m_stats.reset(mappingName.c_str());
+  }
+
+  void file_mapping::CloseMapping(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    obj->close_mapping();
+  }
+
+  void file_mapping::WriteBuffer(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    if (args.Length() < 4)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.writeBuffer")));
+      return;
+    }
+
+    uint64_t destOffset, srcOffset, length;
+
+    if (!(node::Buffer::HasInstance(args[0]) && args[1]->IsNumber() && args[2]->IsNumber() && args[3]->IsNumber() &&
+          ToSize(args[1], destOffset) && ToSize(args[2], srcOffset) && ToSize(args[3], length)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.writeBuffer")));
+      return;
+    }
+
+    uint64_t bufferLength = node::Buffer::Length(args[0]);
+    if (srcOffset > bufferLength || length > bufferLength - srcOffset)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "FileMapping.writeBuffer range is outside of the buffer")));
+      return;
+    }
+
+    auto dest = obj->at(destOffset, length);
+    if (dest == nullptr)
+    {
+      if (obj->m_ptr == nullptr)
+        isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "FileMapping.writeBuffer called on a closed mapping")));
+      else
+        isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "FileMapping.writeBuffer range is outside of the mapping")));
+      return;
+    }
+
+    memcpy(dest, node::Buffer::Data(args[0]) + srcOffset, static_cast<size_t>(length));
+
+    obj->m_stats->add(STAT_WRITE_CALLS);
+    obj->m_stats->add(STAT_BYTES_WRITTEN, length);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::ReadInto(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    if (args.Length() < 3)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.readInto")));
+      return;
+    }
+
+    uint64_t offset, length;
+
+    if (!(args[0]->IsNumber() && args[1]->IsNumber() && node::Buffer::HasInstance(args[2]) && ToSize(args[0], offset) && ToSize(args[1], length)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.readInto")));
+      return;
+    }
+
+    if (length > node::Buffer::Length(args[2]))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "FileMapping.readInto length is longer than the buffer")));
+      return;
+    }
+
+    auto src = obj->at(offset, length);
+    if (src == nullptr)
+    {
+      if (obj->m_ptr == nullptr)
+        isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "FileMapping.readInto called on a closed mapping")));
+      else
+        isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "FileMapping.readInto range is outside of the mapping")));
+      return;
+    }
+
+    memcpy(node::Buffer::Data(args[2]), src, static_cast<size_t>(length));
+
+    obj->m_stats->add(STAT_READ_CALLS);
+    obj->m_stats->add(STAT_BYTES_READ, length);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::WriteV(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    ObjectWrap::Unwrap<file_mapping>(args.Holder())->copy_batch(args, true, "FileMapping.writev");
+  }
+
+  void file_mapping::ReadV(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    ObjectWrap::Unwrap<file_mapping>(args.Holder())->copy_batch(args, false, "FileMapping.readv");
+  }
+
+  void file_mapping::copy_batch(const v8::FunctionCallbackInfo<v8::Value> &args, bool write, const char *method)
+  {
+    auto isolate = args.GetIsolate();
+
+    auto throwError = [&](Local<Value> (*make)(Local<String>), const std::string &message)
+    {
+      isolate->ThrowException(make(String::NewFromUtf8(isolate, message.c_str())));
+    };
+
+    if (args.Length() < 1)
+    {
+      throwError(Exception::TypeError, std::string("Not enough arguments to ") + method);
+      return;
+    }
+
+    // Every entry is checked before anything is copied, so a bad one leaves
+    // the mapping and the buffers as they were
+    std::vector<batch_copy> copies;
+
+    auto add = [&](uint32_t index, Local<Value> buffer, uint64_t bufferOffset, uint64_t length, bool wholeBuffer)
+    {
+      uint64_t bufferLength = node::Buffer::Length(buffer);
+
+      if (wholeBuffer && bufferOffset <= bufferLength)
+        length = bufferLength - bufferOffset;
+
+      if (bufferOffset > bufferLength || length > bufferLength - bufferOffset)
+      {
+        throwError(Exception::RangeError, std::string(method) + " entry " + std::to_string(index) + " is outside of its buffer");
+        return false;
+      }
+
+      copies.push_back({ node::Buffer::Data(buffer) + bufferOffset, 0, length });
+      return true;
+    };
+
+    Local<Value> lock;
+
+    if (args[0]->IsArray())
+    {
+      // [{ buffer, srcOffset, destOffset, length }, ...]
+      auto list = args[0].As<Array>();
+      auto bufferKey = String::NewFromUtf8(isolate, "buffer");
+      auto srcKey = String::NewFromUtf8(isolate, "srcOffset");
+      auto destKey = String::NewFromUtf8(isolate, "destOffset");
+      auto lengthKey = String::NewFromUtf8(isolate, "length");
+
+      copies.reserve(list->Length());
+
+      for (uint32_t i = 0; i < list->Length(); ++i)
+      {
+        auto item = list->Get(i);
+        Local<Value> buffer;
+        uint64_t srcOffset = 0, destOffset = 0, length = 0;
+
+        if (!(item->IsObject() &&
+              node::Buffer::HasInstance(buffer = item.As<Object>()->Get(bufferKey)) &&
+              ToOptionalSize(item.As<Object>()->Get(srcKey), srcOffset) &&
+              ToOptionalSize(item.As<Object>()->Get(destKey), destOffset)))
+        {
+          throwError(Exception::TypeError, std::string("Wrong type arguments to ") + method);
+          return;
+        }
+
+        auto lengthValue = item.As<Object>()->Get(lengthKey);
+
+        if (!ToOptionalSize(lengthValue, length))
+        {
+          throwError(Exception::TypeError, std::string("Wrong type arguments to ") + method);
+          return;
+        }
+
+        if (!add(i, buffer, write ? srcOffset : destOffset, length, lengthValue->IsUndefined()))
+          return;
+
+        copies.back().mappingOffset = write ? destOffset : srcOffset;
+      }
+
+      lock = args[1];
+    }
+    else if (node::Buffer::HasInstance(args[0]) && args[1]->IsFloat64Array() && args[1].As<Float64Array>()->Length() % 3 == 0)
+    {
+      // One buffer, and a Float64Array of srcOffset, destOffset, length
+      // triples. Nothing to look up by name, for big batches of small copies.
+      auto descriptors = args[1].As<Float64Array>();
+      auto values = reinterpret_cast<const double *>(static_cast<char *>(descriptors->Buffer()->GetContents().Data()) + descriptors->ByteOffset());
+      auto count = static_cast<uint32_t>(descriptors->Length() / 3);
+
+      copies.reserve(count);
+
+      for (uint32_t i = 0; i < count; ++i)
+      {
+        uint64_t srcOffset, destOffset, length;
+
+        if (!(ToSize(values[i * 3], srcOffset) && ToSize(values[i * 3 + 1], destOffset) && ToSize(values[i * 3 + 2], length)))
+        {
+          throwError(Exception::TypeError, std::string("Wrong type arguments to ") + method);
+          return;
+        }
+
+        if (!add(i, args[0], write ? srcOffset : destOffset, length, false))
+          return;
+
+        copies.back().mappingOffset = write ? destOffset : srcOffset;
+      }
+
+      lock = args[2];
+    }
+    else
+    {
+      throwError(Exception::TypeError, std::string("Wrong type arguments to ") + method);
+      return;
+    }
+
+    // Anything with wait and release will do, which covers Mutex and
+    // MappedMutex. The whole batch runs under one wait.
+    Local<Object> lockObject;
+    Local<Value> release;
+
+    if (!(lock->IsUndefined() || lock->IsNull()))
+    {
+      Local<Value> wait;
+
+      if (!(lock->IsObject() &&
+            (wait = lock.As<Object>()->Get(String::NewFromUtf8(isolate, "wait")))->IsFunction() &&
+            (release = lock.As<Object>()->Get(String::NewFromUtf8(isolate, "release")))->IsFunction()))
+      {
+        throwError(Exception::TypeError, std::string("Wrong type arguments to ") + method);
+        return;
+      }
+
+      lockObject = lock.As<Object>();
+
+      Local<Value> result;
+      if (!wait.As<Function>()->Call(isolate->GetCurrentContext(), lockObject, 0, nullptr).ToLocal(&result))
+        return;
+
+      auto code = result->Uint32Value();
+      if (code != WAIT_OBJECT_0 && code != WAIT_ABANDONED)
+      {
+        throwError(Exception::Error, std::string(method) + " couldn't take the lock, wait returned " + std::to_string(code));
+        return;
+      }
+    }
+
+    auto unlock = [&]()
+    {
+      return lockObject.IsEmpty() || !release.As<Function>()->Call(isolate->GetCurrentContext(), lockObject, 0, nullptr).IsEmpty();
+    };
+
+    // The mapping side is checked last, once nothing else can run
+    refresh();
+
+    if (m_ptr == nullptr)
+    {
+      if (unlock())
+        throwError(Exception::Error, std::string(method) + " called on a closed mapping");
+      return;
+    }
+
+    for (size_t i = 0; i < copies.size(); ++i)
+    {
+      if (copies[i].mappingOffset > m_size || copies[i].length > m_size - copies[i].mappingOffset)
+      {
+        if (unlock())
+          throwError(Exception::RangeError, std::string(method) + " entry " + std::to_string(i) + " is outside of the mapping");
+        return;
+      }
+    }
+
+    uint64_t total = 0;
+
+    for (auto &copy : copies)
+    {
+      char *mapped = reinterpret_cast<char *>(m_ptr) + copy.mappingOffset;
+
+      // A buffer can be a view of this same mapping, so they may overlap
+      if (write)
+        memmove(mapped, copy.buffer, static_cast<size_t>(copy.length));
+      else
+        memmove(copy.buffer, mapped, static_cast<size_t>(copy.length));
+
+      total += copy.length;
+    }
+
+    m_stats->add(write ? STAT_WRITE_CALLS : STAT_READ_CALLS);
+    m_stats->add(write ? STAT_BYTES_WRITTEN : STAT_BYTES_READ, total);
+
+    if (!unlock())
+      return;
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(total)));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::View(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    if (args.Length() < 2)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.view")));
+      return;
+    }
+
+    uint64_t offset, length;
+
+    if (!(args[0]->IsNumber() && args[1]->IsNumber() && ToSize(args[0], offset) && ToSize(args[1], length)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.view")));
+      return;
+    }
+
+    obj->refresh();
+
+    if (obj->m_ptr == nullptr)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "FileMapping.view called on a closed mapping")));
+      return;
+    }
+
+    if (offset > obj->m_size || length > obj->m_size - offset || length > node::Buffer::kMaxLength)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "FileMapping.view range is outside of the mapping")));
+      return;
+    }
+
+    obj->m_stats->add(STAT_VIEW_CALLS);
+    args.GetReturnValue().Set(obj->make_view(isolate, args.Holder(), offset, length));
+  }
+
+  void file_mapping::Flush(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    // flush([mode]) or flush(offset, length[, mode])
+    bool ranged = args.Length() >= 2 && !args[0]->IsString() && !args[0]->IsUndefined();
+    uint64_t offset = 0, length = 0;
+    flush_mode mode;
+
+    if (!((!ranged || (args[0]->IsNumber() && args[1]->IsNumber() && ToSize(args[0], offset) && ToSize(args[1], length))) &&
+          ReadFlushMode(args[ranged ? 2 : 0], mode)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.flush")));
+      return;
+    }
+
+    obj->refresh();
+
+    if (obj->m_ptr == nullptr)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "FileMapping.flush called on a closed mapping")));
+      return;
+    }
+
+    if (ranged && (offset > obj->m_size || length > obj->m_size - offset))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "FileMapping.flush range is outside of the mapping")));
+      return;
+    }
+
+    obj->m_stats->add(STAT_FLUSH_CALLS);
+
+    // Without a range, flush all of it. Writes through views can land
+    // anywhere, and the OS only writes back the pages that are dirty anyway.
+    if (!ranged)
+    {
+      offset = 0;
+      length = obj->m_size;
+    }
+
+    if (mode == FLUSH_NONE || length == 0)
+    {
+      auto resolver = Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked();
+      resolver->Resolve(isolate->GetCurrentContext(), Undefined(isolate)).FromJust();
+      args.GetReturnValue().Set(resolver->GetPromise());
+      return;
+    }
+
+    args.GetReturnValue().Set(obj->queue_flush(isolate, offset, length, mode));
+  }
 
-  // ---------------------------------------------------------------------------
+  void file_mapping::Prefault(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
 
-  namespace
+    uint64_t offset, length;
+    if (!obj->read_range(args, 0, offset, length, "FileMapping.prefault"))
+      return;
+
+    obj->prefault(offset, length);
+  }
+
+  void file_mapping::Advise(const v8::FunctionCallbackInfo<v8::Value> &args)
   {
-    const char *ToCString(Local<String> str)
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    // advise(hint) or advise(offset, length, hint)
+    int hintIndex = args.Length() > 0 && args[0]->IsNumber() ? 2 : 0;
+    advice hint;
+
+    if (args.Length() <= hintIndex)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.advise")));
+      return;
+    }
+
+    if (!ReadAdvice(args[hintIndex], hint))
     {
-      String::Utf8Value value(str);
-      return *value ? *value : "<string conversion failed>";
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.advise")));
+      return;
     }
+
+    uint64_t offset, length;
+    if (!obj->read_range(args, 0, offset, length, "FileMapping.advise") || length == 0)
+      return;
+
+    auto page = page_size();
+    auto start = reinterpret_cast<char *>(obj->m_ptr) + offset / page * page;
+    auto bytes = static_cast<size_t>(reinterpret_cast<char *>(obj->m_ptr) + offset + length - start);
+
+#ifdef _WIN32
+    // Windows has nothing for access patterns. Pages not wanted are dropped
+    // from the working set, which is what VirtualUnlock does to pages that
+    // aren't locked.
+    if (hint == ADVICE_WILLNEED && !Prefetch(start, bytes))
+      ThrowErrorCode(isolate, "Failed to advise mapping, error code: ", GetLastError());
+    else if (hint == ADVICE_DONTNEED)
+      VirtualUnlock(start, bytes);
+#else
+    static const int HINTS[] = { MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, MADV_DONTNEED };
+
+    if (madvise(start, bytes, HINTS[hint]) != 0)
+      ThrowErrorCode(isolate, "Failed to advise mapping, error code: ", errno);
+#endif
   }
 
-  // ---------------------------------------------------------------------------
+  void file_mapping::Lock(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
 
-  Persistent<Function> file_mapping::constructor;
+    uint64_t offset, length;
+    if (!obj->read_range(args, 0, offset, length, "FileMapping.lock") || length == 0)
+      return;
 
-  // ---------------------------------------------------------------------------
+    auto start = reinterpret_cast<char *>(obj->m_ptr) + offset;
 
-  file_mapping::file_mapping() :
-    m_fileHandle(INVALID_HANDLE_VALUE),
-    m_mappingHandle(INVALID_HANDLE_VALUE)
+#ifdef _WIN32
+    if (!VirtualLock(start, static_cast<SIZE_T>(length)))
+      ThrowErrorCode(isolate, "Failed to lock mapping, error code: ", GetLastError());
+#else
+    if (mlock(start, static_cast<size_t>(length)) != 0)
+      ThrowErrorCode(isolate, "Failed to lock mapping, error code: ", errno);
+#endif
+  }
+
+  void file_mapping::Unlock(const v8::FunctionCallbackInfo<v8::Value> &args)
   {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    uint64_t offset, length;
+    if (!obj->read_range(args, 0, offset, length, "FileMapping.unlock") || length == 0)
+      return;
+
+    auto start = reinterpret_cast<char *>(obj->m_ptr) + offset;
+
+#ifdef _WIN32
+    // Unlocking pages that were never locked is fine, like munlock
+    if (!VirtualUnlock(start, static_cast<SIZE_T>(length)) && GetLastError() != ERROR_NOT_LOCKED)
+      ThrowErrorCode(isolate, "Failed to unlock mapping, error code: ", GetLastError());
+#else
+    if (munlock(start, static_cast<size_t>(length)) != 0)
+      ThrowErrorCode(isolate, "Failed to unlock mapping, error code: ", errno);
+#endif
   }
 
-  file_mapping::~file_mapping()
+  void file_mapping::Residency(const v8::FunctionCallbackInfo<v8::Value> &args)
   {
-    if (m_fileHandle != INVALID_HANDLE_VALUE)
-      CloseHandle(m_fileHandle);
-    if (m_mappingHandle != INVALID_HANDLE_VALUE)
-      CloseHandle(m_mappingHandle);
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    uint64_t offset, length;
+    if (!obj->read_range(args, 0, offset, length, "FileMapping.residency"))
+      return;
+
+    // Asked a batch of pages at a time, to keep the buffer small
+    const uint64_t BATCH_PAGES = 1 << 16;
+
+    auto page = page_size();
+    auto start = reinterpret_cast<char *>(obj->m_ptr) + offset / page * page;
+    auto end = reinterpret_cast<char *>(obj->m_ptr) + offset + length;
+    uint64_t pages = length == 0 ? 0 : (end - start + page - 1) / page;
+    uint64_t resident = 0;
+
+#ifdef _WIN32
+    std::vector<PSAPI_WORKING_SET_EX_INFORMATION> info(static_cast<size_t>(std::min(pages, BATCH_PAGES)));
+#else
+    std::vector<unsigned char> info(static_cast<size_t>(std::min(pages, BATCH_PAGES)));
+#endif
+
+    for (uint64_t first = 0; first < pages; first += BATCH_PAGES)
+    {
+      auto count = static_cast<size_t>(std::min(pages - first, BATCH_PAGES));
+      auto from = start + first * page;
+
+#ifdef _WIN32
+      for (size_t i = 0; i < count; ++i)
+        info[i].VirtualAddress = from + i * page;
+
+      if (!QueryWorkingSetEx(GetCurrentProcess(), info.data(), static_cast<DWORD>(count * sizeof(info[0]))))
+      {
+        ThrowErrorCode(isolate, "Failed to query mapping residency, error code: ", GetLastError());
+        return;
+      }
+
+      for (size_t i = 0; i < count; ++i)
+        resident += info[i].VirtualAttributes.Valid;
+#else
+      auto bytes = std::min(static_cast<size_t>(end - from), count * page);
+      if (mincore(from, bytes, info.data()) != 0)
+      {
+        ThrowErrorCode(isolate, "Failed to query mapping residency, error code: ", errno);
+        return;
+      }
+
+      for (size_t i = 0; i < count; ++i)
+        resident += info[i] & 1;
+#endif
+    }
+
+    auto result = Object::New(isolate);
+    result->Set(String::NewFromUtf8(isolate, "pageSize"), Number::New(isolate, static_cast<double>(page)));
+    result->Set(String::NewFromUtf8(isolate, "pages"), Number::New(isolate, static_cast<double>(pages)));
+    result->Set(String::NewFromUtf8(isolate, "resident"), Number::New(isolate, static_cast<double>(resident)));
+    args.GetReturnValue().Set(result);
   }
 
   // ---------------------------------------------------------------------------
 
-  void file_mapping::create_mapping(const char *fileName, const char *mappingName, unsigned mappingSize, Isolate *isolate)
+  void file_mapping::Grow(const v8::FunctionCallbackInfo<v8::Value> &args)
   {
-    if (fileName == nullptr)
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    if (args.Length() < 1)
     {
-      m_fileHandle = INVALID_HANDLE_VALUE; // Used for plain shared memory, with no backing file
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.grow")));
+      return;
     }
-    else
-    {
-      m_fileHandle = CreateFile(
-        fileName,
-        GENERIC_READ | GENERIC_WRITE,
-        0,
-        nullptr,
-        OPEN_ALWAYS,
-        FILE_ATTRIBUTE_NORMAL,
-        nullptr);
 
-      if (m_fileHandle == INVALID_HANDLE_VALUE)
-      {
-        int lastErr = GetLastError();
-        auto errStr = String::Concat(String::NewFromUtf8(isolate, "Failed to create file, error code: "), Integer::New(isolate, lastErr)->ToString(isolate));
+    uint64_t size;
 
-        isolate->ThrowException(Exception::Error(errStr));
-        return;
-      }
+    if (!(args[0]->IsNumber() && ToSize(args[0], size)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.grow")));
+      return;
     }
 
-    m_mappingHandle = CreateFileMapping(
-      m_fileHandle,
-      nullptr,
-      PAGE_READWRITE,
-      0,
-      mappingSize,
-      mappingName);
+    if (obj->m_ptr == nullptr)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "FileMapping.grow called on a closed mapping")));
+      return;
+    }
 
-    if (m_mappingHandle == INVALID_HANDLE_VALUE)
+    if (obj->m_growHeader == nullptr)
     {
-      int lastErr = GetLastError();
-      auto errStr = String::Concat(String::NewFromUtf8(isolate, "Failed to create file mapping, error code: "), Integer::New(isolate, lastErr)->ToString(isolate));
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "FileMapping.grow called on a mapping that isn't growable")));
+      return;
+    }
 
-      isolate->ThrowException(Exception::Error(errStr));
+#ifndef _WIN32
+    // The lock keeps two processes growing at once from shrinking the object
+    // under each other. It goes away with the process, so a grower dying
+    // doesn't leave it held.
+    if (flock(obj->m_fd, LOCK_EX) != 0)
+    {
+      ThrowErrorCode(isolate, "Failed to grow mapping, error code: ", errno);
       return;
     }
 
-    m_ptr = MapViewOfFile(
-      m_mappingHandle,
-      FILE_MAP_ALL_ACCESS,
-      0,
-      0,
-      mappingSize);
+    auto header = obj->m_growHeader;
+    auto total = obj->m_headerSize + size;
+    int error = 0;
 
-    if (m_ptr == nullptr)
+    // Asking for less than someone else already grew it to is fine, there's
+    // just nothing to do
+    if (size > header->size.load(std::memory_order_relaxed))
     {
-      int lastErr = GetLastError();
-      auto errStr = String::Concat(String::NewFromUtf8(isolate, "Failed to map view of file, error code: "), Integer::New(isolate, lastErr)->ToString(isolate));
+      struct stat fileInfo;
+      if (fstat(obj->m_fd, &fileInfo) != 0)
+        error = errno;
+      else if (static_cast<uint64_t>(fileInfo.st_size) < total && ftruncate(obj->m_fd, static_cast<off_t>(total)) != 0)
+        error = errno;
+      else
+      {
+        header->size.store(size, std::memory_order_relaxed);
+        header->generation.fetch_add(1, std::memory_order_release);
+      }
+    }
+
+    flock(obj->m_fd, LOCK_UN);
+
+    if (error == 0)
+      error = obj->refresh();
 
-      isolate->ThrowException(Exception::Error(errStr));
+    if (error != 0)
+    {
+      ThrowErrorCode(isolate, "Failed to grow mapping, error code: ", error);
       return;
     }
+#endif
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(obj->m_size)));
   }
 
-  // ---------------------------------------------------------------------------
+  void file_mapping::Size(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    obj->refresh();
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(obj->m_size)));
+  }
 
-  void file_mapping::open_mapping(const char *mappingName, unsigned mappingSize, Isolate *isolate)
+  void file_mapping::SharedBufferCollected(const WeakCallbackInfo<shared_buffer> &data)
   {
-    m_mappingHandle = OpenFileMapping(
-      FILE_MAP_ALL_ACCESS,
-      FALSE,
-      mappingName);
+    auto shared = data.GetParameter();
 
-    if (m_mappingHandle == INVALID_HANDLE_VALUE)
+    shared->handle.Reset();
+    delete shared;
+  }
+
+  void file_mapping::SharedBuffer(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+
+    if (args.Length() < 2)
     {
-      int lastErr = GetLastError();
-      auto errStr = String::Concat(String::NewFromUtf8(isolate, "Failed to open file mapping, error code: "), Integer::New(isolate, lastErr)->ToString(isolate));
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.sharedBuffer")));
+      return;
+    }
 
-      isolate->ThrowException(Exception::Error(errStr));
+    uint64_t offset, length;
+
+    if (!(args[0]->IsNumber() && args[1]->IsNumber() && ToSize(args[0], offset) && ToSize(args[1], length)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.sharedBuffer")));
       return;
     }
 
-    m_ptr = MapViewOfFile(
-      m_mappingHandle,
-      FILE_MAP_ALL_ACCESS,
-      0,
-      0,
-      mappingSize);
+    obj->refresh();
 
-    if (m_ptr == nullptr)
+    if (obj->m_ptr == nullptr)
     {
-      int lastErr = GetLastError();
-      auto errStr = String::Concat(String::NewFromUtf8(isolate, "Failed to map view of file, error code: "), Integer::New(isolate, lastErr)->ToString(isolate));
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "FileMapping.sharedBuffer called on a closed mapping")));
+      return;
+    }
 
-      isolate->ThrowException(Exception::Error(errStr));
+    if (offset > obj->m_size || length > obj->m_size - offset || length > node::Buffer::kMaxLength)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "FileMapping.sharedBuffer range is outside of the mapping")));
       return;
     }
-  }
 
-  // ---------------------------------------------------------------------------
+    // Externalized, so V8 never frees the memory - the pin unmaps it once
+    // both the mapping is closed and the buffer is collected
+    auto buffer = SharedArrayBuffer::New(isolate, reinterpret_cast<char *>(obj->m_ptr) + offset, static_cast<size_t>(length));
 
-  void file_mapping::close_mapping()
+    auto shared = new shared_buffer();
+    shared->memory = obj->pin();
+    shared->handle.Reset(isolate, buffer);
+    shared->handle.SetWeak(shared, SharedBufferCollected, WeakCallbackType::kParameter);
+
+    obj->m_stats->add(STAT_VIEW_CALLS);
+    args.GetReturnValue().Set(buffer);
+  }
+
+  std::atomic<uint32_t> *file_mapping::atomic_word(const v8::FunctionCallbackInfo<v8::Value> &args, const char *method)
   {
-    if (m_fileHandle != INVALID_HANDLE_VALUE)
+    auto isolate = args.GetIsolate();
+    uint64_t offset;
+
+    if (!(args[0]->IsNumber() && ToSize(args[0], offset)))
     {
-      CloseHandle(m_fileHandle);
-      m_fileHandle = INVALID_HANDLE_VALUE;
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, (std::string("Wrong type arguments to ") + method).c_str())));
+      return nullptr;
     }
-    if (m_mappingHandle != INVALID_HANDLE_VALUE)
+
+    refresh();
+
+    if (m_ptr == nullptr)
     {
-      CloseHandle(m_mappingHandle);
-      m_mappingHandle = INVALID_HANDLE_VALUE;
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, (std::string(method) + " called on a closed mapping").c_str())));
+      return nullptr;
     }
-  }
 
-  // ---------------------------------------------------------------------------
+    if (offset % sizeof(uint32_t) != 0 || m_size < sizeof(uint32_t) || offset > m_size - sizeof(uint32_t))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, (std::string(method) + " offset is misaligned or outside of the mapping").c_str())));
+      return nullptr;
+    }
 
-  void file_mapping::New(const FunctionCallbackInfo<Value>& args)
+    return reinterpret_cast<std::atomic<uint32_t> *>(reinterpret_cast<char *>(m_ptr) + offset);
+  }
+
+  char *file_mapping::scalar_at(const v8::FunctionCallbackInfo<v8::Value> &args, uint64_t size, const char *method)
   {
     auto isolate = args.GetIsolate();
+    uint64_t offset;
 
-    if (args.IsConstructCall())
+    if (!(args[0]->IsNumber() && ToSize(args[0], offset)))
     {
-      auto obj = new file_mapping();
-      obj->Wrap(args.This());
-      args.GetReturnValue().Set(args.This());
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, (std::string("Wrong type arguments to ") + method).c_str())));
+      return nullptr;
     }
+
+    auto at = this->at(offset, size);
+    if (at != nullptr)
+      return at;
+
+    if (m_ptr == nullptr)
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, (std::string(method) + " called on a closed mapping").c_str())));
     else
-    {
-      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Must create FileMapping with new")));
-      return;
-    }
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, (std::string(method) + " offset is outside of the mapping").c_str())));
+
+    return nullptr;
   }
 
-  // ---------------------------------------------------------------------------
+  template <typename T>
+  void file_mapping::ReadScalar(const v8::FunctionCallbackInfo<v8::Value> &args, const char *method)
+  {
+    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
 
-  void file_mapping::CreateMapping(const FunctionCallbackInfo<Value>& args)
+    auto at = obj->scalar_at(args, sizeof(T), method);
+    if (at == nullptr)
+      return;
+
+    T value;
+    memcpy(&value, at, sizeof(T));
+
+    obj->m_stats->add(STAT_READ_CALLS);
+    obj->m_stats->add(STAT_BYTES_READ, sizeof(T));
+
+    // Everything up to 32 bits comes back as a Smi where it fits
+    args.GetReturnValue().Set(value);
+  }
+
+  template <typename T>
+  void file_mapping::WriteScalar(const v8::FunctionCallbackInfo<v8::Value> &args, const char *method)
   {
     auto isolate = args.GetIsolate();
     auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
 
-    if (args.Length() < 3)
+    if (args.Length() < 2)
     {
-      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.createMapping")));
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, (std::string("Not enough arguments to ") + method).c_str())));
       return;
     }
 
-    if (!((args[0]->IsNull() || args[0]->IsString()) &&
-           args[1]->IsString() &&
-           args[2]->IsNumber()))
+    if (!args[1]->IsNumber())
     {
-      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.createMapping")));
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, (std::string("Wrong type arguments to ") + method).c_str())));
       return;
     }
 
-    const char *filename = args[0]->IsNull() ? nullptr : ToCString(args[0]->ToString());
-    const char *mappingName = ToCString(args[1]->ToString());
-    auto mappingSize = args[2]->Uint32Value();
+    auto at = obj->scalar_at(args, sizeof(T), method);
+    if (at == nullptr)
+      return;
+
+    T value = ToScalar<T>(args[1]);
+    memcpy(at, &value, sizeof(T));
 
-    obj->create_mapping(filename, mappingName, mappingSize, isolate);
+    obj->m_stats->add(STAT_WRITE_CALLS);
+    obj->m_stats->add(STAT_BYTES_WRITTEN, sizeof(T));
   }
-  
-  void file_mapping::OpenMapping(const v8::FunctionCallbackInfo<v8::Value> &args)
+
+  // ---------------------------------------------------------------------------
+
+  void file_mapping::AtomicWait(const v8::FunctionCallbackInfo<v8::Value> &args)
   {
     auto isolate = args.GetIsolate();
     auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
 
     if (args.Length() < 2)
     {
-      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.openMapping")));
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.atomicWait")));
       return;
     }
 
-    if (!(args[0]->IsString() && args[1]->IsNumber()))
+    DWORD ms;
+
+    if (!(args[1]->IsNumber() && ReadTimeout(args[2], ms)))
     {
-      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.openMapping")));
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.atomicWait")));
       return;
     }
 
-    const char *mappingName = ToCString(args[0]->ToString());
-    auto mappingSize = args[1]->Uint32Value();
+    auto word = obj->atomic_word(args, "FileMapping.atomicWait");
+    if (word == nullptr)
+      return;
 
-    obj->open_mapping(mappingName, mappingSize, isolate);
-  }
+    // Compared as the bits of an Int32Array element, which is what JS sees
+    auto expected = static_cast<uint32_t>(args[1]->Int32Value());
+    auto deadline = wait_deadline::after(ms);
+    const char *result = "ok";
 
-  void file_mapping::CloseMapping(const v8::FunctionCallbackInfo<v8::Value> &args)
-  {
-    auto isolate = args.GetIsolate();
-    auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
+    if (word->load(std::memory_order_seq_cst) != expected)
+    {
+      result = "not-equal";
+    }
+    else
+    {
+#ifdef __linux__
+      // Without FUTEX_PRIVATE_FLAG, so the kernel keys the wait on the shared
+      // page and a notify from any process mapping it wakes us
+      for (;;)
+      {
+        int error = futex_wait(word, expected, deadline);
+        if (error == ETIMEDOUT)
+          result = "timed-out";
+        else if (error == EAGAIN)
+          result = "not-equal";
+        if (error != EINTR)
+          break;
+      }
+#else
+      // No futex that works between processes here, so poll
+      while (word->load(std::memory_order_seq_cst) == expected)
+      {
+        if (deadline.expired())
+        {
+          result = "timed-out";
+          break;
+        }
 
-    obj->close_mapping();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+#endif
+    }
+
+    args.GetReturnValue().Set(String::NewFromUtf8(isolate, result));
   }
 
-  void file_mapping::WriteBuffer(const v8::FunctionCallbackInfo<v8::Value> &args)
+  void file_mapping::AtomicNotify(const v8::FunctionCallbackInfo<v8::Value> &args)
   {
     auto isolate = args.GetIsolate();
     auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
 
-    if (args.Length() < 3)
+    if (args.Length() < 1)
     {
-      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.writeBuffer")));
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.atomicNotify")));
       return;
     }
 
-    if (!(node::Buffer::HasInstance(args[0]) && args[1]->IsNumber() && args[2]->IsNumber()))
+    // Like Atomics.notify, leaving out count wakes everyone
+    int count = INT_MAX;
+
+    if (!(args[1]->IsUndefined() || (args[1]->IsNumber() && args[1]->NumberValue() >= 0)))
     {
-      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.writeBuffer")));
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.atomicNotify")));
       return;
     }
 
-    void *bufferData = node::Buffer::Data(args[0]);
-    auto destOffest  = args[1]->Uint32Value();
-    auto srcOffset   = args[2]->Uint32Value();
-    auto length      = args[3]->Uint32Value();
+    if (args[1]->IsNumber() && args[1]->NumberValue() < INT_MAX)
+      count = static_cast<int>(args[1]->NumberValue());
 
-    memcpy(reinterpret_cast<char *>(obj->m_ptr) + destOffest, reinterpret_cast<char *>(bufferData) + srcOffset, length);
-  }
+    auto word = obj->atomic_word(args, "FileMapping.atomicNotify");
+    if (word == nullptr)
+      return;
 
-  // ---------------------------------------------------------------------------
+#ifdef __linux__
+    int woken = count > 0 ? futex_wake(word, count) : 0;
+#else
+    // Pollers see the new value by themselves, and we can't count them
+    int woken = 0;
+#endif
 
-  void file_mapping::ReadInto(const v8::FunctionCallbackInfo<v8::Value> &args)
+    args.GetReturnValue().Set(Integer::New(isolate, woken));
+  }
+
+  void file_mapping::Stats(const v8::FunctionCallbackInfo<v8::Value> &args)
   {
     auto isolate = args.GetIsolate();
     auto obj = ObjectWrap::Unwrap<file_mapping>(args.Holder());
 
-    if (args.Length() < 2)
-    {
-      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FileMapping.readInto")));
-      return;
-    }
+    // Still there after closeMapping, until the next create or open
+    args.GetReturnValue().Set(obj->m_stats.to_object(isolate));
+  }
 
-    if (!(args[0]->IsNumber() && args[1]->IsNumber() && node::Buffer::HasInstance(args[2])))
-    {
-      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FileMapping.readInto")));
-      return;
-    }
+  // ---------------------------------------------------------------------------
+
+  Local<Object> file_mapping::make_view(Isolate *isolate, Local<Object> self, uint64_t offset, uint64_t length)
+  {
+    // The memory belongs to the mapping, so there is nothing to free when the
+    // Buffer is collected
+    auto buffer = node::Buffer::New(
+      isolate,
+      reinterpret_cast<char *>(m_ptr) + offset,
+      static_cast<size_t>(length),
+      [](char *, void *) {},
+      nullptr).ToLocalChecked();
 
-    auto offset = args[0]->Uint32Value();
-    auto length = args[1]->Uint32Value();
-    char *bufferData = node::Buffer::Data(args[2]);
-    
-    bufferData += offset;
-    memcpy(bufferData, obj->m_ptr, length);
+    auto arrayBuffer = buffer.As<Uint8Array>()->Buffer();
+
+    // Keep the FileMapping alive for as long as the view is, so it can't be
+    // unmapped by the garbage collector underneath us
+    auto ownerKey = Private::ForApi(isolate, String::NewFromUtf8(isolate, "node_filemap::view_owner"));
+    arrayBuffer->SetPrivate(isolate->GetCurrentContext(), ownerKey, self).FromJust();
+
+    auto view = new mapping_view();
+    view->owner = this;
+    view->handle.Reset(isolate, arrayBuffer);
+    view->handle.SetWeak(view, ViewCollected, WeakCallbackType::kParameter);
+    m_views.insert(view);
+
+    return buffer;
   }
 
   // ---------------------------------------------------------------------------
@@ -301,10 +2446,42 @@ namespace node_filemap
     NODE_SET_PROTOTYPE_METHOD(tpl, "closeMapping", CloseMapping);
     NODE_SET_PROTOTYPE_METHOD(tpl, "writeBuffer", WriteBuffer);
     NODE_SET_PROTOTYPE_METHOD(tpl, "readInto", ReadInto);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "writev", WriteV);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readv", ReadV);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "view", View);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "flush", Flush);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "prefault", Prefault);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "advise", Advise);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "lock", Lock);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "unlock", Unlock);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "residency", Residency);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "grow", Grow);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "size", Size);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "sharedBuffer", SharedBuffer);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "atomicWait", AtomicWait);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "atomicNotify", AtomicNotify);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "stats", Stats);
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readInt8", [](const FunctionCallbackInfo<Value> &args) { ReadScalar<int8_t>(args, "FileMapping.readInt8"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readUint8", [](const FunctionCallbackInfo<Value> &args) { ReadScalar<uint8_t>(args, "FileMapping.readUint8"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readInt16", [](const FunctionCallbackInfo<Value> &args) { ReadScalar<int16_t>(args, "FileMapping.readInt16"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readUint16", [](const FunctionCallbackInfo<Value> &args) { ReadScalar<uint16_t>(args, "FileMapping.readUint16"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readInt32", [](const FunctionCallbackInfo<Value> &args) { ReadScalar<int32_t>(args, "FileMapping.readInt32"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readUint32", [](const FunctionCallbackInfo<Value> &args) { ReadScalar<uint32_t>(args, "FileMapping.readUint32"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readFloat32", [](const FunctionCallbackInfo<Value> &args) { ReadScalar<float>(args, "FileMapping.readFloat32"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readFloat64", [](const FunctionCallbackInfo<Value> &args) { ReadScalar<double>(args, "FileMapping.readFloat64"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "writeInt8", [](const FunctionCallbackInfo<Value> &args) { WriteScalar<int8_t>(args, "FileMapping.writeInt8"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "writeUint8", [](const FunctionCallbackInfo<Value> &args) { WriteScalar<uint8_t>(args, "FileMapping.writeUint8"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "writeInt16", [](const FunctionCallbackInfo<Value> &args) { WriteScalar<int16_t>(args, "FileMapping.writeInt16"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "writeUint16", [](const FunctionCallbackInfo<Value> &args) { WriteScalar<uint16_t>(args, "FileMapping.writeUint16"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "writeInt32", [](const FunctionCallbackInfo<Value> &args) { WriteScalar<int32_t>(args, "FileMapping.writeInt32"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "writeUint32", [](const FunctionCallbackInfo<Value> &args) { WriteScalar<uint32_t>(args, "FileMapping.writeUint32"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "writeFloat32", [](const FunctionCallbackInfo<Value> &args) { WriteScalar<float>(args, "FileMapping.writeFloat32"); });
+    NODE_SET_PROTOTYPE_METHOD(tpl, "writeFloat64", [](const FunctionCallbackInfo<Value> &args) { WriteScalar<double>(args, "FileMapping.writeFloat64"); });
 
-    constructor.Reset(isolate, tpl->GetFunction());
+    addon_data::current().set_template(CLASS_FILE_MAPPING, tpl);
     exports->Set(
-      String::NewFromUtf8(isolate, "FileMapping"), 
+      String::NewFromUtf8(isolate, "FileMapping"),
       tpl->GetFunction());
   }
 
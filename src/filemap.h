@@ -12,8 +12,15 @@
 
 #include <node.h>
 #include <node_object_wrap.h>
-#include <windows.h>
 #include <node_buffer.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+#include "platform.h"
+#include "stats.h"
 
 // -----------------------------------------------------------------------------
 
@@ -21,14 +28,74 @@ namespace node_filemap
 {
   // ---------------------------------------------------------------------------
 
+  enum huge_page_mode
+  {
+    HUGE_PAGES_NONE,        // Regular 4 KB pages
+    HUGE_PAGES_TRANSPARENT, // Ask the kernel to back the mapping with transparent huge pages (Linux only)
+    HUGE_PAGES_EXPLICIT     // Reserved huge pages (hugetlbfs on Linux, SEC_LARGE_PAGES on Windows)
+  };
+
+  enum flush_mode
+  {
+    FLUSH_NONE,  // Don't write anything back
+    FLUSH_ASYNC, // Start writing back (MS_ASYNC, FlushViewOfFile)
+    FLUSH_SYNC   // Write back and wait until it's on disk (MS_SYNC, FlushFileBuffers)
+  };
+
+  struct mapping_options
+  {
+    mapping_options();
+
+    huge_page_mode hugePages;
+    std::string hugetlbfsPath; // Where hugetlbfs is mounted, for HUGE_PAGES_EXPLICIT on Linux
+    bool populate;             // Fault the whole mapping in up front
+    bool growable;             // Keep a grow_header in the first page, so grow() works
+  };
+
+  // The first page of a growable mapping. Offsets into the mapping start
+  // after it. grow() extends the backing object before it publishes the new
+  // size here, and bumps the generation after, so a process that sees a new
+  // generation can map the new size straight away.
+  struct grow_header
+  {
+    static const uint32_t MAGIC = 0x47726f77; // 'Grow'
+    static const uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    std::atomic<uint64_t> size; // Not counting this page
+    std::atomic<uint64_t> generation;
+    char pad[40];
+  };
+
+  static_assert(sizeof(grow_header) == 64, "grow_header must take exactly one cache line");
+
+  // Named shared memory mapped once for the whole process. Every file_mapping
+  // that creates or opens the same name - from any worker_thread - shares its
+  // handle and its view, instead of mapping another copy.
+  struct mapped_section;
+
+#ifndef _WIN32
+  // Opens, or creates, a shm_open object (or a file, such as on hugetlbfs)
+  // and holds the name. Returns -1 with errno set if that fails.
+  int OpenName(const std::string &path, bool shm, bool create);
+
+  // Closes what OpenName opened, and removes the name if we were the last
+  // to hold it. Without OFD locks that can't be told, and the creator
+  // removes it instead.
+  void ReleaseName(int fd, const std::string &path, bool shm, bool created);
+#endif
+
+  // ---------------------------------------------------------------------------
+
   class file_mapping : public node::ObjectWrap
   {
   public:
     file_mapping();
     ~file_mapping();
 
-    void create_mapping(const char *filename, const char *mappingName, unsigned mappingSize, v8::Isolate *isolate);
-    void open_mapping(const char *mappingName, unsigned mappingSize, v8::Isolate *isolate);
+    void create_mapping(const char *filename, const char *mappingName, uint64_t mappingSize, const mapping_options &options, v8::Isolate *isolate);
+    void open_mapping(const char *mappingName, uint64_t mappingSize, const mapping_options &options, v8::Isolate *isolate);
     void close_mapping();
 
     static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
@@ -38,15 +105,156 @@ namespace node_filemap
     static void CloseMapping(const v8::FunctionCallbackInfo<v8::Value> &args);
     static void WriteBuffer(const v8::FunctionCallbackInfo<v8::Value> &args);
     static void ReadInto(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void WriteV(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void ReadV(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void View(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Flush(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Prefault(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Advise(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Lock(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Unlock(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Residency(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Grow(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Size(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void SharedBuffer(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void AtomicWait(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void AtomicNotify(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Stats(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    // readInt8 ... writeFloat64: one number at an offset, in the machine's
+    // byte order, with no Buffer in between
+    template <typename T> static void ReadScalar(const v8::FunctionCallbackInfo<v8::Value> &args, const char *method);
+    template <typename T> static void WriteScalar(const v8::FunctionCallbackInfo<v8::Value> &args, const char *method);
+
+    static bool HasInstance(v8::Isolate *isolate, v8::Local<v8::Value> value);
+
+    // length bytes at offset into the mapping, or null if the mapping is closed
+    // or the range doesn't fit. Picks up another process growing the mapping
+    // first.
+    char *at(uint64_t offset, uint64_t length);
 
-    static v8::Persistent<v8::Function> constructor;
+    // A Buffer over length bytes at offset, which must fit in the mapping.
+    // self is this mapping's JS object. The Buffer is detached when the
+    // mapping is closed.
+    v8::Local<v8::Object> make_view(v8::Isolate *isolate, v8::Local<v8::Object> self, uint64_t offset, uint64_t length);
+
+    // Keeps the mapped memory from being unmapped, even by closeMapping,
+    // until the pin is dropped. For work on other threads that can't stop on
+    // the spot when the mapping is closed.
+    std::shared_ptr<void> pin() const { return m_memory; }
 
     static void Init(v8::Local<v8::Object> exports);
 
   private:
+    // A Buffer handed out by view(), pointing straight into the mapping. We
+    // only hold it weakly, so we can detach it when the mapping goes away.
+    struct mapping_view
+    {
+      file_mapping *owner;
+      v8::Persistent<v8::ArrayBuffer> handle;
+    };
+
+    // A SharedArrayBuffer handed out by sharedBuffer(). It can't be detached
+    // like a view, so it pins the memory instead, until it's collected.
+    struct shared_buffer
+    {
+      std::shared_ptr<void> memory;
+      v8::Persistent<v8::SharedArrayBuffer> handle;
+    };
+
+    static void SharedBufferCollected(const v8::WeakCallbackInfo<shared_buffer> &data);
+
+    // The 32 bit word at args[0] for atomicWait/atomicNotify. Throws and
+    // returns null if the mapping is closed or the offset is bad.
+    std::atomic<uint32_t> *atomic_word(const v8::FunctionCallbackInfo<v8::Value> &args, const char *method);
+
+    // The size bytes at args[0] for the scalar accessors, which needn't be
+    // aligned. Throws and returns null if the mapping is closed or the offset
+    // is bad.
+    char *scalar_at(const v8::FunctionCallbackInfo<v8::Value> &args, uint64_t size, const char *method);
+
+    class flush_request;
+
+    // Reads an optional (offset, length) pair at args[index], defaulting to
+    // the whole mapping. Throws and returns false if the mapping is closed or
+    // the range is bad.
+    bool read_range(const v8::FunctionCallbackInfo<v8::Value> &args, int index, uint64_t &offset, uint64_t &length, const char *method);
+
+    // Maps the new size if another process grew the mapping since we last
+    // looked. Returns 0, or the error code if it couldn't be mapped, in which
+    // case we carry on with the old size.
+    int refresh();
+
+    // Takes the page faults for a range now rather than on first touch,
+    // spread over a few threads for big ranges
+    void prefault(uint64_t offset, uint64_t length);
+
+    // Starts a flush, or folds it into the one waiting to start after the
+    // flush that's running. Returns the Promise for it.
+    v8::Local<v8::Promise> queue_flush(v8::Isolate *isolate, uint64_t offset, uint64_t length, flush_mode mode);
+    void start_next_flush();
+    void disown_flushes();
+
+    // Uses the section already mapped under key if there is one and it has
+    // at least size bytes (any size if 0). created says we're creating it,
+    // which matters where POSIX has no OFD locks to count users of the name.
+    bool share_section(const std::string &key, uint64_t size, bool created, const mapping_options &options);
+
+    // Hands what we just mapped over to a new section under key, so others
+    // in the process can share it
+    void publish_section(const std::string &key);
+
+    // Stops using our section, closing it if we were the last
+    void release_section();
+
+    // One copy of a writev/readv batch, already checked against the buffer
+    struct batch_copy
+    {
+      char *buffer;
+      uint64_t mappingOffset;
+      uint64_t length;
+    };
+
+    // Reads, checks and runs a whole writev (write) or readv batch
+    void copy_batch(const v8::FunctionCallbackInfo<v8::Value> &args, bool write, const char *method);
+
+    static void ViewCollected(const v8::WeakCallbackInfo<mapping_view> &data);
+    void detach_views();
+    void orphan_views();
+
+    std::unordered_set<mapping_view *> m_views;
+
+#ifdef _WIN32
     HANDLE m_fileHandle;
     HANDLE m_mappingHandle;
+#else
+    bool map_fd(uint64_t mappingSize, const mapping_options &options, v8::Isolate *isolate);
+
+    // Grows our mapping of a growable mapping to size, in place if it can.
+    // Returns 0 or the error code.
+    int remap(uint64_t size);
+
+    int m_fd;
+    std::string m_namePath; // The shm_open name or hugetlbfs file m_fd holds open, if any
+    bool m_nameShm;         // m_namePath is a shm_open name rather than a hugetlbfs file
+    bool m_nameCreated;     // We created it, see ReleaseName
+    std::shared_ptr<size_t> m_mappedLength; // What m_memory unmaps, which mremap can change
+#endif
     void *m_ptr;
+    uint64_t m_size;
+    bool m_fileBacked; // Created over a file, so faulting pages in for writing would dirty them
+    std::shared_ptr<void> m_memory; // Unmaps m_ptr once the last pin() is dropped
+    mapped_section *m_section;      // Null unless we're sharing a section
+
+    grow_header *m_growHeader; // Null unless the mapping is growable
+    uint64_t m_headerSize;     // Before m_ptr, 0 unless the mapping is growable
+    uint64_t m_generation;     // Of the size we have mapped
+    std::vector<std::pair<std::shared_ptr<void>, size_t>> m_retired; // Mappings (and their lengths) from before a grow had to move, which old views still point into
+
+    flush_request *m_flushing;  // Running on the pool, or null
+    flush_request *m_nextFlush; // Waiting for m_flushing to finish, or null
+
+    stats_ref m_stats;
   };
 
   // ---------------------------------------------------------------------------
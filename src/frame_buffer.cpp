@@ -0,0 +1,494 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Frame buffer with dirty tile tracking stored inside a file_mapping, wrapped
+// object for node_filemap
+// -----------------------------------------------------------------------------
+
+#include "frame_buffer.h"
+#include <node_buffer.h>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NODE_FILEMAP_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// -----------------------------------------------------------------------------
+
+// MSVC lets any function use AVX2 intrinsics, GCC and clang have to be told
+// per function so the rest of the addon still runs on older CPUs
+#if defined(NODE_FILEMAP_X86) && !defined(_MSC_VER)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const uint64_t DEFAULT_TILE_SIZE = 1024;
+    const uint64_t MAX_TILE_SIZE = 1 << 20;
+
+    typedef bool (*same_fn)(const char *a, const char *b, size_t length);
+
+#ifdef NODE_FILEMAP_X86
+    // SSE2 is always there on x64, 64 bytes a round
+    bool SameSse2(const char *a, const char *b, size_t length)
+    {
+      size_t i = 0;
+      for (; i + 64 <= length; i += 64)
+      {
+        auto pa = reinterpret_cast<const __m128i *>(a + i);
+        auto pb = reinterpret_cast<const __m128i *>(b + i);
+        auto diff = _mm_or_si128(
+          _mm_or_si128(_mm_xor_si128(_mm_loadu_si128(pa), _mm_loadu_si128(pb)), _mm_xor_si128(_mm_loadu_si128(pa + 1), _mm_loadu_si128(pb + 1))),
+          _mm_or_si128(_mm_xor_si128(_mm_loadu_si128(pa + 2), _mm_loadu_si128(pb + 2)), _mm_xor_si128(_mm_loadu_si128(pa + 3), _mm_loadu_si128(pb + 3))));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF)
+          return false;
+      }
+
+      return memcmp(a + i, b + i, length - i) == 0;
+    }
+
+    TARGET_AVX2 bool SameAvx2(const char *a, const char *b, size_t length)
+    {
+      size_t i = 0;
+      for (; i + 64 <= length; i += 64)
+      {
+        auto pa = reinterpret_cast<const __m256i *>(a + i);
+        auto pb = reinterpret_cast<const __m256i *>(b + i);
+        auto diff = _mm256_or_si256(
+          _mm256_xor_si256(_mm256_loadu_si256(pa), _mm256_loadu_si256(pb)),
+          _mm256_xor_si256(_mm256_loadu_si256(pa + 1), _mm256_loadu_si256(pb + 1)));
+
+        if (!_mm256_testz_si256(diff, diff))
+          return false;
+      }
+
+      return memcmp(a + i, b + i, length - i) == 0;
+    }
+
+    bool HasAvx2()
+    {
+#ifdef _MSC_VER
+      int info[4];
+      __cpuid(info, 0);
+      if (info[0] < 7)
+        return false;
+
+      // The OS has to save the YMM registers too, or AVX faults
+      __cpuid(info, 1);
+      if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 6) != 6)
+        return false;
+
+      __cpuidex(info, 7, 0);
+      return (info[1] & (1 << 5)) != 0;
+#else
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }
+#endif
+
+    // Plain 64 bit words, for anything that isn't x86
+    bool SameScalar(const char *a, const char *b, size_t length)
+    {
+      size_t i = 0;
+      for (; i + 32 <= length; i += 32)
+      {
+        uint64_t x[4], y[4];
+        memcpy(x, a + i, 32);
+        memcpy(y, b + i, 32);
+        if (((x[0] ^ y[0]) | (x[1] ^ y[1]) | (x[2] ^ y[2]) | (x[3] ^ y[3])) != 0)
+          return false;
+      }
+
+      return memcmp(a + i, b + i, length - i) == 0;
+    }
+
+    struct tile_compare
+    {
+      same_fn same;
+      const char *name;
+    };
+
+    // The fastest the CPU has, unless NODE_FILEMAP_SIMD asks for a slower
+    // one - that's how the fallbacks get tested on machines that wouldn't
+    // otherwise use them
+    tile_compare PickCompare()
+    {
+      auto env = getenv("NODE_FILEMAP_SIMD");
+      std::string wanted = env != nullptr ? env : "";
+
+      if (wanted == "scalar")
+        return tile_compare { SameScalar, "scalar" };
+
+#ifdef NODE_FILEMAP_X86
+      if (wanted == "sse2" || !HasAvx2())
+        return tile_compare { SameSse2, "sse2" };
+
+      return tile_compare { SameAvx2, "avx2" };
+#else
+      return tile_compare { SameScalar, "scalar" };
+#endif
+    }
+
+    // Picked once, the first time anyone asks
+    const tile_compare &Compare()
+    {
+      static const tile_compare compare = PickCompare();
+      return compare;
+    }
+
+    bool ReadTileSize(Local<Value> value, uint64_t &tileSize)
+    {
+      tileSize = DEFAULT_TILE_SIZE;
+      return value->IsUndefined() || mapped_object::read_uint(value, UINT64_MAX, tileSize);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool frame_buffer::layout::make(uint64_t frameSize, uint64_t tileSize, layout &result)
+  {
+    // Tiles are whole cache lines, so the compare never splits one
+    if (frameSize == 0 || tileSize < 64 || tileSize > MAX_TILE_SIZE || tileSize % 64 != 0)
+      return false;
+
+    auto tileCount = (frameSize + tileSize - 1) / tileSize;
+    if (tileCount > UINT32_MAX)
+      return false;
+
+    auto bitmapBytes = (tileCount + 63) / 64 * sizeof(uint64_t);
+
+    result.frameSize = frameSize;
+    result.tileSize = static_cast<uint32_t>(tileSize);
+    result.tileCount = static_cast<uint32_t>(tileCount);
+    result.frameOffset = (sizeof(frame_header) + bitmapBytes + 63) & ~static_cast<uint64_t>(63);
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  frame_buffer::frame_buffer()
+  {
+    memset(&m_layout, 0, sizeof(m_layout));
+  }
+
+  frame_header *frame_buffer::header(Isolate *isolate, const char *method) const
+  {
+    return reinterpret_cast<frame_header *>(memory(isolate, method));
+  }
+
+  std::atomic<uint64_t> *frame_buffer::bitmap(frame_header *frame) const
+  {
+    return reinterpret_cast<std::atomic<uint64_t> *>(frame + 1);
+  }
+
+  char *frame_buffer::frame_arg(const v8::FunctionCallbackInfo<v8::Value> &args, const char *method) const
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, (std::string("Not enough arguments to ") + method).c_str())));
+      return nullptr;
+    }
+
+    if (!node::Buffer::HasInstance(args[0]))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, (std::string("Wrong type arguments to ") + method).c_str())));
+      return nullptr;
+    }
+
+    if (attached() && node::Buffer::Length(args[0]) != m_layout.frameSize)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, (std::string("Buffer must be exactly one frame long in ") + method).c_str())));
+      return nullptr;
+    }
+
+    return node::Buffer::Data(args[0]);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void frame_buffer::Size(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to FrameBuffer.size")));
+      return;
+    }
+
+    uint64_t frameSize, tileSize;
+    if (!read_uint(args[0], UINT64_MAX, frameSize) || !ReadTileSize(args[1], tileSize))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FrameBuffer.size")));
+      return;
+    }
+
+    layout shape;
+    if (!layout::make(frameSize, tileSize, shape))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Frame or tile size out of range in FrameBuffer.size")));
+      return;
+    }
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(shape.total_size())));
+  }
+
+  void frame_buffer::Create(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<frame_buffer>(args.Holder());
+
+    if (!read_mapping_args(args, 3, "FrameBuffer.create"))
+      return;
+
+    uint64_t frameSize, tileSize;
+    if (!read_uint(args[2], UINT64_MAX, frameSize) || !ReadTileSize(args[3], tileSize))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to FrameBuffer.create")));
+      return;
+    }
+
+    layout shape;
+    if (!layout::make(frameSize, tileSize, shape))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Frame or tile size out of range in FrameBuffer.create")));
+      return;
+    }
+
+    if (!obj->attach(isolate, args[0], args[1], shape.total_size(), 64, "FrameBuffer.create"))
+      return;
+
+    obj->m_layout = shape;
+
+    // The frame starts out all zeroes, the same as a new Buffer.alloc on the
+    // consumer's side, so nothing is dirty yet
+    auto frame = obj->header(isolate, "FrameBuffer.create");
+    memset(static_cast<void *>(frame), 0, static_cast<size_t>(shape.total_size()));
+
+    frame->frameSize = shape.frameSize;
+    frame->tileSize = shape.tileSize;
+    frame->tileCount = shape.tileCount;
+    frame->version = frame_header::VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    frame->magic = frame_header::MAGIC;
+  }
+
+  void frame_buffer::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<frame_buffer>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "FrameBuffer.open"))
+      return;
+
+    auto describe = [](const frame_header &frame, layout &result) -> uint64_t
+    {
+      bool valid = frame.magic == frame_header::MAGIC && frame.version == frame_header::VERSION &&
+        layout::make(frame.frameSize, frame.tileSize, result) && result.tileCount == frame.tileCount;
+
+      return valid ? result.total_size() : 0;
+    };
+
+    layout shape;
+    if (!obj->attach_existing<frame_header>(isolate, args[0], args[1], shape, describe, "FrameBuffer.open"))
+      return;
+
+    obj->m_layout = shape;
+  }
+
+  void frame_buffer::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<frame_buffer>(args.Holder());
+
+    obj->detach();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void frame_buffer::PublishDelta(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<frame_buffer>(args.Holder());
+
+    auto source = obj->frame_arg(args, "FrameBuffer.publishDelta");
+    if (source == nullptr)
+      return;
+
+    auto frame = obj->header(isolate, "FrameBuffer.publishDelta");
+    if (frame == nullptr)
+      return;
+
+    auto &shape = obj->m_layout;
+    auto same = Compare().same;
+    auto bits = obj->bitmap(frame);
+    auto mapped = reinterpret_cast<char *>(frame) + shape.frameOffset;
+    auto wordCount = (static_cast<uint64_t>(shape.tileCount) + 63) / 64;
+    uint32_t dirty = 0;
+
+    // Bits are gathered a word at a time and set once the word's tiles are
+    // all written, so the consumer never sees a bit before its tile
+    for (uint64_t word = 0; word < wordCount; ++word)
+    {
+      uint64_t changed = 0;
+
+      for (uint32_t bit = 0; bit < 64 && word * 64 + bit < shape.tileCount; ++bit)
+      {
+        auto start = (word * 64 + bit) * shape.tileSize;
+        auto length = static_cast<size_t>(shape.frameSize - start < shape.tileSize ? shape.frameSize - start : shape.tileSize);
+
+        if (same(source + start, mapped + start, length))
+          continue;
+
+        memcpy(mapped + start, source + start, length);
+        changed |= 1ull << bit;
+        ++dirty;
+      }
+
+      if (changed != 0)
+        bits[word].fetch_or(changed, std::memory_order_release);
+    }
+
+    if (dirty != 0)
+      frame->generation.fetch_add(1, std::memory_order_release);
+
+    args.GetReturnValue().Set(Integer::NewFromUnsigned(isolate, dirty));
+  }
+
+  void frame_buffer::ReadDirty(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<frame_buffer>(args.Holder());
+
+    auto dest = obj->frame_arg(args, "FrameBuffer.readDirty");
+    if (dest == nullptr)
+      return;
+
+    auto frame = obj->header(isolate, "FrameBuffer.readDirty");
+    if (frame == nullptr)
+      return;
+
+    auto &shape = obj->m_layout;
+    auto bits = obj->bitmap(frame);
+    auto mapped = reinterpret_cast<char *>(frame) + shape.frameOffset;
+    auto wordCount = (static_cast<uint64_t>(shape.tileCount) + 63) / 64;
+    uint32_t copied = 0;
+
+    for (uint64_t word = 0; word < wordCount; ++word)
+    {
+      // Only write the bitmap when there's something to take, so a static
+      // frame doesn't bounce its cache lines between processes
+      if (bits[word].load(std::memory_order_relaxed) == 0)
+        continue;
+
+      auto taken = bits[word].exchange(0, std::memory_order_acquire);
+
+      for (uint32_t bit = 0; taken != 0; ++bit, taken >>= 1)
+      {
+        if ((taken & 1) == 0)
+          continue;
+
+        auto tile = static_cast<uint32_t>(word * 64 + bit);
+        if (tile >= shape.tileCount)
+          break;
+
+        auto start = static_cast<uint64_t>(tile) * shape.tileSize;
+        auto length = static_cast<size_t>(shape.frameSize - start < shape.tileSize ? shape.frameSize - start : shape.tileSize);
+
+        memcpy(dest + start, mapped + start, length);
+        ++copied;
+      }
+    }
+
+    args.GetReturnValue().Set(Integer::NewFromUnsigned(isolate, copied));
+  }
+
+  void frame_buffer::ReadAll(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<frame_buffer>(args.Holder());
+
+    auto dest = obj->frame_arg(args, "FrameBuffer.readAll");
+    if (dest == nullptr)
+      return;
+
+    auto frame = obj->header(isolate, "FrameBuffer.readAll");
+    if (frame == nullptr)
+      return;
+
+    auto &shape = obj->m_layout;
+    auto bits = obj->bitmap(frame);
+    auto wordCount = (static_cast<uint64_t>(shape.tileCount) + 63) / 64;
+
+    // Take the marks before copying, not after, so a tile published while
+    // we copy is marked again for the next readDirty
+    for (uint64_t word = 0; word < wordCount; ++word)
+    {
+      if (bits[word].load(std::memory_order_relaxed) != 0)
+        bits[word].exchange(0, std::memory_order_acquire);
+    }
+
+    memcpy(dest, reinterpret_cast<char *>(frame) + shape.frameOffset, static_cast<size_t>(shape.frameSize));
+
+    args.GetReturnValue().Set(Integer::NewFromUnsigned(isolate, shape.tileCount));
+  }
+
+  void frame_buffer::Generation(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<frame_buffer>(args.Holder());
+
+    auto frame = obj->header(isolate, "FrameBuffer.generation");
+    if (frame == nullptr)
+      return;
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(frame->generation.load(std::memory_order_acquire))));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void frame_buffer::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<frame_buffer>, String::NewFromUtf8(isolate, "FrameBuffer"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "FrameBuffer"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "size"), FunctionTemplate::New(isolate, Size));
+    tpl->Set(String::NewFromUtf8(isolate, "SIMD"), String::NewFromUtf8(isolate, Compare().name));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "publishDelta", PublishDelta);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readDirty", ReadDirty);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readAll", ReadAll);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "generation", Generation);
+
+    exports->Set(
+      String::NewFromUtf8(isolate, "FrameBuffer"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,96 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Frame buffer with dirty tile tracking stored inside a file_mapping, wrapped
+// object for node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_FRAME_BUFFER_H
+#define NODEJS_FRAME_BUFFER_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <atomic>
+#include <cstdint>
+#include "mapped_object.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // One producer publishes whole frames, one consumer keeps its own copy up
+  // to date. The frame is cut into equal tiles. Publishing compares each tile
+  // of the new frame against the copy in the mapping and only writes the ones
+  // that changed, setting their bits in a dirty bitmap once they're written.
+  // The consumer swaps each bitmap word for zero and copies just those tiles.
+  //
+  // A tile the producer is rewriting while the consumer copies it can come
+  // out torn, but its bit is set again when the write is done, so the next
+  // readDirty puts it right. readAll copies the lot, for a consumer that's
+  // new or has lost track.
+  struct frame_header
+  {
+    static const uint32_t MAGIC = 0x46726d65; // 'Frme'
+    static const uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t frameSize;
+    uint32_t tileSize;
+    uint32_t tileCount;
+    std::atomic<uint64_t> generation; // Publishes that changed at least one tile
+    char pad[32];
+  };
+
+  static_assert(sizeof(frame_header) == 64, "frame_header must take exactly one cache line");
+
+  // ---------------------------------------------------------------------------
+
+  class frame_buffer : public mapped_object
+  {
+  public:
+    frame_buffer();
+
+    static void Create(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void PublishDelta(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void ReadDirty(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void ReadAll(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Generation(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Size(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+  private:
+    struct layout
+    {
+      uint64_t frameSize;
+      uint32_t tileSize;
+      uint32_t tileCount;
+      uint64_t frameOffset; // Where the frame starts, from the header
+
+      static bool make(uint64_t frameSize, uint64_t tileSize, layout &result);
+      uint64_t total_size() const { return frameOffset + frameSize; }
+    };
+
+    frame_header *header(v8::Isolate *isolate, const char *method) const;
+    std::atomic<uint64_t> *bitmap(frame_header *frame) const;
+
+    // The frame argument of publishDelta, readDirty or readAll, which has to
+    // be exactly one frame long. Null (after throwing) if it isn't.
+    char *frame_arg(const v8::FunctionCallbackInfo<v8::Value> &args, const char *method) const;
+
+    layout m_layout;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
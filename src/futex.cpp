@@ -0,0 +1,581 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Futex helpers and the robust futex lock used by node_filemap's locks that
+// live inside a file mapping (Linux only)
+// -----------------------------------------------------------------------------
+
+#include "futex.h"
+
+#include <linux/futex.h>
+#include <alloca.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+// Older headers don't know about futex_waitv, which has the same number on
+// every architecture
+#ifndef SYS_futex_waitv
+#define SYS_futex_waitv 449
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const int MAX_SPINS = 100;
+
+    // Without futex_waitv, how often futex_wait_multiple looks at the other
+    // words while it sleeps on the first
+    const DWORD POLL_MS = 1;
+
+    // struct futex_waitv, and the most entries the kernel takes at once
+    struct waitv_entry
+    {
+      uint64_t val;
+      uint64_t uaddr;
+      uint32_t flags;
+      uint32_t reserved;
+    };
+
+    const size_t WAITV_MAX = 128;
+    const uint32_t WAITV_SIZE_U32 = 2; // FUTEX2_SIZE_U32, and without FUTEX2_PRIVATE it's process shared
+
+    std::atomic<bool> g_noWaitv(false); // The kernel said ENOSYS
+
+    // Where we put the list entry when we have to register our own robust
+    // list. Matches glibc on 64 bit, which puts it 32 bytes past the word.
+    const long OWN_ENTRY_OFFSET = 32;
+
+    // Entries are glibc's __pthread_list_t: prev then next, with the list
+    // pointing at next
+    struct robust_entry
+    {
+      void *prev;
+      robust_entry *next;
+    };
+
+    robust_entry *unmark(void *entry)
+    {
+      return reinterpret_cast<robust_entry *>(reinterpret_cast<uintptr_t>(entry) & ~uintptr_t(1));
+    }
+
+    // Per thread state: the kernel tid and the robust list the kernel walks
+    // when the thread dies
+    class robust_thread
+    {
+    public:
+      static robust_thread &current();
+
+      uint32_t tid() const { return m_tid; }
+
+      void begin(robust_lock *lock);
+      void enqueue(robust_lock *lock);
+      void dequeue(robust_lock *lock);
+      void end();
+
+      // The locks on our list between start and start + length
+      std::vector<robust_lock *> held_in(const char *start, size_t length) const;
+
+    private:
+      robust_thread();
+
+      void **next_of(robust_lock *lock) const;
+
+      uint32_t m_tid;
+      robust_list_head *m_head; // Null when we can't do robust handling
+      long m_entryOffset;       // Bytes from the futex word to the list entry's next pointer
+
+      // Used when no one registered a robust list for this thread yet. The
+      // slot in front of the head stands in for glibc's robust_prev.
+      struct
+      {
+        void *prev;
+        robust_list_head head;
+      } m_own;
+
+      static void after_fork();
+      static thread_local robust_thread *t_current;
+    };
+
+    thread_local robust_thread *robust_thread::t_current = nullptr;
+
+    robust_thread &robust_thread::current()
+    {
+      if (t_current == nullptr)
+      {
+        static pthread_once_t once = PTHREAD_ONCE_INIT;
+        pthread_once(&once, []() { pthread_atfork(nullptr, nullptr, after_fork); });
+
+        t_current = new robust_thread();
+      }
+
+      return *t_current;
+    }
+
+    // The forking thread is the only one left in the child, with a new tid
+    void robust_thread::after_fork()
+    {
+      if (t_current != nullptr)
+        t_current->m_tid = static_cast<uint32_t>(syscall(SYS_gettid));
+    }
+
+    robust_thread::robust_thread() :
+      m_tid(static_cast<uint32_t>(syscall(SYS_gettid))),
+      m_head(nullptr),
+      m_entryOffset(0)
+    {
+      robust_list_head *head = nullptr;
+      size_t length = 0;
+
+      if (syscall(SYS_get_robust_list, 0, &head, &length) != 0)
+        return;
+
+      if (head == nullptr)
+      {
+        memset(&m_own, 0, sizeof(m_own));
+        m_own.head.list.next = &m_own.head.list;
+        m_own.head.futex_offset = -OWN_ENTRY_OFFSET;
+
+        if (syscall(SYS_set_robust_list, &m_own.head, sizeof(m_own.head)) != 0)
+          return;
+
+        head = &m_own.head;
+      }
+#ifndef __GLIBC__
+      else
+      {
+        // Someone else's list, and we only know glibc's entry format
+        return;
+      }
+#endif
+
+      // The entry's prev and next both have to fit in the lock, after the
+      // fields we use ourselves
+      long entryOffset = -head->futex_offset;
+      if (entryOffset < 16 + static_cast<long>(sizeof(void *)) ||
+          entryOffset + static_cast<long>(sizeof(void *)) > static_cast<long>(robust_lock::SIZE) ||
+          entryOffset % sizeof(void *) != 0)
+        return;
+
+      m_head = head;
+      m_entryOffset = entryOffset;
+    }
+
+    void **robust_thread::next_of(robust_lock *lock) const
+    {
+      return reinterpret_cast<void **>(reinterpret_cast<char *>(lock) + m_entryOffset);
+    }
+
+    // list_op_pending covers us dying half way through taking or dropping the
+    // lock, before the list says we own it
+    void robust_thread::begin(robust_lock *lock)
+    {
+      if (m_head == nullptr)
+        return;
+
+      m_head->list_op_pending = reinterpret_cast<robust_list *>(next_of(lock));
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+
+    void robust_thread::end()
+    {
+      if (m_head == nullptr)
+        return;
+
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+      m_head->list_op_pending = nullptr;
+    }
+
+    // Same doubly linked scheme as glibc, so its robust pthread mutexes can
+    // share the list with us
+    void robust_thread::enqueue(robust_lock *lock)
+    {
+      if (m_head == nullptr)
+        return;
+
+      auto entry = unmark(reinterpret_cast<char *>(next_of(lock)) - sizeof(void *));
+      auto first = unmark(reinterpret_cast<char *>(m_head->list.next) - sizeof(void *));
+
+      first->prev = &entry->next;
+      entry->next = reinterpret_cast<robust_entry *>(m_head->list.next);
+      entry->prev = m_head;
+
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+      m_head->list.next = reinterpret_cast<robust_list *>(&entry->next);
+    }
+
+    void robust_thread::dequeue(robust_lock *lock)
+    {
+      if (m_head == nullptr)
+        return;
+
+      auto entry = unmark(reinterpret_cast<char *>(next_of(lock)) - sizeof(void *));
+      auto next = unmark(reinterpret_cast<char *>(entry->next) - sizeof(void *));
+
+      next->prev = entry->prev;
+      *reinterpret_cast<void **>(unmark(entry->prev)) = entry->next;
+      std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+
+    std::vector<robust_lock *> robust_thread::held_in(const char *start, size_t length) const
+    {
+      std::vector<robust_lock *> locks;
+      if (m_head == nullptr)
+        return locks;
+
+      // The list links next pointers, each m_entryOffset into its lock. It
+      // may hold glibc's robust mutexes as well, which the range leaves out.
+      auto end = reinterpret_cast<const char *>(&m_head->list);
+      for (auto next = reinterpret_cast<char *>(unmark(m_head->list.next)); next != end; next = reinterpret_cast<char *>(unmark(*reinterpret_cast<void **>(next))))
+      {
+        auto lock = next - m_entryOffset;
+        if (lock >= start && lock < start + length)
+          locks.push_back(reinterpret_cast<robust_lock *>(lock));
+      }
+
+      return locks;
+    }
+
+    long futex(std::atomic<uint32_t> *word, int op, uint32_t value, const timespec *timeout, uint32_t value3)
+    {
+      return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), op, value, timeout, nullptr, value3);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  int futex_wait(std::atomic<uint32_t> *word, uint32_t expected, const wait_deadline &deadline)
+  {
+    // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC time, so spurious
+    // wakeups don't stretch the timeout
+    auto at = deadline.monotonic();
+    long result = futex(word, FUTEX_WAIT_BITSET, expected, deadline.infinite ? nullptr : &at, FUTEX_BITSET_MATCH_ANY);
+    return result == 0 ? 0 : errno;
+  }
+
+  int futex_wake(std::atomic<uint32_t> *word, int count)
+  {
+    long result = futex(word, FUTEX_WAKE, static_cast<uint32_t>(count), nullptr, 0);
+    return result < 0 ? 0 : static_cast<int>(result);
+  }
+
+  int futex_wait_multiple(const futex_wait_entry *entries, size_t count, const wait_deadline &deadline)
+  {
+    if (count <= WAITV_MAX && !g_noWaitv.load(std::memory_order_relaxed))
+    {
+      waitv_entry waiters[WAITV_MAX];
+      for (size_t i = 0; i < count; ++i)
+        waiters[i] = { entries[i].expected, reinterpret_cast<uintptr_t>(entries[i].word), WAITV_SIZE_U32, 0 };
+
+      // Also an absolute CLOCK_MONOTONIC time
+      auto at = deadline.monotonic();
+      long result = syscall(SYS_futex_waitv, waiters, static_cast<unsigned>(count), 0, deadline.infinite ? nullptr : &at, CLOCK_MONOTONIC);
+      if (result >= 0)
+        return static_cast<int>(result);
+
+      if (errno != ENOSYS)
+        return -1;
+
+      g_noWaitv.store(true, std::memory_order_relaxed);
+    }
+
+    for (size_t i = 1; i < count; ++i)
+    {
+      if (entries[i].word->load() != entries[i].expected)
+      {
+        errno = EAGAIN;
+        return -1;
+      }
+    }
+
+    int result = futex_wait(entries[0].word, entries[0].expected, wait_deadline::earliest(deadline, wait_deadline::after(POLL_MS)));
+    if (result == 0)
+      return 0;
+
+    errno = result == ETIMEDOUT && !deadline.expired() ? EINTR : result;
+    return -1;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void robust_lock::init()
+  {
+    memset(static_cast<void *>(this), 0, SIZE);
+  }
+
+  bool robust_lock::owned_by_caller() const
+  {
+    return (m_word.load(std::memory_order_relaxed) & FUTEX_TID_MASK) == robust_thread::current().tid();
+  }
+
+  void robust_lock::locked()
+  {
+    auto &self = robust_thread::current();
+
+    m_recursion = 1;
+    self.enqueue(this);
+    self.end();
+  }
+
+  DWORD robust_lock::acquire(DWORD ms)
+  {
+    auto &self = robust_thread::current();
+    uint32_t tid = self.tid();
+
+    uint32_t current = m_word.load(std::memory_order_relaxed);
+
+    // Recursive acquire, like a Win32 mutex
+    if ((current & FUTEX_TID_MASK) == tid)
+    {
+      ++m_recursion;
+      return WAIT_OBJECT_0;
+    }
+
+    self.begin(this);
+
+    // Uncontended: one CAS and we're done
+    current = 0;
+    if (m_word.compare_exchange_strong(current, tid, std::memory_order_acquire, std::memory_order_relaxed))
+    {
+      locked();
+      return WAIT_OBJECT_0;
+    }
+
+    // Spin briefly before sleeping. How long adapts to how long it took to
+    // get the lock recently, like glibc's adaptive mutexes.
+    if (ms != 0)
+    {
+      int maxSpins = std::min(MAX_SPINS, m_spins.load(std::memory_order_relaxed) * 2 + 10);
+      int spins = 0;
+
+      for (; spins < maxSpins; ++spins)
+      {
+        current = m_word.load(std::memory_order_relaxed);
+
+        if ((current & FUTEX_TID_MASK) == 0 &&
+            m_word.compare_exchange_weak(current, tid | (current & FUTEX_WAITERS), std::memory_order_acquire, std::memory_order_relaxed))
+        {
+          int average = m_spins.load(std::memory_order_relaxed);
+          m_spins.store(average + (spins - average) / 8, std::memory_order_relaxed);
+
+          locked();
+          return (current & FUTEX_OWNER_DIED) ? WAIT_ABANDONED : WAIT_OBJECT_0;
+        }
+
+        cpu_relax();
+      }
+
+      int average = m_spins.load(std::memory_order_relaxed);
+      m_spins.store(average + (spins - average) / 8, std::memory_order_relaxed);
+    }
+
+    // Sleep in the kernel. Once we've had to wait, we can't tell whether
+    // anyone else is still waiting, so we take the lock with FUTEX_WAITERS
+    // set and the next release wakes someone.
+    auto deadline = wait_deadline::after(ms);
+
+    for (;;)
+    {
+      current = m_word.load(std::memory_order_relaxed);
+
+      if ((current & FUTEX_TID_MASK) == 0)
+      {
+        if (m_word.compare_exchange_weak(current, tid | FUTEX_WAITERS, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+          locked();
+          return (current & FUTEX_OWNER_DIED) ? WAIT_ABANDONED : WAIT_OBJECT_0;
+        }
+
+        continue;
+      }
+
+      if (ms == 0 || deadline.expired())
+        break;
+
+      if (!(current & FUTEX_WAITERS))
+      {
+        if (!m_word.compare_exchange_weak(current, current | FUTEX_WAITERS, std::memory_order_relaxed))
+          continue;
+
+        current |= FUTEX_WAITERS;
+      }
+
+      if (futex_wait(&m_word, current, deadline) == ETIMEDOUT)
+        break;
+    }
+
+    self.end();
+    return WAIT_TIMEOUT;
+  }
+
+  bool robust_lock::release()
+  {
+    auto &self = robust_thread::current();
+
+    if ((m_word.load(std::memory_order_relaxed) & FUTEX_TID_MASK) != self.tid())
+      return false;
+
+    if (--m_recursion > 0)
+      return true;
+
+    self.begin(this);
+    self.dequeue(this);
+
+    uint32_t previous = m_word.exchange(0, std::memory_order_release);
+    if (previous & FUTEX_WAITERS)
+      futex_wake(&m_word, 1);
+
+    self.end();
+    return true;
+  }
+
+  void robust_lock::abandon()
+  {
+    auto &self = robust_thread::current();
+
+    if ((m_word.load(std::memory_order_relaxed) & FUTEX_TID_MASK) != self.tid())
+      return;
+
+    m_recursion = 0;
+
+    self.begin(this);
+    self.dequeue(this);
+
+    uint32_t previous = m_word.exchange(FUTEX_OWNER_DIED, std::memory_order_release);
+    if (previous & FUTEX_WAITERS)
+      futex_wake(&m_word, 1);
+
+    self.end();
+  }
+
+  void robust_lock::abandon_range(const void *start, size_t length)
+  {
+    for (auto lock : robust_thread::current().held_in(reinterpret_cast<const char *>(start), length))
+      lock->abandon();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool robust_lock::is_free() const
+  {
+    return (m_word.load(std::memory_order_relaxed) & FUTEX_TID_MASK) == 0;
+  }
+
+  bool robust_lock::prepare_wait(uint32_t &word)
+  {
+    uint32_t current = m_word.load(std::memory_order_relaxed);
+
+    if ((current & FUTEX_TID_MASK) == 0)
+      return false;
+
+    if (!(current & FUTEX_WAITERS))
+    {
+      if (!m_word.compare_exchange_strong(current, current | FUTEX_WAITERS, std::memory_order_relaxed))
+        return false;
+
+      current |= FUTEX_WAITERS;
+    }
+
+    word = current;
+    return true;
+  }
+
+  void robust_lock::wait_while_held(const wait_deadline &deadline)
+  {
+    uint32_t current;
+    if (prepare_wait(current))
+      futex_wait(&m_word, current, deadline);
+  }
+
+  void robust_lock::wait_while_all_held(robust_lock *const *locks, size_t count, const wait_deadline &deadline)
+  {
+    auto entries = reinterpret_cast<futex_wait_entry *>(alloca(count * sizeof(futex_wait_entry)));
+
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (!locks[i]->wait_entry(entries[i]))
+        return;
+    }
+
+    futex_wait_multiple(entries, count, deadline);
+  }
+
+  bool robust_lock::wait_entry(futex_wait_entry &entry)
+  {
+    entry.word = &m_word;
+    return prepare_wait(entry.expected);
+  }
+
+  DWORD robust_lock::acquire_multiple(robust_lock *const *locks, size_t count, bool waitAll, DWORD ms)
+  {
+    // An empty wait-all would succeed at once, and an empty wait-any never
+    assert(count > 0);
+
+    auto deadline = wait_deadline::after(ms);
+    size_t abandoned = count;
+
+    for (;;)
+    {
+      robust_lock *blocked;
+
+      if (waitAll)
+      {
+        size_t held = 0;
+
+        for (; held < count; ++held)
+        {
+          DWORD result = locks[held]->acquire(0);
+          if (result == WAIT_TIMEOUT)
+            break;
+
+          // Releasing it again below clears the owner died flag, so remember
+          if (result == WAIT_ABANDONED && abandoned == count)
+            abandoned = held;
+        }
+
+        if (held == count)
+          return abandoned == count ? WAIT_OBJECT_0 : WAIT_ABANDONED_0 + static_cast<DWORD>(abandoned);
+
+        blocked = locks[held];
+
+        while (held > 0)
+          locks[--held]->release();
+      }
+      else
+      {
+        for (size_t i = 0; i < count; ++i)
+        {
+          DWORD result = locks[i]->acquire(0);
+          if (result != WAIT_TIMEOUT)
+            return result + static_cast<DWORD>(i);
+        }
+
+        blocked = locks[0];
+      }
+
+      if (ms == 0 || deadline.expired())
+        return WAIT_TIMEOUT;
+
+      // Waiting for all, we can sleep until the one we couldn't get is free.
+      // Waiting for any, sleep on all of them at once.
+      if (waitAll || count == 1)
+        blocked->wait_while_held(deadline);
+      else
+        wait_while_all_held(locks, count, deadline);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
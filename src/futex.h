@@ -0,0 +1,130 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Futex helpers and the robust futex lock used by node_filemap's locks that
+// live inside a file mapping (Linux only)
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_FUTEX_H
+#define NODEJS_FUTEX_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "deadline.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // Sleeps while *word == expected. The futex is process shared, so it can be
+  // woken from any process mapping the same memory. Returns 0 when woken (or
+  // spuriously), otherwise the errno - ETIMEDOUT, EAGAIN or EINTR.
+  int futex_wait(std::atomic<uint32_t> *word, uint32_t expected, const wait_deadline &deadline);
+
+  // Wakes up to count processes sleeping on word. Returns how many woke.
+  int futex_wake(std::atomic<uint32_t> *word, int count);
+
+  struct futex_wait_entry
+  {
+    std::atomic<uint32_t> *word;
+    uint32_t expected;
+  };
+
+  // Sleeps while every word is its expected value, in one futex_waitv call,
+  // so a wake on any of them ends the sleep. Returns the index of the word
+  // that was woken, or -1 with the reason in errno - ETIMEDOUT, EAGAIN (a
+  // word had already changed) or EINTR. Kernels before 5.16 don't have
+  // futex_waitv, and then (or for more words than it takes) we sleep on the
+  // first word for at most a millisecond at a time and return -1 with EINTR
+  // when that runs out, so callers look at all of them again.
+  int futex_wait_multiple(const futex_wait_entry *entries, size_t count, const wait_deadline &deadline);
+
+  // ---------------------------------------------------------------------------
+
+  // An exclusive, recursive lock for shared memory, with the same semantics as
+  // a Win32 mutex. The word holds the owner's thread id, so the kernel's robust
+  // futex support can flag it with FUTEX_OWNER_DIED if the owner dies holding
+  // it, which we report as WAIT_ABANDONED.
+  //
+  // The layout is fixed and takes one cache line. Zeroed memory is a valid,
+  // unlocked lock.
+  class robust_lock
+  {
+  public:
+    static const size_t SIZE = 64;
+
+    void init();
+
+    // WAIT_OBJECT_0, WAIT_ABANDONED or WAIT_TIMEOUT
+    DWORD acquire(DWORD ms);
+
+    // false if the calling thread doesn't own the lock
+    bool release();
+
+    // For when the calling thread is about to unmap a lock it may still hold.
+    // Lets go of it the way the kernel would if the thread died - flagged
+    // FUTEX_OWNER_DIED, so the next owner sees WAIT_ABANDONED - and takes it
+    // off the thread's robust list, which would otherwise point into memory
+    // that's gone.
+    void abandon();
+
+    // abandon() for every lock the calling thread holds between start and
+    // start + length, for when it's about to unmap that range
+    static void abandon_range(const void *start, size_t length);
+
+    bool owned_by_caller() const;
+
+    // No one owns the lock right now (it may have been abandoned)
+    bool is_free() const;
+
+    // Sleeps until the lock may have been released, without taking it
+    void wait_while_held(const wait_deadline &deadline);
+
+    // Sleeps until any of the locks may have been released, in one futex
+    // wait on all of them
+    static void wait_while_all_held(robust_lock *const *locks, size_t count, const wait_deadline &deadline);
+
+    // For sleeping on the lock alongside other futexes. Fills in entry with
+    // what to sleep on until the lock may have been released, or returns
+    // false if it may be free already.
+    bool wait_entry(futex_wait_entry &entry);
+
+    // Like WaitForMultipleObjects: WAIT_OBJECT_0 + i or WAIT_ABANDONED_0 + i
+    // for the lock taken when waiting for any, WAIT_OBJECT_0 (or
+    // WAIT_ABANDONED_0 + i if lock i was abandoned) once all of them are held
+    // when waiting for all, or WAIT_TIMEOUT. Never sleeps holding some of the
+    // locks, so waiting for all can't deadlock against another waiter.
+    static DWORD acquire_multiple(robust_lock *const *locks, size_t count, bool waitAll, DWORD ms);
+
+  private:
+    void locked();
+
+    // Makes sure the owner will wake us when it releases. false if the lock
+    // is free (or just changed), so there's nothing to sleep on. Otherwise
+    // word is what to sleep on.
+    bool prepare_wait(uint32_t &word);
+
+    std::atomic<uint32_t> m_word;
+    uint32_t m_recursion;    // Only touched by the owner
+    std::atomic<int32_t> m_spins; // Running average of how long spinning took to get the lock
+    uint32_t m_reserved;
+
+    // The robust list entry (a glibc style prev/next pair) goes in here, at
+    // whatever offset from m_word the thread's robust list head asks for
+    char m_robustArea[SIZE - 16];
+  };
+
+  static_assert(sizeof(robust_lock) == robust_lock::SIZE, "robust_lock must fill exactly one cache line");
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,826 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Key/value hash table stored inside a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#include "hash_table.h"
+#include <node_buffer.h>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const uint32_t NONE = 0xFFFFFFFF;
+
+    // Slot words. Neither can be a real entry, which always has a granule
+    // past the arena's own header.
+    const uint64_t SLOT_EMPTY = 0;
+    const uint64_t SLOT_DELETED = 1;
+
+    const uint64_t ENTRY_HEADER = 8; // Key and value lengths
+    const uint32_t MAX_CAPACITY = 1u << 30;
+    const uint32_t MAX_STRIPES = 1024;
+
+    const int SPINS_BEFORE_YIELD = 1000;
+    const int SPINS_BEFORE_OWNER_CHECK = 10000;
+
+    uint32_t SlotGranule(uint64_t word) { return static_cast<uint32_t>(word); }
+    uint32_t SlotTag(uint64_t word) { return static_cast<uint32_t>(word >> 32); }
+
+    // 64 bit FNV-1a a word at a time, finished with MurmurHash3's mixer so
+    // every bit of the key reaches the low bits we index with
+    uint64_t HashKey(const char *data, size_t length)
+    {
+      const uint64_t PRIME = 0x100000001b3ull;
+      uint64_t hash = 0xcbf29ce484222325ull ^ length;
+
+      size_t i = 0;
+      for (; i + 8 <= length; i += 8)
+      {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * PRIME;
+        hash ^= hash >> 29;
+      }
+
+      uint64_t tail = 0;
+      memcpy(&tail, data + i, length - i);
+      hash = (hash ^ tail) * PRIME;
+
+      hash ^= hash >> 33;
+      hash *= 0xff51afd7ed558ccdull;
+      hash ^= hash >> 33;
+      hash *= 0xc4ceb9fe1a85ec53ull;
+      hash ^= hash >> 33;
+      return hash;
+    }
+
+    // Keys and values can be Buffers or strings, which are stored as UTF-8
+    bool ReadBytes(Local<Value> value, std::string &storage, const char *&data, size_t &length)
+    {
+      if (node::Buffer::HasInstance(value))
+      {
+        data = node::Buffer::Data(value);
+        length = node::Buffer::Length(value);
+        return true;
+      }
+
+      if (value->IsString())
+      {
+        String::Utf8Value text(value);
+        storage.assign(*text ? *text : "", *text ? text.length() : 0);
+        data = storage.data();
+        length = storage.size();
+        return true;
+      }
+
+      return false;
+    }
+
+    void ThrowCorrupt(Isolate *isolate)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "HashTable contains a corrupt entry")));
+    }
+
+    void Backoff(int &spins)
+    {
+      if (++spins % SPINS_BEFORE_YIELD != 0)
+        cpu_relax();
+      else
+        std::this_thread::yield();
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool hash_table::layout::make(uint32_t capacity, uint64_t dataSize, layout &result)
+  {
+    if (capacity < 8 || capacity > MAX_CAPACITY || (capacity & (capacity - 1)) != 0)
+      return false;
+
+    if (!arena_heap::layout::make(dataSize, result.heap))
+      return false;
+
+    // About one stripe per 16 slots, so a stripe's keys are a small share
+    result.capacity = capacity;
+    result.stripeCount = capacity / 16 < 1 ? 1 : capacity / 16;
+    if (result.stripeCount > MAX_STRIPES)
+      result.stripeCount = MAX_STRIPES;
+
+    auto slotsEnd = sizeof(table_header) + result.stripeCount * sizeof(table_stripe) + static_cast<uint64_t>(capacity) * sizeof(uint64_t);
+    result.heapOffset = (slotsEnd + arena_heap::PAGE_BYTES - 1) & ~static_cast<uint64_t>(arena_heap::PAGE_BYTES - 1);
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  hash_table::hash_table()
+  {
+    memset(&m_layout, 0, sizeof(m_layout));
+  }
+
+  table_header *hash_table::header(Isolate *isolate, const char *method) const
+  {
+    return reinterpret_cast<table_header *>(memory(isolate, method));
+  }
+
+  table_stripe *hash_table::stripe(table_header *table, const key_ref &key) const
+  {
+    auto stripes = reinterpret_cast<table_stripe *>(table + 1);
+    return stripes + ((key.hash >> 32) & (m_layout.stripeCount - 1));
+  }
+
+  std::atomic<uint64_t> *hash_table::slots(table_header *table) const
+  {
+    auto stripes = reinterpret_cast<table_stripe *>(table + 1);
+    return reinterpret_cast<std::atomic<uint64_t> *>(stripes + m_layout.stripeCount);
+  }
+
+  arena_heap hash_table::heap(table_header *table) const
+  {
+    auto base = reinterpret_cast<char *>(table) + m_layout.heapOffset;
+    return arena_heap(reinterpret_cast<arena_header *>(base), m_layout.heap);
+  }
+
+  char *hash_table::entry(table_header *table, uint64_t word, uint32_t &keyLength, uint32_t &valueLength) const
+  {
+    // A reader can see an entry that's being freed and reused, so check
+    // everything against the bounds of the heap before following it
+    auto offset = static_cast<uint64_t>(SlotGranule(word)) * arena_heap::GRANULE;
+    if (offset + ENTRY_HEADER > m_layout.heap.size)
+      return nullptr;
+
+    auto data = heap(table).at(offset);
+    memcpy(&keyLength, data, 4);
+    memcpy(&valueLength, data + 4, 4);
+
+    if (keyLength + static_cast<uint64_t>(valueLength) > m_layout.heap.size - offset - ENTRY_HEADER)
+      return nullptr;
+
+    return data;
+  }
+
+  hash_table::probe_result hash_table::probe(table_header *table, const key_ref &key) const
+  {
+    probe_result result = { NONE, SLOT_EMPTY, NONE, false };
+    auto slot = slots(table);
+    auto mask = m_layout.capacity - 1;
+    auto tag = static_cast<uint32_t>(key.hash >> 32);
+
+    for (uint32_t i = 0; i < m_layout.capacity; ++i)
+    {
+      auto index = static_cast<uint32_t>(key.hash + i) & mask;
+      auto word = slot[index].load(std::memory_order_acquire);
+
+      if (word == SLOT_EMPTY || word == SLOT_DELETED)
+      {
+        if (result.freeSlot == NONE)
+          result.freeSlot = index;
+
+        if (word == SLOT_EMPTY)
+          break;
+        continue;
+      }
+
+      if (SlotTag(word) != tag)
+        continue;
+
+      uint32_t keyLength, valueLength;
+      auto data = entry(table, word, keyLength, valueLength);
+      if (data == nullptr)
+      {
+        result.torn = true;
+        break;
+      }
+
+      if (keyLength == key.length && memcmp(data + ENTRY_HEADER, key.data, key.length) == 0)
+      {
+        result.slot = index;
+        result.entry = word;
+        break;
+      }
+    }
+
+    return result;
+  }
+
+  template <typename F>
+  bool hash_table::read_stable(table_header *table, table_stripe *stripe, F read) const
+  {
+    int spins = 0;
+    int tornInARow = 0;
+
+    for (;;)
+    {
+      auto before = stripe->sequence.load(std::memory_order_acquire);
+
+      if ((before & 1) == 0)
+      {
+        bool clean = read();
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (stripe->sequence.load(std::memory_order_relaxed) == before)
+        {
+          if (clean)
+            return true;
+
+          // Torn with no writer about isn't a race, the table is broken
+          if (++tornInARow > 1)
+            return false;
+        }
+      }
+      else if (spins % SPINS_BEFORE_OWNER_CHECK == SPINS_BEFORE_OWNER_CHECK - 1)
+      {
+        // The writer may have died halfway through, and then it's up to us
+        // to take its lock over and put the sequence right
+        auto owner = stripe->owner.load(std::memory_order_relaxed);
+        if (process_died(owner))
+        {
+          lock(stripe);
+          unlock(stripe);
+        }
+      }
+
+      Backoff(spins);
+    }
+  }
+
+  void hash_table::lock(table_stripe *stripe)
+  {
+    auto self = current_pid();
+    int spins = 0;
+
+    for (;;)
+    {
+      uint32_t owner = 0;
+      if (stripe->owner.compare_exchange_weak(owner, self, std::memory_order_acquire))
+        break;
+
+      if (owner != 0 && spins % SPINS_BEFORE_OWNER_CHECK == SPINS_BEFORE_OWNER_CHECK - 1 && process_died(owner) &&
+        stripe->owner.compare_exchange_strong(owner, self, std::memory_order_acquire))
+        break;
+
+      Backoff(spins);
+    }
+
+    // If we took over from a writer that died, the sequence is still odd and
+    // stays that way until we're done
+    auto sequence = stripe->sequence.load(std::memory_order_relaxed);
+    if ((sequence & 1) == 0)
+      stripe->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void hash_table::unlock(table_stripe *stripe)
+  {
+    stripe->sequence.store(stripe->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    stripe->owner.store(0, std::memory_order_release);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void hash_table::Size(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < 2)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to HashTable.size")));
+      return;
+    }
+
+    uint64_t capacity, dataSize;
+    if (!read_uint(args[0], MAX_CAPACITY, capacity) || !read_uint(args[1], UINT64_MAX, dataSize))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to HashTable.size")));
+      return;
+    }
+
+    layout shape;
+    if (!layout::make(static_cast<uint32_t>(capacity), dataSize, shape))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Capacity or data size out of range in HashTable.size")));
+      return;
+    }
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(shape.total_size())));
+  }
+
+  void hash_table::Create(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<hash_table>(args.Holder());
+
+    if (!read_mapping_args(args, 4, "HashTable.create"))
+      return;
+
+    uint64_t capacity, dataSize;
+    if (!read_uint(args[2], MAX_CAPACITY, capacity) || !read_uint(args[3], UINT64_MAX, dataSize))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to HashTable.create")));
+      return;
+    }
+
+    layout shape;
+    if (!layout::make(static_cast<uint32_t>(capacity), dataSize, shape))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Capacity or data size out of range in HashTable.create")));
+      return;
+    }
+
+    if (!obj->attach(isolate, args[0], args[1], shape.total_size(), 64, "HashTable.create"))
+      return;
+
+    obj->m_layout = shape;
+
+    auto table = obj->header(isolate, "HashTable.create");
+    memset(static_cast<void *>(table), 0, static_cast<size_t>(shape.heapOffset));
+    obj->heap(table).init();
+
+    table->capacity = shape.capacity;
+    table->stripeCount = shape.stripeCount;
+    table->size = shape.total_size();
+    table->heapOffset = shape.heapOffset;
+    table->version = table_header::VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    table->magic = table_header::MAGIC;
+  }
+
+  void hash_table::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<hash_table>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "HashTable.open"))
+      return;
+
+    auto describe = [](const table_header &table, layout &result) -> uint64_t
+    {
+      auto size = table.size;
+      auto heapOffset = table.heapOffset;
+      bool valid = table.magic == table_header::MAGIC && table.version == table_header::VERSION &&
+        size > heapOffset && layout::make(table.capacity, size - heapOffset, result) &&
+        result.stripeCount == table.stripeCount && result.heapOffset == heapOffset;
+
+      return valid ? result.total_size() : 0;
+    };
+
+    layout shape;
+    if (!obj->attach_existing<table_header>(isolate, args[0], args[1], shape, describe, "HashTable.open"))
+      return;
+
+    // The heap's own header has to agree with the shape we worked out
+    arena_heap::layout heapShape;
+    auto table = obj->header(isolate, "HashTable.open");
+    auto heapHeader = reinterpret_cast<const arena_header *>(reinterpret_cast<char *>(table) + shape.heapOffset);
+    if (!arena_heap::layout::describe(heapHeader, heapShape) || heapShape.size != shape.heap.size)
+    {
+      obj->detach();
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "No HashTable at that offset in HashTable.open")));
+      return;
+    }
+
+    obj->m_layout = shape;
+  }
+
+  void hash_table::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<hash_table>(args.Holder());
+
+    obj->detach();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void hash_table::Get(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<hash_table>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to HashTable.get")));
+      return;
+    }
+
+    std::string storage;
+    const char *keyData;
+    size_t keyLength;
+    if (!ReadBytes(args[0], storage, keyData, keyLength))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to HashTable.get")));
+      return;
+    }
+
+    auto table = obj->header(isolate, "HashTable.get");
+    if (table == nullptr)
+      return;
+
+    key_ref key = { keyData, static_cast<uint32_t>(keyLength), HashKey(keyData, keyLength) };
+    bool found = false;
+    Local<Object> result;
+
+    bool ok = obj->read_stable(table, obj->stripe(table, key), [&]() {
+      auto probe = obj->probe(table, key);
+      found = probe.slot != NONE;
+      if (!found)
+        return !probe.torn;
+
+      uint32_t entryKeyLength, valueLength;
+      auto data = obj->entry(table, probe.entry, entryKeyLength, valueLength);
+      if (data == nullptr)
+        return false;
+
+      // Copy straight into the Buffer we hand back. If the read turns out
+      // to be torn the next attempt makes a new one.
+      if (result.IsEmpty() || node::Buffer::Length(result) != valueLength)
+        result = node::Buffer::New(isolate, valueLength).ToLocalChecked();
+      memcpy(node::Buffer::Data(result), data + ENTRY_HEADER + entryKeyLength, valueLength);
+      return true;
+    });
+
+    if (!ok)
+    {
+      ThrowCorrupt(isolate);
+      return;
+    }
+
+    if (found)
+      args.GetReturnValue().Set(result);
+    else
+      args.GetReturnValue().SetNull();
+  }
+
+  void hash_table::GetInto(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<hash_table>(args.Holder());
+
+    if (args.Length() < 2)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to HashTable.getInto")));
+      return;
+    }
+
+    std::string storage;
+    const char *keyData;
+    size_t keyLength;
+    if (!ReadBytes(args[0], storage, keyData, keyLength) || !node::Buffer::HasInstance(args[1]))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to HashTable.getInto")));
+      return;
+    }
+
+    auto table = obj->header(isolate, "HashTable.getInto");
+    if (table == nullptr)
+      return;
+
+    auto dest = node::Buffer::Data(args[1]);
+    auto room = node::Buffer::Length(args[1]);
+
+    key_ref key = { keyData, static_cast<uint32_t>(keyLength), HashKey(keyData, keyLength) };
+    double length = -1;
+
+    bool ok = obj->read_stable(table, obj->stripe(table, key), [&]() {
+      auto probe = obj->probe(table, key);
+      if (probe.slot == NONE)
+      {
+        length = -1;
+        return !probe.torn;
+      }
+
+      uint32_t entryKeyLength, valueLength;
+      auto data = obj->entry(table, probe.entry, entryKeyLength, valueLength);
+      if (data == nullptr)
+        return false;
+
+      memcpy(dest, data + ENTRY_HEADER + entryKeyLength, valueLength < room ? valueLength : room);
+      length = valueLength;
+      return true;
+    });
+
+    if (!ok)
+    {
+      ThrowCorrupt(isolate);
+      return;
+    }
+
+    args.GetReturnValue().Set(Number::New(isolate, length));
+  }
+
+  void hash_table::Has(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<hash_table>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to HashTable.has")));
+      return;
+    }
+
+    std::string storage;
+    const char *keyData;
+    size_t keyLength;
+    if (!ReadBytes(args[0], storage, keyData, keyLength))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to HashTable.has")));
+      return;
+    }
+
+    auto table = obj->header(isolate, "HashTable.has");
+    if (table == nullptr)
+      return;
+
+    key_ref key = { keyData, static_cast<uint32_t>(keyLength), HashKey(keyData, keyLength) };
+    bool found = false;
+
+    bool ok = obj->read_stable(table, obj->stripe(table, key), [&]() {
+      auto probe = obj->probe(table, key);
+      found = probe.slot != NONE;
+      return !probe.torn;
+    });
+
+    if (!ok)
+    {
+      ThrowCorrupt(isolate);
+      return;
+    }
+
+    args.GetReturnValue().Set(found);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void hash_table::Set(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<hash_table>(args.Holder());
+
+    if (args.Length() < 2)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to HashTable.set")));
+      return;
+    }
+
+    std::string keyStorage, valueStorage;
+    const char *keyData, *valueData;
+    size_t keyLength, valueLength;
+    if (!ReadBytes(args[0], keyStorage, keyData, keyLength) || !ReadBytes(args[1], valueStorage, valueData, valueLength))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to HashTable.set")));
+      return;
+    }
+
+    auto table = obj->header(isolate, "HashTable.set");
+    if (table == nullptr)
+      return;
+
+    if (keyLength + valueLength > obj->m_layout.heap.size)
+    {
+      args.GetReturnValue().Set(false);
+      return;
+    }
+
+    key_ref key = { keyData, static_cast<uint32_t>(keyLength), HashKey(keyData, keyLength) };
+    auto heap = obj->heap(table);
+    auto slot = obj->slots(table);
+    auto mask = obj->m_layout.capacity - 1;
+
+    // Write the entry out before we take the lock, so it's held as briefly
+    // as possible
+    auto block = heap.alloc(ENTRY_HEADER + keyLength + valueLength);
+    if (block == 0)
+    {
+      args.GetReturnValue().Set(false);
+      return;
+    }
+
+    auto data = heap.at(block);
+    auto keyLength32 = static_cast<uint32_t>(keyLength);
+    auto valueLength32 = static_cast<uint32_t>(valueLength);
+    memcpy(data, &keyLength32, 4);
+    memcpy(data + 4, &valueLength32, 4);
+    memcpy(data + ENTRY_HEADER, keyData, keyLength);
+    memcpy(data + ENTRY_HEADER + keyLength, valueData, valueLength);
+
+    auto word = (key.hash >> 32) << 32 | (block / arena_heap::GRANULE);
+    auto stripe = obj->stripe(table, key);
+    bool stored = false;
+    uint64_t replaced = SLOT_EMPTY;
+
+    lock(stripe);
+
+    // Nobody else can add or remove this key while we hold its stripe
+    auto probe = obj->probe(table, key);
+
+    if (probe.slot != NONE)
+    {
+      replaced = probe.entry;
+      slot[probe.slot].store(word, std::memory_order_release);
+      stored = true;
+    }
+    else if (!probe.torn && probe.freeSlot != NONE)
+    {
+      // Other stripes' writers may be after the same free slot, so claim it
+      // with a CAS, moving on to the next free one if we lose. Slots before
+      // it never go back to empty, so a probe for our key still gets here.
+      for (uint32_t i = 0; i < obj->m_layout.capacity && !stored; ++i)
+      {
+        auto index = (probe.freeSlot + i) & mask;
+        auto current = slot[index].load(std::memory_order_relaxed);
+
+        while ((current == SLOT_EMPTY || current == SLOT_DELETED) && !stored)
+          stored = slot[index].compare_exchange_weak(current, word, std::memory_order_release);
+      }
+
+      if (stored)
+        stripe->count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    unlock(stripe);
+
+    // Readers that might still be looking at the old entry will see the
+    // sequence has moved, so it can go now
+    if (replaced != SLOT_EMPTY)
+      heap.free(static_cast<uint64_t>(SlotGranule(replaced)) * arena_heap::GRANULE);
+
+    if (!stored)
+      heap.free(block);
+
+    if (probe.torn)
+    {
+      ThrowCorrupt(isolate);
+      return;
+    }
+
+    args.GetReturnValue().Set(stored);
+  }
+
+  void hash_table::Delete(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<hash_table>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to HashTable.delete")));
+      return;
+    }
+
+    std::string storage;
+    const char *keyData;
+    size_t keyLength;
+    if (!ReadBytes(args[0], storage, keyData, keyLength))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to HashTable.delete")));
+      return;
+    }
+
+    auto table = obj->header(isolate, "HashTable.delete");
+    if (table == nullptr)
+      return;
+
+    key_ref key = { keyData, static_cast<uint32_t>(keyLength), HashKey(keyData, keyLength) };
+    auto stripe = obj->stripe(table, key);
+
+    lock(stripe);
+
+    auto probe = obj->probe(table, key);
+    if (probe.slot != NONE)
+    {
+      obj->slots(table)[probe.slot].store(SLOT_DELETED, std::memory_order_release);
+      stripe->count.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    unlock(stripe);
+
+    if (probe.slot != NONE)
+      obj->heap(table).free(static_cast<uint64_t>(SlotGranule(probe.entry)) * arena_heap::GRANULE);
+
+    if (probe.torn)
+    {
+      ThrowCorrupt(isolate);
+      return;
+    }
+
+    args.GetReturnValue().Set(probe.slot != NONE);
+  }
+
+  void hash_table::Count(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<hash_table>(args.Holder());
+
+    auto table = obj->header(isolate, "HashTable.count");
+    if (table == nullptr)
+      return;
+
+    auto stripes = reinterpret_cast<table_stripe *>(table + 1);
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < obj->m_layout.stripeCount; ++i)
+      count += stripes[i].count.load(std::memory_order_relaxed);
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(count)));
+  }
+
+  void hash_table::Compact(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<hash_table>(args.Holder());
+
+    auto table = obj->header(isolate, "HashTable.compact");
+    if (table == nullptr)
+      return;
+
+    // Writers only ever hold one stripe, so taking them all in order can't
+    // deadlock. Readers spin on the odd sequences until we're done.
+    auto stripes = reinterpret_cast<table_stripe *>(table + 1);
+    for (uint32_t i = 0; i < obj->m_layout.stripeCount; ++i)
+      lock(stripes + i);
+
+    auto slot = obj->slots(table);
+    auto mask = obj->m_layout.capacity - 1;
+    std::vector<std::pair<uint64_t, uint64_t>> live; // Slot word and full hash
+
+    bool corrupt = false;
+    for (uint32_t i = 0; i < obj->m_layout.capacity; ++i)
+    {
+      auto word = slot[i].load(std::memory_order_relaxed);
+      slot[i].store(SLOT_EMPTY, std::memory_order_relaxed);
+      if (word == SLOT_EMPTY || word == SLOT_DELETED)
+        continue;
+
+      uint32_t keyLength, valueLength;
+      auto data = obj->entry(table, word, keyLength, valueLength);
+      if (data == nullptr)
+      {
+        corrupt = true;
+        continue;
+      }
+
+      live.emplace_back(word, HashKey(data + ENTRY_HEADER, keyLength));
+    }
+
+    for (auto &it : live)
+    {
+      for (uint32_t i = 0; i < obj->m_layout.capacity; ++i)
+      {
+        auto index = static_cast<uint32_t>(it.second + i) & mask;
+        if (slot[index].load(std::memory_order_relaxed) == SLOT_EMPTY)
+        {
+          slot[index].store(it.first, std::memory_order_relaxed);
+          break;
+        }
+      }
+    }
+
+    for (uint32_t i = obj->m_layout.stripeCount; i > 0; --i)
+      unlock(stripes + i - 1);
+
+    if (corrupt)
+      ThrowCorrupt(isolate);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void hash_table::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<hash_table>, String::NewFromUtf8(isolate, "HashTable"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "HashTable"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "size"), FunctionTemplate::New(isolate, Size));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "get", Get);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "getInto", GetInto);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "has", Has);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "set", Set);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "delete", Delete);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "count", Count);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "compact", Compact);
+
+    exports->Set(
+      String::NewFromUtf8(isolate, "HashTable"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
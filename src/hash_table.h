@@ -0,0 +1,144 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Key/value hash table stored inside a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_HASH_TABLE_H
+#define NODEJS_HASH_TABLE_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <atomic>
+#include <cstdint>
+#include "mapped_object.h"
+#include "arena.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // An open addressing table with linear probing. Each slot is one 64 bit
+  // word: the top half of the key's hash, to skip most mismatches without
+  // looking further, and the entry's place in an arena_heap that follows the
+  // slots, in granules. Entries hold the key and value lengths, then the key
+  // and value.
+  //
+  // Keys are spread over lock stripes. A writer takes the lock for its key's
+  // stripe, so writers of different keys rarely meet, and claims empty slots
+  // with a CAS since probes cross stripes. Readers never lock: each stripe
+  // also has a sequence, odd while its writer is changing something, and a
+  // reader retries if the sequence moved while it looked. The lock word
+  // holds the writer's pid, so the lock can be taken over if it dies.
+  //
+  // Slots only go from empty to used to deleted, never back, so a probe can
+  // stop at the first empty slot. compact clears out the deleted ones.
+  struct table_header
+  {
+    static const uint32_t MAGIC = 0x48546162; // 'HTab'
+    static const uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t stripeCount;
+    uint64_t size;
+    uint64_t heapOffset; // Where the arena starts, from the header
+    char pad[32];
+  };
+
+  static_assert(sizeof(table_header) == 64, "table_header must take exactly one cache line");
+
+  struct table_stripe
+  {
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint32_t> owner; // pid of the writer, or 0
+    std::atomic<uint64_t> count; // Entries whose key belongs to this stripe
+    char pad[48];
+  };
+
+  static_assert(sizeof(table_stripe) == 64, "table_stripe must take exactly one cache line");
+
+  // ---------------------------------------------------------------------------
+
+  class hash_table : public mapped_object
+  {
+  public:
+    hash_table();
+
+    static void Create(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Get(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void GetInto(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Has(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Set(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Delete(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Count(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Compact(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Size(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+  private:
+    struct layout
+    {
+      uint32_t capacity;
+      uint32_t stripeCount;
+      uint64_t heapOffset;
+      arena_heap::layout heap;
+
+      static bool make(uint32_t capacity, uint64_t dataSize, layout &result);
+      uint64_t total_size() const { return heapOffset + heap.size; }
+    };
+
+    // A key being looked up
+    struct key_ref
+    {
+      const char *data;
+      uint32_t length;
+      uint64_t hash;
+    };
+
+    // What a probe found
+    struct probe_result
+    {
+      uint32_t slot;     // Holding the key, or NONE
+      uint64_t entry;    // What that slot held
+      uint32_t freeSlot; // First slot a new entry could go in, or NONE
+      bool torn;         // Saw something that didn't add up
+    };
+
+    table_header *header(v8::Isolate *isolate, const char *method) const;
+    table_stripe *stripe(table_header *table, const key_ref &key) const;
+    std::atomic<uint64_t> *slots(table_header *table) const;
+    arena_heap heap(table_header *table) const;
+
+    // The entry a slot word points to, or null if it's out of bounds
+    char *entry(table_header *table, uint64_t word, uint32_t &keyLength, uint32_t &valueLength) const;
+
+    probe_result probe(table_header *table, const key_ref &key) const;
+
+    // Runs read (returning false if it saw a torn entry) until it sees the
+    // stripe's sequence hold still around it. false if the table is corrupt.
+    template <typename F>
+    bool read_stable(table_header *table, table_stripe *stripe, F read) const;
+
+    // The writer's lock, held while the sequence is odd
+    static void lock(table_stripe *stripe);
+    static void unlock(table_stripe *stripe);
+
+    layout m_layout;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
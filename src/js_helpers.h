@@ -0,0 +1,105 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Small V8 helpers shared by node_filemap's classes
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_JS_HELPERS_H
+#define NODEJS_JS_HELPERS_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <cstdint>
+#include <string>
+#include "platform.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  inline std::string ToCString(v8::Local<v8::String> str)
+  {
+    v8::String::Utf8Value value(str);
+    return *value ? *value : "<string conversion failed>";
+  }
+
+  // Throws an Error of message followed by the number
+  inline void ThrowErrorCode(v8::Isolate *isolate, const char *message, int errorCode)
+  {
+    auto errStr = v8::String::Concat(v8::String::NewFromUtf8(isolate, message), v8::Integer::New(isolate, errorCode)->ToString(isolate));
+
+    isolate->ThrowException(v8::Exception::Error(errStr));
+  }
+
+  // A whole number from JS, up to max
+  inline bool ReadUint(v8::Local<v8::Value> value, uint64_t max, uint64_t &result)
+  {
+    if (!value->IsNumber() || value->IntegerValue() < 0 || static_cast<uint64_t>(value->IntegerValue()) > max)
+      return false;
+
+    result = static_cast<uint64_t>(value->IntegerValue());
+    return true;
+  }
+
+  // For a constructor called without new. The constructor's data is the
+  // class name.
+  inline void ThrowNotConstructed(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    v8::String::Utf8Value name(args.Data());
+
+    auto text = std::string("Must create ") + (*name ? *name : "it") + " with new";
+    isolate->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(isolate, text.c_str())));
+  }
+
+  // The JS constructor for a T, with the class name as its data. Wraps a new
+  // T when called with new, and throws otherwise. T has to befriend it to let
+  // it at ObjectWrap::Wrap.
+  template <typename T>
+  void Construct(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    if (!args.IsConstructCall())
+    {
+      ThrowNotConstructed(args);
+      return;
+    }
+
+    auto obj = new T();
+    obj->Wrap(args.This());
+    args.GetReturnValue().Set(args.This());
+  }
+
+  // Milliseconds, like Atomics.wait: undefined or Infinity waits forever. So
+  // does the INFINITE we export, which JS sees as -1.
+  inline bool ReadTimeout(v8::Local<v8::Value> value, DWORD &result)
+  {
+    if (value->IsUndefined())
+    {
+      result = INFINITE;
+      return true;
+    }
+
+    if (!value->IsNumber())
+      return false;
+
+    auto ms = value->NumberValue();
+    if (ms != ms)
+      result = 0;
+    else if (ms == -1 || ms >= INFINITE)
+      result = INFINITE;
+    else
+      result = ms > 0 ? static_cast<DWORD>(ms) : 0;
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
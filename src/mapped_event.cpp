@@ -0,0 +1,616 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Change notification (doorbell) stored inside a file_mapping, wrapped object
+// for node_filemap
+// -----------------------------------------------------------------------------
+
+#include "mapped_event.h"
+#include "addon_data.h"
+#include "js_helpers.h"
+#include "waiter.h"
+#include <climits>
+#include <cstdio>
+#include <random>
+
+#ifndef _WIN32
+#include "futex.h"
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    bool ReadGeneration(Local<Value> value, uint32_t &result)
+    {
+      if (!value->IsNumber())
+        return false;
+
+      result = value->Uint32Value();
+      return true;
+    }
+
+    // Same limit as WaitForMultipleObjects, everywhere
+    const size_t MAX_EVENTS = 64;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // An async waitForChange. Holds on to the mapping's memory (and on Windows
+  // the semaphore) so they stay valid on the pool thread even if the mapping
+  // or the event is closed while we're asleep. On Linux the pool may be
+  // asleep on the generation whenever the request is in flight, so it counts
+  // as a sleeper from start to finish.
+  class mapped_event::change_request : public promise_request
+  {
+  public:
+    change_request(Isolate *isolate, mapped_event *owner, event_header *event, uint32_t last, DWORD ms, Local<Promise::Resolver> resolver) :
+      promise_request(isolate, "node_filemap:MappedEvent.waitForChangeAsync", ms, resolver),
+      m_owner(owner),
+      m_memory(owner->pin()),
+      m_semaphore(owner->m_semaphore),
+      m_event(event),
+      m_last(last),
+      m_closed(false)
+    {
+      m_owner->m_requests.insert(this);
+#ifndef _WIN32
+      m_event->sleepers.fetch_add(1);
+#endif
+    }
+
+    ~change_request()
+    {
+#ifndef _WIN32
+      m_event->sleepers.fetch_sub(1);
+#endif
+      if (m_owner != nullptr)
+        m_owner->m_requests.erase(this);
+    }
+
+#ifdef _WIN32
+    bool block(const wait_deadline &until) override
+    {
+      while (!cancelled() && !until.expired())
+      {
+        if (m_event->generation.load() != m_last)
+          return true;
+
+        sleep(m_event, m_semaphore.get(), m_last, until, cancel_word());
+      }
+
+      return m_event->generation.load() != m_last;
+    }
+#else
+    bool poll(std::vector<futex_wait_entry> &entries) override
+    {
+      if (m_event->generation.load() != m_last)
+        return true;
+
+      entries.push_back({ &m_event->generation, m_last });
+      return false;
+    }
+#endif
+
+    void finished(bool ready) override
+    {
+      // We're called straight from the event loop, not from JS
+      auto isolate = this->isolate();
+      HandleScope scope(isolate);
+      Context::Scope contextScope(context());
+
+      if (cancelled())
+      {
+        if (m_closed)
+          reject(Exception::Error(String::NewFromUtf8(isolate, "MappedEvent was closed while waiting for it")));
+        else
+          reject(abort_error(isolate));
+
+        delete this;
+        return;
+      }
+
+      auto generation = m_event->generation.load();
+
+      if (generation == m_last && !deadline().expired())
+      {
+        waiter_pool::instance().submit(this);
+        return;
+      }
+
+      resolve(Number::New(isolate, generation));
+      delete this;
+    }
+
+    // JS thread. The event is going away, so fail the wait.
+    void close()
+    {
+      m_owner = nullptr;
+      m_closed = true;
+      cancel();
+    }
+
+  private:
+    mapped_event *m_owner;
+    std::shared_ptr<void> m_memory;
+    std::shared_ptr<void> m_semaphore;
+    event_header *m_event;
+    uint32_t m_last;
+    bool m_closed;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  mapped_event::mapped_event()
+  {
+  }
+
+  mapped_event::~mapped_event()
+  {
+    close();
+  }
+
+  event_header *mapped_event::header(Isolate *isolate, const char *method) const
+  {
+    return reinterpret_cast<event_header *>(memory(isolate, method));
+  }
+
+  void mapped_event::close()
+  {
+    auto requests = m_requests;
+    m_requests.clear();
+
+    for (auto request : requests)
+      request->close();
+
+    m_semaphore.reset();
+    detach();
+  }
+
+  // ---------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+  bool mapped_event::open_semaphore(Isolate *isolate, event_header *event, const char *method)
+  {
+    char name[64];
+    sprintf_s(name, "node_filemap_event_%016llx", static_cast<unsigned long long>(event->id));
+
+    // Whoever gets here first creates it, everyone else opens the same one
+    auto semaphore = CreateSemaphoreA(nullptr, 0, LONG_MAX, name);
+    if (semaphore == nullptr)
+    {
+      char message[128];
+      sprintf_s(message, "Failed to create semaphore in %s, error code: %lu", method, GetLastError());
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, message)));
+      return false;
+    }
+
+    m_semaphore.reset(semaphore, [](void *handle) { CloseHandle(handle); });
+    return true;
+  }
+
+  uint32_t mapped_event::signal(event_header *event, void *semaphore)
+  {
+    auto generation = event->generation.fetch_add(1) + 1;
+
+    // Everyone counted in sleepers either sees the new generation before it
+    // sleeps or gets one of these. A few spare releases only cost someone a
+    // spurious wakeup later.
+    auto sleepers = event->sleepers.load();
+    if (sleepers > 0)
+      ReleaseSemaphore(semaphore, static_cast<LONG>(sleepers), nullptr);
+
+    return generation;
+  }
+
+  void mapped_event::sleep(event_header *event, void *semaphore, uint32_t last, const wait_deadline &deadline, std::atomic<uint32_t> *cancelled)
+  {
+    event->sleepers.fetch_add(1);
+
+    // A pool thread's wait is alertable, so cancelling the request ends it
+    if (event->generation.load() == last)
+      WaitForSingleObjectEx(semaphore, deadline.remaining_ms(), cancelled != nullptr);
+
+    event->sleepers.fetch_sub(1);
+  }
+
+  namespace
+  {
+    // One round of wait_for_changes' sleep, on the events that haven't
+    // changed yet. Each signal releases its semaphore for every sleeper, and
+    // we only take one of them, so the spares just cost a spurious wakeup.
+    void SleepOnAny(event_header *const *events, void *const *semaphores, const uint32_t *last, size_t count, const wait_deadline &deadline)
+    {
+      HANDLE handles[MAX_EVENTS];
+      size_t waiting = 0;
+
+      for (size_t i = 0; i < count; ++i)
+        events[i]->sleepers.fetch_add(1);
+
+      for (size_t i = 0; i < count; ++i)
+      {
+        if (events[i]->generation.load() != last[i])
+        {
+          waiting = 0;
+          break;
+        }
+
+        handles[waiting++] = semaphores[i];
+      }
+
+      if (waiting > 0)
+        WaitForMultipleObjects(static_cast<DWORD>(waiting), handles, FALSE, deadline.remaining_ms());
+
+      for (size_t i = 0; i < count; ++i)
+        events[i]->sleepers.fetch_sub(1);
+    }
+  }
+
+#else
+
+  bool mapped_event::open_semaphore(Isolate *, event_header *, const char *)
+  {
+    // The futex is the generation itself, there's nothing to open
+    return true;
+  }
+
+  uint32_t mapped_event::signal(event_header *event, void *)
+  {
+    auto generation = event->generation.fetch_add(1) + 1;
+
+    // A sleeper bumps sleepers before it checks the generation, so either it
+    // sees ours or we see it here. Without sleepers this is just the add.
+    if (event->sleepers.load() > 0)
+      futex_wake(&event->generation, INT_MAX);
+
+    return generation;
+  }
+
+  void mapped_event::sleep(event_header *event, void *, uint32_t last, const wait_deadline &deadline, std::atomic<uint32_t> *)
+  {
+    event->sleepers.fetch_add(1);
+    futex_wait(&event->generation, last, deadline);
+    event->sleepers.fetch_sub(1);
+  }
+
+  namespace
+  {
+    // One round of wait_for_changes' sleep, on the events that haven't
+    // changed yet, with a single futex_waitv
+    void SleepOnAny(event_header *const *events, void *const *, const uint32_t *last, size_t count, const wait_deadline &deadline)
+    {
+      futex_wait_entry entries[MAX_EVENTS];
+
+      for (size_t i = 0; i < count; ++i)
+      {
+        events[i]->sleepers.fetch_add(1);
+        entries[i].word = &events[i]->generation;
+        entries[i].expected = last[i];
+      }
+
+      futex_wait_multiple(entries, count, deadline);
+
+      for (size_t i = 0; i < count; ++i)
+        events[i]->sleepers.fetch_sub(1);
+    }
+  }
+
+#endif
+
+  uint32_t mapped_event::wait_for_change(event_header *event, void *semaphore, uint32_t last, const wait_deadline &deadline)
+  {
+    for (;;)
+    {
+      auto generation = event->generation.load();
+      if (generation != last || deadline.expired())
+        return generation;
+
+      sleep(event, semaphore, last, deadline);
+    }
+  }
+
+  DWORD mapped_event::wait_for_changes(event_header *const *events, void *const *semaphores, const uint32_t *last, size_t count, bool waitAll, const wait_deadline &deadline)
+  {
+    event_header *unchangedEvents[MAX_EVENTS];
+    void *unchangedSemaphores[MAX_EVENTS];
+    uint32_t unchangedLast[MAX_EVENTS];
+
+    for (;;)
+    {
+      size_t unchanged = 0;
+
+      for (size_t i = 0; i < count; ++i)
+      {
+        if (events[i]->generation.load() != last[i])
+        {
+          if (!waitAll)
+            return WAIT_OBJECT_0 + static_cast<DWORD>(i);
+
+          continue;
+        }
+
+        unchangedEvents[unchanged] = events[i];
+        unchangedSemaphores[unchanged] = semaphores[i];
+        unchangedLast[unchanged] = last[i];
+        ++unchanged;
+      }
+
+      if (unchanged == 0)
+        return WAIT_OBJECT_0;
+
+      if (deadline.expired())
+        return WAIT_TIMEOUT;
+
+      // Waiting for all, a change on any of the rest is still progress, so
+      // both kinds sleep until one of them moves
+      if (unchanged == 1)
+        sleep(unchangedEvents[0], unchangedSemaphores[0], unchangedLast[0], deadline);
+      else
+        SleepOnAny(unchangedEvents, unchangedSemaphores, unchangedLast, unchanged, deadline);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void mapped_event::Create(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<mapped_event>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "MappedEvent.create"))
+      return;
+
+    obj->close();
+
+    if (!obj->attach(isolate, args[0], args[1], sizeof(event_header), 64, "MappedEvent.create"))
+      return;
+
+    auto event = obj->header(isolate, "MappedEvent.create");
+    event->generation.store(0);
+    event->sleepers.store(0);
+    event->magic = event_header::MAGIC;
+    event->version = event_header::VERSION;
+
+    std::random_device random;
+    event->id = (static_cast<uint64_t>(random()) << 32) | random();
+
+    if (!obj->open_semaphore(isolate, event, "MappedEvent.create"))
+      obj->detach();
+  }
+
+  void mapped_event::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<mapped_event>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "MappedEvent.open"))
+      return;
+
+    obj->close();
+
+    if (!obj->attach(isolate, args[0], args[1], sizeof(event_header), 64, "MappedEvent.open"))
+      return;
+
+    auto event = obj->header(isolate, "MappedEvent.open");
+
+    if (event->magic != event_header::MAGIC || event->version != event_header::VERSION)
+    {
+      obj->detach();
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "No MappedEvent at that offset in MappedEvent.open")));
+      return;
+    }
+
+    if (!obj->open_semaphore(isolate, event, "MappedEvent.open"))
+      obj->detach();
+  }
+
+  void mapped_event::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<mapped_event>(args.Holder());
+
+    obj->close();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void mapped_event::Signal(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<mapped_event>(args.Holder());
+
+    auto event = obj->header(isolate, "MappedEvent.signal");
+    if (event == nullptr)
+      return;
+
+    auto generation = signal(event, obj->m_semaphore.get());
+    args.GetReturnValue().Set(Number::New(isolate, generation));
+  }
+
+  void mapped_event::Generation(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<mapped_event>(args.Holder());
+
+    auto event = obj->header(isolate, "MappedEvent.generation");
+    if (event == nullptr)
+      return;
+
+    args.GetReturnValue().Set(Number::New(isolate, event->generation.load()));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void mapped_event::WaitForChange(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<mapped_event>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to MappedEvent.waitForChange")));
+      return;
+    }
+
+    uint32_t last;
+    DWORD ms = INFINITE;
+    if (!ReadGeneration(args[0], last) || (args.Length() > 1 && !ReadTimeout(args[1], ms)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to MappedEvent.waitForChange")));
+      return;
+    }
+
+    auto event = obj->header(isolate, "MappedEvent.waitForChange");
+    if (event == nullptr)
+      return;
+
+    auto generation = wait_for_change(event, obj->m_semaphore.get(), last, wait_deadline::after(ms));
+    args.GetReturnValue().Set(Number::New(isolate, generation));
+  }
+
+  void mapped_event::WaitForChangeAsync(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto context = isolate->GetCurrentContext();
+    auto obj = ObjectWrap::Unwrap<mapped_event>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to MappedEvent.waitForChangeAsync")));
+      return;
+    }
+
+    uint32_t last;
+    DWORD ms = INFINITE;
+    Local<Object> signal;
+    if (!ReadGeneration(args[0], last) ||
+      (args.Length() > 1 && !ReadTimeout(args[1], ms)) ||
+      !promise_request::read_signal(isolate, args[2], signal))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to MappedEvent.waitForChangeAsync")));
+      return;
+    }
+
+    auto event = obj->header(isolate, "MappedEvent.waitForChangeAsync");
+    if (event == nullptr)
+      return;
+
+    auto resolver = Promise::Resolver::New(context).ToLocalChecked();
+    args.GetReturnValue().Set(resolver->GetPromise());
+
+    if (promise_request::aborted(isolate, signal))
+    {
+      resolver->Reject(context, promise_request::abort_error(isolate)).FromJust();
+      return;
+    }
+
+    // Already moved on, or not prepared to wait - no need for the pool
+    auto generation = event->generation.load();
+    if (generation != last || ms == 0)
+    {
+      resolver->Resolve(context, Number::New(isolate, generation)).FromJust();
+      return;
+    }
+
+    auto request = new change_request(isolate, obj, event, last, ms, resolver);
+
+    if (!signal.IsEmpty())
+      request->listen(signal);
+
+    waiter_pool::instance().submit(request);
+  }
+
+  void mapped_event::WaitMultiple(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < 3)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to MappedEvent.waitMultiple")));
+      return;
+    }
+
+    DWORD ms = INFINITE;
+    if (!(
+      args[0]->IsArray() &&
+      args[1]->IsArray() &&
+      args[2]->IsBoolean() &&
+      (args.Length() < 4 || ReadTimeout(args[3], ms))))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to MappedEvent.waitMultiple")));
+      return;
+    }
+
+    auto eventList = Local<Array>::Cast(args[0]);
+    auto lastList = Local<Array>::Cast(args[1]);
+    size_t count = eventList->Length();
+
+    if (count == 0 || count > MAX_EVENTS || lastList->Length() != count)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Wrong number of events passed to MappedEvent.waitMultiple")));
+      return;
+    }
+
+    auto &data = addon_data::current();
+
+    event_header *events[MAX_EVENTS];
+    void *semaphores[MAX_EVENTS];
+    uint32_t last[MAX_EVENTS];
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+      auto it = eventList->Get(i);
+
+      if (!data.has_instance(CLASS_MAPPED_EVENT, it) || !ReadGeneration(lastList->Get(i), last[i]))
+      {
+        isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to MappedEvent.waitMultiple")));
+        return;
+      }
+
+      auto obj = ObjectWrap::Unwrap<mapped_event>(it->ToObject());
+
+      events[i] = obj->header(isolate, "MappedEvent.waitMultiple");
+      if (events[i] == nullptr)
+        return;
+
+      semaphores[i] = obj->m_semaphore.get();
+    }
+
+    args.GetReturnValue().Set(Integer::New(isolate, wait_for_changes(events, semaphores, last, count, args[2]->BooleanValue(), wait_deadline::after(ms))));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void mapped_event::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<mapped_event>, String::NewFromUtf8(isolate, "MappedEvent"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "MappedEvent"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "SIZE"), Integer::New(isolate, sizeof(event_header)));
+    tpl->Set(String::NewFromUtf8(isolate, "waitMultiple"), FunctionTemplate::New(isolate, WaitMultiple));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "signal", Signal);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "generation", Generation);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "waitForChange", WaitForChange);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "waitForChangeAsync", WaitForChangeAsync);
+
+    addon_data::current().set_template(CLASS_MAPPED_EVENT, tpl);
+    exports->Set(
+      String::NewFromUtf8(isolate, "MappedEvent"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
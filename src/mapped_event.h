@@ -0,0 +1,105 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Change notification (doorbell) stored inside a file_mapping, wrapped object
+// for node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_MAPPED_EVENT_H
+#define NODEJS_MAPPED_EVENT_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include "mapped_object.h"
+#include "deadline.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // A generation counter that writers bump after changing the mapping, and
+  // that readers sleep on until it moves. On Linux readers sleep on the
+  // counter itself with a futex. Windows has no futex between processes, so
+  // there they sleep on a named semaphore, which signal releases once for
+  // each sleeper. Either way signal skips the kernel when no one is asleep.
+  struct event_header
+  {
+    static const uint32_t MAGIC = 0x45766e74; // 'Evnt'
+    static const uint32_t VERSION = 1;
+
+    std::atomic<uint32_t> generation;
+    std::atomic<uint32_t> sleepers;
+    uint32_t magic;
+    uint32_t version;
+    uint64_t id; // Names the semaphore on Windows
+    char pad[40];
+  };
+
+  static_assert(sizeof(event_header) == 64, "event_header must take exactly one cache line");
+
+  // ---------------------------------------------------------------------------
+
+  class mapped_event : public mapped_object
+  {
+  public:
+    mapped_event();
+    ~mapped_event();
+
+    static void Create(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Signal(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Generation(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void WaitForChange(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void WaitForChangeAsync(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void WaitMultiple(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+    // Bumps the generation and wakes everyone waiting for it to change.
+    // Returns the new generation.
+    static uint32_t signal(event_header *event, void *semaphore);
+
+    // Sleeps until the generation isn't last any more, or deadline passes.
+    // Returns the generation it saw last.
+    static uint32_t wait_for_change(event_header *event, void *semaphore, uint32_t last, const wait_deadline &deadline);
+
+    // Sleeps until any (or all) of the generations have moved on from last,
+    // in one wait on all of them. WAIT_OBJECT_0 + the first that changed when
+    // waiting for any, WAIT_OBJECT_0 when waiting for all, or WAIT_TIMEOUT.
+    static DWORD wait_for_changes(event_header *const *events, void *const *semaphores, const uint32_t *last, size_t count, bool waitAll, const wait_deadline &deadline);
+
+    // One round of wait_for_change's sleep. May return early for no reason.
+    // On Windows a pool thread passes its request's cancel_word() as
+    // cancelled, which makes the sleep alertable, so cancelling the request
+    // ends it too.
+    static void sleep(event_header *event, void *semaphore, uint32_t last, const wait_deadline &deadline, std::atomic<uint32_t> *cancelled = nullptr);
+
+  private:
+    class change_request;
+
+    event_header *header(v8::Isolate *isolate, const char *method) const;
+    bool open_semaphore(v8::Isolate *isolate, event_header *event, const char *method);
+    void close();
+
+    // The Windows semaphore, shared with async waits so close() can't pull
+    // it out from under them. Empty on Linux.
+    std::shared_ptr<void> m_semaphore;
+
+    std::unordered_set<change_request *> m_requests;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,179 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Futex mutex stored inside a file_mapping, wrapped object for node_filemap
+// -----------------------------------------------------------------------------
+
+#include "mapped_mutex.h"
+#include "addon_data.h"
+#include <malloc.h> // alloca
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  robust_lock *mapped_mutex::lock(Isolate *isolate, const char *method) const
+  {
+    return reinterpret_cast<robust_lock *>(memory(isolate, method));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void mapped_mutex::Create(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<mapped_mutex>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "MappedMutex.create"))
+      return;
+
+    if (!obj->attach(isolate, args[0], args[1], robust_lock::SIZE, sizeof(void *), "MappedMutex.create"))
+      return;
+
+    obj->lock(isolate, "MappedMutex.create")->init();
+  }
+
+  void mapped_mutex::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<mapped_mutex>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "MappedMutex.open"))
+      return;
+
+    obj->attach(isolate, args[0], args[1], robust_lock::SIZE, sizeof(void *), "MappedMutex.open");
+  }
+
+  void mapped_mutex::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<mapped_mutex>(args.Holder());
+
+    obj->detach();
+  }
+
+  void mapped_mutex::Wait(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<mapped_mutex>(args.Holder());
+
+    DWORD ms;
+
+    if (args.Length() < 1)
+    {
+      ms = INFINITE;
+    }
+    else
+    {
+      if (!args[0]->IsNumber())
+      {
+        isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to MappedMutex.wait")));
+        return;
+      }
+
+      ms = args[0]->Uint32Value();
+    }
+
+    auto lock = obj->lock(isolate, "MappedMutex.wait");
+    if (lock == nullptr)
+      return;
+
+    args.GetReturnValue().Set(Integer::New(isolate, lock->acquire(ms)));
+  }
+
+  void mapped_mutex::Release(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<mapped_mutex>(args.Holder());
+
+    auto lock = obj->lock(isolate, "MappedMutex.release");
+    if (lock == nullptr)
+      return;
+
+    if (!lock->release())
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "MappedMutex.release called by a thread that doesn't own the mutex")));
+      return;
+    }
+  }
+
+  void mapped_mutex::WaitMultiple(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < 3)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to MappedMutex.waitMultiple")));
+      return;
+    }
+
+    if (!(
+      args[0]->IsArray() &&
+      args[1]->IsBoolean() &&
+      args[2]->IsNumber()))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to MappedMutex.waitMultiple")));
+      return;
+    }
+
+    auto mutexList = Local<Array>::Cast(args[0]);
+    auto len = mutexList->Length();
+
+    if (len == 0)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Wrong number of mutexes passed to MappedMutex.waitMultiple")));
+      return;
+    }
+
+    auto &data = addon_data::current();
+    robust_lock **lockArr = reinterpret_cast<robust_lock **>(alloca(len * sizeof(robust_lock *)));
+
+    for (unsigned i = 0; i < len; ++i)
+    {
+      auto it = mutexList->Get(i);
+
+      if (!data.has_instance(CLASS_MAPPED_MUTEX, it))
+      {
+        isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to MappedMutex.waitMultiple")));
+        return;
+      }
+
+      lockArr[i] = ObjectWrap::Unwrap<mapped_mutex>(it->ToObject())->lock(isolate, "MappedMutex.waitMultiple");
+      if (lockArr[i] == nullptr)
+        return;
+    }
+
+    auto waitResult = robust_lock::acquire_multiple(lockArr, len, args[1]->BooleanValue(), args[2]->Uint32Value());
+    args.GetReturnValue().Set(Integer::New(isolate, waitResult));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void mapped_mutex::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<mapped_mutex>, String::NewFromUtf8(isolate, "MappedMutex"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "MappedMutex"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "SIZE"), Integer::New(isolate, robust_lock::SIZE));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "wait", Wait);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "release", Release);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "waitMultiple", WaitMultiple);
+
+    addon_data::current().set_template(CLASS_MAPPED_MUTEX, tpl);
+    exports->Set(
+      String::NewFromUtf8(isolate, "MappedMutex"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
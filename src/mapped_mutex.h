@@ -0,0 +1,45 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Futex mutex stored inside a file_mapping, wrapped object for node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_MAPPED_MUTEX_H
+#define NODEJS_MAPPED_MUTEX_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include "mapped_object.h"
+#include "futex.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  class mapped_mutex : public mapped_object
+  {
+  public:
+
+    static void Create(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Wait(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Release(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void WaitMultiple(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+  private:
+    robust_lock *lock(v8::Isolate *isolate, const char *method) const;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,136 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Base for node_filemap objects that live inside a file_mapping
+// -----------------------------------------------------------------------------
+
+#include "mapped_object.h"
+#include <cstring>
+#include <string>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    void ThrowMessage(Isolate *isolate, Local<Value> (*make)(Local<String>), const char *message, const char *method)
+    {
+      auto text = std::string(message) + method;
+      isolate->ThrowException(make(String::NewFromUtf8(isolate, text.c_str())));
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  mapped_object::mapped_object() :
+    m_mapping(nullptr),
+    m_offset(0),
+    m_length(0)
+  {
+  }
+
+  mapped_object::~mapped_object()
+  {
+    detach();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void mapped_object::throw_not_found(Isolate *isolate, const char *method)
+  {
+    auto dot = strchr(method, '.');
+    auto text = "No " + std::string(method, dot != nullptr ? dot - method : strlen(method)) + " at that offset in " + method;
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, text.c_str())));
+  }
+
+  bool mapped_object::read_mapping_args(const FunctionCallbackInfo<Value> &args, int count, const char *method)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < count)
+    {
+      ThrowMessage(isolate, Exception::TypeError, "Not enough arguments to ", method);
+      return false;
+    }
+
+    if (!(file_mapping::HasInstance(isolate, args[0]) && args[1]->IsNumber() && args[1]->IntegerValue() >= 0))
+    {
+      ThrowMessage(isolate, Exception::TypeError, "Wrong type arguments to ", method);
+      return false;
+    }
+
+    return true;
+  }
+
+  bool mapped_object::attach(Isolate *isolate, Local<Value> mapping, Local<Value> offset, uint64_t length, uint64_t alignment, const char *method)
+  {
+    auto mappingObject = mapping->ToObject();
+    auto fileMapping = ObjectWrap::Unwrap<file_mapping>(mappingObject);
+    auto start = static_cast<uint64_t>(offset->IntegerValue());
+
+    if (alignment > 1 && start % alignment != 0)
+    {
+      ThrowMessage(isolate, Exception::RangeError, "Misaligned offset passed to ", method);
+      return false;
+    }
+
+    if (fileMapping->at(start, length) == nullptr)
+    {
+      ThrowMessage(isolate, Exception::RangeError, "Mapping is closed or too small in ", method);
+      return false;
+    }
+
+    detach();
+
+    m_mappingObject.Reset(isolate, mappingObject);
+    m_mapping = fileMapping;
+    m_offset = start;
+    m_length = length;
+    return true;
+  }
+
+  void mapped_object::detach()
+  {
+    m_mappingObject.Reset();
+    m_mapping = nullptr;
+    m_offset = 0;
+    m_length = 0;
+  }
+
+  char *mapped_object::memory(Isolate *isolate, const char *method) const
+  {
+    if (m_mapping == nullptr)
+    {
+      ThrowMessage(isolate, Exception::Error, "Not attached to a mapping in ", method);
+      return nullptr;
+    }
+
+    auto ptr = m_mapping->at(m_offset, m_length);
+    if (ptr == nullptr)
+    {
+      ThrowMessage(isolate, Exception::Error, "Mapping has been closed in ", method);
+      return nullptr;
+    }
+
+    return ptr;
+  }
+
+  std::shared_ptr<void> mapped_object::pin() const
+  {
+    return m_mapping != nullptr ? m_mapping->pin() : std::shared_ptr<void>();
+  }
+
+  Local<Object> mapped_object::view(Isolate *isolate, uint64_t offset, uint64_t length)
+  {
+    auto mappingObject = Local<Object>::New(isolate, m_mappingObject);
+    return m_mapping->make_view(isolate, mappingObject, m_offset + offset, length);
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,124 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Base for node_filemap objects that live inside a file_mapping
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_MAPPED_OBJECT_H
+#define NODEJS_MAPPED_OBJECT_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <cstdint>
+#include "filemap.h"
+#include "js_helpers.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // Something laid out at an offset in a FileMapping, like a lock or a queue.
+  // Holds on to the FileMapping so it can't be collected, and looks the memory
+  // up again on every call so using it after closeMapping throws instead of
+  // crashing.
+  class mapped_object : public node::ObjectWrap
+  {
+  public:
+    mapped_object();
+    ~mapped_object();
+
+    // A whole number from JS, up to max
+    static bool read_uint(v8::Local<v8::Value> value, uint64_t max, uint64_t &result)
+    {
+      return ReadUint(value, max, result);
+    }
+
+    // The JS constructor for a T, with the class name as its data. Wraps a
+    // new T when called with new, and throws otherwise.
+    template <typename T>
+    static void construct(const v8::FunctionCallbackInfo<v8::Value> &args)
+    {
+      if (!args.IsConstructCall())
+      {
+        ThrowNotConstructed(args);
+        return;
+      }
+
+      mapped_object *obj = new T();
+      obj->Wrap(args.This());
+      args.GetReturnValue().Set(args.This());
+    }
+
+  protected:
+    // Attaches to length bytes at offset in mapping. Throws and returns false
+    // if the arguments are bad or the range doesn't fit in the mapping.
+    bool attach(v8::Isolate *isolate, v8::Local<v8::Value> mapping, v8::Local<v8::Value> offset, uint64_t length, uint64_t alignment, const char *method);
+    void detach();
+
+    // The attached memory, or null (after throwing) if we're not attached or
+    // the mapping has been closed
+    char *memory(v8::Isolate *isolate, const char *method) const;
+
+    // A zero-copy Buffer over length bytes at offset into our memory, which
+    // must be valid (call memory() first)
+    v8::Local<v8::Object> view(v8::Isolate *isolate, uint64_t offset, uint64_t length);
+
+    // See file_mapping::pin. Empty if we're not attached.
+    std::shared_ptr<void> pin() const;
+
+    bool attached() const { return m_mapping != nullptr; }
+    uint64_t offset() const { return m_offset; }
+    uint64_t length() const { return m_length; }
+
+    // Reads args[0] and args[1] as (mapping, offset)
+    static bool read_mapping_args(const v8::FunctionCallbackInfo<v8::Value> &args, int count, const char *method);
+
+    // Attaches to an object another process already set up at offset in
+    // mapping. Attaches to just its Header first, and passes that to
+    // describe(header, shape), which checks it, fills in shape and returns
+    // how many bytes the whole object takes, or 0 if there's no object
+    // there. Then attaches to all of it.
+    //
+    // Anything derived from the header belongs in shape, read once here.
+    // Another process can write over the header whenever it likes, so sizes
+    // and offsets taken from it later could point outside the object.
+    template <typename Header, typename Shape, typename Describe>
+    bool attach_existing(v8::Isolate *isolate, v8::Local<v8::Value> mapping, v8::Local<v8::Value> offset, Shape &shape, Describe describe, const char *method)
+    {
+      if (!attach(isolate, mapping, offset, sizeof(Header), 64, method))
+        return false;
+
+      auto header = reinterpret_cast<const Header *>(memory(isolate, method));
+      uint64_t size = describe(*header, shape);
+
+      if (size == 0)
+      {
+        detach();
+        throw_not_found(isolate, method);
+        return false;
+      }
+
+      return attach(isolate, mapping, offset, size, 64, method);
+    }
+
+  private:
+    // "No <class> at that offset in <class>.<method>"
+    static void throw_not_found(v8::Isolate *isolate, const char *method);
+
+    v8::Persistent<v8::Object> m_mappingObject;
+    file_mapping *m_mapping;
+    uint64_t m_offset;
+    uint64_t m_length;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -1,10 +1,25 @@
 // -----------------------------------------------------------------------------
 // Howard Hughes
-// Windows named mutex wrapped object for node_filemap
+// Named mutex wrapped object for node_filemap
 // -----------------------------------------------------------------------------
 
 #include "mutex.h"
+#include "js_helpers.h"
+#include "filemap.h"
+#include "addon_data.h"
+#include "waiter.h"
+#include <algorithm>
+#include <chrono>
+#include <unordered_set>
+
+#ifdef _WIN32
 #include <malloc.h> // alloca
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 // -----------------------------------------------------------------------------
 
@@ -16,60 +31,521 @@ namespace node_filemap
 
   namespace
   {
-    const char *ToCString(Local<String> str)
+#ifdef _WIN32
+    const size_t MAX_ASYNC_MUTEXES = MAXIMUM_WAIT_OBJECTS;
+#else
+    const size_t MAX_ASYNC_MUTEXES = 64;
+
+    std::string ShmName(const char *name)
+    {
+      return std::string("/") + name;
+    }
+#endif
+
+    // -------------------------------------------------------------------------
+
+    typedef std::chrono::steady_clock clock;
+
+    uint64_t ElapsedNs(clock::time_point start)
     {
-      String::Utf8Value value(str);
-      return *value ? *value : "<string conversion failed>";
+      return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
     }
+
+    // Counts how a wait on count handles came out. waitedNs is how long it
+    // blocked, or 0 if it never had to.
+    void CountWait(const std::shared_ptr<mutex_handle> *handles, size_t count, bool waitAll, DWORD result, uint64_t waitedNs)
+    {
+      auto acquired = [&](size_t i)
+      {
+        handles[i]->stats->add(STAT_ACQUISITIONS);
+        if (waitedNs != 0)
+          handles[i]->stats->waited(waitedNs);
+      };
+
+      if (result == WAIT_TIMEOUT)
+      {
+        for (size_t i = 0; i < count; ++i)
+          handles[i]->stats->add(STAT_TIMEOUTS);
+      }
+      else if (result - WAIT_OBJECT_0 < count)
+      {
+        if (waitAll)
+        {
+          for (size_t i = 0; i < count; ++i)
+            acquired(i);
+        }
+        else
+        {
+          acquired(result - WAIT_OBJECT_0);
+        }
+      }
+      else if (result - WAIT_ABANDONED_0 < count)
+      {
+        handles[result - WAIT_ABANDONED_0]->stats->add(STAT_ABANDONED);
+
+        if (waitAll)
+        {
+          for (size_t i = 0; i < count; ++i)
+            acquired(i);
+        }
+        else
+        {
+          acquired(result - WAIT_ABANDONED_0);
+        }
+      }
+    }
+
+    // -------------------------------------------------------------------------
+
+    // waitAsync/waitMultipleAsync. The pool thread only waits for the mutexes
+    // to become available; they're taken back on the JS thread, which is what
+    // ends up owning them, just like a synchronous wait.
+    class mutex_wait_request : public promise_request
+    {
+    public:
+      mutex_wait_request(Isolate *isolate, std::vector<std::shared_ptr<mutex_handle>> &&handles, bool waitAll, DWORD ms, Local<Promise::Resolver> resolver);
+      ~mutex_wait_request();
+
+#ifdef _WIN32
+      bool block(const wait_deadline &until) override;
+#else
+      bool poll(std::vector<futex_wait_entry> &entries) override;
+#endif
+      void finished(bool ready) override;
+
+      // JS thread. Takes the mutexes without waiting if they're free.
+      DWORD try_acquire();
+
+      // JS thread. Counts the result of try_acquire in the mutexes' stats.
+      void count(DWORD result, bool waited)
+      {
+        CountWait(m_handles.data(), m_handles.size(), m_waitAll, result, waited ? std::max<uint64_t>(ElapsedNs(m_start), 1) : 0);
+      }
+
+      void close_handle(const mutex_handle *handle);
+
+    private:
+      std::vector<std::shared_ptr<mutex_handle>> m_handles;
+      bool m_waitAll;
+      bool m_closed;
+      clock::time_point m_start;
+
+#ifdef _WIN32
+      std::atomic<int> m_abandoned; // Index the pool thread saw abandoned, or -1
+#endif
+    };
+
+    // Requests in flight, so closing a Mutex can cancel the ones using it.
+    // Each JS thread has its own, as a Mutex only belongs to one isolate.
+    thread_local std::unordered_set<mutex_wait_request *> g_requests;
+
+    mutex_wait_request::mutex_wait_request(Isolate *isolate, std::vector<std::shared_ptr<mutex_handle>> &&handles, bool waitAll, DWORD ms, Local<Promise::Resolver> resolver) :
+      promise_request(isolate, "node_filemap:Mutex.waitAsync", ms, resolver),
+      m_handles(std::move(handles)),
+      m_waitAll(waitAll),
+      m_closed(false),
+      m_start(clock::now())
+    {
+#ifdef _WIN32
+      m_abandoned.store(-1);
+#endif
+      g_requests.insert(this);
+    }
+
+    mutex_wait_request::~mutex_wait_request()
+    {
+      g_requests.erase(this);
+    }
+
+    void mutex_wait_request::close_handle(const mutex_handle *handle)
+    {
+      for (auto &it : m_handles)
+      {
+        if (it.get() == handle)
+        {
+          m_closed = true;
+          cancel();
+          return;
+        }
+      }
+    }
+
+    void mutex_wait_request::finished(bool ready)
+    {
+      // We're called straight from the event loop, not from JS
+      auto isolate = this->isolate();
+      HandleScope scope(isolate);
+      Context::Scope contextScope(context());
+
+      if (cancelled())
+      {
+        if (m_closed)
+          reject(Exception::Error(String::NewFromUtf8(isolate, "Mutex was closed while waiting for it")));
+        else
+          reject(abort_error(isolate));
+
+        delete this;
+        return;
+      }
+
+      DWORD result = try_acquire();
+
+      if (result == WAIT_FAILED)
+      {
+        reject(Exception::Error(String::NewFromUtf8(isolate, "Failed to wait on mutex")));
+        delete this;
+        return;
+      }
+
+      // Someone else got in first - go back to waiting
+      if (result == WAIT_TIMEOUT && !deadline().expired())
+      {
+        waiter_pool::instance().submit(this);
+        return;
+      }
+
+      count(result, true);
+      resolve(Integer::New(isolate, result));
+      delete this;
+    }
+
+#ifdef _WIN32
+
+    bool mutex_wait_request::block(const wait_deadline &until)
+    {
+      auto count = m_handles.size();
+      HANDLE *handles = reinterpret_cast<HANDLE *>(alloca(count * sizeof(HANDLE)));
+      for (size_t i = 0; i < count; ++i)
+        handles[i] = m_handles[i]->handle;
+
+      // Alertable, so the APC cancel() queues ends the wait with
+      // WAIT_IO_COMPLETION, waiting for all as well as for any
+      DWORD waitResult = WaitForMultipleObjectsEx(static_cast<DWORD>(count), handles, m_waitAll, until.remaining_ms(), TRUE);
+
+      // Waiting took the mutexes on this thread, so hand them straight back
+      // and let the JS thread take them. Abandonment is only reported to the
+      // first thread to take a mutex, so remember it for the JS thread.
+      if (waitResult >= WAIT_OBJECT_0 && waitResult < WAIT_OBJECT_0 + count)
+      {
+        if (m_waitAll)
+        {
+          for (size_t i = 0; i < count; ++i)
+            ReleaseMutex(handles[i]);
+        }
+        else
+        {
+          ReleaseMutex(handles[waitResult - WAIT_OBJECT_0]);
+        }
+
+        return true;
+      }
+
+      if (waitResult >= WAIT_ABANDONED_0 && waitResult < WAIT_ABANDONED_0 + count)
+      {
+        m_abandoned.store(static_cast<int>(waitResult - WAIT_ABANDONED_0));
+
+        if (m_waitAll)
+        {
+          for (size_t i = 0; i < count; ++i)
+            ReleaseMutex(handles[i]);
+        }
+        else
+        {
+          ReleaseMutex(handles[waitResult - WAIT_ABANDONED_0]);
+        }
+
+        return true;
+      }
+
+      return false;
+    }
+
+    DWORD mutex_wait_request::try_acquire()
+    {
+      auto count = m_handles.size();
+      HANDLE *handles = reinterpret_cast<HANDLE *>(alloca(count * sizeof(HANDLE)));
+      for (size_t i = 0; i < count; ++i)
+        handles[i] = m_handles[i]->handle;
+
+      DWORD waitResult = WaitForMultipleObjects(static_cast<DWORD>(count), handles, m_waitAll, 0);
+
+      int abandoned = m_abandoned.load();
+      if (abandoned >= 0 && waitResult >= WAIT_OBJECT_0 && waitResult < WAIT_OBJECT_0 + count)
+      {
+        if (m_waitAll)
+          return WAIT_ABANDONED_0 + abandoned;
+        if (waitResult - WAIT_OBJECT_0 == static_cast<DWORD>(abandoned))
+          return WAIT_ABANDONED_0 + abandoned;
+      }
+
+      return waitResult;
+    }
+
+#else
+
+    bool mutex_wait_request::poll(std::vector<futex_wait_entry> &entries)
+    {
+      auto first = entries.size();
+
+      for (;;)
+      {
+        robust_lock *held = nullptr;
+        size_t free = 0;
+
+        for (auto &it : m_handles)
+        {
+          if (it->lock->is_free())
+            ++free;
+          else if (held == nullptr)
+            held = it->lock;
+        }
+
+        if (m_waitAll ? held == nullptr : free > 0)
+          return true;
+
+        // Same as robust_lock::acquire_multiple, waiting for all sleeps on
+        // the first one held and waiting for any on all of them. If one
+        // changed under us, look again.
+        futex_wait_entry entry;
+
+        if (m_waitAll)
+        {
+          if (held->wait_entry(entry))
+          {
+            entries.push_back(entry);
+            return false;
+          }
+
+          continue;
+        }
+
+        bool changed = false;
+        for (auto &it : m_handles)
+        {
+          if (!it->lock->wait_entry(entry))
+          {
+            changed = true;
+            break;
+          }
+
+          entries.push_back(entry);
+        }
+
+        if (!changed)
+          return false;
+
+        entries.resize(first);
+      }
+    }
+
+    DWORD mutex_wait_request::try_acquire()
+    {
+      auto count = m_handles.size();
+      robust_lock **locks = reinterpret_cast<robust_lock **>(alloca(count * sizeof(robust_lock *)));
+      for (size_t i = 0; i < count; ++i)
+        locks[i] = m_handles[i]->lock;
+
+      return robust_lock::acquire_multiple(locks, count, m_waitAll, 0);
+    }
+
+#endif
+  }
+
+  // ---------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+  mutex_handle::mutex_handle() :
+    handle(nullptr),
+    stats(STATS_MUTEX)
+  {
+  }
+
+  mutex_handle::~mutex_handle()
+  {
+    if (handle != nullptr)
+      CloseHandle(handle);
+  }
+
+#else
+
+  mutex_handle::mutex_handle() :
+    lock(nullptr),
+    fd(-1),
+    created(false),
+    stats(STATS_MUTEX)
+  {
   }
 
+  mutex_handle::~mutex_handle()
+  {
+    if (lock != nullptr)
+    {
+      lock->abandon();
+      munmap(lock, robust_lock::SIZE);
+    }
+    if (fd >= 0)
+      ReleaseName(fd, name, true, created);
+  }
+
+#endif
+
   // ---------------------------------------------------------------------------
 
-  mutex::mutex() :
-    m_mutex(INVALID_HANDLE_VALUE)
+  mutex::mutex()
   {
   }
 
   mutex::~mutex()
   {
-    if (m_mutex != INVALID_HANDLE_VALUE)
-      CloseHandle(m_mutex);
+    close();
   }
 
   // ---------------------------------------------------------------------------
 
+#ifdef _WIN32
+
   void mutex::create(const char *name, Isolate *isolate)
   {
-    m_mutex = CreateMutex(
+    close();
+
+    auto handle = std::make_shared<mutex_handle>();
+
+    handle->handle = CreateMutex(
       nullptr,
       FALSE,
       name);
 
-    if (m_mutex == INVALID_HANDLE_VALUE)
+    if (handle->handle == nullptr)
     {
-      int lastErr = GetLastError();
-      auto errStr = String::Concat(String::NewFromUtf8(isolate, "Failed to create mutex, error code: "), Integer::New(isolate, lastErr)->ToString(isolate));
-
-      isolate->ThrowException(Exception::Error(errStr));
+      ThrowErrorCode(isolate, "Failed to create mutex, error code: ", GetLastError());
       return;
     }
+
+    m_handle = handle;
   }
 
   void mutex::open(const char *name, Isolate *isolate)
   {
-    m_mutex = OpenMutex(
+    close();
+
+    auto handle = std::make_shared<mutex_handle>();
+
+    handle->handle = OpenMutex(
       SYNCHRONIZE,
       FALSE,
       name);
 
-    if (m_mutex == INVALID_HANDLE_VALUE)
+    if (handle->handle == nullptr)
+    {
+      ThrowErrorCode(isolate, "Failed to open mutex, error code: ", GetLastError());
+      return;
+    }
+
+    m_handle = handle;
+  }
+
+#else
+
+  // The mutex lives in a shared memory object named after it, which starts
+  // out zeroed - an unlocked robust_lock - so creating it races safely with
+  // other creators. Every handle holds the name with OpenName, so it lasts
+  // until the last one closes, like a Win32 mutex.
+  void mutex::create(const char *name, Isolate *isolate)
+  {
+    close();
+
+    auto handle = std::make_shared<mutex_handle>();
+    handle->name = ShmName(name);
+
+    handle->fd = OpenName(handle->name, true, true);
+    if (handle->fd < 0)
+    {
+      ThrowErrorCode(isolate, "Failed to create mutex, error code: ", errno);
+      return;
+    }
+
+    struct stat info;
+    if (fstat(handle->fd, &info) != 0)
+    {
+      ThrowErrorCode(isolate, "Failed to create mutex, error code: ", errno);
+      return;
+    }
+
+    // Something else (a file mapping, say) already has this name
+    if (info.st_size != 0 && info.st_size != static_cast<off_t>(robust_lock::SIZE))
+    {
+      ThrowErrorCode(isolate, "Failed to create mutex, error code: ", EEXIST);
+      return;
+    }
+
+    if (info.st_size == 0)
+    {
+      handle->created = true;
+
+      if (ftruncate(handle->fd, robust_lock::SIZE) != 0)
+      {
+        ThrowErrorCode(isolate, "Failed to create mutex, error code: ", errno);
+        return;
+      }
+    }
+
+    void *ptr = mmap(nullptr, robust_lock::SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, handle->fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+      ThrowErrorCode(isolate, "Failed to create mutex, error code: ", errno);
+      return;
+    }
+
+    handle->lock = reinterpret_cast<robust_lock *>(ptr);
+    m_handle = handle;
+  }
+
+  void mutex::open(const char *name, Isolate *isolate)
+  {
+    close();
+
+    auto handle = std::make_shared<mutex_handle>();
+    handle->name = ShmName(name);
+
+    handle->fd = OpenName(handle->name, true, false);
+    if (handle->fd < 0)
+    {
+      ThrowErrorCode(isolate, "Failed to open mutex, error code: ", errno);
+      return;
+    }
+
+    struct stat info;
+    if (fstat(handle->fd, &info) != 0 || info.st_size != static_cast<off_t>(robust_lock::SIZE))
     {
-      int lastErr = GetLastError();
-      auto errStr = String::Concat(String::NewFromUtf8(isolate, "Failed to create mutex, error code: "), Integer::New(isolate, lastErr)->ToString(isolate));
+      ThrowErrorCode(isolate, "Failed to open mutex, error code: ", EINVAL);
+      return;
+    }
 
-      isolate->ThrowException(Exception::Error(errStr));
+    void *ptr = mmap(nullptr, robust_lock::SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, handle->fd, 0);
+    if (ptr == MAP_FAILED)
+    {
+      ThrowErrorCode(isolate, "Failed to open mutex, error code: ", errno);
       return;
     }
+
+    handle->lock = reinterpret_cast<robust_lock *>(ptr);
+    m_handle = handle;
+  }
+
+#endif
+
+  void mutex::close()
+  {
+    if (!m_handle)
+      return;
+
+    // Async waits on this mutex can't finish any more
+    std::vector<mutex_wait_request *> requests(g_requests.begin(), g_requests.end());
+    for (auto request : requests)
+      request->close_handle(m_handle.get());
+
+    m_handle.reset();
   }
 
   // ---------------------------------------------------------------------------
@@ -110,9 +586,11 @@ namespace node_filemap
       return;
     }
 
-    const char *name = ToCString(args[0]->ToString());
+    std::string name = ToCString(args[0]->ToString());
 
-    obj->create(name, isolate);
+    obj->create(name.c_str(), isolate);
+    if (obj->m_handle)
+      obj->m_handle->stats.reset(name.c_str());
   }
 
   void mutex::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
@@ -132,18 +610,18 @@ namespace node_filemap
       return;
     }
 
-    const char *name = ToCString(args[0]->ToString());
+    std::string name = ToCString(args[0]->ToString());
 
-    obj->open(name, isolate);
+    obj->open(name.c_str(), isolate);
+    if (obj->m_handle)
+      obj->m_handle->stats.reset(name.c_str());
   }
 
   void mutex::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
   {
-    auto isolate = args.GetIsolate();
     auto obj = ObjectWrap::Unwrap<mutex>(args.Holder());
 
-    if (obj->m_mutex != INVALID_HANDLE_VALUE)
-      CloseHandle(obj->m_mutex);
+    obj->close();
   }
 
   void mutex::Wait(const v8::FunctionCallbackInfo<v8::Value> &args)
@@ -168,24 +646,77 @@ namespace node_filemap
       ms = args[0]->Uint32Value();
     }
 
-    DWORD waitResult = WaitForSingleObject(obj->m_mutex, ms);
+    if (!obj->m_handle)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Mutex.wait called on a closed mutex")));
+      return;
+    }
 
-    if (waitResult == WAIT_FAILED)
+    // Try without waiting first, so only a wait that blocks is timed
+    auto &handle = obj->m_handle;
+    uint64_t waitedNs = 0;
+
+#ifdef _WIN32
+    DWORD waitResult = WaitForSingleObject(handle->handle, 0);
+
+    if (waitResult == WAIT_TIMEOUT && ms != 0)
     {
-      int lastErr = GetLastError();
-      auto errStr = String::Concat(String::NewFromUtf8(isolate, "Failed to wait on mutex, error code: "), Integer::New(isolate, lastErr)->ToString(isolate));
+      auto start = clock::now();
+      waitResult = WaitForSingleObject(handle->handle, ms);
+      waitedNs = std::max<uint64_t>(ElapsedNs(start), 1);
+    }
 
-      isolate->ThrowException(Exception::Error(errStr));
+    if (waitResult == WAIT_FAILED)
+    {
+      ThrowErrorCode(isolate, "Failed to wait on mutex, error code: ", GetLastError());
       return;
     }
+#else
+    DWORD waitResult = handle->lock->acquire(0);
+
+    if (waitResult == WAIT_TIMEOUT && ms != 0)
+    {
+      auto start = clock::now();
+      waitResult = handle->lock->acquire(ms);
+      waitedNs = std::max<uint64_t>(ElapsedNs(start), 1);
+    }
+#endif
 
+    CountWait(&handle, 1, true, waitResult, waitedNs);
     args.GetReturnValue().Set(Integer::New(isolate, waitResult));
   }
 
+  bool mutex::ReadMutexList(Isolate *isolate, Local<Value> value, std::vector<std::shared_ptr<mutex_handle>> &handles, const char *method)
+  {
+    auto mutexList = Local<Array>::Cast(value);
+    auto &data = addon_data::current();
+
+    for (unsigned i = 0; i < mutexList->Length(); ++i)
+    {
+      auto it = mutexList->Get(i);
+
+      if (!data.has_instance(CLASS_MUTEX, it))
+      {
+        isolate->ThrowException(Exception::TypeError(String::Concat(String::NewFromUtf8(isolate, "Wrong type arguments to "), String::NewFromUtf8(isolate, method))));
+        return false;
+      }
+
+      auto handle = ObjectWrap::Unwrap<mutex>(it->ToObject())->m_handle;
+      if (!handle)
+      {
+        isolate->ThrowException(Exception::Error(String::Concat(String::NewFromUtf8(isolate, "Closed mutex passed to "), String::NewFromUtf8(isolate, method))));
+        return false;
+      }
+
+      handles.push_back(handle);
+    }
+
+    return true;
+  }
+
   void mutex::WaitMultiple(const v8::FunctionCallbackInfo<v8::Value> &args)
   {
     auto isolate = args.GetIsolate();
-    auto obj = ObjectWrap::Unwrap<mutex>(args.Holder());
 
     if (args.Length() < 3)
     {
@@ -202,47 +733,207 @@ namespace node_filemap
       return;
     }
 
-    auto mutexList = Local<Array>::Cast(args[0]);
+    std::vector<std::shared_ptr<mutex_handle>> handles;
+    if (!ReadMutexList(isolate, args[0], handles, "Mutex.waitMultiple"))
+      return;
+
+    if (handles.empty())
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Wrong number of mutexes passed to Mutex.waitMultiple")));
+      return;
+    }
+
     bool waitAll = args[1]->BooleanValue();
     auto waitFor = args[2]->Uint32Value();
 
-    auto len = mutexList->Length();
+    auto len = handles.size();
+
+#ifdef _WIN32
     HANDLE *mutexArr = reinterpret_cast<HANDLE *>(alloca(len * sizeof(HANDLE)));
-    for (unsigned i = 0; i < mutexList->Length(); ++i)
+    for (size_t i = 0; i < len; ++i)
+      mutexArr[i] = handles[i]->handle;
+
+    uint64_t waitedNs = 0;
+    DWORD waitResult = WaitForMultipleObjects(static_cast<DWORD>(len), mutexArr, waitAll, 0);
+
+    if (waitResult == WAIT_TIMEOUT && waitFor != 0)
     {
-      auto it = mutexList->Get(i);
-      mutexArr[i] = ObjectWrap::Unwrap<mutex>(it->ToObject())->m_mutex;
+      auto start = clock::now();
+      waitResult = WaitForMultipleObjects(static_cast<DWORD>(len), mutexArr, waitAll, waitFor);
+      waitedNs = std::max<uint64_t>(ElapsedNs(start), 1);
     }
-    
-    DWORD waitResult = WaitForMultipleObjects(
-      mutexList->Length(),
-      mutexArr,
-      waitAll,
-      waitFor);
 
     if (waitResult == WAIT_FAILED)
     {
-      int lastErr = GetLastError();
-      auto errStr = String::Concat(String::NewFromUtf8(isolate, "Failed to wait on mutex, error code: "), Integer::New(isolate, lastErr)->ToString(isolate));
-
-      isolate->ThrowException(Exception::Error(errStr));
+      ThrowErrorCode(isolate, "Failed to wait on mutex, error code: ", GetLastError());
       return;
     }
+#else
+    robust_lock **lockArr = reinterpret_cast<robust_lock **>(alloca(len * sizeof(robust_lock *)));
+    for (size_t i = 0; i < len; ++i)
+      lockArr[i] = handles[i]->lock;
+
+    uint64_t waitedNs = 0;
+    DWORD waitResult = robust_lock::acquire_multiple(lockArr, len, waitAll, 0);
 
+    if (waitResult == WAIT_TIMEOUT && waitFor != 0)
+    {
+      auto start = clock::now();
+      waitResult = robust_lock::acquire_multiple(lockArr, len, waitAll, waitFor);
+      waitedNs = std::max<uint64_t>(ElapsedNs(start), 1);
+    }
+#endif
+
+    CountWait(handles.data(), len, waitAll, waitResult, waitedNs);
     args.GetReturnValue().Set(Integer::New(isolate, waitResult));
   }
-  
-  void mutex::Release(const v8::FunctionCallbackInfo<v8::Value> &args)
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    // Shared tail of waitAsync and waitMultipleAsync: take the mutexes now if
+    // we can, otherwise park the wait on the waiter pool
+    void StartAsyncWait(const FunctionCallbackInfo<Value> &args, std::vector<std::shared_ptr<mutex_handle>> &&handles, bool waitAll, DWORD ms, Local<Value> signalArg, const char *method)
+    {
+      auto isolate = args.GetIsolate();
+      auto context = isolate->GetCurrentContext();
+
+      Local<Object> signal;
+      if (!promise_request::read_signal(isolate, signalArg, signal))
+      {
+        isolate->ThrowException(Exception::TypeError(String::Concat(String::NewFromUtf8(isolate, "Wrong type arguments to "), String::NewFromUtf8(isolate, method))));
+        return;
+      }
+
+      if (handles.empty() || handles.size() > MAX_ASYNC_MUTEXES)
+      {
+        isolate->ThrowException(Exception::RangeError(String::Concat(String::NewFromUtf8(isolate, "Wrong number of mutexes passed to "), String::NewFromUtf8(isolate, method))));
+        return;
+      }
+
+      auto resolver = Promise::Resolver::New(context).ToLocalChecked();
+      args.GetReturnValue().Set(resolver->GetPromise());
+
+      if (promise_request::aborted(isolate, signal))
+      {
+        resolver->Reject(context, promise_request::abort_error(isolate)).FromJust();
+        return;
+      }
+
+      auto request = new mutex_wait_request(isolate, std::move(handles), waitAll, ms, resolver);
+
+      DWORD result = request->try_acquire();
+      if (result != WAIT_TIMEOUT || ms == 0)
+      {
+        if (result == WAIT_FAILED)
+        {
+          resolver->Reject(context, Exception::Error(String::NewFromUtf8(isolate, "Failed to wait on mutex"))).FromJust();
+        }
+        else
+        {
+          request->count(result, false);
+          resolver->Resolve(context, Integer::New(isolate, result)).FromJust();
+        }
+
+        delete request;
+        return;
+      }
+
+      if (!signal.IsEmpty())
+        request->listen(signal);
+
+      waiter_pool::instance().submit(request);
+    }
+  }
+
+  void mutex::WaitAsync(const v8::FunctionCallbackInfo<v8::Value> &args)
   {
     auto isolate = args.GetIsolate();
     auto obj = ObjectWrap::Unwrap<mutex>(args.Holder());
 
-    ReleaseMutex(obj->m_mutex);
+    DWORD ms = INFINITE;
+
+    if (args.Length() >= 1 && !args[0]->IsUndefined())
+    {
+      if (!args[0]->IsNumber())
+      {
+        isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to Mutex.waitAsync")));
+        return;
+      }
+
+      ms = args[0]->Uint32Value();
+    }
+
+    if (!obj->m_handle)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Mutex.waitAsync called on a closed mutex")));
+      return;
+    }
+
+    std::vector<std::shared_ptr<mutex_handle>> handles(1, obj->m_handle);
+    StartAsyncWait(args, std::move(handles), true, ms, args[1], "Mutex.waitAsync");
+  }
+
+  void mutex::WaitMultipleAsync(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < 3)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to Mutex.waitMultipleAsync")));
+      return;
+    }
+
+    if (!(
+      args[0]->IsArray() &&
+      args[1]->IsBoolean() &&
+      args[2]->IsNumber()))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to Mutex.waitMultipleAsync")));
+      return;
+    }
+
+    std::vector<std::shared_ptr<mutex_handle>> handles;
+    if (!ReadMutexList(isolate, args[0], handles, "Mutex.waitMultipleAsync"))
+      return;
+
+    StartAsyncWait(args, std::move(handles), args[1]->BooleanValue(), args[2]->Uint32Value(), args[3], "Mutex.waitMultipleAsync");
   }
 
   // ---------------------------------------------------------------------------
 
-  v8::Persistent<v8::Function> mutex::constructor;
+  void mutex::Release(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<mutex>(args.Holder());
+
+    if (!obj->m_handle)
+      return;
+
+    // Releasing a mutex the thread doesn't own does nothing, so don't count it
+#ifdef _WIN32
+    bool released = ReleaseMutex(obj->m_handle->handle) != FALSE;
+#else
+    bool released = obj->m_handle->lock->release();
+#endif
+
+    if (released)
+      obj->m_handle->stats->add(STAT_RELEASES);
+  }
+
+  void mutex::Stats(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<mutex>(args.Holder());
+
+    if (!obj->m_handle)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "Mutex.stats called on a closed mutex")));
+      return;
+    }
+
+    args.GetReturnValue().Set(obj->m_handle->stats.to_object(isolate));
+  }
 
   // ---------------------------------------------------------------------------
 
@@ -259,9 +950,12 @@ namespace node_filemap
     NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
     NODE_SET_PROTOTYPE_METHOD(tpl, "wait", Wait);
     NODE_SET_PROTOTYPE_METHOD(tpl, "waitMultiple", WaitMultiple);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "waitAsync", WaitAsync);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "waitMultipleAsync", WaitMultipleAsync);
     NODE_SET_PROTOTYPE_METHOD(tpl, "release", Release);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "stats", Stats);
 
-    constructor.Reset(isolate, tpl->GetFunction());
+    addon_data::current().set_template(CLASS_MUTEX, tpl);
     exports->Set(
       String::NewFromUtf8(isolate, "Mutex"),
       tpl->GetFunction());
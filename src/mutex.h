@@ -1,6 +1,6 @@
 // -----------------------------------------------------------------------------
 // Howard Hughes
-// Windows named mutex wrapped object for node_filemap
+// Named mutex wrapped object for node_filemap
 // -----------------------------------------------------------------------------
 
 #ifndef NODEJS_MUTEX_H
@@ -12,8 +12,16 @@
 
 #include <node.h>
 #include <node_object_wrap.h>
-#include <windows.h>
 #include <node_buffer.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "platform.h"
+#include "stats.h"
+
+#ifndef _WIN32
+#include "futex.h"
+#endif
 
 // -----------------------------------------------------------------------------
 
@@ -21,6 +29,28 @@ namespace node_filemap
 {
   // ---------------------------------------------------------------------------
 
+  // The OS object behind a Mutex. Async waits in flight hold on to it too, so
+  // closing the Mutex can't pull it out from under them. On Linux it's a
+  // robust_lock in its own little shared memory object.
+  struct mutex_handle
+  {
+    mutex_handle();
+    ~mutex_handle();
+
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    robust_lock *lock;
+    int fd;
+    std::string name; // The shm_open name, held with OpenName
+    bool created;
+#endif
+
+    stats_ref stats;
+  };
+
+  // ---------------------------------------------------------------------------
+
   class mutex : public node::ObjectWrap
   {
   public:
@@ -29,6 +59,7 @@ namespace node_filemap
 
     void create(const char *name, v8::Isolate *isolate);
     void open(const char *name, v8::Isolate *isolate);
+    void close();
 
     static void New(const v8::FunctionCallbackInfo<v8::Value>& args);
 
@@ -37,14 +68,17 @@ namespace node_filemap
     static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
     static void Wait(const v8::FunctionCallbackInfo<v8::Value> &args);
     static void WaitMultiple(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void WaitAsync(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void WaitMultipleAsync(const v8::FunctionCallbackInfo<v8::Value> &args);
     static void Release(const v8::FunctionCallbackInfo<v8::Value> &args);
-
-    static v8::Persistent<v8::Function> constructor;
+    static void Stats(const v8::FunctionCallbackInfo<v8::Value> &args);
 
     static void Init(v8::Local<v8::Object> exports);
 
   private:
-    HANDLE m_mutex;
+    static bool ReadMutexList(v8::Isolate *isolate, v8::Local<v8::Value> value, std::vector<std::shared_ptr<mutex_handle>> &handles, const char *method);
+
+    std::shared_ptr<mutex_handle> m_handle;
   };
 
   // ---------------------------------------------------------------------------
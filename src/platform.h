@@ -0,0 +1,101 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Platform definitions shared by the Windows and POSIX builds of node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_PLATFORM_H
+#define NODEJS_PLATFORM_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+#else
+
+#include <cstdint>
+#include <cerrno>
+#include <signal.h>
+#include <unistd.h>
+
+// The JS API hands back the Win32 wait codes, so define them with the same
+// values on platforms that don't have them
+typedef uint32_t DWORD;
+
+#define INFINITE         0xFFFFFFFF
+#define WAIT_OBJECT_0    0x00000000
+#define WAIT_ABANDONED   0x00000080
+#define WAIT_ABANDONED_0 0x00000080
+#define WAIT_TIMEOUT     0x00000102
+#define WAIT_FAILED      0xFFFFFFFF
+
+#endif
+
+#include <atomic>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // Tells the CPU we're in a spin loop
+  inline void cpu_relax()
+  {
+#if defined(_WIN32)
+    YieldProcessor();
+#elif defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+  }
+
+  // The size of a small page, what madvise, mlock and friends round to
+  inline size_t page_size()
+  {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+  }
+
+  inline uint32_t current_pid()
+  {
+#ifdef _WIN32
+    return GetCurrentProcessId();
+#else
+    return static_cast<uint32_t>(getpid());
+#endif
+  }
+
+  // Whether pid is gone for good. Errs on the side of alive, since taking
+  // over something a live process is using would corrupt it.
+  inline bool process_died(uint32_t pid)
+  {
+    if (pid == 0 || pid == current_pid())
+      return false;
+
+#ifdef _WIN32
+    HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, pid);
+    if (process == nullptr)
+      return GetLastError() == ERROR_INVALID_PARAMETER;
+
+    bool exited = WaitForSingleObject(process, 0) == WAIT_OBJECT_0;
+    CloseHandle(process);
+    return exited;
+#else
+    return kill(static_cast<pid_t>(pid), 0) != 0 && errno == ESRCH;
+#endif
+  }
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,547 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Single producer, single consumer ring buffer stored inside a file_mapping,
+// wrapped object for node_filemap
+// -----------------------------------------------------------------------------
+
+#include "ring_buffer.h"
+#include <cstring>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const uint64_t MIN_CAPACITY = 64;
+
+    void ThrowCorrupt(Isolate *isolate)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "RingBuffer contains a corrupt record")));
+    }
+
+    bool ReadCount(const FunctionCallbackInfo<Value> &args, int index, uint32_t &count)
+    {
+      if (args.Length() <= index)
+        return true;
+
+      if (!args[index]->IsNumber() || args[index]->IntegerValue() < 0)
+        return false;
+
+      auto value = args[index]->IntegerValue();
+      count = value > 0xFFFFFFFF ? 0xFFFFFFFF : static_cast<uint32_t>(value);
+      return true;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  ring_buffer::ring_buffer() :
+    m_capacity(0),
+    m_cachedTail(0),
+    m_cachedHead(0)
+  {
+  }
+
+  ring_header *ring_buffer::header(Isolate *isolate, const char *method) const
+  {
+    return reinterpret_cast<ring_header *>(memory(isolate, method));
+  }
+
+  bool ring_buffer::write(ring_header *ring, uint64_t &head, const char *data, uint64_t length)
+  {
+    auto capacity = m_capacity;
+    auto size = ring_header::record_size(length);
+    auto index = head & (capacity - 1);
+    auto skip = capacity - index < size ? capacity - index : 0;
+
+    if (head + skip + size - m_cachedTail > capacity)
+    {
+      m_cachedTail = ring->tail.load(std::memory_order_acquire);
+      if (head + skip + size - m_cachedTail > capacity)
+        return false;
+    }
+
+    auto base = ring->data();
+
+    if (skip != 0)
+    {
+      uint32_t wrap = ring_header::WRAP;
+      memcpy(base + index, &wrap, sizeof(wrap));
+      head += skip;
+      index = 0;
+    }
+
+    auto length32 = static_cast<uint32_t>(length);
+    memcpy(base + index, &length32, sizeof(length32));
+    memcpy(base + index + ring_header::RECORD_HEADER, data, static_cast<size_t>(length));
+    head += size;
+    return true;
+  }
+
+  const char *ring_buffer::read(ring_header *ring, uint64_t tail, uint32_t &length, uint64_t &next, bool &corrupt)
+  {
+    corrupt = false;
+
+    if (tail == m_cachedHead)
+    {
+      m_cachedHead = ring->head.load(std::memory_order_acquire);
+      if (tail == m_cachedHead)
+        return nullptr;
+    }
+
+    auto capacity = m_capacity;
+    auto base = ring->data();
+    auto index = tail & (capacity - 1);
+
+    memcpy(&length, base + index, sizeof(length));
+
+    if (length == ring_header::WRAP)
+    {
+      tail += capacity - index;
+      index = 0;
+      memcpy(&length, base, sizeof(length));
+    }
+
+    // The other side can write anything into the mapping, so don't trust it
+    // to send us past the end of the ring
+    if (length > ring_header::max_length(capacity) || tail + ring_header::record_size(length) > m_cachedHead)
+    {
+      corrupt = true;
+      return nullptr;
+    }
+
+    next = tail + ring_header::record_size(length);
+    return base + index + ring_header::RECORD_HEADER;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void ring_buffer::Create(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    if (!read_mapping_args(args, 3, "RingBuffer.create"))
+      return;
+
+    if (!args[2]->IsNumber())
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RingBuffer.create")));
+      return;
+    }
+
+    auto capacity = args[2]->IntegerValue();
+    if (capacity < static_cast<int64_t>(MIN_CAPACITY) || (capacity & (capacity - 1)) != 0)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Capacity must be a power of two of at least 64 in RingBuffer.create")));
+      return;
+    }
+
+    if (!obj->attach(isolate, args[0], args[1], sizeof(ring_header) + capacity, 64, "RingBuffer.create"))
+      return;
+
+    auto ring = obj->header(isolate, "RingBuffer.create");
+    ring->magic = ring_header::MAGIC;
+    ring->version = ring_header::VERSION;
+    ring->capacity = static_cast<uint64_t>(capacity);
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tail.store(0, std::memory_order_release);
+
+    obj->m_capacity = ring->capacity;
+    obj->m_cachedTail = 0;
+    obj->m_cachedHead = 0;
+  }
+
+  void ring_buffer::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "RingBuffer.open"))
+      return;
+
+    auto describe = [](const ring_header &ring, uint64_t &capacity) -> uint64_t
+    {
+      capacity = ring.capacity;
+      bool valid = ring.magic == ring_header::MAGIC && ring.version == ring_header::VERSION &&
+        capacity >= MIN_CAPACITY && (capacity & (capacity - 1)) == 0;
+
+      return valid ? sizeof(ring_header) + capacity : 0;
+    };
+
+    uint64_t capacity;
+    if (!obj->attach_existing<ring_header>(isolate, args[0], args[1], capacity, describe, "RingBuffer.open"))
+      return;
+
+    auto ring = obj->header(isolate, "RingBuffer.open");
+    obj->m_capacity = capacity;
+    obj->m_cachedTail = ring->tail.load(std::memory_order_acquire);
+    obj->m_cachedHead = ring->head.load(std::memory_order_acquire);
+  }
+
+  void ring_buffer::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    obj->detach();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void ring_buffer::Push(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to RingBuffer.push")));
+      return;
+    }
+
+    if (!node::Buffer::HasInstance(args[0]))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RingBuffer.push")));
+      return;
+    }
+
+    auto ring = obj->header(isolate, "RingBuffer.push");
+    if (ring == nullptr)
+      return;
+
+    auto length = node::Buffer::Length(args[0]);
+    if (length > ring_header::max_length(obj->m_capacity))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Message is too large for RingBuffer.push")));
+      return;
+    }
+
+    auto head = ring->head.load(std::memory_order_relaxed);
+    auto pushed = obj->write(ring, head, node::Buffer::Data(args[0]), length);
+    if (pushed)
+      ring->head.store(head, std::memory_order_release);
+
+    args.GetReturnValue().Set(pushed);
+  }
+
+  void ring_buffer::PushBatch(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to RingBuffer.pushBatch")));
+      return;
+    }
+
+    if (!args[0]->IsArray())
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RingBuffer.pushBatch")));
+      return;
+    }
+
+    auto ring = obj->header(isolate, "RingBuffer.pushBatch");
+    if (ring == nullptr)
+      return;
+
+    auto list = Local<Array>::Cast(args[0]);
+    auto count = list->Length();
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+      auto item = list->Get(i);
+      if (!node::Buffer::HasInstance(item))
+      {
+        isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RingBuffer.pushBatch")));
+        return;
+      }
+
+      if (node::Buffer::Length(item) > ring_header::max_length(obj->m_capacity))
+      {
+        isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Message is too large for RingBuffer.pushBatch")));
+        return;
+      }
+    }
+
+    // Publish the whole batch with one store, so the consumer's cache line
+    // only bounces once
+    auto head = ring->head.load(std::memory_order_relaxed);
+    uint32_t pushed = 0;
+
+    while (pushed < count)
+    {
+      auto item = list->Get(pushed);
+      if (!obj->write(ring, head, node::Buffer::Data(item), node::Buffer::Length(item)))
+        break;
+      pushed++;
+    }
+
+    if (pushed != 0)
+      ring->head.store(head, std::memory_order_release);
+
+    args.GetReturnValue().Set(Integer::NewFromUnsigned(isolate, pushed));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void ring_buffer::Pop(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    auto ring = obj->header(isolate, "RingBuffer.pop");
+    if (ring == nullptr)
+      return;
+
+    uint32_t length;
+    uint64_t next;
+    bool corrupt;
+
+    auto data = obj->read(ring, ring->tail.load(std::memory_order_relaxed), length, next, corrupt);
+    if (data == nullptr)
+    {
+      if (corrupt)
+        ThrowCorrupt(isolate);
+      else
+        args.GetReturnValue().SetNull();
+      return;
+    }
+
+    auto buffer = node::Buffer::Copy(isolate, data, length).ToLocalChecked();
+    ring->tail.store(next, std::memory_order_release);
+
+    args.GetReturnValue().Set(buffer);
+  }
+
+  void ring_buffer::PopBatch(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    uint32_t max = 0xFFFFFFFF;
+    if (!ReadCount(args, 0, max))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RingBuffer.popBatch")));
+      return;
+    }
+
+    auto ring = obj->header(isolate, "RingBuffer.popBatch");
+    if (ring == nullptr)
+      return;
+
+    auto list = Array::New(isolate);
+    auto tail = ring->tail.load(std::memory_order_relaxed);
+    uint32_t popped = 0;
+
+    while (popped < max)
+    {
+      uint32_t length;
+      uint64_t next;
+      bool corrupt;
+
+      auto data = obj->read(ring, tail, length, next, corrupt);
+      if (data == nullptr)
+      {
+        if (corrupt)
+        {
+          ThrowCorrupt(isolate);
+          return;
+        }
+        break;
+      }
+
+      list->Set(popped++, node::Buffer::Copy(isolate, data, length).ToLocalChecked());
+      tail = next;
+    }
+
+    if (popped != 0)
+      ring->tail.store(tail, std::memory_order_release);
+
+    args.GetReturnValue().Set(list);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void ring_buffer::Peek(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    auto ring = obj->header(isolate, "RingBuffer.peek");
+    if (ring == nullptr)
+      return;
+
+    uint32_t length;
+    uint64_t next;
+    bool corrupt;
+
+    auto data = obj->read(ring, ring->tail.load(std::memory_order_relaxed), length, next, corrupt);
+    if (data == nullptr)
+    {
+      if (corrupt)
+        ThrowCorrupt(isolate);
+      else
+        args.GetReturnValue().SetNull();
+      return;
+    }
+
+    args.GetReturnValue().Set(obj->view(isolate, data - reinterpret_cast<char *>(ring), length));
+  }
+
+  void ring_buffer::PeekBatch(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    uint32_t max = 0xFFFFFFFF;
+    if (!ReadCount(args, 0, max))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RingBuffer.peekBatch")));
+      return;
+    }
+
+    auto ring = obj->header(isolate, "RingBuffer.peekBatch");
+    if (ring == nullptr)
+      return;
+
+    auto list = Array::New(isolate);
+    auto tail = ring->tail.load(std::memory_order_relaxed);
+    uint32_t peeked = 0;
+
+    while (peeked < max)
+    {
+      uint32_t length;
+      uint64_t next;
+      bool corrupt;
+
+      auto data = obj->read(ring, tail, length, next, corrupt);
+      if (data == nullptr)
+      {
+        if (corrupt)
+        {
+          ThrowCorrupt(isolate);
+          return;
+        }
+        break;
+      }
+
+      list->Set(peeked++, obj->view(isolate, data - reinterpret_cast<char *>(ring), length));
+      tail = next;
+    }
+
+    args.GetReturnValue().Set(list);
+  }
+
+  void ring_buffer::Consume(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    uint32_t count = 1;
+    if (!ReadCount(args, 0, count))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RingBuffer.consume")));
+      return;
+    }
+
+    auto ring = obj->header(isolate, "RingBuffer.consume");
+    if (ring == nullptr)
+      return;
+
+    auto tail = ring->tail.load(std::memory_order_relaxed);
+    uint32_t consumed = 0;
+
+    while (consumed < count)
+    {
+      uint32_t length;
+      uint64_t next;
+      bool corrupt;
+
+      if (obj->read(ring, tail, length, next, corrupt) == nullptr)
+      {
+        if (corrupt)
+        {
+          ThrowCorrupt(isolate);
+          return;
+        }
+        break;
+      }
+
+      consumed++;
+      tail = next;
+    }
+
+    if (consumed != 0)
+      ring->tail.store(tail, std::memory_order_release);
+
+    args.GetReturnValue().Set(Integer::NewFromUnsigned(isolate, consumed));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void ring_buffer::Capacity(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    auto ring = obj->header(isolate, "RingBuffer.capacity");
+    if (ring == nullptr)
+      return;
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(obj->m_capacity)));
+  }
+
+  void ring_buffer::Used(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<ring_buffer>(args.Holder());
+
+    auto ring = obj->header(isolate, "RingBuffer.used");
+    if (ring == nullptr)
+      return;
+
+    auto tail = ring->tail.load(std::memory_order_acquire);
+    auto head = ring->head.load(std::memory_order_acquire);
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(head - tail)));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void ring_buffer::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<ring_buffer>, String::NewFromUtf8(isolate, "RingBuffer"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "RingBuffer"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "HEADER_SIZE"), Integer::New(isolate, sizeof(ring_header)));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "push", Push);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "pushBatch", PushBatch);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "pop", Pop);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "popBatch", PopBatch);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "peek", Peek);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "peekBatch", PeekBatch);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "consume", Consume);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "capacity", Capacity);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "used", Used);
+
+    exports->Set(
+      String::NewFromUtf8(isolate, "RingBuffer"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,121 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Single producer, single consumer ring buffer stored inside a file_mapping,
+// wrapped object for node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_RING_BUFFER_H
+#define NODEJS_RING_BUFFER_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <node_buffer.h>
+#include <atomic>
+#include <cstdint>
+#include "mapped_object.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // The shared part of a ring buffer. The producer only writes head and the
+  // consumer only writes tail, each on its own cache line, so the two never
+  // fight over a line and neither needs a lock. Positions count bytes ever
+  // pushed and never wrap - the slot is position & (capacity - 1).
+  //
+  // Each record is a 32 bit length followed by the data, padded to 8 bytes.
+  // Records never straddle the end of the ring: if one doesn't fit, a WRAP
+  // marker fills the rest and the record starts again at the beginning.
+  struct ring_header
+  {
+    static const uint32_t MAGIC = 0x52696e67; // 'Ring'
+    static const uint32_t VERSION = 1;
+    static const uint32_t WRAP = 0xFFFFFFFF;
+    static const uint64_t RECORD_HEADER = 4;
+    static const uint64_t ALIGNMENT = 8;
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    char pad0[48];
+
+    std::atomic<uint64_t> head;
+    char pad1[56];
+
+    std::atomic<uint64_t> tail;
+    char pad2[56];
+
+    // Space a record of length bytes takes up in the ring
+    static uint64_t record_size(uint64_t length)
+    {
+      return (RECORD_HEADER + length + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+    // The largest record that always fits, however full the ring was when it
+    // was pushed
+    static uint64_t max_length(uint64_t capacity)
+    {
+      auto length = capacity / 2 - RECORD_HEADER;
+      return length < node::Buffer::kMaxLength ? length : node::Buffer::kMaxLength;
+    }
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+  };
+
+  static_assert(sizeof(ring_header) == 192, "ring_header must take exactly three cache lines");
+
+  // ---------------------------------------------------------------------------
+
+  class ring_buffer : public mapped_object
+  {
+  public:
+    ring_buffer();
+
+    static void Create(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Push(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void PushBatch(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Pop(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void PopBatch(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Peek(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void PeekBatch(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Consume(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Capacity(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Used(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+  private:
+    ring_header *header(v8::Isolate *isolate, const char *method) const;
+
+    // Producer side. Copies length bytes into the ring without publishing
+    // them, advancing head. false if there's no room.
+    bool write(ring_header *ring, uint64_t &head, const char *data, uint64_t length);
+
+    // Consumer side. Finds the record at tail (skipping a WRAP marker), or
+    // returns null if the ring is empty. next is where the record after it
+    // starts. Sets corrupt if the record doesn't make sense.
+    const char *read(ring_header *ring, uint64_t tail, uint32_t &length, uint64_t &next, bool &corrupt);
+
+    // Read once when we attach - the other side can scribble over the header,
+    // but mustn't be able to send us outside the memory we attached to
+    uint64_t m_capacity;
+
+    // Cached copies of the other side's position, so we only touch its cache
+    // line when the ring looks full (or empty)
+    uint64_t m_cachedTail;
+    uint64_t m_cachedHead;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
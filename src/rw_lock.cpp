@@ -0,0 +1,571 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Reader/writer lock stored inside a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#include "rw_lock.h"
+#include "deadline.h"
+#include "js_helpers.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <thread>
+
+#ifdef __linux__
+#include "futex.h"
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const uint32_t DEFAULT_SLOTS = 64;
+    const uint32_t MAX_SLOTS = 4096;
+
+    const int SPINS_BEFORE_SLEEP = 100;
+
+    // How long to sleep before looking for a dead process holding us up
+    const DWORD OWNER_CHECK_MS = 100;
+
+    bool ReadSlotCount(Local<Value> value, uint32_t &result)
+    {
+      if (value->IsUndefined())
+      {
+        result = DEFAULT_SLOTS;
+        return true;
+      }
+
+      if (!value->IsNumber() || value->NumberValue() < 1 || value->NumberValue() > MAX_SLOTS)
+        return false;
+
+      result = value->Uint32Value();
+      return true;
+    }
+
+    uint64_t TotalSize(uint32_t slotCount)
+    {
+      return sizeof(rw_header) + static_cast<uint64_t>(slotCount) * sizeof(rw_slot);
+    }
+
+    // Tells apart the threads of one process, for the write lock's owner
+    uint32_t ThreadToken()
+    {
+      static std::atomic<uint32_t> next(1);
+      thread_local uint32_t token = next.fetch_add(1);
+      return token;
+    }
+
+    uint32_t SlotOwner(uint64_t state) { return static_cast<uint32_t>(state >> 32); }
+    uint32_t SlotCount(uint64_t state) { return static_cast<uint32_t>(state); }
+
+    // Sleeps while *word is expected. Only Linux has a process shared wait on
+    // an arbitrary word, so elsewhere we look again in a millisecond.
+    void SleepOn(std::atomic<uint32_t> *word, uint32_t expected, const wait_deadline &until)
+    {
+#ifdef __linux__
+      futex_wait(word, expected, until);
+#else
+      if (word->load() == expected)
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::min<DWORD>(until.remaining_ms(), 1)));
+#endif
+    }
+
+    void WakeAll(std::atomic<uint32_t> *word)
+    {
+#ifdef __linux__
+      futex_wake(word, INT_MAX);
+#else
+      (void)word;
+#endif
+    }
+
+    // Lets everyone waiting for writer to go back to 0 look again
+    void OpenGate(rw_header *lock)
+    {
+      lock->gate.fetch_add(1);
+      if (lock->gateWaiters.exchange(0) != 0)
+        WakeAll(&lock->gate);
+    }
+
+    // Sleeps until the gate opens, unless writer already moved on
+    void WaitAtGate(rw_header *lock, uint32_t writer, const wait_deadline &until)
+    {
+      auto gate = lock->gate.load();
+      lock->gateWaiters.store(1);
+
+      if (lock->writer.load() == writer)
+        SleepOn(&lock->gate, gate, until);
+    }
+
+    // Clears the lock of a writer that died waiting for it or holding it.
+    // Only one process gets to, by swapping in RECOVERING.
+    void RecoverWriter(rw_header *lock, uint32_t writer)
+    {
+      if (writer == 0 || writer == rw_header::RECOVERING || !process_died(writer))
+        return;
+
+      if (!lock->writer.compare_exchange_strong(writer, rw_header::RECOVERING))
+        return;
+
+      if (lock->held.load() != 0)
+        lock->abandoned.store(1);
+
+      lock->held.store(0);
+      lock->writerThread.store(0);
+      lock->writer.store(0);
+      OpenGate(lock);
+    }
+
+    // WAIT_ABANDONED for the first one in after a writer died holding the lock
+    DWORD Taken(rw_header *lock)
+    {
+      if (lock->abandoned.load(std::memory_order_relaxed) != 0 && lock->abandoned.exchange(0) != 0)
+        return WAIT_ABANDONED;
+
+      return WAIT_OBJECT_0;
+    }
+
+    // Spaces out the checks for dead lock holders while we wait
+    struct owner_check
+    {
+      wait_deadline next = wait_deadline::after(OWNER_CHECK_MS);
+
+      bool due()
+      {
+        if (!next.expired())
+          return false;
+
+        next = wait_deadline::after(OWNER_CHECK_MS);
+        return true;
+      }
+    };
+  }
+
+  // ---------------------------------------------------------------------------
+
+  rw_lock::rw_lock() :
+    m_slotCount(0),
+    m_hint(0)
+  {
+  }
+
+  rw_header *rw_lock::header(Isolate *isolate, const char *method) const
+  {
+    return reinterpret_cast<rw_header *>(memory(isolate, method));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  // The slot CAS and the writer loads and stores are all sequentially
+  // consistent, so a reader adding itself and a writer announcing itself
+  // can't both miss each other: either the reader sees the writer and backs
+  // out, or the writer sees the reader and waits for it.
+  bool rw_lock::enter(rw_header *lock)
+  {
+    auto self = current_pid();
+    auto all = slots(lock);
+
+    // Our own slot or a free one first, and only if they're all taken look
+    // for one a dead process left behind
+    for (int pass = 0; pass < 2; ++pass)
+    {
+      for (uint32_t i = 0; i < m_slotCount; ++i)
+      {
+        auto index = (m_hint + i) % m_slotCount;
+        auto &slot = all[index];
+        auto state = slot.state.load(std::memory_order_relaxed);
+
+        for (;;)
+        {
+          auto owner = SlotOwner(state);
+          uint64_t next;
+
+          if (owner == self)
+            next = state + 1;
+          else if (owner == 0 || (pass == 1 && process_died(owner)))
+            next = (static_cast<uint64_t>(self) << 32) | 1;
+          else
+            break;
+
+          if (slot.state.compare_exchange_weak(state, next, std::memory_order_seq_cst, std::memory_order_relaxed))
+          {
+            m_hint = index;
+            return true;
+          }
+        }
+      }
+    }
+
+    return false;
+  }
+
+  bool rw_lock::leave(rw_header *lock)
+  {
+    auto self = current_pid();
+    auto all = slots(lock);
+
+    for (uint32_t i = 0; i < m_slotCount; ++i)
+    {
+      auto &slot = all[(m_hint + i) % m_slotCount];
+      auto state = slot.state.load(std::memory_order_relaxed);
+
+      while (SlotOwner(state) == self)
+      {
+        // The last lock out gives the slot up
+        uint64_t next = SlotCount(state) == 1 ? 0 : state - 1;
+
+        if (slot.state.compare_exchange_weak(state, next, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+          if (next == 0 && lock->writer.load() != 0)
+          {
+            lock->drain.fetch_add(1);
+            WakeAll(&lock->drain);
+          }
+
+          return true;
+        }
+      }
+    }
+
+    return false;
+  }
+
+  bool rw_lock::drained(rw_header *lock, bool reclaim)
+  {
+    auto all = slots(lock);
+    bool busy = false;
+
+    for (uint32_t i = 0; i < m_slotCount; ++i)
+    {
+      auto state = all[i].state.load();
+      if (state == 0)
+        continue;
+
+      if (reclaim && process_died(SlotOwner(state)) && all[i].state.compare_exchange_strong(state, 0))
+        continue;
+
+      busy = true;
+    }
+
+    return !busy;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  DWORD rw_lock::acquire_read(rw_header *lock, DWORD ms)
+  {
+    auto deadline = wait_deadline::after(ms);
+    owner_check check;
+    int spins = 0;
+
+    for (;;)
+    {
+      auto writer = lock->writer.load();
+
+      if (writer == 0)
+      {
+        if (enter(lock))
+        {
+          if (lock->writer.load() == 0)
+            return Taken(lock);
+
+          // A writer got in between, and it goes first
+          leave(lock);
+          continue;
+        }
+
+        // Every slot is in use by another live process
+        if (ms == 0 || deadline.expired())
+          return WAIT_TIMEOUT;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        continue;
+      }
+
+      if (ms == 0 || deadline.expired())
+        return WAIT_TIMEOUT;
+
+      if (++spins < SPINS_BEFORE_SLEEP)
+      {
+        cpu_relax();
+        continue;
+      }
+
+      if (check.due())
+        RecoverWriter(lock, writer);
+      else
+        WaitAtGate(lock, writer, wait_deadline::earliest(deadline, check.next));
+    }
+  }
+
+  DWORD rw_lock::acquire_write(rw_header *lock, DWORD ms)
+  {
+    auto self = current_pid();
+    auto thread = ThreadToken();
+
+    // Not recursive - it would wait for itself forever
+    if (lock->writer.load(std::memory_order_relaxed) == self && lock->writerThread.load(std::memory_order_relaxed) == thread)
+      return WAIT_FAILED;
+
+    auto deadline = wait_deadline::after(ms);
+    owner_check check;
+    int spins = 0;
+
+    // Announce ourselves, which stops new readers
+    for (;;)
+    {
+      uint32_t writer = 0;
+      if (lock->writer.compare_exchange_strong(writer, self))
+        break;
+
+      if (ms == 0 || deadline.expired())
+        return WAIT_TIMEOUT;
+
+      if (++spins < SPINS_BEFORE_SLEEP)
+      {
+        cpu_relax();
+        continue;
+      }
+
+      if (check.due())
+        RecoverWriter(lock, writer);
+      else
+        WaitAtGate(lock, writer, wait_deadline::earliest(deadline, check.next));
+    }
+
+    lock->writerThread.store(thread);
+
+    // Then wait for the readers already in to leave
+    check = owner_check();
+    spins = 0;
+
+    for (;;)
+    {
+      auto drain = lock->drain.load();
+
+      if (drained(lock, check.due()))
+      {
+        lock->held.store(1);
+        return Taken(lock);
+      }
+
+      if (ms == 0 || deadline.expired())
+        break;
+
+      if (++spins < SPINS_BEFORE_SLEEP)
+      {
+        cpu_relax();
+        continue;
+      }
+
+      SleepOn(&lock->drain, drain, wait_deadline::earliest(deadline, check.next));
+    }
+
+    // Timed out: let the readers back in
+    lock->writerThread.store(0);
+    lock->writer.store(0);
+    OpenGate(lock);
+    return WAIT_TIMEOUT;
+  }
+
+  bool rw_lock::release_write(rw_header *lock)
+  {
+    if (lock->writer.load() != current_pid() || lock->writerThread.load() != ThreadToken() || lock->held.load() == 0)
+      return false;
+
+    lock->held.store(0);
+    lock->writerThread.store(0);
+    lock->writer.store(0);
+    OpenGate(lock);
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void rw_lock::Size(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    uint32_t slotCount;
+    if (!ReadSlotCount(args[0], slotCount))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RwLock.size")));
+      return;
+    }
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(TotalSize(slotCount))));
+  }
+
+  void rw_lock::Create(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<rw_lock>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "RwLock.create"))
+      return;
+
+    uint32_t slotCount;
+    if (!ReadSlotCount(args[2], slotCount))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RwLock.create")));
+      return;
+    }
+
+    if (!obj->attach(isolate, args[0], args[1], TotalSize(slotCount), 64, "RwLock.create"))
+      return;
+
+    auto lock = obj->header(isolate, "RwLock.create");
+    memset(static_cast<void *>(lock), 0, static_cast<size_t>(TotalSize(slotCount)));
+    lock->slotCount = slotCount;
+    lock->version = rw_header::VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    lock->magic = rw_header::MAGIC;
+
+    obj->m_slotCount = slotCount;
+    obj->m_hint = static_cast<uint32_t>((current_pid() * 2654435761ull) % slotCount);
+  }
+
+  void rw_lock::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<rw_lock>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "RwLock.open"))
+      return;
+
+    auto describe = [](const rw_header &lock, uint32_t &slotCount) -> uint64_t
+    {
+      slotCount = lock.slotCount;
+      bool valid = lock.magic == rw_header::MAGIC && lock.version == rw_header::VERSION && slotCount >= 1 && slotCount <= MAX_SLOTS;
+      return valid ? TotalSize(slotCount) : 0;
+    };
+
+    uint32_t slotCount;
+    if (!obj->attach_existing<rw_header>(isolate, args[0], args[1], slotCount, describe, "RwLock.open"))
+      return;
+
+    obj->m_slotCount = slotCount;
+    obj->m_hint = static_cast<uint32_t>((current_pid() * 2654435761ull) % slotCount);
+  }
+
+  void rw_lock::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<rw_lock>(args.Holder());
+
+    obj->detach();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void rw_lock::WaitRead(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<rw_lock>(args.Holder());
+
+    DWORD ms;
+    if (!ReadTimeout(args[0], ms))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RwLock.waitRead")));
+      return;
+    }
+
+    auto lock = obj->header(isolate, "RwLock.waitRead");
+    if (lock == nullptr)
+      return;
+
+    args.GetReturnValue().Set(Integer::New(isolate, obj->acquire_read(lock, ms)));
+  }
+
+  void rw_lock::ReleaseRead(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<rw_lock>(args.Holder());
+
+    auto lock = obj->header(isolate, "RwLock.releaseRead");
+    if (lock == nullptr)
+      return;
+
+    if (!obj->leave(lock))
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "RwLock.releaseRead called by a process that doesn't hold a read lock")));
+      return;
+    }
+  }
+
+  void rw_lock::WaitWrite(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<rw_lock>(args.Holder());
+
+    DWORD ms;
+    if (!ReadTimeout(args[0], ms))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to RwLock.waitWrite")));
+      return;
+    }
+
+    auto lock = obj->header(isolate, "RwLock.waitWrite");
+    if (lock == nullptr)
+      return;
+
+    DWORD result = obj->acquire_write(lock, ms);
+    if (result == WAIT_FAILED)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "RwLock.waitWrite called by the thread that holds the write lock")));
+      return;
+    }
+
+    args.GetReturnValue().Set(Integer::New(isolate, result));
+  }
+
+  void rw_lock::ReleaseWrite(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<rw_lock>(args.Holder());
+
+    auto lock = obj->header(isolate, "RwLock.releaseWrite");
+    if (lock == nullptr)
+      return;
+
+    if (!obj->release_write(lock))
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "RwLock.releaseWrite called by a thread that doesn't hold the write lock")));
+      return;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void rw_lock::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<rw_lock>, String::NewFromUtf8(isolate, "RwLock"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "RwLock"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "size"), FunctionTemplate::New(isolate, Size));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "waitRead", WaitRead);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "releaseRead", ReleaseRead);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "waitWrite", WaitWrite);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "releaseWrite", ReleaseWrite);
+
+    exports->Set(
+      String::NewFromUtf8(isolate, "RwLock"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,118 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Reader/writer lock stored inside a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_RW_LOCK_H
+#define NODEJS_RW_LOCK_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <atomic>
+#include <cstdint>
+#include "mapped_object.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // Shared and exclusive locking for read-mostly data. Readers don't share a
+  // counter: each process counts its read locks in a slot of its own, on its
+  // own cache line, so readers in different processes never touch the same
+  // memory and don't slow each other down. A writer announces itself in the
+  // header, which turns new readers away, then waits for the slots to drain.
+  //
+  // Writers are preferred: once one is waiting no new read locks are granted,
+  // so a steady stream of readers can't starve it.
+  //
+  // Slots and the writer word hold pids, so when a process dies holding the
+  // lock the next one to run into it takes it back. A dead reader's locks are
+  // just dropped; a dead writer's lock is reported as WAIT_ABANDONED to
+  // whoever gets the lock next, since the data may be half written.
+  struct rw_header
+  {
+    static const uint32_t MAGIC = 0x52774c6b; // 'RwLk'
+    static const uint32_t VERSION = 1;
+    static const uint32_t RECOVERING = 0xFFFFFFFF; // writer while someone clears up after a dead one
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    std::atomic<uint32_t> abandoned; // A writer died holding the lock, and no one's been told yet
+
+    std::atomic<uint32_t> writer;       // pid of the writer holding or waiting for the lock, 0 or RECOVERING
+    std::atomic<uint32_t> writerThread; // Which of the writer's threads, so others can't release it
+    std::atomic<uint32_t> held;         // 1 once the writer has drained the readers
+    std::atomic<uint32_t> gate;         // Moves on whenever writer goes back to 0
+    std::atomic<uint32_t> gateWaiters;  // Someone may be asleep on gate
+    std::atomic<uint32_t> drain;        // Moves on when a reader leaves while a writer waits
+    char pad[24];
+  };
+
+  static_assert(sizeof(rw_header) == 64, "rw_header must take exactly one cache line");
+
+  struct rw_slot
+  {
+    std::atomic<uint64_t> state; // pid in the top 32 bits, that process's read locks below
+    char pad[56];
+  };
+
+  static_assert(sizeof(rw_slot) == 64, "rw_slot must take exactly one cache line");
+
+  // ---------------------------------------------------------------------------
+
+  class rw_lock : public mapped_object
+  {
+  public:
+    rw_lock();
+
+    static void Create(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void WaitRead(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void ReleaseRead(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void WaitWrite(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void ReleaseWrite(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Size(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+  private:
+    rw_header *header(v8::Isolate *isolate, const char *method) const;
+    rw_slot *slots(rw_header *lock) const { return reinterpret_cast<rw_slot *>(lock + 1); }
+
+    // WAIT_OBJECT_0, WAIT_ABANDONED or WAIT_TIMEOUT
+    DWORD acquire_read(rw_header *lock, DWORD ms);
+    DWORD acquire_write(rw_header *lock, DWORD ms);
+
+    // false if the calling thread doesn't hold the write lock
+    bool release_write(rw_header *lock);
+
+    // Adds a read lock to our process's slot, claiming one if we don't have
+    // one. false if every slot belongs to another live process.
+    bool enter(rw_header *lock);
+
+    // Takes a read lock back out, letting a waiting writer know if that
+    // drained our slot. false if we have no read locks.
+    bool leave(rw_header *lock);
+
+    // Whether none of the slots have read locks, dropping the locks of dead
+    // readers first when reclaim is set
+    bool drained(rw_header *lock, bool reclaim);
+
+    uint32_t m_slotCount;
+    uint32_t m_hint;      // Where our process's slot search starts
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,287 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Seqlock protected region stored inside a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#include "seq_lock.h"
+#include "deadline.h"
+#include "js_helpers.h"
+#include <node_buffer.h>
+#include <cstring>
+#include <thread>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    // How long a reader spins on an odd sequence before giving its time
+    // slice up, in case the writer was descheduled mid write
+    const int SPINS_BEFORE_YIELD = 1000;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  seq_lock::seq_lock() :
+    m_size(0)
+  {
+  }
+
+  seq_header *seq_lock::header(Isolate *isolate, const char *method) const
+  {
+    return reinterpret_cast<seq_header *>(memory(isolate, method));
+  }
+
+  uint64_t seq_lock::write(seq_header *seq, uint64_t offset, const char *data, uint64_t length)
+  {
+    // Only the writer changes the sequence, so it doesn't need a CAS
+    auto sequence = seq->sequence.load(std::memory_order_relaxed) | 1;
+
+    seq->sequence.store(sequence, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    memcpy(seq->data() + offset, data, static_cast<size_t>(length));
+
+    seq->sequence.store(sequence + 1, std::memory_order_release);
+    return sequence + 1;
+  }
+
+  bool seq_lock::read(seq_header *seq, char *dest, uint64_t length, DWORD ms, uint64_t &sequence)
+  {
+    int spins = 0;
+    bool timed = false;
+    wait_deadline deadline;
+
+    for (;;)
+    {
+      auto before = seq->sequence.load(std::memory_order_acquire);
+
+      if ((before & 1) == 0)
+      {
+        // memcpy picks the widest vector copy the CPU has. It may see a torn
+        // value while the writer is busy, but then the sequence will have
+        // moved and we throw the copy away.
+        memcpy(dest, seq->data(), static_cast<size_t>(length));
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (seq->sequence.load(std::memory_order_relaxed) == before)
+        {
+          sequence = before;
+          return true;
+        }
+      }
+
+      if (ms == 0)
+        return false;
+
+      if (++spins < SPINS_BEFORE_YIELD)
+      {
+        cpu_relax();
+      }
+      else
+      {
+        // Only start the clock once the writer has held us up for a while,
+        // so a copy that has to go again once or twice doesn't pay for it
+        if (!timed)
+        {
+          deadline = wait_deadline::after(ms);
+          timed = true;
+        }
+        else if (deadline.expired())
+        {
+          return false;
+        }
+
+        std::this_thread::yield();
+        spins = 0;
+      }
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void seq_lock::Create(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<seq_lock>(args.Holder());
+
+    if (!read_mapping_args(args, 3, "SeqLock.create"))
+      return;
+
+    uint64_t size;
+    if (!read_uint(args[2], UINT64_MAX, size))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to SeqLock.create")));
+      return;
+    }
+
+    if (!obj->attach(isolate, args[0], args[1], sizeof(seq_header) + size, 64, "SeqLock.create"))
+      return;
+
+    auto seq = obj->header(isolate, "SeqLock.create");
+    seq->magic = seq_header::MAGIC;
+    seq->version = seq_header::VERSION;
+    seq->size = size;
+    seq->sequence.store(0, std::memory_order_release);
+
+    obj->m_size = size;
+  }
+
+  void seq_lock::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<seq_lock>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "SeqLock.open"))
+      return;
+
+    auto describe = [](const seq_header &seq, uint64_t &size) -> uint64_t
+    {
+      size = seq.size;
+      bool valid = seq.magic == seq_header::MAGIC && seq.version == seq_header::VERSION && size <= UINT64_MAX - sizeof(seq_header);
+      return valid ? sizeof(seq_header) + size : 0;
+    };
+
+    uint64_t size;
+    if (!obj->attach_existing<seq_header>(isolate, args[0], args[1], size, describe, "SeqLock.open"))
+      return;
+
+    obj->m_size = size;
+  }
+
+  void seq_lock::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<seq_lock>(args.Holder());
+
+    obj->detach();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void seq_lock::Publish(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<seq_lock>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to SeqLock.publish")));
+      return;
+    }
+
+    uint64_t offset = 0;
+    if (!node::Buffer::HasInstance(args[0]) || (args.Length() > 1 && !read_uint(args[1], UINT64_MAX, offset)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to SeqLock.publish")));
+      return;
+    }
+
+    auto seq = obj->header(isolate, "SeqLock.publish");
+    if (seq == nullptr)
+      return;
+
+    auto length = node::Buffer::Length(args[0]);
+    if (offset > obj->m_size || length > obj->m_size - offset)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Buffer doesn't fit in the region in SeqLock.publish")));
+      return;
+    }
+
+    auto sequence = write(seq, offset, node::Buffer::Data(args[0]), length);
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(sequence)));
+  }
+
+  void seq_lock::Snapshot(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<seq_lock>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to SeqLock.snapshot")));
+      return;
+    }
+
+    DWORD ms = INFINITE;
+    if (!node::Buffer::HasInstance(args[0]) || (args.Length() > 1 && !ReadTimeout(args[1], ms)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to SeqLock.snapshot")));
+      return;
+    }
+
+    auto seq = obj->header(isolate, "SeqLock.snapshot");
+    if (seq == nullptr)
+      return;
+
+    uint64_t length = node::Buffer::Length(args[0]);
+    if (length > obj->m_size)
+      length = obj->m_size;
+
+    uint64_t sequence;
+    if (!read(seq, node::Buffer::Data(args[0]), length, ms, sequence))
+    {
+      args.GetReturnValue().SetNull();
+      return;
+    }
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(sequence)));
+  }
+
+  void seq_lock::Sequence(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<seq_lock>(args.Holder());
+
+    auto seq = obj->header(isolate, "SeqLock.sequence");
+    if (seq == nullptr)
+      return;
+
+    auto sequence = seq->sequence.load(std::memory_order_acquire);
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(sequence)));
+  }
+
+  void seq_lock::Size(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<seq_lock>(args.Holder());
+
+    if (obj->header(isolate, "SeqLock.size") == nullptr)
+      return;
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(obj->m_size)));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void seq_lock::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<seq_lock>, String::NewFromUtf8(isolate, "SeqLock"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "SeqLock"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "HEADER_SIZE"), Integer::New(isolate, sizeof(seq_header)));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "publish", Publish);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "snapshot", Snapshot);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "sequence", Sequence);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "size", Size);
+
+    exports->Set(
+      String::NewFromUtf8(isolate, "SeqLock"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
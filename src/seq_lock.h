@@ -0,0 +1,84 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Seqlock protected region stored inside a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_SEQ_LOCK_H
+#define NODEJS_SEQ_LOCK_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <atomic>
+#include <cstdint>
+#include "mapped_object.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // One writer publishes a value, any number of readers copy it out. The
+  // sequence is odd while a write is in progress and moves on by two for
+  // every publish, so a reader that sees the same even sequence before and
+  // after its copy knows it got a consistent snapshot. Readers never write to
+  // the shared memory, so adding more of them doesn't slow anyone down.
+  struct seq_header
+  {
+    static const uint32_t MAGIC = 0x5365714c; // 'SeqL'
+    static const uint32_t VERSION = 1;
+
+    std::atomic<uint64_t> sequence;
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    char pad[40];
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+  };
+
+  static_assert(sizeof(seq_header) == 64, "seq_header must take exactly one cache line");
+
+  // ---------------------------------------------------------------------------
+
+  class seq_lock : public mapped_object
+  {
+  public:
+    seq_lock();
+
+    static void Create(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Publish(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Snapshot(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Sequence(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Size(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+    // The writer's side: copies length bytes to offset in the region and
+    // returns the new sequence
+    static uint64_t write(seq_header *seq, uint64_t offset, const char *data, uint64_t length);
+
+    // The reader's side: copies length bytes from the start of the region
+    // into dest, retrying until no write overlapped the copy or ms runs out.
+    // Sets the sequence the copy belongs to and returns true, or returns
+    // false if every copy in that time was spoiled by a write.
+    static bool read(seq_header *seq, char *dest, uint64_t length, DWORD ms, uint64_t &sequence);
+
+  private:
+    seq_header *header(v8::Isolate *isolate, const char *method) const;
+
+    uint64_t m_size;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,429 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Counters for FileMapping and Mutex, and the shared memory segment they can
+// be published in, for node_filemap
+// -----------------------------------------------------------------------------
+
+#include "stats.h"
+#include "js_helpers.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    // The front of the stats segment. The slots follow it, one object_stats
+    // each.
+    struct stats_header
+    {
+      static const uint32_t MAGIC = 0x53746174; // 'Stat'
+      static const uint32_t VERSION = 2;
+
+      uint32_t magic;
+      uint32_t version;
+      uint32_t pid;
+      uint32_t slotCount;
+      uint32_t slotSize;
+      char pad[44];
+    };
+
+    static_assert(sizeof(stats_header) == 64, "stats_header must take exactly one cache line");
+
+    const uint32_t SLOT_COUNT = 1024;
+
+    const char *const COUNTER_NAMES[STAT_WAIT_HISTOGRAM] =
+    {
+      "readCalls",
+      "writeCalls",
+      "bytesRead",
+      "bytesWritten",
+      "flushCalls",
+      "viewCalls",
+      "acquisitions",
+      "contended",
+      "timeouts",
+      "abandoned",
+      "releases",
+      "waitNs"
+    };
+
+    size_t SegmentSize(uint32_t slotCount)
+    {
+      return sizeof(stats_header) + static_cast<size_t>(slotCount) * sizeof(object_stats);
+    }
+
+    // Every stats_ref in the process, and the segment once it's published
+    struct stats_registry
+    {
+      std::mutex lock;
+      std::string name;
+      object_stats *slots = nullptr;
+
+#ifdef _WIN32
+      HANDLE mapping = nullptr;
+#endif
+
+      ~stats_registry()
+      {
+        // Objects still alive at exit keep pointing into the segment, so
+        // leave it mapped and only drop the name
+#ifndef _WIN32
+        if (!name.empty())
+          shm_unlink(("/" + name).c_str());
+#endif
+      }
+    };
+
+    stats_registry &Registry()
+    {
+      static stats_registry registry;
+      return registry;
+    }
+
+    Local<Object> CountersObject(Isolate *isolate, const object_stats &block, stats_kind kind)
+    {
+      auto result = Object::New(isolate);
+
+      int first = kind == STATS_MAPPING ? STAT_READ_CALLS : STAT_ACQUISITIONS;
+      int last = kind == STATS_MAPPING ? STAT_VIEW_CALLS : STAT_WAIT_NS;
+
+      for (int i = first; i <= last; ++i)
+        result->Set(String::NewFromUtf8(isolate, COUNTER_NAMES[i]), Number::New(isolate, static_cast<double>(block.counters[i].load(std::memory_order_relaxed))));
+
+      if (kind == STATS_MUTEX)
+      {
+        auto histogram = Array::New(isolate, static_cast<int>(STAT_WAIT_BUCKETS));
+        for (uint32_t i = 0; i < STAT_WAIT_BUCKETS; ++i)
+          histogram->Set(i, Number::New(isolate, static_cast<double>(block.counters[STAT_WAIT_HISTOGRAM + i].load(std::memory_order_relaxed))));
+
+        result->Set(String::NewFromUtf8(isolate, "waitHistogram"), histogram);
+      }
+
+      return result;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void object_stats::waited(uint64_t ns)
+  {
+    size_t bucket = 0;
+    for (auto us = ns / 1000; us != 0 && bucket + 1 < STAT_WAIT_BUCKETS; us >>= 1)
+      ++bucket;
+
+    add(STAT_CONTENDED);
+    add(STAT_WAIT_NS, ns);
+    add(static_cast<stats_counter>(STAT_WAIT_HISTOGRAM + bucket));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  stats_ref::stats_ref(stats_kind kind) :
+    m_kind(kind),
+    m_local(new object_stats())
+  {
+    m_block = m_local.get();
+    m_block->kind.store(kind, std::memory_order_relaxed);
+    m_block->name[0] = '\0';
+  }
+
+  stats_ref::~stats_ref()
+  {
+    if (m_local)
+      return;
+
+    std::lock_guard<std::mutex> guard(Registry().lock);
+    m_block->kind.store(STATS_FREE, std::memory_order_release);
+  }
+
+  bool stats_ref::publish(object_stats *slots, uint32_t slotCount)
+  {
+    for (uint32_t i = 0; i < slotCount; ++i)
+    {
+      auto &slot = slots[i];
+      if (slot.kind.load(std::memory_order_relaxed) != STATS_FREE)
+        continue;
+
+      // Claimed before the lock is dropped, so no one else can pick it, and
+      // hidden until reset() has wiped what the last owner left in it
+      slot.begin_rewrite();
+      slot.kind.store(m_kind, std::memory_order_relaxed);
+
+      m_block = &slot;
+      m_local.reset();
+      return true;
+    }
+
+    return false;
+  }
+
+  void stats_ref::reset(const char *name)
+  {
+    // Only picks up a segment published since we were made here, on the
+    // thread that owns the counters, so nothing is writing them as they move
+    bool claimed = false;
+    if (m_local)
+    {
+      auto &registry = Registry();
+      std::lock_guard<std::mutex> guard(registry.lock);
+
+      if (registry.slots != nullptr)
+        claimed = publish(registry.slots, SLOT_COUNT);
+    }
+
+    if (!claimed)
+      m_block->begin_rewrite();
+
+    for (auto &counter : m_block->counters)
+      counter.store(0, std::memory_order_relaxed);
+
+    strncpy(m_block->name, name, sizeof(m_block->name) - 1);
+    m_block->name[sizeof(m_block->name) - 1] = '\0';
+
+    m_block->end_rewrite();
+  }
+
+  Local<Object> stats_ref::to_object(Isolate *isolate) const
+  {
+    return CountersObject(isolate, *m_block, m_kind);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void stats_ref::PublishStats(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (!(args.Length() < 1 || args[0]->IsUndefined() || args[0]->IsString()))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to publishStats")));
+      return;
+    }
+
+    std::string name = args.Length() > 0 && args[0]->IsString() ? ToCString(args[0]->ToString()) : "node_filemap_stats_" + std::to_string(current_pid());
+
+    auto &registry = Registry();
+    std::lock_guard<std::mutex> guard(registry.lock);
+
+    if (!registry.name.empty())
+    {
+      if (registry.name != name)
+      {
+        isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, ("Stats are already published as " + registry.name).c_str())));
+        return;
+      }
+
+      args.GetReturnValue().Set(String::NewFromUtf8(isolate, name.c_str()));
+      return;
+    }
+
+    auto size = SegmentSize(SLOT_COUNT);
+
+#ifdef _WIN32
+    HANDLE mapping = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0, static_cast<DWORD>(size), name.c_str());
+    if (mapping == nullptr)
+    {
+      ThrowErrorCode(isolate, "Failed to create stats segment, error code: ", GetLastError());
+      return;
+    }
+
+    void *ptr = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if (ptr == nullptr)
+    {
+      int lastErr = GetLastError();
+      CloseHandle(mapping);
+
+      ThrowErrorCode(isolate, "Failed to create stats segment, error code: ", lastErr);
+      return;
+    }
+
+    registry.mapping = mapping;
+#else
+    auto shmName = "/" + name;
+    int fd = shm_open(shmName.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+      ThrowErrorCode(isolate, "Failed to create stats segment, error code: ", errno);
+      return;
+    }
+
+    void *ptr = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(size)) == 0)
+      ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    int lastErr = errno;
+    close(fd);
+
+    if (ptr == MAP_FAILED)
+    {
+      shm_unlink(shmName.c_str());
+
+      ThrowErrorCode(isolate, "Failed to create stats segment, error code: ", lastErr);
+      return;
+    }
+#endif
+
+    // A segment left behind by a process that had our pid before is ours now
+    memset(ptr, 0, size);
+
+    auto header = reinterpret_cast<stats_header *>(ptr);
+    header->pid = current_pid();
+    header->slotCount = SLOT_COUNT;
+    header->slotSize = sizeof(object_stats);
+    header->version = stats_header::VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    header->magic = stats_header::MAGIC;
+
+    registry.name = name;
+    registry.slots = reinterpret_cast<object_stats *>(header + 1);
+
+    args.GetReturnValue().Set(String::NewFromUtf8(isolate, name.c_str()));
+  }
+
+  void stats_ref::ReadStats(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to readStats")));
+      return;
+    }
+
+    if (!args[0]->IsString())
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to readStats")));
+      return;
+    }
+
+    std::string name = ToCString(args[0]->ToString());
+    size_t size;
+
+#ifdef _WIN32
+    HANDLE mapping = OpenFileMapping(FILE_MAP_READ, FALSE, name.c_str());
+    if (mapping == nullptr)
+    {
+      ThrowErrorCode(isolate, "Failed to open stats segment, error code: ", GetLastError());
+      return;
+    }
+
+    void *ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+
+    if (ptr == nullptr)
+    {
+      ThrowErrorCode(isolate, "Failed to open stats segment, error code: ", GetLastError());
+      return;
+    }
+
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery(ptr, &info, sizeof(info));
+    size = info.RegionSize;
+#else
+    int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+    if (fd < 0)
+    {
+      ThrowErrorCode(isolate, "Failed to open stats segment, error code: ", errno);
+      return;
+    }
+
+    struct stat info;
+    void *ptr = MAP_FAILED;
+    size = 0;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+      size = static_cast<size_t>(info.st_size);
+      ptr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+
+    int lastErr = errno;
+    close(fd);
+
+    if (ptr == MAP_FAILED)
+    {
+      ThrowErrorCode(isolate, "Failed to open stats segment, error code: ", lastErr);
+      return;
+    }
+#endif
+
+    // Another process wrote this, so check it adds up before using it
+    auto header = reinterpret_cast<const stats_header *>(ptr);
+    bool valid = size >= sizeof(stats_header) && header->magic == stats_header::MAGIC && header->version == stats_header::VERSION &&
+      header->slotSize == sizeof(object_stats) && header->slotCount <= (size - sizeof(stats_header)) / sizeof(object_stats);
+
+    if (valid)
+    {
+      auto slots = reinterpret_cast<const object_stats *>(header + 1);
+      auto objects = Array::New(isolate);
+      uint32_t count = 0;
+
+      for (uint32_t i = 0; i < header->slotCount; ++i)
+      {
+        auto &slot = slots[i];
+        auto sequence = slot.sequence.load(std::memory_order_acquire);
+        auto kind = slot.kind.load(std::memory_order_relaxed);
+        if ((sequence & 1) != 0 || (kind != STATS_MAPPING && kind != STATS_MUTEX))
+          continue;
+
+        char slotName[sizeof(slot.name) + 1];
+        memcpy(slotName, slot.name, sizeof(slot.name));
+        slotName[sizeof(slot.name)] = '\0';
+
+        auto object = CountersObject(isolate, slot, static_cast<stats_kind>(kind));
+
+        // Skip a slot that was rewritten or handed to someone else while we
+        // read it
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence || slot.kind.load(std::memory_order_relaxed) != kind)
+          continue;
+
+        object->Set(String::NewFromUtf8(isolate, "kind"), String::NewFromUtf8(isolate, kind == STATS_MAPPING ? "mapping" : "mutex"));
+        object->Set(String::NewFromUtf8(isolate, "name"), String::NewFromUtf8(isolate, slotName));
+        objects->Set(count++, object);
+      }
+
+      auto result = Object::New(isolate);
+      result->Set(String::NewFromUtf8(isolate, "pid"), Integer::NewFromUnsigned(isolate, header->pid));
+      result->Set(String::NewFromUtf8(isolate, "objects"), objects);
+      args.GetReturnValue().Set(result);
+    }
+
+#ifdef _WIN32
+    UnmapViewOfFile(ptr);
+#else
+    munmap(ptr, size);
+#endif
+
+    if (!valid)
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "No stats segment by that name in readStats")));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void stats_ref::Init(v8::Local<v8::Object> exports)
+  {
+    NODE_SET_METHOD(exports, "publishStats", PublishStats);
+    NODE_SET_METHOD(exports, "readStats", ReadStats);
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,140 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Counters for FileMapping and Mutex, and the shared memory segment they can
+// be published in, for node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_STATS_H
+#define NODEJS_STATS_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include "platform.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  enum stats_kind
+  {
+    STATS_FREE,
+    STATS_MAPPING,
+    STATS_MUTEX
+  };
+
+  // Contended waits by how long they took: bucket 0 is under 1 us, bucket i
+  // is [2^(i-1), 2^i) us, and the last one is everything longer
+  const size_t STAT_WAIT_BUCKETS = 24;
+
+  enum stats_counter
+  {
+    // FileMapping
+    STAT_READ_CALLS,
+    STAT_WRITE_CALLS,
+    STAT_BYTES_READ,
+    STAT_BYTES_WRITTEN,
+    STAT_FLUSH_CALLS,
+    STAT_VIEW_CALLS,
+
+    // Mutex
+    STAT_ACQUISITIONS,
+    STAT_CONTENDED,   // Acquisitions that had to wait
+    STAT_TIMEOUTS,
+    STAT_ABANDONED,
+    STAT_RELEASES,
+    STAT_WAIT_NS,     // Total time spent in contended waits
+    STAT_WAIT_HISTOGRAM,
+
+    STAT_COUNTERS = STAT_WAIT_HISTOGRAM + STAT_WAIT_BUCKETS
+  };
+
+  // One object's counters, laid out the same in process memory and in the
+  // stats segment. Only the thread using the object writes them, so bumping
+  // one is a plain load and store rather than a locked instruction. A reader
+  // in another process sees every counter whole, but not necessarily in step
+  // with the others.
+  struct object_stats
+  {
+    std::atomic<uint32_t> kind;     // stats_kind, STATS_FREE while the slot is unused
+    std::atomic<uint32_t> sequence; // Odd while the name and counters are being rewritten
+    char name[56];
+    std::atomic<uint64_t> counters[STAT_COUNTERS];
+    char pad[32];
+
+    void add(stats_counter counter, uint64_t by = 1)
+    {
+      auto &value = counters[counter];
+      value.store(value.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+    }
+
+    // Counts a contended wait of ns nanoseconds
+    void waited(uint64_t ns);
+
+    // Bracket rewriting the name and counters, so readers skip the slot
+    // rather than see it half done
+    void begin_rewrite()
+    {
+      sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_rewrite()
+    {
+      sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+  };
+
+  static_assert(sizeof(object_stats) == 384, "object_stats must be a whole number of cache lines");
+
+  // ---------------------------------------------------------------------------
+
+  // The counters for one FileMapping or Mutex. They live in a slot of the
+  // stats segment when publishStats was called before the object was created
+  // or opened, and in the process otherwise.
+  class stats_ref
+  {
+  public:
+    explicit stats_ref(stats_kind kind);
+    ~stats_ref();
+
+    object_stats *operator->() const { return m_block; }
+
+    // Zeroes the counters and names them, for a newly created or opened
+    // object, moving them into the stats segment if it's been published
+    void reset(const char *name);
+
+    v8::Local<v8::Object> to_object(v8::Isolate *isolate) const;
+
+    // publishStats([name]) and readStats(name), on the module
+    static void PublishStats(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void ReadStats(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+  private:
+    stats_ref(const stats_ref &) = delete;
+    stats_ref &operator=(const stats_ref &) = delete;
+
+    // Claims a free slot of the segment for the counters, under the
+    // registry's lock, and starts rewriting it. False if they're all taken.
+    bool publish(object_stats *slots, uint32_t slotCount);
+
+    stats_kind m_kind;
+    object_stats *m_block;
+    std::unique_ptr<object_stats> m_local; // Null once published
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
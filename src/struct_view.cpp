@@ -0,0 +1,589 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Schema defined records laid out inside a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#include "struct_view.h"
+#include <node_buffer.h>
+#include <cstring>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const uint64_t MAX_COUNT = 0xFFFFFFFF;
+    const uint64_t MAX_LENGTH = 1u << 24;
+    const uint64_t MAX_ALIGN = 4096;
+
+    // Columns start on a cache line of their own unless asked otherwise
+    const uint64_t SOA_ALIGN = 64;
+
+    struct type_name
+    {
+      const char *name;
+      struct_view::field_type type;
+      uint32_t size;
+    };
+
+    const type_name TYPES[] = {
+      { "int8", struct_view::FIELD_INT8, 1 },
+      { "uint8", struct_view::FIELD_UINT8, 1 },
+      { "int16", struct_view::FIELD_INT16, 2 },
+      { "uint16", struct_view::FIELD_UINT16, 2 },
+      { "int32", struct_view::FIELD_INT32, 4 },
+      { "uint32", struct_view::FIELD_UINT32, 4 },
+      { "float32", struct_view::FIELD_FLOAT32, 4 },
+      { "float64", struct_view::FIELD_FLOAT64, 8 }
+    };
+
+    void Throw(Isolate *isolate, Local<Value> (*make)(Local<String>), const std::string &message)
+    {
+      isolate->ThrowException(make(String::NewFromUtf8(isolate, message.c_str())));
+    }
+
+    uint64_t AlignUp(uint64_t value, uint64_t align)
+    {
+      return (value + align - 1) & ~(align - 1);
+    }
+
+    // A whole number in [min, max], or def if value is undefined
+    bool ReadUint(Local<Value> value, uint64_t min, uint64_t max, uint64_t def, uint64_t &result)
+    {
+      if (value->IsUndefined())
+      {
+        result = def;
+        return true;
+      }
+
+      if (!value->IsNumber())
+        return false;
+
+      auto number = value.As<Number>()->Value();
+      if (!(number >= static_cast<double>(min) && number <= static_cast<double>(max)) || number != static_cast<double>(static_cast<uint64_t>(number)))
+        return false;
+
+      result = static_cast<uint64_t>(number);
+      return true;
+    }
+
+    bool ReadAlign(Local<Value> value, uint64_t def, uint64_t &result)
+    {
+      return ReadUint(value, 1, MAX_ALIGN, def, result) && (result & (result - 1)) == 0;
+    }
+
+    // A field is "type" or { type, length, align }
+    bool ReadField(Isolate *isolate, Local<Value> value, struct_view::field &f)
+    {
+      Local<Value> type = value;
+      Local<Value> length = Undefined(isolate);
+      Local<Value> align = Undefined(isolate);
+
+      if (value->IsObject() && !value->IsArray())
+      {
+        auto obj = value->ToObject();
+        type = obj->Get(String::NewFromUtf8(isolate, "type"));
+        length = obj->Get(String::NewFromUtf8(isolate, "length"));
+        align = obj->Get(String::NewFromUtf8(isolate, "align"));
+      }
+
+      if (!type->IsString())
+        return false;
+
+      String::Utf8Value name(type);
+      const type_name *found = nullptr;
+      for (auto &it : TYPES)
+      {
+        if (*name != nullptr && strcmp(*name, it.name) == 0)
+          found = &it;
+      }
+
+      uint64_t elements, alignment;
+      if (found == nullptr || !ReadUint(length, 1, MAX_LENGTH, 0, elements) || !ReadAlign(align, found->size, alignment))
+        return false;
+
+      f.type = found->type;
+      f.size = found->size;
+      f.length = static_cast<uint32_t>(elements);
+      f.align = alignment < found->size ? found->size : alignment;
+      f.offset = 0;
+      return true;
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  struct_view::struct_view()
+  {
+    m_layout.soa = false;
+    m_layout.count = 0;
+    m_layout.align = 1;
+    m_layout.stride = 0;
+    m_layout.size = 0;
+  }
+
+  struct_view::~struct_view()
+  {
+    m_buffer.Reset();
+    m_records.Reset();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool struct_view::make_layout(Isolate *isolate, Local<Value> schema, Local<Value> count, Local<Value> options, layout &result, const char *method)
+  {
+    uint64_t records;
+    if (!schema->IsObject() || schema->IsArray() || !ReadUint(count, 1, MAX_COUNT, 1, records) || !(options->IsUndefined() || options->IsObject()))
+    {
+      Throw(isolate, Exception::TypeError, std::string("Wrong type arguments to ") + method);
+      return false;
+    }
+
+    result.fields.clear();
+    result.soa = false;
+    result.count = records;
+
+    Local<Value> align = Undefined(isolate);
+    if (options->IsObject())
+    {
+      auto obj = options->ToObject();
+      auto mode = obj->Get(String::NewFromUtf8(isolate, "layout"));
+      align = obj->Get(String::NewFromUtf8(isolate, "align"));
+
+      bool known = mode->IsUndefined();
+      if (mode->IsString())
+      {
+        String::Utf8Value name(mode);
+        result.soa = *name != nullptr && strcmp(*name, "soa") == 0;
+        known = result.soa || (*name != nullptr && strcmp(*name, "aos") == 0);
+      }
+
+      if (!known)
+      {
+        Throw(isolate, Exception::TypeError, std::string("Layout must be 'aos' or 'soa' in ") + method);
+        return false;
+      }
+    }
+
+    auto obj = schema->ToObject();
+    auto names = obj->GetOwnPropertyNames();
+    uint64_t largest = 1;
+
+    for (uint32_t i = 0; i < names->Length(); ++i)
+    {
+      auto name = names->Get(i);
+
+      field f;
+      if (!ReadField(isolate, obj->Get(name), f))
+      {
+        String::Utf8Value text(name);
+        Throw(isolate, Exception::TypeError, std::string("Bad type for field '") + (*text ? *text : "") + "' in " + method);
+        return false;
+      }
+
+      String::Utf8Value text(name);
+      f.name = *text ? *text : "";
+
+      // Records keep the index they're at in a property of that name
+      if (f.name == "index")
+      {
+        Throw(isolate, Exception::TypeError, std::string("Field name 'index' is reserved in ") + method);
+        return false;
+      }
+
+      if (f.align > largest)
+        largest = f.align;
+
+      result.fields.push_back(f);
+    }
+
+    if (result.fields.empty())
+    {
+      Throw(isolate, Exception::TypeError, std::string("Schema has no fields in ") + method);
+      return false;
+    }
+
+    if (!ReadAlign(align, result.soa ? SOA_ALIGN : largest, result.align))
+    {
+      Throw(isolate, Exception::TypeError, std::string("Alignment must be a power of two up to 4096 in ") + method);
+      return false;
+    }
+
+    // Fields in the order the schema lists them, each on its own alignment.
+    // A record is padded out to the largest, so the next one starts aligned
+    // too, like a C struct.
+    uint64_t end = 0;
+    if (!result.soa)
+    {
+      if (result.align < largest)
+        result.align = largest;
+
+      for (auto &f : result.fields)
+      {
+        f.offset = AlignUp(end, f.align);
+        end = f.offset + f.bytes();
+      }
+
+      result.stride = AlignUp(end, result.align);
+      result.size = result.stride * result.count;
+    }
+    else
+    {
+      for (auto &f : result.fields)
+      {
+        f.offset = AlignUp(end, f.align > result.align ? f.align : result.align);
+        end = f.offset + f.bytes() * result.count;
+      }
+
+      result.stride = 0;
+      result.size = end;
+    }
+
+    return true;
+  }
+
+  int struct_view::find_field(Local<Value> name) const
+  {
+    if (!name->IsString())
+      return -1;
+
+    String::Utf8Value text(name);
+    for (size_t i = 0; i < m_layout.fields.size(); ++i)
+    {
+      if (*text != nullptr && m_layout.fields[i].name == *text)
+        return static_cast<int>(i);
+    }
+
+    return -1;
+  }
+
+  Local<Object> struct_view::typed_array(Isolate *isolate, const field &f, uint64_t offset, uint64_t length)
+  {
+    auto buffer = Local<ArrayBuffer>::New(isolate, m_buffer);
+    auto start = static_cast<size_t>(offset);
+    auto count = static_cast<size_t>(length);
+
+    switch (f.type)
+    {
+    case FIELD_INT8: return Int8Array::New(buffer, start, count);
+    case FIELD_UINT8: return Uint8Array::New(buffer, start, count);
+    case FIELD_INT16: return Int16Array::New(buffer, start, count);
+    case FIELD_UINT16: return Uint16Array::New(buffer, start, count);
+    case FIELD_INT32: return Int32Array::New(buffer, start, count);
+    case FIELD_UINT32: return Uint32Array::New(buffer, start, count);
+    case FIELD_FLOAT32: return Float32Array::New(buffer, start, count);
+    case FIELD_FLOAT64: return Float64Array::New(buffer, start, count);
+    }
+
+    return buffer;
+  }
+
+  // Every field gets a typed array of its own: over the whole view for aos,
+  // over just its column for soa. Its accessors then index that with
+  // constants, first + index * step, which is all the JIT needs to inline
+  // them. An index past the end reads undefined, like it would for the array.
+  bool struct_view::make_records(Isolate *isolate)
+  {
+    auto context = isolate->GetCurrentContext();
+    auto arrays = Array::New(isolate, static_cast<int>(m_layout.fields.size()));
+    auto names = Array::New(isolate, static_cast<int>(m_layout.fields.size()));
+
+    std::string source =
+      "(function (arrays, names) {\n"
+      "  'use strict';\n"
+      "  function StructRecord(index) { this.index = index; }\n";
+
+    for (uint32_t i = 0; i < m_layout.fields.size(); ++i)
+    {
+      auto &f = m_layout.fields[i];
+      auto a = "a" + std::to_string(i);
+      auto first = std::to_string(m_layout.soa ? 0 : f.offset / f.size);
+      auto step = std::to_string(m_layout.soa ? f.bytes() / f.size : m_layout.stride / f.size);
+      auto at = first + " + this.index * " + step;
+
+      if (m_layout.soa)
+        arrays->Set(i, typed_array(isolate, f, f.offset, m_layout.count * (f.bytes() / f.size)));
+      else
+        arrays->Set(i, typed_array(isolate, f, 0, m_layout.size / f.size));
+      names->Set(i, String::NewFromUtf8(isolate, f.name.c_str()));
+
+      source += "  const " + a + " = arrays[" + std::to_string(i) + "];\n";
+      source += "  Object.defineProperty(StructRecord.prototype, names[" + std::to_string(i) + "], {\n    enumerable: true,\n";
+
+      if (f.length == 0)
+      {
+        source += "    get: function () { return " + a + "[" + at + "]; },\n";
+        source += "    set: function (value) { " + a + "[" + at + "] = value; }\n";
+      }
+      else
+      {
+        auto length = std::to_string(f.length);
+        source += "    get: function () { const at = " + at + "; return " + a + ".subarray(at, at + " + length + "); },\n";
+        source += "    set: function (value) {\n";
+        source += "      if (value == null || value.length !== " + length + ")\n";
+        source += "        throw new RangeError('Wrong length assigned to StructView field ' + names[" + std::to_string(i) + "]);\n";
+        source += "      " + a + ".set(value, " + at + ");\n";
+        source += "    }\n";
+      }
+
+      source += "  });\n";
+    }
+
+    source += "  return StructRecord;\n})";
+
+    Local<Script> script;
+    Local<Value> factory, records;
+    Local<Value> argv[] = { arrays, names };
+
+    if (!Script::Compile(context, String::NewFromUtf8(isolate, source.c_str())).ToLocal(&script) ||
+        !script->Run(context).ToLocal(&factory) ||
+        !factory.As<Function>()->Call(context, Undefined(isolate), 2, argv).ToLocal(&records))
+      return false;
+
+    m_records.Reset(isolate, records.As<Function>());
+    return true;
+  }
+
+  void struct_view::drop_buffer()
+  {
+    if (!m_buffer.IsEmpty())
+    {
+      auto isolate = Isolate::GetCurrent();
+      HandleScope scope(isolate);
+
+      auto buffer = Local<ArrayBuffer>::New(isolate, m_buffer);
+      if (buffer->IsNeuterable())
+        buffer->Neuter();
+    }
+
+    m_buffer.Reset();
+    m_records.Reset();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void struct_view::Size(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to StructView.size")));
+      return;
+    }
+
+    layout shape;
+    if (!make_layout(isolate, args[0], args[1], args[2], shape, "StructView.size"))
+      return;
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(shape.size)));
+  }
+
+  void struct_view::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<struct_view>(args.Holder());
+
+    if (!read_mapping_args(args, 3, "StructView.open"))
+      return;
+
+    layout shape;
+    if (!make_layout(isolate, args[2], args[3], args[4], shape, "StructView.open"))
+      return;
+
+    // Every field lands on its own alignment as long as the start does
+    uint64_t largest = 1;
+    for (auto &f : shape.fields)
+    {
+      if (f.align > largest)
+        largest = f.align;
+    }
+
+    if (!obj->attach(isolate, args[0], args[1], shape.size, largest, "StructView.open"))
+      return;
+
+    auto buffer = obj->view(isolate, 0, shape.size).As<Uint8Array>();
+
+    obj->drop_buffer();
+    obj->m_layout = shape;
+    obj->m_buffer.Reset(isolate, buffer->Buffer());
+
+    if (!obj->make_records(isolate))
+    {
+      obj->drop_buffer();
+      obj->detach();
+    }
+  }
+
+  void struct_view::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<struct_view>(args.Holder());
+
+    obj->drop_buffer();
+    obj->detach();
+    obj->m_layout.fields.clear();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void struct_view::At(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<struct_view>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to StructView.at")));
+      return;
+    }
+
+    uint64_t index;
+    if (!ReadUint(args[0], 0, MAX_COUNT, 0, index))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to StructView.at")));
+      return;
+    }
+
+    if (obj->memory(isolate, "StructView.at") == nullptr)
+      return;
+
+    if (index >= obj->m_layout.count)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Index out of range in StructView.at")));
+      return;
+    }
+
+    Local<Value> argv[] = { Number::New(isolate, static_cast<double>(index)) };
+    Local<Object> record;
+    if (!Local<Function>::New(isolate, obj->m_records)->NewInstance(isolate->GetCurrentContext(), 1, argv).ToLocal(&record))
+      return;
+
+    args.GetReturnValue().Set(record);
+  }
+
+  void struct_view::Column(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<struct_view>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to StructView.column")));
+      return;
+    }
+
+    if (!args[0]->IsString())
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to StructView.column")));
+      return;
+    }
+
+    if (obj->memory(isolate, "StructView.column") == nullptr)
+      return;
+
+    if (!obj->m_layout.soa)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "StructView.column needs the soa layout")));
+      return;
+    }
+
+    auto index = obj->find_field(args[0]);
+    if (index < 0)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "No such field in StructView.column")));
+      return;
+    }
+
+    auto &f = obj->m_layout.fields[index];
+    auto length = obj->m_layout.count * (f.length == 0 ? 1 : f.length);
+    args.GetReturnValue().Set(obj->typed_array(isolate, f, f.offset, length));
+  }
+
+  void struct_view::OffsetOf(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<struct_view>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to StructView.offsetOf")));
+      return;
+    }
+
+    uint64_t index;
+    if (!args[0]->IsString() || !ReadUint(args[1], 0, MAX_COUNT, 0, index))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to StructView.offsetOf")));
+      return;
+    }
+
+    if (obj->memory(isolate, "StructView.offsetOf") == nullptr)
+      return;
+
+    auto field = obj->find_field(args[0]);
+    if (field < 0 || index >= obj->m_layout.count)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "No such field or index in StructView.offsetOf")));
+      return;
+    }
+
+    auto offset = obj->offset() + obj->m_layout.address(obj->m_layout.fields[field], index);
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(offset)));
+  }
+
+  void struct_view::Count(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<struct_view>(args.Holder());
+
+    if (obj->memory(isolate, "StructView.count") == nullptr)
+      return;
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(obj->m_layout.count)));
+  }
+
+  void struct_view::TotalSize(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<struct_view>(args.Holder());
+
+    if (obj->memory(isolate, "StructView.size") == nullptr)
+      return;
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(obj->m_layout.size)));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void struct_view::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<struct_view>, String::NewFromUtf8(isolate, "StructView"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "StructView"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "size"), FunctionTemplate::New(isolate, Size));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "at", At);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "column", Column);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "offsetOf", OffsetOf);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "count", Count);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "size", TotalSize);
+
+    exports->Set(
+      String::NewFromUtf8(isolate, "StructView"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,121 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Schema defined records laid out inside a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_STRUCT_VIEW_H
+#define NODEJS_STRUCT_VIEW_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "mapped_object.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // An array of count records described by a schema, read and written in
+  // place. There's no header: the schema is the layout, so every process
+  // opening the same range has to pass the same one. Records are laid out
+  // one after another (aos), or with each field in a column of its own (soa),
+  // so a pass over one field of every record reads contiguous memory.
+  //
+  // Records are plain JS objects whose field accessors index typed arrays
+  // over the mapping at offsets worked out when the view is opened. Calling
+  // into the addon for every field would cost more than the copy it saves,
+  // where the JIT inlines a typed array access down to a load or a store.
+  class struct_view : public mapped_object
+  {
+  public:
+    struct_view();
+    ~struct_view();
+
+    static void Size(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void At(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Column(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void OffsetOf(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Count(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void TotalSize(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+    enum field_type
+    {
+      FIELD_INT8,
+      FIELD_UINT8,
+      FIELD_INT16,
+      FIELD_UINT16,
+      FIELD_INT32,
+      FIELD_UINT32,
+      FIELD_FLOAT32,
+      FIELD_FLOAT64
+    };
+
+    struct field
+    {
+      std::string name;
+      field_type type;
+      uint32_t size;   // Of one element
+      uint32_t length; // Elements in a fixed array, 0 for a single number
+      uint64_t align;
+      uint64_t offset; // In the record (aos), or where the column starts (soa)
+
+      uint64_t bytes() const { return static_cast<uint64_t>(size) * (length == 0 ? 1 : length); }
+    };
+
+    struct layout
+    {
+      std::vector<field> fields;
+      bool soa;
+      uint64_t count;
+      uint64_t align;  // Of the record (aos) or of each column (soa)
+      uint64_t stride; // Between records, aos only
+      uint64_t size;
+
+      // Where record index's copy of f starts, from the start of the view
+      uint64_t address(const field &f, uint64_t index) const
+      {
+        return soa ? f.offset + index * f.bytes() : index * stride + f.offset;
+      }
+    };
+
+    // Parses a schema, count and options into a layout. Throws and returns
+    // false if any of them are bad.
+    static bool make_layout(v8::Isolate *isolate, v8::Local<v8::Value> schema, v8::Local<v8::Value> count, v8::Local<v8::Value> options, layout &result, const char *method);
+
+  private:
+    int find_field(v8::Local<v8::Value> name) const;
+
+    // A typed array over length elements of f's type, offset bytes into
+    // the view, with no copy
+    v8::Local<v8::Object> typed_array(v8::Isolate *isolate, const field &f, uint64_t offset, uint64_t length);
+
+    // Builds the constructor at() makes records with
+    bool make_records(v8::Isolate *isolate);
+
+    // Neuters m_buffer, so records and columns from before stop working
+    void drop_buffer();
+
+    layout m_layout;
+
+    v8::Persistent<v8::ArrayBuffer> m_buffer; // Over the whole view
+    v8::Persistent<v8::Function> m_records;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,298 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Lock-free triple buffer stored inside a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#include "triple_buffer.h"
+#include <node_buffer.h>
+#include <cstring>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const uint32_t SLOT_MASK = 3;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  bool triple_buffer::layout::make(uint64_t frameSize, layout &result)
+  {
+    if (frameSize == 0 || frameSize > node::Buffer::kMaxLength)
+      return false;
+
+    result.frameSize = frameSize;
+    result.slotStride = (frameSize + 63) & ~static_cast<uint64_t>(63);
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  triple_buffer::triple_buffer()
+  {
+    memset(&m_layout, 0, sizeof(m_layout));
+  }
+
+  triple_header *triple_buffer::header(Isolate *isolate, const char *method) const
+  {
+    return reinterpret_cast<triple_header *>(memory(isolate, method));
+  }
+
+  triple_slot *triple_buffer::slots(triple_header *triple) const
+  {
+    return reinterpret_cast<triple_slot *>(triple + 1);
+  }
+
+  bool triple_buffer::check_slots(Isolate *isolate, triple_header *triple)
+  {
+    // The other side may be halfway through its swap, so the three don't
+    // have to be different right now - only in range
+    if (triple->writeSlot < 3 && triple->readSlot < 3 && (triple->state.load(std::memory_order_relaxed) & SLOT_MASK) < 3)
+      return true;
+
+    isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "TripleBuffer is corrupt")));
+    return false;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void triple_buffer::Size(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to TripleBuffer.size")));
+      return;
+    }
+
+    uint64_t frameSize;
+    if (!read_uint(args[0], UINT64_MAX, frameSize))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to TripleBuffer.size")));
+      return;
+    }
+
+    layout shape;
+    if (!layout::make(frameSize, shape))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Frame size out of range in TripleBuffer.size")));
+      return;
+    }
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(shape.total_size())));
+  }
+
+  void triple_buffer::Create(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<triple_buffer>(args.Holder());
+
+    if (!read_mapping_args(args, 3, "TripleBuffer.create"))
+      return;
+
+    uint64_t frameSize;
+    if (!read_uint(args[2], UINT64_MAX, frameSize))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to TripleBuffer.create")));
+      return;
+    }
+
+    layout shape;
+    if (!layout::make(frameSize, shape))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Frame size out of range in TripleBuffer.create")));
+      return;
+    }
+
+    if (!obj->attach(isolate, args[0], args[1], shape.total_size(), 64, "TripleBuffer.create"))
+      return;
+
+    obj->m_layout = shape;
+
+    auto triple = obj->header(isolate, "TripleBuffer.create");
+    memset(static_cast<void *>(triple), 0, static_cast<size_t>(shape.frame_offset(0)));
+
+    triple->frameSize = shape.frameSize;
+    triple->writeSlot = 0;
+    triple->state.store(1, std::memory_order_relaxed);
+    triple->readSlot = 2;
+    triple->version = triple_header::VERSION;
+    std::atomic_thread_fence(std::memory_order_release);
+    triple->magic = triple_header::MAGIC;
+  }
+
+  void triple_buffer::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<triple_buffer>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "TripleBuffer.open"))
+      return;
+
+    auto describe = [](const triple_header &triple, layout &result) -> uint64_t
+    {
+      bool valid = triple.magic == triple_header::MAGIC && triple.version == triple_header::VERSION &&
+        layout::make(triple.frameSize, result);
+
+      return valid ? result.total_size() : 0;
+    };
+
+    layout shape;
+    if (!obj->attach_existing<triple_header>(isolate, args[0], args[1], shape, describe, "TripleBuffer.open"))
+      return;
+
+    obj->m_layout = shape;
+  }
+
+  void triple_buffer::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<triple_buffer>(args.Holder());
+
+    obj->detach();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void triple_buffer::AcquireWrite(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<triple_buffer>(args.Holder());
+
+    auto triple = obj->header(isolate, "TripleBuffer.acquireWrite");
+    if (triple == nullptr || !check_slots(isolate, triple))
+      return;
+
+    auto &shape = obj->m_layout;
+    args.GetReturnValue().Set(obj->view(isolate, shape.frame_offset(triple->writeSlot), shape.frameSize));
+  }
+
+  void triple_buffer::Publish(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<triple_buffer>(args.Holder());
+    auto &shape = obj->m_layout;
+
+    // Either the length written through acquireWrite's view, or a Buffer to
+    // copy in first
+    uint64_t length = shape.frameSize;
+    bool copy = args.Length() > 0 && node::Buffer::HasInstance(args[0]);
+
+    if (!(args.Length() < 1 || args[0]->IsUndefined() || copy || read_uint(args[0], UINT64_MAX, length)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to TripleBuffer.publish")));
+      return;
+    }
+
+    auto triple = obj->header(isolate, "TripleBuffer.publish");
+    if (triple == nullptr || !check_slots(isolate, triple))
+      return;
+
+    if (copy)
+      length = node::Buffer::Length(args[0]);
+
+    if (length > shape.frameSize)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Frame is bigger than the slots in TripleBuffer.publish")));
+      return;
+    }
+
+    auto back = triple->writeSlot;
+    auto frame = reinterpret_cast<char *>(triple) + shape.frame_offset(back);
+    if (copy)
+      memcpy(frame, node::Buffer::Data(args[0]), static_cast<size_t>(length));
+
+    auto sequence = triple->published.load(std::memory_order_relaxed) + 1;
+    auto slot = obj->slots(triple) + back;
+    slot->sequence = sequence;
+    slot->length = length;
+    triple->published.store(sequence, std::memory_order_relaxed);
+
+    // Hand our slot over as the newest frame and take whatever was in the
+    // middle, which the reader has either seen or never will
+    auto previous = triple->state.exchange(back | triple_header::FRESH, std::memory_order_acq_rel);
+    triple->writeSlot = previous & SLOT_MASK;
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(sequence)));
+  }
+
+  void triple_buffer::AcquireLatest(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<triple_buffer>(args.Holder());
+
+    auto triple = obj->header(isolate, "TripleBuffer.acquireLatest");
+    if (triple == nullptr || !check_slots(isolate, triple))
+      return;
+
+    auto front = triple->readSlot;
+    if (triple->state.load(std::memory_order_relaxed) & triple_header::FRESH)
+    {
+      auto previous = triple->state.exchange(front, std::memory_order_acq_rel);
+      front = previous & SLOT_MASK;
+      triple->readSlot = front;
+
+      if (!check_slots(isolate, triple))
+        return;
+    }
+
+    auto slot = obj->slots(triple) + front;
+    if (slot->sequence == 0)
+    {
+      args.GetReturnValue().SetNull();
+      return;
+    }
+
+    auto &shape = obj->m_layout;
+    auto length = slot->length < shape.frameSize ? slot->length : shape.frameSize;
+    args.GetReturnValue().Set(obj->view(isolate, shape.frame_offset(front), length));
+  }
+
+  void triple_buffer::Sequence(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<triple_buffer>(args.Holder());
+
+    auto triple = obj->header(isolate, "TripleBuffer.sequence");
+    if (triple == nullptr || !check_slots(isolate, triple))
+      return;
+
+    auto slot = obj->slots(triple) + triple->readSlot;
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(slot->sequence)));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void triple_buffer::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<triple_buffer>, String::NewFromUtf8(isolate, "TripleBuffer"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "TripleBuffer"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "size"), FunctionTemplate::New(isolate, Size));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "acquireWrite", AcquireWrite);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "publish", Publish);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "acquireLatest", AcquireLatest);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "sequence", Sequence);
+
+    exports->Set(
+      String::NewFromUtf8(isolate, "TripleBuffer"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
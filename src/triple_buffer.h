@@ -0,0 +1,106 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Lock-free triple buffer stored inside a file_mapping, wrapped object for
+// node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_TRIPLE_BUFFER_H
+#define NODEJS_TRIPLE_BUFFER_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <atomic>
+#include <cstdint>
+#include "mapped_object.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // Three frame slots handed around between one writer and one reader. The
+  // writer owns one slot and the reader owns another; the third sits in the
+  // middle holding the newest finished frame. Publishing swaps the writer's
+  // slot with the middle one, and taking the latest swaps the reader's slot
+  // with the middle one if a new frame arrived since. Both swaps are a single
+  // exchange on the state word, so neither side ever waits for the other -
+  // a writer that outruns the reader just replaces the frame in the middle.
+  struct triple_header
+  {
+    static const uint32_t MAGIC = 0x54726970; // 'Trip'
+    static const uint32_t VERSION = 1;
+    static const uint32_t FRESH = 4; // In state: the middle slot hasn't been read yet
+
+    uint32_t magic;
+    uint32_t version;
+    uint64_t frameSize;
+    std::atomic<uint32_t> state; // Middle slot, | FRESH
+    uint32_t writeSlot;          // Only the writer changes this
+    uint32_t readSlot;           // Only the reader changes this
+    uint32_t pad0;
+    std::atomic<uint64_t> published;
+    char pad[24];
+  };
+
+  static_assert(sizeof(triple_header) == 64, "triple_header must take exactly one cache line");
+
+  // What's in a slot, written by the writer before the slot is published
+  struct triple_slot
+  {
+    uint64_t sequence; // 0 until a frame is published in it
+    uint64_t length;
+    char pad[48];
+  };
+
+  static_assert(sizeof(triple_slot) == 64, "triple_slot must take exactly one cache line");
+
+  // ---------------------------------------------------------------------------
+
+  class triple_buffer : public mapped_object
+  {
+  public:
+    triple_buffer();
+
+    static void Create(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void AcquireWrite(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Publish(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void AcquireLatest(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Sequence(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Size(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+  private:
+    // Where everything is for a frame size, worked out without the header
+    struct layout
+    {
+      uint64_t frameSize;
+      uint64_t slotStride; // Frame size rounded up to a cache line
+
+      static bool make(uint64_t frameSize, layout &result);
+      uint64_t frame_offset(uint32_t slot) const { return sizeof(triple_header) + 3 * sizeof(triple_slot) + slot * slotStride; }
+      uint64_t total_size() const { return frame_offset(3); }
+    };
+
+    triple_header *header(v8::Isolate *isolate, const char *method) const;
+    triple_slot *slots(triple_header *triple) const;
+
+    // Checks the slot numbers in the header, which another process could
+    // have scribbled on. Throws and returns false if they don't add up.
+    static bool check_slots(v8::Isolate *isolate, triple_header *triple);
+
+    layout m_layout;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,465 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Shared pool of threads that do node_filemap's blocking waits, so async
+// waits don't block the event loop
+// -----------------------------------------------------------------------------
+
+#include "waiter.h"
+#include "addon_data.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <thread>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    // How long an idle pool thread waits for another request before exiting
+    const DWORD IDLE_MS = 10000;
+
+#ifdef __linux__
+    // The most threads the pool runs, and how many requests each takes on
+    // before the pool starts another
+    const size_t MAX_THREADS = 4;
+    const size_t THREAD_REQUESTS = 16;
+#endif
+
+#ifdef _WIN32
+    // Queued by cancel(). Running it is enough to end an alertable wait.
+    void CALLBACK WakeUp(ULONG_PTR)
+    {
+    }
+#endif
+  }
+
+  // ---------------------------------------------------------------------------
+
+  wait_request::wait_request(DWORD ms) :
+    m_deadline(wait_deadline::after(ms)),
+    m_cancelled(0),
+    m_port(nullptr)
+  {
+#ifdef _WIN32
+    m_thread = nullptr;
+#endif
+  }
+
+  wait_request::~wait_request()
+  {
+  }
+
+  bool wait_request::block(const wait_deadline &)
+  {
+    return false;
+  }
+
+#ifdef __linux__
+  bool wait_request::poll(std::vector<futex_wait_entry> &)
+  {
+    return block(m_deadline);
+  }
+#endif
+
+  void wait_request::discard()
+  {
+    delete this;
+  }
+
+  void wait_request::cancel()
+  {
+    m_cancelled.store(1);
+
+#ifdef _WIN32
+    std::lock_guard<std::mutex> guard(m_threadLock);
+    if (m_thread != nullptr)
+      QueueUserAPC(WakeUp, m_thread, 0);
+#elif defined(__linux__)
+    futex_wake(&m_cancelled, INT_MAX);
+#endif
+  }
+
+  // ---------------------------------------------------------------------------
+
+  using namespace v8;
+
+  promise_request::promise_request(Isolate *isolate, const char *name, DWORD ms, Local<Promise::Resolver> resolver) :
+    wait_request(ms),
+    node::AsyncResource(isolate, Object::New(isolate), name),
+    m_isolate(isolate),
+    m_context(isolate, isolate->GetCurrentContext()),
+    m_resolver(isolate, resolver)
+  {
+  }
+
+  promise_request::~promise_request()
+  {
+    if (!m_signal.IsEmpty())
+    {
+      HandleScope scope(m_isolate);
+
+      auto signal = Local<Object>::New(m_isolate, m_signal);
+      auto remove = signal->Get(String::NewFromUtf8(m_isolate, "removeEventListener")).As<Function>();
+      Local<Value> removeArgs[] = { String::NewFromUtf8(m_isolate, "abort"), Local<Function>::New(m_isolate, m_onAbort) };
+      remove->Call(signal, 2, removeArgs);
+    }
+
+    m_signal.Reset();
+    m_onAbort.Reset();
+    m_resolver.Reset();
+    m_context.Reset();
+  }
+
+  void promise_request::discard()
+  {
+    // Nothing can run JS now, so leave the listener on the signal
+    m_signal.Reset();
+    delete this;
+  }
+
+  Local<Context> promise_request::context() const
+  {
+    return Local<Context>::New(m_isolate, m_context);
+  }
+
+  void promise_request::listen(Local<Object> signal)
+  {
+    auto context = m_isolate->GetCurrentContext();
+    auto onAbort = Function::New(context, OnAbort, External::New(m_isolate, this)).ToLocalChecked();
+
+    auto add = signal->Get(String::NewFromUtf8(m_isolate, "addEventListener")).As<Function>();
+    Local<Value> addArgs[] = { String::NewFromUtf8(m_isolate, "abort"), onAbort };
+    add->Call(signal, 2, addArgs);
+
+    m_signal.Reset(m_isolate, signal);
+    m_onAbort.Reset(m_isolate, onAbort);
+  }
+
+  // The listener is removed before the request is deleted, so this is always
+  // a live request
+  void promise_request::OnAbort(const FunctionCallbackInfo<Value> &args)
+  {
+    auto request = reinterpret_cast<promise_request *>(args.Data().As<External>()->Value());
+    request->cancel();
+  }
+
+  void promise_request::resolve(Local<Value> value)
+  {
+    node::AsyncResource::CallbackScope callbackScope(this);
+
+    auto resolver = Local<Promise::Resolver>::New(m_isolate, m_resolver);
+    resolver->Resolve(m_isolate->GetCurrentContext(), value).FromJust();
+  }
+
+  void promise_request::reject(Local<Value> error)
+  {
+    node::AsyncResource::CallbackScope callbackScope(this);
+
+    auto resolver = Local<Promise::Resolver>::New(m_isolate, m_resolver);
+    resolver->Reject(m_isolate->GetCurrentContext(), error).FromJust();
+  }
+
+  bool promise_request::read_signal(Isolate *isolate, Local<Value> value, Local<Object> &signal)
+  {
+    if (value->IsUndefined() || value->IsNull())
+      return true;
+
+    if (!value->IsObject())
+      return false;
+
+    signal = value.As<Object>();
+    return signal->Get(String::NewFromUtf8(isolate, "addEventListener"))->IsFunction() &&
+           signal->Get(String::NewFromUtf8(isolate, "removeEventListener"))->IsFunction();
+  }
+
+  bool promise_request::aborted(Isolate *isolate, Local<Object> signal)
+  {
+    return !signal.IsEmpty() && signal->Get(String::NewFromUtf8(isolate, "aborted"))->BooleanValue();
+  }
+
+  Local<Value> promise_request::abort_error(Isolate *isolate)
+  {
+    auto err = Exception::Error(String::NewFromUtf8(isolate, "The operation was aborted")).As<Object>();
+    err->Set(String::NewFromUtf8(isolate, "name"), String::NewFromUtf8(isolate, "AbortError"));
+    err->Set(String::NewFromUtf8(isolate, "code"), String::NewFromUtf8(isolate, "ABORT_ERR"));
+    return err;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  wait_port::wait_port(uv_loop_t *loop)
+  {
+    uv_async_init(loop, &m_async, OnCompleted);
+    m_async.data = this;
+
+    // Only keep the loop alive while something is waiting
+    uv_unref(reinterpret_cast<uv_handle_t *>(&m_async));
+  }
+
+  void wait_port::close()
+  {
+    for (auto request : m_requests)
+      request->cancel();
+
+    // Cancelled requests come back from the pool as soon as block() wakes
+    std::vector<std::pair<wait_request *, bool>> done;
+    {
+      std::unique_lock<std::mutex> guard(m_lock);
+      m_returned.wait(guard, [this]() { return m_done.size() == m_requests.size(); });
+      done.swap(m_done);
+    }
+
+    m_requests.clear();
+
+    for (auto &it : done)
+      it.first->discard();
+
+    uv_close(reinterpret_cast<uv_handle_t *>(&m_async), [](uv_handle_t *handle) {
+      delete reinterpret_cast<wait_port *>(handle->data);
+    });
+  }
+
+  void wait_port::OnCompleted(uv_async_t *handle)
+  {
+    auto port = reinterpret_cast<wait_port *>(handle->data);
+
+    std::vector<std::pair<wait_request *, bool>> done;
+    {
+      std::lock_guard<std::mutex> guard(port->m_lock);
+      done.swap(port->m_done);
+    }
+
+    for (auto &it : done)
+    {
+      port->m_requests.erase(it.first);
+      it.first->finished(it.second);
+    }
+
+    if (port->m_requests.empty())
+      uv_unref(reinterpret_cast<uv_handle_t *>(&port->m_async));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  waiter_pool &waiter_pool::instance()
+  {
+    static waiter_pool *pool = new waiter_pool();
+    return *pool;
+  }
+
+#ifdef __linux__
+  waiter_pool::waiter_pool()
+  {
+  }
+
+  waiter_pool::watcher::watcher() :
+    wake(0),
+    load(0)
+  {
+  }
+#else
+  waiter_pool::waiter_pool() :
+    m_idle(0)
+  {
+  }
+#endif
+
+  // ---------------------------------------------------------------------------
+
+  void waiter_pool::submit(wait_request *request)
+  {
+    auto &port = addon_data::current().port();
+    request->m_port = &port;
+
+    if (port.m_requests.empty())
+      uv_ref(reinterpret_cast<uv_handle_t *>(&port.m_async));
+
+    port.m_requests.insert(request);
+
+    std::lock_guard<std::mutex> guard(m_lock);
+
+#ifdef __linux__
+    // The least busy thread takes it, unless they all have plenty to watch
+    // already and there's room for another
+    watcher *target = nullptr;
+    for (auto it : m_watchers)
+    {
+      if (target == nullptr || it->load < target->load)
+        target = it;
+    }
+
+    if (target == nullptr || (target->load >= THREAD_REQUESTS && m_watchers.size() < MAX_THREADS))
+    {
+      target = new watcher();
+      m_watchers.push_back(target);
+      std::thread(&waiter_pool::run, this, target).detach();
+    }
+
+    target->incoming.push_back(request);
+    ++target->load;
+
+    target->wake.fetch_add(1);
+    futex_wake(&target->wake, 1);
+#else
+    m_queue.push_back(request);
+
+    if (m_queue.size() > m_idle)
+    {
+      ++m_idle;
+      std::thread(&waiter_pool::run, this).detach();
+    }
+
+    m_wake.notify_one();
+#endif
+  }
+
+  void waiter_pool::finish(wait_request *request, bool ready)
+  {
+    // All under the port's lock, so once close() has seen every request
+    // come back no pool thread touches the port again
+    auto port = request->m_port;
+
+    std::lock_guard<std::mutex> portGuard(port->m_lock);
+    port->m_done.emplace_back(request, ready);
+    port->m_returned.notify_all();
+    uv_async_send(&port->m_async);
+  }
+
+  // ---------------------------------------------------------------------------
+
+#ifdef __linux__
+
+  void waiter_pool::run(watcher *self)
+  {
+    std::vector<wait_request *> watching;
+    std::vector<futex_wait_entry> entries;
+    bool idle = false;
+
+    for (;;)
+    {
+      // Read before picking up requests, so one handed over after we look
+      // ends the sleep below
+      uint32_t wake = self->wake.load();
+
+      {
+        std::lock_guard<std::mutex> guard(m_lock);
+
+        watching.insert(watching.end(), self->incoming.begin(), self->incoming.end());
+        self->incoming.clear();
+
+        if (watching.empty() && idle)
+        {
+          m_watchers.erase(std::find(m_watchers.begin(), m_watchers.end(), self));
+          delete self;
+          return;
+        }
+      }
+
+      entries.clear();
+      entries.push_back({ &self->wake, wake });
+      auto until = wait_deadline::after(INFINITE);
+
+      for (size_t i = 0; i < watching.size();)
+      {
+        auto request = watching[i];
+        auto first = entries.size();
+
+        // cancel() sets the flag before it wakes it, so either we see it
+        // here or it ends the sleep
+        entries.push_back({ request->cancel_word(), 0 });
+        bool ready = !request->cancelled() && request->poll(entries);
+
+        if (ready || entries.size() == first + 1 || request->deadline().expired())
+        {
+          entries.resize(first);
+          watching[i] = watching.back();
+          watching.pop_back();
+
+          finish(request, ready);
+
+          std::lock_guard<std::mutex> guard(m_lock);
+          --self->load;
+          continue;
+        }
+
+        until = wait_deadline::earliest(until, request->deadline());
+        ++i;
+      }
+
+      if (watching.empty())
+      {
+        idle = futex_wait(&self->wake, wake, wait_deadline::after(IDLE_MS)) == ETIMEDOUT;
+      }
+      else
+      {
+        idle = false;
+        futex_wait_multiple(entries.data(), entries.size(), until);
+      }
+    }
+  }
+
+#else
+
+  void waiter_pool::run()
+  {
+#ifdef _WIN32
+    HANDLE thread;
+    DuplicateHandle(GetCurrentProcess(), GetCurrentThread(), GetCurrentProcess(), &thread, 0, FALSE, DUPLICATE_SAME_ACCESS);
+#endif
+
+    std::unique_lock<std::mutex> guard(m_lock);
+
+    while (m_wake.wait_for(guard, std::chrono::milliseconds(IDLE_MS), [this]() { return !m_queue.empty(); }))
+    {
+      auto request = m_queue.front();
+      m_queue.pop_front();
+      --m_idle;
+
+      guard.unlock();
+
+#ifdef _WIN32
+      {
+        std::lock_guard<std::mutex> threadGuard(request->m_threadLock);
+        request->m_thread = thread;
+      }
+#endif
+
+      // cancel() sets the flag before it looks for our thread, so either we
+      // see it here or it wakes the block()
+      bool ready = !request->cancelled() && request->block(request->deadline());
+
+#ifdef _WIN32
+      {
+        std::lock_guard<std::mutex> threadGuard(request->m_threadLock);
+        request->m_thread = nullptr;
+      }
+
+      // Run any APC that came too late to wake the block(), so it can't cut
+      // short the next one
+      SleepEx(0, TRUE);
+#endif
+
+      finish(request, ready);
+
+      guard.lock();
+      ++m_idle;
+    }
+
+    --m_idle;
+    guard.unlock();
+
+#ifdef _WIN32
+    CloseHandle(thread);
+#endif
+  }
+
+#endif
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
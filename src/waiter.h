@@ -0,0 +1,218 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Shared pool of threads that do node_filemap's blocking waits, so async
+// waits don't block the event loop
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_WAITER_H
+#define NODEJS_WAITER_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <uv.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+#include "deadline.h"
+
+#ifdef __linux__
+#include "futex.h"
+#endif
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  class wait_port;
+
+  // One async wait. The pool waits on a pool thread until the objects look
+  // available, the deadline passes or the request is cancelled, then calls
+  // finished() back on the JS thread. Actually taking the objects happens in
+  // finished(), so the calling thread ends up owning them; if someone beat
+  // us to it, finished() can submit the request again.
+  class wait_request
+  {
+  public:
+    explicit wait_request(DWORD ms);
+    virtual ~wait_request();
+
+    // Pool thread. Blocks until the objects look available (returns true) or
+    // until is reached, or the request is cancelled (returns false). On
+    // Windows it sleeps alertably, and cancel() queues an APC to end the
+    // sleep. On Linux only requests with work to do, like a flush, get here;
+    // waits sleep through poll() instead.
+    virtual bool block(const wait_deadline &until);
+
+#ifdef __linux__
+    // Pool thread. Lets one thread sleep on many requests at once: true if
+    // the objects look available, otherwise adds the futex words to sleep
+    // on, and the values they hold now, to entries. Adding nothing means
+    // the request is done without them. The default runs block() instead.
+    virtual bool poll(std::vector<futex_wait_entry> &entries);
+#endif
+
+    // JS thread. ready is what the last block() returned.
+    virtual void finished(bool ready) = 0;
+
+    // JS thread, instead of finished() when the environment is going away.
+    // Mustn't call into JS.
+    virtual void discard();
+
+    // JS thread. Wakes a block() in progress, and the next finished() will
+    // see cancelled() set.
+    void cancel();
+
+    bool cancelled() const { return m_cancelled.load() != 0; }
+    const wait_deadline &deadline() const { return m_deadline; }
+
+    // Nonzero once the request is cancelled, and futex woken then, so a
+    // cancel can't slip in between block() looking and going to sleep
+    std::atomic<uint32_t> *cancel_word() { return &m_cancelled; }
+
+  private:
+    friend class waiter_pool;
+
+    wait_deadline m_deadline;
+    std::atomic<uint32_t> m_cancelled;
+    wait_port *m_port; // Where the pool hands it back, set when it's submitted
+
+#ifdef _WIN32
+    std::mutex m_threadLock;
+    HANDLE m_thread; // The pool thread in block(), for cancel() to queue an APC to
+#endif
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // A wait_request that settles a Promise, and which an AbortSignal can
+  // cancel. Subclasses settle it in finished(), inside scope().
+  class promise_request : public wait_request, public node::AsyncResource
+  {
+  public:
+    promise_request(v8::Isolate *isolate, const char *name, DWORD ms, v8::Local<v8::Promise::Resolver> resolver);
+    ~promise_request();
+
+    // JS thread. Cancels the request when signal fires.
+    void listen(v8::Local<v8::Object> signal);
+
+    void resolve(v8::Local<v8::Value> value);
+    void reject(v8::Local<v8::Value> error);
+
+    // Reads an optional AbortSignal. Anything with an aborted flag and
+    // add/removeEventListener will do.
+    static bool read_signal(v8::Isolate *isolate, v8::Local<v8::Value> value, v8::Local<v8::Object> &signal);
+    static bool aborted(v8::Isolate *isolate, v8::Local<v8::Object> signal);
+
+    // What AbortSignal-aware node APIs reject with
+    static v8::Local<v8::Value> abort_error(v8::Isolate *isolate);
+
+    void discard() override;
+
+  protected:
+    v8::Isolate *isolate() const { return m_isolate; }
+    v8::Local<v8::Context> context() const;
+
+  private:
+    static void OnAbort(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    v8::Isolate *m_isolate;
+    v8::Persistent<v8::Context> m_context;
+    v8::Persistent<v8::Promise::Resolver> m_resolver;
+    v8::Persistent<v8::Object> m_signal;
+    v8::Persistent<v8::Function> m_onAbort;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // Where the pool hands finished requests back to the JS thread that
+  // submitted them. There's one for each isolate using the addon, on that
+  // isolate's event loop, so a wait started on a worker_thread finishes on
+  // the same worker.
+  class wait_port
+  {
+  public:
+    explicit wait_port(uv_loop_t *loop);
+
+    // JS thread, as the environment goes away. Cancels the requests still in
+    // flight, waits for the pool to give them back, discards them and then
+    // closes and deletes the port.
+    void close();
+
+  private:
+    friend class waiter_pool;
+
+    ~wait_port() {}
+
+    static void OnCompleted(uv_async_t *handle);
+
+    std::mutex m_lock;
+    std::condition_variable m_returned;
+    std::vector<std::pair<wait_request *, bool>> m_done;
+
+    std::unordered_set<wait_request *> m_requests; // JS thread only - submitted but not finished
+    uv_async_t m_async;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // Shared by every isolate in the process. On Linux each thread sleeps on
+  // the requests it's been handed all at once, in one futex_wait_multiple
+  // on their objects and cancel_word()s, so a handful of threads serve any
+  // number of waits. A Windows wait for all of a list can't share a call
+  // with anything else, so there each request blocks a thread of its own.
+  // Either way threads are started as requests come in and exit once
+  // they've been idle for a while.
+  class waiter_pool
+  {
+  public:
+    static waiter_pool &instance();
+
+    // JS thread. The pool owns the request until finished() is called on
+    // this thread.
+    void submit(wait_request *request);
+
+  private:
+    waiter_pool();
+
+    // Pool thread. Hands the request back to the JS thread that submitted it.
+    static void finish(wait_request *request, bool ready);
+
+    std::mutex m_lock;
+
+#ifdef __linux__
+    // One pool thread and the requests handed to it
+    struct watcher
+    {
+      watcher();
+
+      std::atomic<uint32_t> wake;           // Bumped and woken when requests are handed over
+      std::vector<wait_request *> incoming; // Handed over, not picked up yet
+      size_t load;                          // Requests handed to it and not handed back yet
+    };
+
+    void run(watcher *self);
+
+    std::vector<watcher *> m_watchers; // All under m_lock, apart from wake
+#else
+    void run();
+
+    std::condition_variable m_wake;
+    std::deque<wait_request *> m_queue;
+    size_t m_idle;
+#endif
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,545 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// File mapped a window at a time, wrapped object for node_filemap
+// -----------------------------------------------------------------------------
+
+#include "windowed_file.h"
+#include "js_helpers.h"
+#include <node_buffer.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    const uint64_t DEFAULT_WINDOW_SIZE = 64ull << 20;
+    const uint64_t DEFAULT_BUDGET = 1ull << 30;
+
+    // Where a window may start: the allocation granularity on Windows (64
+    // KB), the page size elsewhere
+    uint64_t Granularity()
+    {
+#ifdef _WIN32
+      SYSTEM_INFO info;
+      GetSystemInfo(&info);
+      return info.dwAllocationGranularity;
+#else
+      return page_size();
+#endif
+    }
+
+    bool ReadWindowOptions(Isolate *isolate, Local<Value> value, window_options &options)
+    {
+      if (value->IsUndefined() || value->IsNull())
+        return true;
+
+      if (!value->IsObject())
+        return false;
+
+      auto obj = value->ToObject();
+
+      auto windowSize = obj->Get(String::NewFromUtf8(isolate, "windowSize"));
+      if (!windowSize->IsUndefined() && !(ReadUint(windowSize, UINT64_MAX, options.windowSize) && options.windowSize > 0))
+        return false;
+
+      auto budget = obj->Get(String::NewFromUtf8(isolate, "budget"));
+      if (!budget->IsUndefined() && !ReadUint(budget, UINT64_MAX, options.budget))
+        return false;
+
+      auto size = obj->Get(String::NewFromUtf8(isolate, "size"));
+      if (!size->IsUndefined() && !ReadUint(size, UINT64_MAX, options.size))
+        return false;
+
+      auto readOnly = obj->Get(String::NewFromUtf8(isolate, "readOnly"));
+      if (readOnly->IsBoolean())
+        options.readOnly = readOnly->IsTrue();
+      else if (!readOnly->IsUndefined())
+        return false;
+
+      return !(options.readOnly && options.size != 0);
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  window_options::window_options() :
+    windowSize(DEFAULT_WINDOW_SIZE),
+    budget(DEFAULT_BUDGET),
+    size(0),
+    readOnly(false)
+  {
+  }
+
+  // ---------------------------------------------------------------------------
+
+  windowed_file::windowed_file() :
+    m_size(0),
+    m_maxWindows(0),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0),
+#ifdef _WIN32
+    m_fileHandle(INVALID_HANDLE_VALUE),
+    m_mappingHandle(INVALID_HANDLE_VALUE)
+#else
+    m_fd(-1)
+#endif
+  {
+  }
+
+  windowed_file::~windowed_file()
+  {
+    close();
+  }
+
+  bool windowed_file::is_open() const
+  {
+#ifdef _WIN32
+    return m_fileHandle != INVALID_HANDLE_VALUE;
+#else
+    return m_fd >= 0;
+#endif
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void windowed_file::open(const char *fileName, const window_options &options, Isolate *isolate)
+  {
+    close();
+
+    m_options = options;
+
+    auto granularity = Granularity();
+    m_options.windowSize = (options.windowSize + granularity - 1) / granularity * granularity;
+    m_maxWindows = static_cast<size_t>(options.budget / m_options.windowSize);
+
+    // One window has to fit, or nothing could be read at all
+    if (m_maxWindows == 0)
+      m_maxWindows = 1;
+
+#ifdef _WIN32
+    m_fileHandle = CreateFile(
+      fileName,
+      GENERIC_READ | (options.readOnly ? 0 : GENERIC_WRITE),
+      FILE_SHARE_READ | FILE_SHARE_WRITE,
+      nullptr,
+      options.size != 0 ? OPEN_ALWAYS : OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL,
+      nullptr);
+
+    if (m_fileHandle == INVALID_HANDLE_VALUE)
+    {
+      ThrowErrorCode(isolate, "Failed to open file, error code: ", GetLastError());
+      return;
+    }
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(m_fileHandle, &fileSize))
+    {
+      int lastErr = GetLastError();
+      close();
+
+      ThrowErrorCode(isolate, "Failed to open file, error code: ", lastErr);
+      return;
+    }
+
+    // A section bigger than the file grows the file, like CreateFileMapping
+    // does for createMapping
+    m_size = static_cast<uint64_t>(fileSize.QuadPart);
+    if (options.size > m_size)
+      m_size = options.size;
+
+    if (m_size == 0)
+    {
+      close();
+
+      ThrowErrorCode(isolate, "Failed to open file, error code: ", ERROR_FILE_INVALID);
+      return;
+    }
+
+    m_mappingHandle = CreateFileMapping(
+      m_fileHandle,
+      nullptr,
+      options.readOnly ? PAGE_READONLY : PAGE_READWRITE,
+      static_cast<DWORD>(m_size >> 32),
+      static_cast<DWORD>(m_size),
+      nullptr);
+
+    if (m_mappingHandle == nullptr)
+    {
+      m_mappingHandle = INVALID_HANDLE_VALUE;
+      int lastErr = GetLastError();
+      close();
+
+      ThrowErrorCode(isolate, "Failed to create file mapping, error code: ", lastErr);
+      return;
+    }
+#else
+    m_fd = ::open(fileName, (options.readOnly ? O_RDONLY : O_RDWR) | (options.size != 0 ? O_CREAT : 0) | O_CLOEXEC, 0666);
+
+    if (m_fd < 0)
+    {
+      ThrowErrorCode(isolate, "Failed to open file, error code: ", errno);
+      return;
+    }
+
+    struct stat fileInfo;
+    if (fstat(m_fd, &fileInfo) != 0)
+    {
+      int lastErr = errno;
+      close();
+
+      ThrowErrorCode(isolate, "Failed to open file, error code: ", lastErr);
+      return;
+    }
+
+    m_size = static_cast<uint64_t>(fileInfo.st_size);
+
+    if (options.size > m_size)
+    {
+      if (ftruncate(m_fd, static_cast<off_t>(options.size)) != 0)
+      {
+        int lastErr = errno;
+        close();
+
+        ThrowErrorCode(isolate, "Failed to open file, error code: ", lastErr);
+        return;
+      }
+
+      m_size = options.size;
+    }
+#endif
+  }
+
+  void windowed_file::close()
+  {
+    for (auto &view : m_windows)
+      unmap(view);
+
+    m_windows.clear();
+    m_byIndex.clear();
+    m_hits = m_misses = m_evictions = 0;
+    m_size = 0;
+
+#ifdef _WIN32
+    if (m_mappingHandle != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(m_mappingHandle);
+      m_mappingHandle = INVALID_HANDLE_VALUE;
+    }
+    if (m_fileHandle != INVALID_HANDLE_VALUE)
+    {
+      CloseHandle(m_fileHandle);
+      m_fileHandle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_fd >= 0)
+    {
+      ::close(m_fd);
+      m_fd = -1;
+    }
+#endif
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void windowed_file::unmap(window &view)
+  {
+#ifdef _WIN32
+    UnmapViewOfFile(view.ptr);
+#else
+    munmap(view.ptr, static_cast<size_t>(view.length));
+#endif
+  }
+
+  windowed_file::window *windowed_file::find(uint64_t offset, int &error)
+  {
+    auto index = offset / m_options.windowSize;
+    // Random reads mostly land in the window they landed in last time, so
+    // check the front of the list before the map
+    auto found = !m_windows.empty() && m_windows.front().index == index ? m_windows.begin() : m_windows.end();
+
+    if (found == m_windows.end())
+    {
+      auto it = m_byIndex.find(index);
+      if (it != m_byIndex.end())
+      {
+        found = it->second;
+        m_windows.splice(m_windows.begin(), m_windows, found);
+      }
+    }
+
+    if (found != m_windows.end())
+    {
+      ++found->hits;
+      ++m_hits;
+      return &m_windows.front();
+    }
+
+    ++m_misses;
+
+    while (m_windows.size() >= m_maxWindows)
+    {
+      auto &oldest = m_windows.back();
+      unmap(oldest);
+      m_byIndex.erase(oldest.index);
+      m_windows.pop_back();
+      ++m_evictions;
+    }
+
+    window view;
+    view.index = index;
+    view.hits = 0;
+    auto start = index * m_options.windowSize;
+    view.length = m_size - start < m_options.windowSize ? m_size - start : m_options.windowSize;
+
+#ifdef _WIN32
+    view.ptr = reinterpret_cast<char *>(MapViewOfFile(
+      m_mappingHandle,
+      m_options.readOnly ? FILE_MAP_READ : FILE_MAP_WRITE,
+      static_cast<DWORD>(start >> 32),
+      static_cast<DWORD>(start),
+      static_cast<SIZE_T>(view.length)));
+
+    if (view.ptr == nullptr)
+    {
+      error = GetLastError();
+      return nullptr;
+    }
+#else
+    void *ptr = mmap(nullptr, static_cast<size_t>(view.length), PROT_READ | (m_options.readOnly ? 0 : PROT_WRITE), MAP_SHARED, m_fd, static_cast<off_t>(start));
+
+    if (ptr == MAP_FAILED)
+    {
+      error = errno;
+      return nullptr;
+    }
+
+    view.ptr = reinterpret_cast<char *>(ptr);
+#endif
+
+    m_windows.push_front(view);
+    m_byIndex[index] = m_windows.begin();
+    return &m_windows.front();
+  }
+
+  bool windowed_file::copy(uint64_t offset, char *buffer, uint64_t length, bool write, int &error)
+  {
+    while (length > 0)
+    {
+      auto view = find(offset, error);
+      if (view == nullptr)
+        return false;
+
+      auto within = offset - view->index * m_options.windowSize;
+      auto chunk = view->length - within < length ? view->length - within : length;
+
+      if (write)
+        memcpy(view->ptr + within, buffer, static_cast<size_t>(chunk));
+      else
+        memcpy(buffer, view->ptr + within, static_cast<size_t>(chunk));
+
+      offset += chunk;
+      buffer += chunk;
+      length -= chunk;
+    }
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void windowed_file::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<windowed_file>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to WindowedFile.open")));
+      return;
+    }
+
+    window_options options;
+
+    if (!(args[0]->IsString() && ReadWindowOptions(isolate, args[1], options)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to WindowedFile.open")));
+      return;
+    }
+
+    std::string fileName = ToCString(args[0]->ToString());
+
+    obj->open(fileName.c_str(), options, isolate);
+  }
+
+  void windowed_file::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<windowed_file>(args.Holder());
+
+    obj->close();
+  }
+
+  void windowed_file::ReadInto(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<windowed_file>(args.Holder());
+
+    if (args.Length() < 3)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to WindowedFile.readInto")));
+      return;
+    }
+
+    uint64_t offset, length;
+
+    if (!(ReadUint(args[0], UINT64_MAX, offset) && ReadUint(args[1], UINT64_MAX, length) && node::Buffer::HasInstance(args[2])))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to WindowedFile.readInto")));
+      return;
+    }
+
+    if (!obj->is_open())
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "WindowedFile.readInto called on a closed file")));
+      return;
+    }
+
+    if (offset > obj->m_size || length > obj->m_size - offset || length > node::Buffer::Length(args[2]))
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "WindowedFile.readInto range is outside of the file or the buffer")));
+      return;
+    }
+
+    int error = 0;
+    if (!obj->copy(offset, node::Buffer::Data(args[2]), length, false, error))
+      ThrowErrorCode(isolate, "Failed to map window, error code: ", error);
+  }
+
+  void windowed_file::WriteBuffer(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<windowed_file>(args.Holder());
+
+    if (args.Length() < 4)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to WindowedFile.writeBuffer")));
+      return;
+    }
+
+    uint64_t destOffset, srcOffset, length;
+
+    if (!(node::Buffer::HasInstance(args[0]) && ReadUint(args[1], UINT64_MAX, destOffset) && ReadUint(args[2], UINT64_MAX, srcOffset) && ReadUint(args[3], UINT64_MAX, length)))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to WindowedFile.writeBuffer")));
+      return;
+    }
+
+    if (!obj->is_open())
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "WindowedFile.writeBuffer called on a closed file")));
+      return;
+    }
+
+    if (obj->m_options.readOnly)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "WindowedFile.writeBuffer called on a read only file")));
+      return;
+    }
+
+    uint64_t bufferLength = node::Buffer::Length(args[0]);
+
+    if (destOffset > obj->m_size || length > obj->m_size - destOffset || srcOffset > bufferLength || length > bufferLength - srcOffset)
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "WindowedFile.writeBuffer range is outside of the file or the buffer")));
+      return;
+    }
+
+    int error = 0;
+    if (!obj->copy(destOffset, node::Buffer::Data(args[0]) + srcOffset, length, true, error))
+      ThrowErrorCode(isolate, "Failed to map window, error code: ", error);
+  }
+
+  void windowed_file::Size(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<windowed_file>(args.Holder());
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(obj->m_size)));
+  }
+
+  void windowed_file::Stats(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<windowed_file>(args.Holder());
+
+    // In file order, not least recently used order
+    std::vector<const window *> mapped;
+    for (auto &view : obj->m_windows)
+      mapped.push_back(&view);
+    std::sort(mapped.begin(), mapped.end(), [](const window *a, const window *b) { return a->index < b->index; });
+
+    auto windows = Array::New(isolate, static_cast<int>(mapped.size()));
+    uint32_t i = 0;
+
+    for (auto view : mapped)
+    {
+      auto entry = Object::New(isolate);
+      entry->Set(String::NewFromUtf8(isolate, "offset"), Number::New(isolate, static_cast<double>(view->index * obj->m_options.windowSize)));
+      entry->Set(String::NewFromUtf8(isolate, "hits"), Number::New(isolate, static_cast<double>(view->hits)));
+      windows->Set(i++, entry);
+    }
+
+    auto result = Object::New(isolate);
+    result->Set(String::NewFromUtf8(isolate, "windowSize"), Number::New(isolate, static_cast<double>(obj->m_options.windowSize)));
+    result->Set(String::NewFromUtf8(isolate, "maxWindows"), Number::New(isolate, static_cast<double>(obj->m_maxWindows)));
+    result->Set(String::NewFromUtf8(isolate, "mapped"), Number::New(isolate, static_cast<double>(obj->m_windows.size())));
+    result->Set(String::NewFromUtf8(isolate, "hits"), Number::New(isolate, static_cast<double>(obj->m_hits)));
+    result->Set(String::NewFromUtf8(isolate, "misses"), Number::New(isolate, static_cast<double>(obj->m_misses)));
+    result->Set(String::NewFromUtf8(isolate, "evictions"), Number::New(isolate, static_cast<double>(obj->m_evictions)));
+    result->Set(String::NewFromUtf8(isolate, "windows"), windows);
+    args.GetReturnValue().Set(result);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void windowed_file::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, Construct<windowed_file>, String::NewFromUtf8(isolate, "WindowedFile"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "WindowedFile"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "readInto", ReadInto);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "writeBuffer", WriteBuffer);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "size", Size);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "stats", Stats);
+
+    exports->Set(
+      String::NewFromUtf8(isolate, "WindowedFile"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,109 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// File mapped a window at a time, wrapped object for node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_WINDOWED_FILE_H
+#define NODEJS_WINDOWED_FILE_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <node_object_wrap.h>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include "platform.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  struct window_options
+  {
+    window_options();
+
+    uint64_t windowSize; // Rounded up to the mapping granularity
+    uint64_t budget;     // How much address space the windows may take at once
+    uint64_t size;       // Grow the file to at least this, 0 to leave it
+    bool readOnly;
+  };
+
+  // ---------------------------------------------------------------------------
+
+  // A file too big to map all at once. Aligned windows of it are mapped as
+  // reads and writes touch them, and the least recently used window is
+  // unmapped when the windows would go over the budget. Copies that cross a
+  // window boundary are split between the windows.
+  class windowed_file : public node::ObjectWrap
+  {
+  public:
+    windowed_file();
+    ~windowed_file();
+
+    void open(const char *fileName, const window_options &options, v8::Isolate *isolate);
+    void close();
+
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void ReadInto(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void WriteBuffer(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Size(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Stats(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+  private:
+    template <typename T>
+    friend void Construct(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    struct window
+    {
+      uint64_t index;
+      char *ptr;
+      uint64_t length;
+      uint64_t hits; // Since it was mapped
+    };
+
+    // The window holding offset, mapping it (and unmapping others) if it
+    // isn't mapped already. Null, with error set, if it can't be mapped.
+    window *find(uint64_t offset, int &error);
+
+    void unmap(window &view);
+
+    // Copies between the file and buffer, a window at a time. Returns false,
+    // with error set, if a window can't be mapped.
+    bool copy(uint64_t offset, char *buffer, uint64_t length, bool write, int &error);
+
+    bool is_open() const;
+
+    window_options m_options;
+    uint64_t m_size;
+    size_t m_maxWindows;
+
+    std::list<window> m_windows; // Most recently used first
+    std::unordered_map<uint64_t, std::list<window>::iterator> m_byIndex;
+
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_evictions;
+
+#ifdef _WIN32
+    HANDLE m_fileHandle;
+    HANDLE m_mappingHandle;
+#else
+    int m_fd;
+#endif
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,567 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Multi producer, multi consumer work queue stored inside a file_mapping,
+// wrapped object for node_filemap
+// -----------------------------------------------------------------------------
+
+#include "work_queue.h"
+#include <node_buffer.h>
+#include <cstring>
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  using namespace v8;
+
+  // ---------------------------------------------------------------------------
+
+  namespace
+  {
+    enum slot_phase
+    {
+      SLOT_EMPTY = 0,
+      SLOT_WRITING = 1,
+      SLOT_FULL = 2,
+      SLOT_READING = 3
+    };
+
+    const uint32_t PID_MASK = 0x3FFFFFFF;
+    const uint64_t SLOT_HEADER = sizeof(queue_slot);
+    const uint64_t BLOCK_HEADER = sizeof(queue_block);
+    const uint32_t MAX_SLOTS = 1u << 30;
+    const uint32_t MAX_SLOT_SIZE = 1u << 20;
+
+    uint64_t MakeState(uint32_t lap, uint32_t phase, uint32_t pid)
+    {
+      return (static_cast<uint64_t>(lap) << 32) | (phase << 30) | (pid & PID_MASK);
+    }
+
+    uint32_t StateLap(uint64_t state) { return static_cast<uint32_t>(state >> 32); }
+    uint32_t StatePhase(uint64_t state) { return static_cast<uint32_t>(state >> 30) & 3; }
+    uint32_t StatePid(uint64_t state) { return static_cast<uint32_t>(state) & PID_MASK; }
+
+    uint32_t CurrentPid()
+    {
+      return current_pid() & PID_MASK;
+    }
+
+    bool ReadUint32(Local<Value> value, uint32_t max, uint32_t &result)
+    {
+      uint64_t number;
+      if (!mapped_object::read_uint(value, max, number))
+        return false;
+
+      result = static_cast<uint32_t>(number);
+      return true;
+    }
+
+    void ThrowCorrupt(Isolate *isolate)
+    {
+      isolate->ThrowException(Exception::Error(String::NewFromUtf8(isolate, "WorkQueue contains a corrupt message")));
+    }
+  }
+
+  // ---------------------------------------------------------------------------
+
+  uint64_t work_queue::layout::slot_stride() const
+  {
+    return (SLOT_HEADER + slotSize + 63) & ~static_cast<uint64_t>(63);
+  }
+
+  uint64_t work_queue::layout::total_size() const
+  {
+    return sizeof(queue_header) + slotCount * slot_stride() + static_cast<uint64_t>(blockCount) * blockSize;
+  }
+
+  uint64_t work_queue::layout::max_length() const
+  {
+    uint64_t overflow = blockCount * static_cast<uint64_t>(blockSize - BLOCK_HEADER);
+    uint64_t length = overflow > slotSize ? overflow : slotSize;
+    return length < node::Buffer::kMaxLength ? length : node::Buffer::kMaxLength;
+  }
+
+  bool work_queue::layout::valid() const
+  {
+    return slotCount >= 2 && slotCount <= MAX_SLOTS && (slotCount & (slotCount - 1)) == 0 &&
+      slotSize <= MAX_SLOT_SIZE &&
+      (blockCount == 0 || (blockCount < queue_block::NONE && blockSize >= 64 && blockSize % 64 == 0));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  work_queue::work_queue() :
+    m_lapShift(0)
+  {
+    memset(&m_layout, 0, sizeof(m_layout));
+  }
+
+  queue_header *work_queue::header(Isolate *isolate, const char *method) const
+  {
+    return reinterpret_cast<queue_header *>(memory(isolate, method));
+  }
+
+  queue_slot *work_queue::slot(queue_header *queue, uint64_t position) const
+  {
+    auto index = position & (m_layout.slotCount - 1);
+    auto base = reinterpret_cast<char *>(queue + 1);
+    return reinterpret_cast<queue_slot *>(base + index * m_layout.slot_stride());
+  }
+
+  queue_block *work_queue::block(queue_header *queue, uint32_t index) const
+  {
+    auto base = reinterpret_cast<char *>(queue + 1) + m_layout.slotCount * m_layout.slot_stride();
+    return reinterpret_cast<queue_block *>(base + static_cast<uint64_t>(index) * m_layout.blockSize);
+  }
+
+  // ---------------------------------------------------------------------------
+
+  uint32_t work_queue::alloc_chain(queue_header *queue, const char *data, uint64_t length)
+  {
+    auto perBlock = m_layout.blockSize - BLOCK_HEADER;
+    uint32_t first = queue_block::NONE;
+    queue_block *last = nullptr;
+
+    for (uint64_t done = 0; done < length; done += perBlock)
+    {
+      // Pop a block off the free list. The generation count stops a block
+      // that was taken and put back in the meantime from fooling the CAS.
+      uint32_t index;
+      auto head = queue->freeBlocks.load(std::memory_order_acquire);
+
+      for (;;)
+      {
+        index = static_cast<uint32_t>(head);
+        if (index >= m_layout.blockCount)
+        {
+          free_chain(queue, first);
+          return queue_block::NONE;
+        }
+
+        auto next = block(queue, index)->next.load(std::memory_order_relaxed);
+        auto replacement = ((head >> 32) + 1) << 32 | next;
+        if (queue->freeBlocks.compare_exchange_weak(head, replacement, std::memory_order_acquire))
+          break;
+      }
+
+      auto current = block(queue, index);
+      auto chunk = length - done < perBlock ? length - done : perBlock;
+      memcpy(current->data(), data + done, static_cast<size_t>(chunk));
+      current->next.store(queue_block::NONE, std::memory_order_relaxed);
+
+      if (last == nullptr)
+        first = index;
+      else
+        last->next.store(index, std::memory_order_relaxed);
+      last = current;
+    }
+
+    return first;
+  }
+
+  void work_queue::free_chain(queue_header *queue, uint32_t first)
+  {
+    while (first < m_layout.blockCount)
+    {
+      auto current = block(queue, first);
+      auto next = current->next.load(std::memory_order_relaxed);
+
+      auto head = queue->freeBlocks.load(std::memory_order_relaxed);
+      for (;;)
+      {
+        current->next.store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+        auto replacement = ((head >> 32) + 1) << 32 | first;
+        if (queue->freeBlocks.compare_exchange_weak(head, replacement, std::memory_order_release))
+          break;
+      }
+
+      first = next;
+    }
+  }
+
+  bool work_queue::copy_chain(queue_header *queue, uint32_t first, char *dest, uint64_t length)
+  {
+    auto perBlock = m_layout.blockSize - BLOCK_HEADER;
+
+    for (uint64_t done = 0; done < length; done += perBlock)
+    {
+      if (first >= m_layout.blockCount)
+        return false;
+
+      auto current = block(queue, first);
+      auto chunk = length - done < perBlock ? length - done : perBlock;
+      memcpy(dest + done, current->data(), static_cast<size_t>(chunk));
+      first = current->next.load(std::memory_order_relaxed);
+    }
+
+    return true;
+  }
+
+  bool work_queue::recover(queue_header *queue, queue_slot *slot, uint64_t state)
+  {
+    auto phase = StatePhase(state);
+    if ((phase != SLOT_WRITING && phase != SLOT_READING) || !process_died(StatePid(state)))
+      return false;
+
+    auto lap = StateLap(state);
+    if (!slot->state.compare_exchange_strong(state, MakeState(lap, phase, CurrentPid()), std::memory_order_acquire))
+      return false;
+
+    if (phase == SLOT_WRITING)
+    {
+      // We can't tell how far the producer got, so hand consumers a message
+      // they'll skip. Any blocks it had taken are lost.
+      slot->length = queue_slot::DEAD;
+      slot->firstBlock.store(queue_block::NONE, std::memory_order_relaxed);
+      slot->state.store(MakeState(lap, SLOT_FULL, 0), std::memory_order_release);
+    }
+    else
+    {
+      // The consumer clears firstBlock before it starts freeing, so whatever
+      // is left here is still ours to free
+      free_chain(queue, slot->firstBlock.exchange(queue_block::NONE, std::memory_order_acquire));
+      slot->state.store(MakeState(lap + 1, SLOT_EMPTY, 0), std::memory_order_release);
+    }
+
+    return true;
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void work_queue::Size(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+
+    if (args.Length() < 2)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to WorkQueue.size")));
+      return;
+    }
+
+    layout shape = {0, 0, 0, 0};
+
+    if (!(ReadUint32(args[0], MAX_SLOTS, shape.slotCount) && ReadUint32(args[1], MAX_SLOT_SIZE, shape.slotSize) &&
+          (args.Length() < 3 || ReadUint32(args[2], queue_block::NONE - 1, shape.blockCount)) &&
+          (args.Length() < 4 || ReadUint32(args[3], MAX_SLOT_SIZE, shape.blockSize))))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to WorkQueue.size")));
+      return;
+    }
+
+    if (!shape.valid())
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Bad queue shape passed to WorkQueue.size")));
+      return;
+    }
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(shape.total_size())));
+  }
+
+  void work_queue::Create(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<work_queue>(args.Holder());
+
+    if (!read_mapping_args(args, 4, "WorkQueue.create"))
+      return;
+
+    layout shape = {0, 0, 0, 0};
+
+    if (!(ReadUint32(args[2], MAX_SLOTS, shape.slotCount) && ReadUint32(args[3], MAX_SLOT_SIZE, shape.slotSize) &&
+          (args.Length() < 5 || ReadUint32(args[4], queue_block::NONE - 1, shape.blockCount)) &&
+          (args.Length() < 6 || ReadUint32(args[5], MAX_SLOT_SIZE, shape.blockSize))))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to WorkQueue.create")));
+      return;
+    }
+
+    if (!shape.valid())
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Bad queue shape passed to WorkQueue.create")));
+      return;
+    }
+
+    if (!obj->attach(isolate, args[0], args[1], shape.total_size(), 64, "WorkQueue.create"))
+      return;
+
+    obj->m_layout = shape;
+    obj->m_lapShift = 0;
+    while ((1u << obj->m_lapShift) < shape.slotCount)
+      obj->m_lapShift++;
+
+    auto queue = obj->header(isolate, "WorkQueue.create");
+    queue->magic = queue_header::MAGIC;
+    queue->version = queue_header::VERSION;
+    queue->slotCount = shape.slotCount;
+    queue->slotSize = shape.slotSize;
+    queue->blockCount = shape.blockCount;
+    queue->blockSize = shape.blockSize;
+    queue->enqueuePos.store(0, std::memory_order_relaxed);
+    queue->dequeuePos.store(0, std::memory_order_relaxed);
+
+    // Position i starts out in lap 0 of slot i
+    for (uint32_t i = 0; i < shape.slotCount; i++)
+    {
+      auto current = obj->slot(queue, i);
+      current->length = 0;
+      current->firstBlock.store(queue_block::NONE, std::memory_order_relaxed);
+      current->state.store(MakeState(0, SLOT_EMPTY, 0), std::memory_order_relaxed);
+    }
+
+    for (uint32_t i = 0; i < shape.blockCount; i++)
+      obj->block(queue, i)->next.store(i + 1 < shape.blockCount ? i + 1 : queue_block::NONE, std::memory_order_relaxed);
+
+    queue->freeBlocks.store(shape.blockCount != 0 ? 0 : queue_block::NONE, std::memory_order_release);
+  }
+
+  void work_queue::Open(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<work_queue>(args.Holder());
+
+    if (!read_mapping_args(args, 2, "WorkQueue.open"))
+      return;
+
+    auto describe = [](const queue_header &queue, layout &result) -> uint64_t
+    {
+      result = { queue.slotCount, queue.slotSize, queue.blockCount, queue.blockSize };
+      bool valid = queue.magic == queue_header::MAGIC && queue.version == queue_header::VERSION && result.valid();
+      return valid ? result.total_size() : 0;
+    };
+
+    layout shape;
+    if (!obj->attach_existing<queue_header>(isolate, args[0], args[1], shape, describe, "WorkQueue.open"))
+      return;
+
+    obj->m_layout = shape;
+    obj->m_lapShift = 0;
+    while ((1u << obj->m_lapShift) < shape.slotCount)
+      obj->m_lapShift++;
+  }
+
+  void work_queue::Close(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto obj = ObjectWrap::Unwrap<work_queue>(args.Holder());
+
+    obj->detach();
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void work_queue::Push(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<work_queue>(args.Holder());
+
+    if (args.Length() < 1)
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Not enough arguments to WorkQueue.push")));
+      return;
+    }
+
+    if (!node::Buffer::HasInstance(args[0]))
+    {
+      isolate->ThrowException(Exception::TypeError(String::NewFromUtf8(isolate, "Wrong type arguments to WorkQueue.push")));
+      return;
+    }
+
+    auto queue = obj->header(isolate, "WorkQueue.push");
+    if (queue == nullptr)
+      return;
+
+    auto data = node::Buffer::Data(args[0]);
+    auto length = node::Buffer::Length(args[0]);
+    if (length > obj->m_layout.max_length())
+    {
+      isolate->ThrowException(Exception::RangeError(String::NewFromUtf8(isolate, "Message is too large for WorkQueue.push")));
+      return;
+    }
+
+    // Big messages are copied into the overflow arena before we claim a
+    // slot, so we hold the slot for as short a time as possible
+    auto chain = queue_block::NONE;
+    if (length > obj->m_layout.slotSize)
+    {
+      chain = obj->alloc_chain(queue, data, length);
+      if (chain == queue_block::NONE)
+      {
+        args.GetReturnValue().Set(false);
+        return;
+      }
+    }
+
+    auto me = CurrentPid();
+    auto position = queue->enqueuePos.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+      auto current = obj->slot(queue, position);
+      auto lap = static_cast<uint32_t>(position >> obj->m_lapShift);
+      auto state = current->state.load(std::memory_order_acquire);
+      auto behind = static_cast<int32_t>(StateLap(state) - lap);
+
+      if (behind == 0 && StatePhase(state) == SLOT_EMPTY)
+      {
+        if (current->state.compare_exchange_weak(state, MakeState(lap, SLOT_WRITING, me), std::memory_order_acquire))
+        {
+          queue->enqueuePos.compare_exchange_strong(position, position + 1, std::memory_order_relaxed);
+
+          current->length = static_cast<uint32_t>(length);
+          current->firstBlock.store(chain, std::memory_order_relaxed);
+          if (chain == queue_block::NONE)
+            memcpy(current->data(), data, length);
+
+          current->state.store(MakeState(lap, SLOT_FULL, 0), std::memory_order_release);
+          args.GetReturnValue().Set(true);
+          return;
+        }
+      }
+      else if (behind >= 0)
+      {
+        // Someone else claimed this position, help move the queue along
+        queue->enqueuePos.compare_exchange_strong(position, position + 1, std::memory_order_relaxed);
+      }
+      else if (!obj->recover(queue, current, state))
+      {
+        // The slot still holds last lap's message
+        auto latest = queue->enqueuePos.load(std::memory_order_relaxed);
+        if (latest == position)
+        {
+          obj->free_chain(queue, chain);
+          args.GetReturnValue().Set(false);
+          return;
+        }
+      }
+
+      position = queue->enqueuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  void work_queue::Pop(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<work_queue>(args.Holder());
+
+    auto queue = obj->header(isolate, "WorkQueue.pop");
+    if (queue == nullptr)
+      return;
+
+    auto me = CurrentPid();
+    auto position = queue->dequeuePos.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+      auto current = obj->slot(queue, position);
+      auto lap = static_cast<uint32_t>(position >> obj->m_lapShift);
+      auto state = current->state.load(std::memory_order_acquire);
+      auto behind = static_cast<int32_t>(StateLap(state) - lap);
+      auto phase = StatePhase(state);
+
+      if (behind == 0 && phase == SLOT_FULL)
+      {
+        if (current->state.compare_exchange_weak(state, MakeState(lap, SLOT_READING, me), std::memory_order_acquire))
+        {
+          queue->dequeuePos.compare_exchange_strong(position, position + 1, std::memory_order_relaxed);
+
+          auto length = current->length;
+          auto chain = current->firstBlock.exchange(queue_block::NONE, std::memory_order_acquire);
+          Local<Object> buffer;
+          bool valid = true;
+
+          if (length != queue_slot::DEAD)
+          {
+            if (length > obj->m_layout.max_length() || (chain == queue_block::NONE && length > obj->m_layout.slotSize))
+            {
+              valid = false;
+            }
+            else if (chain == queue_block::NONE)
+            {
+              buffer = node::Buffer::Copy(isolate, current->data(), length).ToLocalChecked();
+            }
+            else
+            {
+              buffer = node::Buffer::New(isolate, length).ToLocalChecked();
+              valid = obj->copy_chain(queue, chain, node::Buffer::Data(buffer), length);
+            }
+          }
+
+          obj->free_chain(queue, chain);
+          current->state.store(MakeState(lap + 1, SLOT_EMPTY, 0), std::memory_order_release);
+
+          if (!valid)
+          {
+            ThrowCorrupt(isolate);
+            return;
+          }
+
+          if (length != queue_slot::DEAD)
+          {
+            args.GetReturnValue().Set(buffer);
+            return;
+          }
+        }
+      }
+      else if (behind > 0 || (behind == 0 && phase == SLOT_READING))
+      {
+        // Someone else already took this position, help move the queue along
+        queue->dequeuePos.compare_exchange_strong(position, position + 1, std::memory_order_relaxed);
+      }
+      else if (!(behind == 0 && obj->recover(queue, current, state)))
+      {
+        // Nothing there yet, or its producer is still writing it
+        auto latest = queue->dequeuePos.load(std::memory_order_relaxed);
+        if (latest == position)
+        {
+          args.GetReturnValue().SetNull();
+          return;
+        }
+      }
+
+      position = queue->dequeuePos.load(std::memory_order_relaxed);
+    }
+  }
+
+  void work_queue::Length(const v8::FunctionCallbackInfo<v8::Value> &args)
+  {
+    auto isolate = args.GetIsolate();
+    auto obj = ObjectWrap::Unwrap<work_queue>(args.Holder());
+
+    auto queue = obj->header(isolate, "WorkQueue.length");
+    if (queue == nullptr)
+      return;
+
+    // Only a snapshot - both ends can move while we look
+    auto dequeued = queue->dequeuePos.load(std::memory_order_acquire);
+    auto enqueued = queue->enqueuePos.load(std::memory_order_acquire);
+    auto length = enqueued > dequeued ? enqueued - dequeued : 0;
+
+    args.GetReturnValue().Set(Number::New(isolate, static_cast<double>(length)));
+  }
+
+  // ---------------------------------------------------------------------------
+
+  void work_queue::Init(v8::Local<v8::Object> exports)
+  {
+    auto isolate = exports->GetIsolate();
+
+    Local<FunctionTemplate> tpl = FunctionTemplate::New(isolate, construct<work_queue>, String::NewFromUtf8(isolate, "WorkQueue"));
+    tpl->SetClassName(String::NewFromUtf8(isolate, "WorkQueue"));
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    tpl->Set(String::NewFromUtf8(isolate, "size"), FunctionTemplate::New(isolate, Size));
+
+    NODE_SET_PROTOTYPE_METHOD(tpl, "create", Create);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "open", Open);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "close", Close);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "push", Push);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "pop", Pop);
+    NODE_SET_PROTOTYPE_METHOD(tpl, "length", Length);
+
+    exports->Set(
+      String::NewFromUtf8(isolate, "WorkQueue"),
+      tpl->GetFunction());
+  }
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
@@ -0,0 +1,138 @@
+// -----------------------------------------------------------------------------
+// Howard Hughes
+// Multi producer, multi consumer work queue stored inside a file_mapping,
+// wrapped object for node_filemap
+// -----------------------------------------------------------------------------
+
+#ifndef NODEJS_WORK_QUEUE_H
+#define NODEJS_WORK_QUEUE_H
+
+#pragma once
+
+// -----------------------------------------------------------------------------
+
+#include <node.h>
+#include <atomic>
+#include <cstdint>
+#include "mapped_object.h"
+
+// -----------------------------------------------------------------------------
+
+namespace node_filemap
+{
+  // ---------------------------------------------------------------------------
+
+  // A bounded queue of fixed size slots in the style of Dmitry Vyukov's MPMC
+  // queue. Producers and consumers each bump their own position, on its own
+  // cache line, and only meet at the slot they're using.
+  //
+  // Each slot has a 64 bit state word: the lap (position / slotCount) in the
+  // top 32 bits, then a 2 bit phase (EMPTY, WRITING, FULL, READING) and the
+  // pid of the process in the middle of WRITING or READING it. Claiming a slot
+  // is one CAS on that word, so if a process dies holding a slot anyone who
+  // runs into it can tell, take it over and move it on, and the queue keeps
+  // going - a message being read is lost and one being written is skipped.
+  //
+  // Messages that don't fit in a slot go in a chain of blocks from an
+  // overflow arena, kept on a lock-free free list.
+  struct queue_header
+  {
+    static const uint32_t MAGIC = 0x57517565; // 'WQue'
+    static const uint32_t VERSION = 1;
+
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t slotSize;   // Payload bytes that fit in a slot
+    uint32_t blockCount;
+    uint32_t blockSize;  // Including the block header
+    char pad0[40];
+
+    std::atomic<uint64_t> enqueuePos;
+    char pad1[56];
+
+    std::atomic<uint64_t> dequeuePos;
+    char pad2[56];
+
+    std::atomic<uint64_t> freeBlocks; // Generation in the top 32 bits, block index below
+    char pad3[56];
+  };
+
+  static_assert(sizeof(queue_header) == 256, "queue_header must take exactly four cache lines");
+
+  struct queue_slot
+  {
+    static const uint32_t DEAD = 0xFFFFFFFF; // length of a message whose producer died
+
+    std::atomic<uint64_t> state;
+    uint32_t length;
+    std::atomic<uint32_t> firstBlock;
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+  };
+
+  struct queue_block
+  {
+    static const uint32_t NONE = 0xFFFFFFFF;
+
+    std::atomic<uint32_t> next;
+    uint32_t reserved;
+
+    char *data() { return reinterpret_cast<char *>(this + 1); }
+  };
+
+  // ---------------------------------------------------------------------------
+
+  class work_queue : public mapped_object
+  {
+  public:
+    work_queue();
+
+    static void Create(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Open(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Close(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Push(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Pop(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Length(const v8::FunctionCallbackInfo<v8::Value> &args);
+    static void Size(const v8::FunctionCallbackInfo<v8::Value> &args);
+
+    static void Init(v8::Local<v8::Object> exports);
+
+  private:
+    struct layout
+    {
+      uint32_t slotCount;
+      uint32_t slotSize;
+      uint32_t blockCount;
+      uint32_t blockSize;
+
+      uint64_t slot_stride() const;
+      uint64_t total_size() const;
+      uint64_t max_length() const;
+      bool valid() const;
+    };
+
+    queue_header *header(v8::Isolate *isolate, const char *method) const;
+    queue_slot *slot(queue_header *queue, uint64_t position) const;
+    queue_block *block(queue_header *queue, uint32_t index) const;
+
+    // Block chains in the overflow arena. alloc_chain returns NONE if there
+    // aren't enough free blocks.
+    uint32_t alloc_chain(queue_header *queue, const char *data, uint64_t length);
+    void free_chain(queue_header *queue, uint32_t first);
+    bool copy_chain(queue_header *queue, uint32_t first, char *dest, uint64_t length);
+
+    // Takes over a slot whose WRITING or READING process has died and moves
+    // it on. false if the process is still alive or someone else beat us.
+    bool recover(queue_header *queue, queue_slot *slot, uint64_t state);
+
+    layout m_layout;
+    uint32_t m_lapShift;
+  };
+
+  // ---------------------------------------------------------------------------
+}
+
+// -----------------------------------------------------------------------------
+
+#endif
@@ -0,0 +1,198 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName, createInMapping } = require('./harness');
+const addon = require('..');
+
+const worker = path.join(__dirname, 'fixtures', 'arena-worker.js');
+
+test('Arena hands out blocks by size class and takes them back', function () {
+  const { map, object: arena } = createInMapping(addon.Arena, 1 << 20, [1 << 20]);
+
+  const a = arena.alloc(10);
+  const b = arena.alloc(10);
+  const c = arena.alloc(100);
+  assert.notStrictEqual(a, b);
+  assert.strictEqual(arena.sizeOf(a), 16);
+  assert.strictEqual(arena.sizeOf(c), 128);
+  assert.strictEqual(a % 16, 0);
+
+  // Blocks are mapping offsets, usable straight away
+  map.view(c, 100).fill(7);
+  assert.strictEqual(map.view(a, 16).readUInt8(0), 0);
+
+  arena.free(b);
+  assert.strictEqual(arena.alloc(16), b);
+
+  const big = arena.alloc(10000);
+  assert.strictEqual(arena.sizeOf(big), 16384);
+  assert.strictEqual(big % addon.Arena.PAGE_SIZE, 0);
+  arena.free(big);
+  assert.strictEqual(arena.alloc(16384), big);
+
+  map.closeMapping();
+});
+
+test('Arena turns down a block that is already free', function () {
+  const { map, object: arena } = createInMapping(addon.Arena, 1 << 16, [1 << 16]);
+
+  const a = arena.alloc(16);
+  const big = arena.alloc(10000);
+  arena.free(a);
+  arena.free(big);
+  assert.throws(function () { arena.free(a); }, /Not a block/);
+  assert.throws(function () { arena.free(big); }, /Not a block/);
+  assert.throws(function () { arena.sizeOf(a); }, /Not a block/);
+
+  // Freeing twice didn't put them on their lists twice
+  const again = arena.alloc(16);
+  assert.strictEqual(again, a);
+  assert.notStrictEqual(arena.alloc(16), a);
+  assert.strictEqual(arena.alloc(16384), big);
+  assert.notStrictEqual(arena.alloc(16384), big);
+  assert.strictEqual(arena.stats().classes[0].allocated, 2);
+
+  map.closeMapping();
+});
+
+test('Arena offsets are relative to the mapping, not the arena', function () {
+  const { map, object: arena } = createInMapping(addon.Arena, 1 << 16, [1 << 16], { offset: 4096 });
+
+  const a = arena.alloc(64);
+  assert.ok(a > 4096);
+  assert.strictEqual(arena.sizeOf(a), 64);
+  arena.free(a);
+
+  map.closeMapping();
+});
+
+test('Arena returns null when it runs out and reuses what is freed', function () {
+  const { map, object: arena } = createInMapping(addon.Arena, 1 << 16, [1 << 16]);
+  const pages = arena.stats().size / addon.Arena.PAGE_SIZE;
+
+  const blocks = [];
+  let offset;
+  while ((offset = arena.alloc(4096)) !== null)
+    blocks.push(offset);
+
+  assert.strictEqual(blocks.length, pages);
+  assert.strictEqual(arena.alloc(16), null);
+  assert.strictEqual(arena.alloc(1 << 30), null);
+
+  for (const block of blocks)
+    arena.free(block);
+
+  assert.notStrictEqual(arena.alloc(16), null);
+  map.closeMapping();
+});
+
+test('Arena splits longer free runs to serve shorter ones', function () {
+  const { map, object: arena } = createInMapping(addon.Arena, 1 << 16, [1 << 16]);
+
+  // Take everything as one long run, give it back, then ask for short ones
+  const stats = arena.stats();
+  const longest = stats.runs[stats.runs.length - 1].size;
+  const run = arena.alloc(longest);
+  assert.notStrictEqual(run, null);
+  while (arena.alloc(4096) !== null);
+  arena.free(run);
+
+  const small = arena.alloc(4096);
+  assert.strictEqual(small, run);
+  assert.notStrictEqual(arena.alloc(8192), null);
+
+  map.closeMapping();
+});
+
+test('Arena.stats reports occupancy and fragmentation', function () {
+  const { map, object: arena } = createInMapping(addon.Arena, 1 << 20, [1 << 20]);
+
+  let stats = arena.stats();
+  assert.strictEqual(stats.allocated, 0);
+  assert.strictEqual(stats.free, 0);
+  assert.strictEqual(stats.untouched, stats.size);
+  assert.strictEqual(stats.fragmentation, 0);
+
+  const a = arena.alloc(32);
+  const b = arena.alloc(8192);
+  stats = arena.stats();
+  assert.strictEqual(stats.allocated, 32 + 8192);
+  assert.strictEqual(stats.classes[1].size, 32);
+  assert.strictEqual(stats.classes[1].allocated, 1);
+  assert.strictEqual(stats.classes[1].free, 4096 / 32 - 1);
+  assert.strictEqual(stats.runs[1].allocated, 1);
+  assert.strictEqual(stats.untouched, stats.size - 3 * 4096);
+
+  arena.free(a);
+  arena.free(b);
+  stats = arena.stats();
+  assert.strictEqual(stats.allocated, 0);
+  assert.strictEqual(stats.free, 4096 + 8192);
+  assert.ok(stats.fragmentation > 0 && stats.fragmentation < 1);
+
+  map.closeMapping();
+});
+
+test('Arena.open finds an existing arena', function () {
+  const { name, map, object: arena } = createInMapping(addon.Arena, 1 << 16, [1 << 16]);
+  const other = new addon.FileMapping();
+  const reader = new addon.Arena();
+
+  const a = arena.alloc(48);
+
+  other.openMapping(name, 0);
+  assert.throws(function () { reader.open(other, 64); }, /No Arena/);
+  reader.open(other, 0);
+  assert.strictEqual(reader.sizeOf(a), 48);
+  reader.free(a);
+  assert.strictEqual(arena.alloc(48), a);
+
+  other.closeMapping();
+  map.closeMapping();
+});
+
+test('Arena checks its arguments', function () {
+  const map = new addon.FileMapping();
+  const arena = new addon.Arena();
+  map.createMapping(null, uniqueName('arena_args'), 1 << 16);
+
+  assert.throws(function () { arena.create(map, 0); }, /Not enough arguments/);
+  assert.throws(function () { arena.create(map, 0, -1); }, /Wrong type/);
+  assert.throws(function () { arena.create(map, 0, 100); }, RangeError);
+  assert.throws(function () { arena.create(map, 8, 1 << 15); }, /Misaligned/);
+  assert.throws(function () { arena.create(map, 0, 1 << 17); }, /too small/);
+  assert.throws(function () { arena.alloc(16); }, /Not attached/);
+
+  arena.create(map, 0, 1 << 16);
+  const a = arena.alloc(64);
+  assert.throws(function () { arena.alloc(); }, /Not enough arguments/);
+  assert.throws(function () { arena.alloc('big'); }, /Wrong type/);
+  assert.throws(function () { arena.free(a + 16); }, /Not a block/);
+  assert.throws(function () { arena.free(0); }, /Not a block/);
+  assert.throws(function () { arena.sizeOf(1 << 20); }, /Not a block/);
+
+  map.closeMapping();
+  assert.throws(function () { arena.stats(); }, /closed/);
+});
+
+test('Arena never hands the same block to two processes', async function () {
+  const { name, map, object: arena } = createInMapping(addon.Arena, 1 << 20, [1 << 20]);
+
+  const children = [];
+  for (let i = 1; i <= 4; ++i)
+    children.push(fork(worker, [name, String(i), '20000']));
+
+  const exited = Promise.all(children.map(function (child) {
+    return new Promise(function (resolve) { child.on('exit', resolve); });
+  }));
+  const results = await Promise.all(children.map(function (child) {
+    return new Promise(function (resolve) { child.once('message', resolve); });
+  }));
+  assert.deepStrictEqual(await exited, [0, 0, 0, 0]);
+
+  for (const result of results)
+    assert.strictEqual(result.errors, 0);
+
+  assert.strictEqual(arena.stats().allocated, 0);
+  map.closeMapping();
+});
@@ -0,0 +1,637 @@
+const assert = require('assert');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const { execFileSync, fork } = require('child_process');
+const { test, uniqueName } = require('./harness');
+const addon = require('..');
+
+test('shared memory round trips through writeBuffer/readInto', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('rt'), 64);
+
+  const src = Buffer.from('hello, shared memory');
+  map.writeBuffer(src, 8, 0, src.length);
+
+  const dst = Buffer.alloc(src.length);
+  map.readInto(8, src.length, dst);
+  assert.strictEqual(dst.toString(), src.toString());
+
+  map.closeMapping();
+});
+
+test('openMapping sees data written through createMapping', function () {
+  const name = uniqueName('open');
+  const creator = new addon.FileMapping();
+  const opener = new addon.FileMapping();
+
+  creator.createMapping(null, name, 16);
+  opener.openMapping(name, 16);
+
+  const src = Buffer.alloc(4);
+  src.writeInt32LE(0x12345678);
+  creator.writeBuffer(src, 0, 0, 4);
+
+  const dst = Buffer.alloc(4);
+  opener.readInto(0, 4, dst);
+  assert.strictEqual(dst.readInt32LE(0), 0x12345678);
+
+  opener.closeMapping();
+  creator.closeMapping();
+});
+
+test('openMapping with size 0 maps the whole segment', function () {
+  const name = uniqueName('whole');
+  const creator = new addon.FileMapping();
+  const opener = new addon.FileMapping();
+
+  creator.createMapping(null, name, 8192);
+  opener.openMapping(name, 0);
+
+  creator.writeBuffer(Buffer.from([42]), 8191, 0, 1);
+  const dst = Buffer.alloc(1);
+  opener.readInto(8191, 1, dst);
+  assert.strictEqual(dst[0], 42);
+
+  opener.closeMapping();
+  creator.closeMapping();
+});
+
+test('openMapping fails for a missing segment', function () {
+  const map = new addon.FileMapping();
+  assert.throws(function () {
+    map.openMapping(uniqueName('missing'), 16);
+  }, /Failed to open file mapping/);
+});
+
+test('file backed mappings persist to the file', function () {
+  const file = path.join(os.tmpdir(), uniqueName('file') + '.bin');
+  const map = new addon.FileMapping();
+
+  map.createMapping(file, uniqueName('file'), 32);
+  map.writeBuffer(Buffer.from('persisted'), 4, 0, 9);
+  map.closeMapping();
+
+  const contents = fs.readFileSync(file);
+  assert.strictEqual(contents.length, 32);
+  assert.strictEqual(contents.slice(4, 13).toString(), 'persisted');
+  fs.unlinkSync(file);
+});
+
+test('flush writes a file backed mapping back without blocking', async function () {
+  const file = path.join(os.tmpdir(), uniqueName('flush') + '.bin');
+  const map = new addon.FileMapping();
+  map.createMapping(file, uniqueName('flush'), 3 * 4096);
+
+  // Nothing written yet, so nothing for it to write
+  await map.flush();
+
+  map.writeBuffer(Buffer.from('first'), 5000, 0, 5);
+  map.writev([{ buffer: Buffer.from('second'), destOffset: 9000 }]);
+  assert.strictEqual(await map.flush(), undefined);
+  assert.strictEqual(fs.readFileSync(file).slice(5000, 5005).toString(), 'first');
+
+  await map.flush(0, 100, 'async');
+  await map.flush('none');
+
+  // Flushes asked for while one is running share the next one
+  const running = map.flush(0, 4096);
+  const next = map.flush(4096, 4096, 'async');
+  const joined = map.flush(8192, 4096);
+  assert.notStrictEqual(running, next);
+  assert.strictEqual(next, joined);
+  await Promise.all([running, next]);
+
+  // Closing doesn't strand a flush that's on its way
+  const pending = map.flush(0, 4096);
+  map.closeMapping();
+  await pending;
+
+  fs.unlinkSync(file);
+});
+
+if (process.platform === 'linux') {
+  // Kilobytes of the file's mapping that are dirty and not written back yet
+  const dirtyKb = function (file) {
+    let kb = 0, inFile = false;
+    for (const line of fs.readFileSync('/proc/self/smaps', 'utf8').split('\n')) {
+      if (/^[0-9a-f]+-[0-9a-f]+ /.test(line))
+        inFile = line.endsWith(file);
+      else if (inFile && /^(Shared|Private)_Dirty:/.test(line))
+        kb += parseInt(line.split(/\s+/)[1], 10);
+    }
+    return kb;
+  };
+
+  test('flush without a range writes back what views wrote too', async function () {
+    const file = path.join(os.tmpdir(), uniqueName('flush_view') + '.bin');
+    const map = new addon.FileMapping();
+    map.createMapping(file, uniqueName('flush_view'), 3 * 4096);
+
+    map.view(4096, 4096).write('through a view', 100);
+    assert.ok(dirtyKb(file) > 0);
+
+    await map.flush();
+    assert.strictEqual(dirtyKb(file), 0);
+    assert.strictEqual(fs.readFileSync(file).slice(4196, 4210).toString(), 'through a view');
+
+    map.closeMapping();
+    fs.unlinkSync(file);
+  });
+}
+
+test('flush checks its arguments', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('flush_args'), 4096);
+
+  assert.throws(function () { map.flush('eventually'); }, TypeError);
+  assert.throws(function () { map.flush(0, 16, 'fast'); }, TypeError);
+  assert.throws(function () { map.flush(-1, 16); }, TypeError);
+  assert.throws(function () { map.flush(4000, 100); }, RangeError);
+
+  map.closeMapping();
+  assert.throws(function () { map.flush(); }, /closed mapping/);
+});
+
+test('prefault and populate fault a mapping in up front', function () {
+  const size = 8 << 20;
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('fault'), size);
+
+  const before = map.residency();
+  assert.strictEqual(before.pages, size / before.pageSize);
+  assert.strictEqual(before.resident, 0);
+
+  map.prefault(0, size / 2);
+  assert.strictEqual(map.residency(0, size / 2).resident, size / 2 / before.pageSize);
+  assert.strictEqual(map.residency(size / 2, size / 2).resident, 0);
+
+  map.prefault();
+  assert.strictEqual(map.residency().resident, before.pages);
+  map.closeMapping();
+
+  const populated = new addon.FileMapping();
+  populated.createMapping(null, uniqueName('populate'), 1 << 20, { populate: true });
+  const residency = populated.residency();
+  assert.strictEqual(residency.resident, residency.pages);
+  populated.closeMapping();
+});
+
+test('advise, lock and unlock take ranges of the mapping', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('advise'), 1 << 20);
+
+  for (const hint of ['normal', 'sequential', 'random', 'willneed', 'dontneed'])
+    map.advise(hint);
+  map.advise(100, 5000, 'willneed');
+
+  // Locking can be refused by RLIMIT_MEMLOCK, but then it says so
+  try {
+    map.lock(0, 4096);
+    map.unlock(0, 4096);
+  } catch (err) {
+    assert.ok(/Failed to lock mapping/.test(err.message));
+  }
+  map.unlock();
+
+  assert.throws(function () { map.advise(); }, /Not enough arguments/);
+  assert.throws(function () { map.advise('soon'); }, TypeError);
+  assert.throws(function () { map.advise(0, 'all', 'random'); }, TypeError);
+  assert.throws(function () { map.prefault(0, 2 << 20); }, RangeError);
+  assert.throws(function () { map.residency(1 << 20, 1); }, RangeError);
+  assert.throws(function () {
+    map.createMapping(null, uniqueName('advise'), 16, { populate: 'yes' });
+  }, TypeError);
+
+  map.closeMapping();
+  assert.throws(function () { map.prefault(); }, /closed mapping/);
+  assert.throws(function () { map.lock(); }, /closed mapping/);
+});
+
+test('mappings larger than 4 GB use 64-bit sizes and offsets', function () {
+  const size = 5 * 1024 * 1024 * 1024;
+  const offset = size - 4096;
+  const map = new addon.FileMapping();
+
+  // Shared memory is sparse, so only the page we touch is allocated
+  map.createMapping(null, uniqueName('big'), size);
+  map.writeBuffer(Buffer.from('far'), offset, 0, 3);
+
+  const dst = Buffer.alloc(3);
+  map.readInto(offset, 3, dst);
+  assert.strictEqual(dst.toString(), 'far');
+
+  map.closeMapping();
+});
+
+test('mapping is shared with another process', function () {
+  const name = uniqueName('xproc');
+  const map = new addon.FileMapping();
+  map.createMapping(null, name, 16);
+
+  execFileSync(process.execPath, [path.join(__dirname, 'fixtures', 'write-mapping.js'), name, '16', '1234']);
+
+  const dst = Buffer.alloc(4);
+  map.readInto(0, 4, dst);
+  assert.strictEqual(dst.readInt32LE(0), 1234);
+
+  map.closeMapping();
+});
+
+test('transparent huge pages are accepted as a hint', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('thp'), 4 * 1024 * 1024, { hugePages: 'transparent' });
+  map.writeBuffer(Buffer.from([7]), 2 * 1024 * 1024, 0, 1);
+  map.closeMapping();
+});
+
+if (process.platform === 'linux' && fs.existsSync('/dev/hugepages')) {
+  test('explicit huge pages map through hugetlbfs', function () {
+    const name = uniqueName('huge');
+    const map = new addon.FileMapping();
+
+    try {
+      map.createMapping(null, name, 1, { hugePages: 'explicit' });
+    } catch (err) {
+      // No huge pages reserved in vm.nr_hugepages
+      return;
+    }
+
+    const opener = new addon.FileMapping();
+    opener.openMapping(name, 0, { hugePages: 'explicit' });
+    map.writeBuffer(Buffer.from([9]), 0, 0, 1);
+    const dst = Buffer.alloc(1);
+    opener.readInto(0, 1, dst);
+    assert.strictEqual(dst[0], 9);
+
+    opener.closeMapping();
+    map.closeMapping();
+  });
+} else {
+  test.skip('explicit huge pages map through hugetlbfs');
+}
+
+test('bad options are rejected', function () {
+  const map = new addon.FileMapping();
+  assert.throws(function () {
+    map.createMapping(null, uniqueName('opts'), 16, { hugePages: 'gigantic' });
+  }, TypeError);
+  assert.throws(function () {
+    map.createMapping(null, uniqueName('opts'), -1);
+  }, TypeError);
+});
+
+test('writev/readv copy a batch of buffers in one call', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('vec'), 64);
+
+  const written = map.writev([
+    { buffer: Buffer.from('abcd'), destOffset: 0 },
+    { buffer: Buffer.from('xxefghxx'), srcOffset: 2, destOffset: 4, length: 4 },
+    { buffer: Buffer.from('ij'), destOffset: 60 }
+  ]);
+  assert.strictEqual(written, 10);
+
+  const a = Buffer.alloc(8);
+  const b = Buffer.alloc(4, '-');
+  assert.strictEqual(map.readv([
+    { buffer: a, srcOffset: 0 },
+    { buffer: b, srcOffset: 60, destOffset: 1, length: 2 }
+  ]), 10);
+  assert.strictEqual(a.toString(), 'abcdefgh');
+  assert.strictEqual(b.toString(), '-ij-');
+
+  map.closeMapping();
+});
+
+test('writev/readv take packed srcOffset/destOffset/length triples', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('vecp'), 64);
+
+  const src = Buffer.from('0123456789');
+  assert.strictEqual(map.writev(src, new Float64Array([0, 10, 3, 5, 20, 5])), 8);
+
+  const dst = Buffer.alloc(8);
+  assert.strictEqual(map.readv(dst, new Float64Array([20, 0, 5, 10, 5, 3])), 8);
+  assert.strictEqual(dst.toString(), '56789012');
+
+  map.closeMapping();
+});
+
+test('writev checks every entry before copying any', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('vecb'), 16);
+
+  assert.throws(function () {
+    map.writev([
+      { buffer: Buffer.from('ok'), destOffset: 0 },
+      { buffer: Buffer.from('too far'), destOffset: 12 }
+    ]);
+  }, /entry 1 is outside of the mapping/);
+  assert.throws(function () {
+    map.writev([{ buffer: Buffer.from('ab'), srcOffset: 1, length: 2 }]);
+  }, /entry 0 is outside of its buffer/);
+  assert.throws(function () {
+    map.readv(Buffer.alloc(4), new Float64Array([0, 0]));
+  }, TypeError);
+  assert.throws(function () {
+    map.writev([{ buffer: 'not a buffer' }]);
+  }, TypeError);
+
+  const dst = Buffer.alloc(2);
+  map.readInto(0, 2, dst);
+  assert.deepStrictEqual(dst, Buffer.alloc(2));
+
+  map.closeMapping();
+  assert.throws(function () {
+    map.writev([{ buffer: Buffer.from('ab') }]);
+  }, /closed mapping/);
+});
+
+test('writev runs the whole batch under one lock wait', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('vecl'), 16);
+
+  const calls = [];
+  const lock = {
+    wait() { calls.push('wait'); return 0; },
+    release() { calls.push('release'); }
+  };
+
+  map.writev([{ buffer: Buffer.from('a') }, { buffer: Buffer.from('b'), destOffset: 1 }], lock);
+  assert.deepStrictEqual(calls, ['wait', 'release']);
+
+  // Released even when the batch doesn't fit
+  assert.throws(function () {
+    map.writev([{ buffer: Buffer.from('abc'), destOffset: 15 }], lock);
+  }, RangeError);
+  assert.deepStrictEqual(calls, ['wait', 'release', 'wait', 'release']);
+
+  const mutex = new addon.Mutex();
+  mutex.create(uniqueName('veclm'));
+  map.writev(Buffer.from('zz'), new Float64Array([0, 2, 2]), mutex);
+  const dst = Buffer.alloc(4);
+  map.readv([{ buffer: dst }], mutex);
+  assert.strictEqual(dst.toString(), 'abzz');
+  mutex.close();
+
+  map.closeMapping();
+});
+
+if (process.platform === 'win32') {
+  test.skip('growable mappings grow in place');
+  test.skip('growable mappings are picked up by other processes');
+} else {
+  test('growable mappings grow in place', function () {
+    const map = new addon.FileMapping();
+    map.createMapping(null, uniqueName('grow'), 4096, { growable: true });
+    assert.strictEqual(map.size(), 4096);
+
+    const before = map.view(0, 16);
+    before.write('kept');
+
+    assert.strictEqual(map.grow(1 << 20), 1 << 20);
+    assert.strictEqual(map.size(), 1 << 20);
+
+    // Growing never shrinks, and views from before still work
+    assert.strictEqual(map.grow(100), 1 << 20);
+    assert.strictEqual(before.toString('utf8', 0, 4), 'kept');
+
+    const src = Buffer.from('far out');
+    map.writeBuffer(src, (1 << 20) - src.length, 0, src.length);
+    assert.strictEqual(map.view((1 << 20) - src.length, src.length).toString(), 'far out');
+
+    // Objects can go in the new space
+    const triple = new addon.TripleBuffer();
+    triple.create(map, 1 << 19, 64);
+    assert.strictEqual(triple.publish(Buffer.from('frame')), 1);
+
+    map.closeMapping();
+    assert.strictEqual(before.length, 0);
+  });
+
+  test('growable mappings are picked up by other processes', async function () {
+    const name = uniqueName('growx');
+    const map = new addon.FileMapping();
+    map.createMapping(null, name, 4096, { growable: true });
+
+    const child = fork(path.join(__dirname, 'fixtures', 'grow-worker.js'), [name]);
+    const exited = new Promise(function (resolve) { child.on('exit', resolve); });
+    const messages = [];
+    let waiting = null;
+    child.on('message', function (message) {
+      messages.push(message);
+      if (waiting)
+        waiting();
+    });
+    const next = function () {
+      if (messages.length > 0)
+        return Promise.resolve(messages.shift());
+      return new Promise(function (resolve) {
+        waiting = function () { waiting = null; resolve(messages.shift()); };
+      });
+    };
+
+    assert.deepStrictEqual(await next(), { size: 4096 });
+
+    // The child maps the new size the next time it touches the mapping
+    map.grow(1 << 20);
+    map.writeBuffer(Buffer.from('hello'), 900000, 0, 5);
+    child.send({ read: 900000, length: 5 });
+    assert.deepStrictEqual(await next(), { size: 1 << 20, text: 'hello' });
+
+    // And the other way round
+    child.send({ grow: 2 << 20, write: 'child', offset: (2 << 20) - 5 });
+    assert.deepStrictEqual(await next(), { size: 2 << 20 });
+    assert.strictEqual(map.size(), 2 << 20);
+    const dst = Buffer.alloc(5);
+    map.readInto((2 << 20) - 5, 5, dst);
+    assert.strictEqual(dst.toString(), 'child');
+
+    child.send('exit');
+    assert.strictEqual(await exited, 0);
+    map.closeMapping();
+  });
+
+  test('grow checks its arguments', function () {
+    const map = new addon.FileMapping();
+    assert.throws(function () { map.grow(4096); }, /closed mapping/);
+
+    map.createMapping(null, uniqueName('growa'), 4096);
+    assert.throws(function () { map.grow(8192); }, /isn't growable/);
+    assert.throws(function () { map.grow(); }, TypeError);
+    assert.throws(function () { map.grow(-1); }, TypeError);
+    map.closeMapping();
+
+    const name = uniqueName('growb');
+    map.createMapping(null, name, 4096);
+    const other = new addon.FileMapping();
+    assert.throws(function () { other.openMapping(name, 0, { growable: true }); }, /isn't growable/);
+    assert.throws(function () {
+      map.createMapping(null, uniqueName('growc'), 4096, { growable: true, hugePages: 'explicit' });
+    }, TypeError);
+    map.closeMapping();
+  });
+}
+
+if (process.platform === 'linux') {
+  // Growable mappings each open the name themselves, so they stand in for
+  // separate processes here
+  test('the name lasts until the last user closes it', function () {
+    const name = uniqueName('last');
+    const creator = new addon.FileMapping();
+    const opener = new addon.FileMapping();
+    creator.createMapping(null, name, 4096, { growable: true });
+    opener.openMapping(name, 0, { growable: true });
+
+    creator.closeMapping();
+    const late = new addon.FileMapping();
+    late.openMapping(name, 0, { growable: true });
+    late.closeMapping();
+
+    opener.closeMapping();
+    assert.throws(function () { late.openMapping(name, 0, { growable: true }); }, /Failed to open file mapping/);
+  });
+}
+
+test('writeBuffer and readInto check their ranges', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('ranges'), 4096);
+  const buffer = Buffer.alloc(8);
+
+  assert.throws(function () { map.writeBuffer(buffer, 0, 0); }, /Not enough arguments/);
+  assert.throws(function () { map.readInto(0, 4); }, /Not enough arguments/);
+  assert.throws(function () { map.writeBuffer(buffer, 1 << 30, 0, 4); }, RangeError);
+  assert.throws(function () { map.writeBuffer(buffer, 4093, 0, 4); }, RangeError);
+  assert.throws(function () { map.writeBuffer(buffer, 0, 6, 4); }, RangeError);
+  assert.throws(function () { map.readInto(1 << 30, 4, buffer); }, RangeError);
+  assert.throws(function () { map.readInto(0, 9, buffer); }, RangeError);
+  assert.strictEqual(map.stats().writeCalls, 0);
+
+  map.writeBuffer(buffer, 4088, 0, 8);
+  map.readInto(4088, 8, buffer);
+
+  map.closeMapping();
+  assert.throws(function () { map.writeBuffer(buffer, 0, 0, 4); }, /closed mapping/);
+  assert.throws(function () { map.readInto(0, 4, buffer); }, /closed mapping/);
+});
+
+test('scalar accessors read and write single numbers in place', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('scalar'), 64);
+
+  map.writeInt32(4, -5);
+  map.writeUint32(8, 0xdeadbeef);
+  map.writeFloat64(13, Math.PI); // Unaligned is fine
+  map.writeFloat32(24, 0.1);
+  map.writeInt16(28, 0x12345); // Wraps like a DataView
+  map.writeUint8(30, -1);
+  map.writeInt8(31, 200);
+
+  assert.strictEqual(map.readInt32(4), -5);
+  assert.strictEqual(map.readUint32(8), 0xdeadbeef);
+  assert.strictEqual(map.readFloat64(13), Math.PI);
+  assert.strictEqual(map.readFloat32(24), Math.fround(0.1));
+  assert.strictEqual(map.readInt16(28), 0x2345);
+  assert.strictEqual(map.readUint16(28), 0x2345);
+  assert.strictEqual(map.readUint8(30), 255);
+  assert.strictEqual(map.readInt8(31), -56);
+
+  // Same bytes as the Buffer path sees
+  const buffer = Buffer.alloc(4);
+  map.readInto(4, 4, buffer);
+  assert.strictEqual(buffer.readInt32LE(0), -5);
+
+  assert.strictEqual(map.stats().writeCalls, 7);
+  assert.strictEqual(map.stats().bytesWritten, 4 + 4 + 8 + 4 + 2 + 1 + 1);
+
+  map.writeFloat64(56, 1.5);
+  assert.throws(function () { map.readFloat64(57); }, RangeError);
+  assert.throws(function () { map.writeUint32(61, 1); }, RangeError);
+  assert.throws(function () { map.readInt32('4'); }, /Wrong type/);
+  assert.throws(function () { map.readInt32(-1); }, /Wrong type/);
+  assert.throws(function () { map.writeInt32(4, '1'); }, /Wrong type/);
+  assert.throws(function () { map.writeInt32(4); }, /Not enough arguments/);
+
+  map.closeMapping();
+  assert.throws(function () { map.readInt32(0); }, /closed/);
+});
+
+test('sharedBuffer aliases the mapping for Atomics', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('sab'), 64);
+
+  const shared = map.sharedBuffer(16, 16);
+  assert.ok(shared instanceof SharedArrayBuffer);
+  assert.strictEqual(shared.byteLength, 16);
+
+  const words = new Int32Array(shared);
+  Atomics.store(words, 1, 0x01020304);
+  assert.strictEqual(Atomics.add(words, 1, 1), 0x01020304);
+
+  const dst = Buffer.alloc(4);
+  map.readInto(20, 4, dst);
+  assert.strictEqual(dst.readInt32LE(0), 0x01020305);
+
+  // The memory stays mapped for as long as the SharedArrayBuffer is around
+  map.closeMapping();
+  assert.strictEqual(Atomics.load(words, 1), 0x01020305);
+});
+
+test('atomicWait returns like Atomics.wait', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('aw'), 64);
+  const words = new Int32Array(map.sharedBuffer(0, 64));
+
+  Atomics.store(words, 2, -5);
+  assert.strictEqual(map.atomicWait(8, 0, 0), 'not-equal');
+  assert.strictEqual(map.atomicWait(8, -5, 0), 'timed-out');
+
+  const start = Date.now();
+  assert.strictEqual(map.atomicWait(8, -5, 30), 'timed-out');
+  assert.ok(Date.now() - start >= 25);
+
+  assert.strictEqual(map.atomicNotify(8), 0);
+
+  assert.throws(function () { map.atomicWait(2, 0, 0); }, RangeError);
+  assert.throws(function () { map.atomicWait(64, 0, 0); }, RangeError);
+  assert.throws(function () { map.atomicWait(0); }, TypeError);
+  assert.throws(function () { map.atomicNotify('x'); }, TypeError);
+  assert.throws(function () { map.sharedBuffer(60, 8); }, RangeError);
+
+  map.closeMapping();
+  assert.throws(function () { map.atomicNotify(0); }, /closed mapping/);
+});
+
+if (process.platform === 'linux') {
+  test('atomicNotify wakes an atomicWait in another process', async function () {
+    const name = uniqueName('awx');
+    const map = new addon.FileMapping();
+    map.createMapping(null, name, 64);
+    const words = new Int32Array(map.sharedBuffer(0, 8));
+
+    const child = fork(path.join(__dirname, 'fixtures', 'atomic-waiter.js'), [name]);
+    const exited = new Promise(function (resolve) { child.on('exit', resolve); });
+    const messages = [];
+    child.on('message', function (message) { messages.push(message); });
+
+    while (messages.length === 0)
+      await new Promise(function (resolve) { setTimeout(resolve, 5); });
+
+    // The child may not be asleep yet, so keep trying until it's woken
+    Atomics.store(words, 0, 42);
+    let woken = 0;
+    while (woken === 0) {
+      woken = map.atomicNotify(4, 1);
+      await new Promise(function (resolve) { setTimeout(resolve, 5); });
+    }
+    assert.strictEqual(woken, 1);
+
+    while (messages.length < 2)
+      await new Promise(function (resolve) { setTimeout(resolve, 5); });
+    assert.deepStrictEqual(messages[1], { result: 'ok', value: 42 });
+
+    assert.strictEqual(await exited, 0);
+    map.closeMapping();
+  });
+}
@@ -0,0 +1,48 @@
+// Child process side of arena.test.js
+//   <name> <id> <rounds>   allocs and frees blocks of mixed sizes from the
+//                          Arena at offset 0, stamping each with id and
+//                          checking nobody else wrote over it before freeing
+const addon = require('../..');
+
+const map = new addon.FileMapping();
+const arena = new addon.Arena();
+map.openMapping(process.argv[2], 0);
+arena.open(map, 0);
+
+const id = Number(process.argv[3]);
+const rounds = Number(process.argv[4]);
+const sizes = [8, 24, 100, 700, 2000, 5000, 20000];
+const held = [];
+let errors = 0;
+
+function check(block) {
+  const view = map.view(block.offset, 4);
+  if (view.readUInt32LE(0) !== block.stamp)
+    errors++;
+}
+
+for (let i = 0; i < rounds; ++i) {
+  const size = sizes[i % sizes.length];
+  const offset = arena.alloc(size);
+  if (offset !== null) {
+    const stamp = (id << 24) | (i & 0xFFFFFF);
+    map.view(offset, 4).writeUInt32LE(stamp >>> 0, 0);
+    held.push({ offset: offset, stamp: stamp >>> 0 });
+  }
+
+  // Keep a few dozen blocks live, freeing one at random
+  if (held.length > 40 || (offset === null && held.length > 0)) {
+    const block = held.splice(Math.floor(Math.random() * held.length), 1)[0];
+    check(block);
+    arena.free(block.offset);
+  }
+}
+
+for (const block of held) {
+  check(block);
+  arena.free(block.offset);
+}
+
+process.send({ errors: errors });
+arena.close();
+map.closeMapping();
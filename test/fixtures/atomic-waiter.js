@@ -0,0 +1,14 @@
+// Child process side of the atomicWait/atomicNotify test in filemap.test.js
+//   <name>   wait on the word at offset 4 of the mapping while it's 0, and
+//            send back what atomicWait returned and the word at offset 0
+const addon = require('../..');
+
+const map = new addon.FileMapping();
+map.openMapping(process.argv[2], 0);
+const words = new Int32Array(map.sharedBuffer(0, 8));
+
+process.send('waiting');
+const result = map.atomicWait(4, 0, 10000);
+process.send({ result: result, value: Atomics.load(words, 0) });
+
+map.closeMapping();
@@ -0,0 +1,25 @@
+// Child process side of frame-buffer.test.js, run with NODE_FILEMAP_SIMD set
+// to pick a compare. Changes every byte of a frame in turn, and prints which
+// compare was used and every publish that didn't find exactly one tile.
+const addon = require('../..');
+const { uniqueName } = require('../harness');
+
+const frameSize = 256 * 3 + 40;
+const map = new addon.FileMapping();
+const frames = new addon.FrameBuffer();
+map.createMapping(null, uniqueName('frame_cmp'), addon.FrameBuffer.size(frameSize, 256));
+frames.create(map, 0, frameSize, 256);
+
+const frame = Buffer.alloc(frameSize);
+const wrong = [];
+
+for (let i = 0; i < frameSize; ++i) {
+  frame[i] = 0x80 | (i & 0x7f);
+  const changed = frames.publishDelta(frame);
+  const again = frames.publishDelta(frame);
+  if (changed !== 1 || again !== 0)
+    wrong.push(i);
+}
+
+map.closeMapping();
+process.stdout.write(JSON.stringify({ simd: addon.FrameBuffer.SIMD, wrong: wrong }));
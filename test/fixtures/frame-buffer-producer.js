@@ -0,0 +1,22 @@
+// Child process side of frame-buffer.test.js
+//   <name> <frames>   publish frames to the FrameBuffer at offset 0, each
+//                     one changing a single byte of the last
+const addon = require('../..');
+
+const map = new addon.FileMapping();
+const frames = new addon.FrameBuffer();
+map.openMapping(process.argv[2], 0);
+frames.open(map, 0);
+
+const count = Number(process.argv[3]);
+const frame = Buffer.alloc(65536);
+
+process.send('started');
+
+for (let i = 1; i <= count; ++i) {
+  frame[(i * 1031) % frame.length] = i & 0xff;
+  frames.publishDelta(frame);
+}
+
+frames.close();
+map.closeMapping();
@@ -0,0 +1,31 @@
+// Child process side of the growable mapping tests in filemap.test.js
+//   <name>   open the growable mapping, then answer messages from the parent:
+//            { read, length }         read a string, and say how big we think
+//                                     the mapping is
+//            { grow, write, offset }  grow the mapping and write a string
+//            'exit'                   close up and exit
+const addon = require('../..');
+
+const map = new addon.FileMapping();
+map.openMapping(process.argv[2], 0, { growable: true });
+
+process.on('message', function (message) {
+  if (message === 'exit') {
+    map.closeMapping();
+    process.disconnect();
+    return;
+  }
+
+  if (message.grow !== undefined) {
+    const size = map.grow(message.grow);
+    map.writeBuffer(Buffer.from(message.write), message.offset, 0, message.write.length);
+    process.send({ size: size });
+    return;
+  }
+
+  const buffer = Buffer.alloc(message.length);
+  map.readInto(message.read, message.length, buffer);
+  process.send({ size: map.size(), text: buffer.toString() });
+});
+
+process.send({ size: map.size() });
@@ -0,0 +1,54 @@
+// Child process side of hash-table.test.js
+//   <name> <id> <rounds>   sets, reads back and deletes keys of its own in
+//                          the HashTable at offset 0, while reading everyone
+//                          else's. Every value starts with its own key, so a
+//                          reader can tell it got the right one, whole.
+const addon = require('../..');
+
+const map = new addon.FileMapping();
+const table = new addon.HashTable();
+map.openMapping(process.argv[2], 0);
+table.open(map, 0);
+
+const id = process.argv[3];
+const rounds = Number(process.argv[4]);
+const into = Buffer.alloc(4096);
+let errors = 0;
+let reads = 0;
+
+// The round at both ends, with padding in between so entries change size
+function valueFor(key, round) {
+  return key + ':' + round + ':' + 'x'.repeat(round % 50) + ':' + round;
+}
+
+function check(key, length) {
+  if (length < 0)
+    return;
+
+  reads++;
+  const parts = into.toString('utf8', 0, length).split(':');
+  if (parts.length !== 4 || parts[0] !== key || parts[1] !== parts[3] || parts[2].length !== Number(parts[1]) % 50)
+    errors++;
+}
+
+for (let i = 0; i < rounds; ++i) {
+  const mine = 'w' + id + '_' + (i % 64);
+  if (!table.set(mine, valueFor(mine, i)))
+    errors++;
+
+  const length = table.getInto(mine, into);
+  if (length !== Buffer.byteLength(valueFor(mine, i)))
+    errors++;
+  check(mine, length);
+
+  if (i % 3 === 0)
+    table.delete(mine);
+
+  // Someone else's key
+  const other = 'w' + (1 + i % 4) + '_' + (i % 64);
+  check(other, table.getInto(other, into));
+}
+
+process.send({ errors: errors, reads: reads });
+table.close();
+map.closeMapping();
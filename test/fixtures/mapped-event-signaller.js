@@ -0,0 +1,26 @@
+// Child process side of mapped-event.test.js
+//   <name> <delay> <count> [offset]   after delay ms, signals the MappedEvent
+//                                     at offset (default 0) count times, 1 ms
+//                                     apart, then exits
+const addon = require('../..');
+
+const map = new addon.FileMapping();
+const event = new addon.MappedEvent();
+map.openMapping(process.argv[2], 0);
+event.open(map, Number(process.argv[5] || 0));
+
+const delay = Number(process.argv[3]);
+let count = Number(process.argv[4]);
+
+process.send('started');
+
+function next() {
+  event.signal();
+  if (--count > 0)
+    return setTimeout(next, 1);
+
+  event.close();
+  map.closeMapping();
+}
+
+setTimeout(next, delay);
@@ -0,0 +1,47 @@
+// Child process side of mapped-mutex.test.js
+//   hold <name> <ms>        take the lock, hold it for ms, release it
+//   abandon <name>          take the lock and exit without releasing it
+//   count <name> <n>        n times: lock, increment the Int32 at offset 64, unlock
+//   pair <name> <ms> <ms2>  also take the lock at offset 128, release it after
+//                           ms2 and the one at 0 after ms
+const addon = require('../..');
+
+const mode = process.argv[2];
+const map = new addon.FileMapping();
+const lock = new addon.MappedMutex();
+
+map.openMapping(process.argv[3], 0);
+lock.open(map, 0);
+
+if (mode === 'hold') {
+  lock.wait();
+  process.send('locked');
+  setTimeout(function () {
+    lock.release();
+    process.exit(0);
+  }, Number(process.argv[4]));
+} else if (mode === 'pair') {
+  const second = new addon.MappedMutex();
+  second.open(map, 128);
+
+  lock.wait();
+  second.wait();
+  process.send('locked');
+  setTimeout(function () { second.release(); }, Number(process.argv[5]));
+  setTimeout(function () {
+    lock.release();
+    process.exit(0);
+  }, Number(process.argv[4]));
+} else if (mode === 'abandon') {
+  lock.wait();
+  process.exit(0);
+} else if (mode === 'count') {
+  const counter = map.view(64, 4);
+  const n = Number(process.argv[4]);
+
+  for (let i = 0; i < n; ++i) {
+    lock.wait();
+    counter.writeInt32LE(counter.readInt32LE(0) + 1, 0);
+    lock.release();
+  }
+}
@@ -0,0 +1,25 @@
+// Child process side of mutex.test.js
+//   hold <name> <ms>    take the mutex, hold it for ms, release it
+//   abandon <name>      take the mutex and exit without releasing it
+//   try <name>          print the result of wait(0)
+const addon = require('../..');
+
+const mode = process.argv[2];
+const lock = new addon.Mutex();
+lock.open(process.argv[3]);
+
+if (mode === 'hold') {
+  lock.wait();
+  process.send('locked');
+  setTimeout(function () {
+    lock.release();
+    lock.close();
+    process.exit(0);
+  }, Number(process.argv[4]));
+} else if (mode === 'abandon') {
+  lock.wait();
+  process.exit(0);
+} else if (mode === 'try') {
+  process.send(lock.wait(0));
+  process.exit(0);
+}
@@ -0,0 +1,34 @@
+// Child process side of ring-buffer.test.js
+//   <name> <n>    push n messages, 'message <i>' with i counting up, into the
+//                 RingBuffer at offset 0, in batches, waiting while it's full
+const addon = require('../..');
+
+const map = new addon.FileMapping();
+const ring = new addon.RingBuffer();
+
+map.openMapping(process.argv[2], 0);
+ring.open(map, 0);
+
+const n = Number(process.argv[3]);
+let next = 0;
+
+function produce() {
+  while (next < n) {
+    const batch = [];
+    for (let i = next; i < n && batch.length < 64; ++i)
+      batch.push(Buffer.from('message ' + i));
+
+    const pushed = ring.pushBatch(batch);
+    next += pushed;
+
+    if (pushed < batch.length) {
+      setImmediate(produce);
+      return;
+    }
+  }
+
+  ring.close();
+  map.closeMapping();
+}
+
+produce();
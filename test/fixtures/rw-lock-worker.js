@@ -0,0 +1,58 @@
+// Child process side of rw-lock.test.js
+//   read <name> [ms]        take a read lock, hold it until told to let go,
+//                           or for ms if given
+//   write <name> [ms]       take the write lock, hold it until told to let go,
+//                           or for ms if given
+//   abandon-read <name>     take a read lock and exit without releasing it
+//   abandon-write <name>    take the write lock and exit without releasing it
+//   count <name> <n>        n times: write lock, increment the Int32 after the
+//                           lock, unlock, and check it under a read lock
+const addon = require('../..');
+
+const mode = process.argv[2];
+const map = new addon.FileMapping();
+const lock = new addon.RwLock();
+
+map.openMapping(process.argv[3], 0);
+lock.open(map, 0);
+
+if (mode === 'read' || mode === 'write') {
+  const result = mode === 'read' ? lock.waitRead() : lock.waitWrite();
+  process.send(result);
+
+  const release = function () {
+    if (mode === 'read')
+      lock.releaseRead();
+    else
+      lock.releaseWrite();
+    process.exit(0);
+  };
+
+  if (process.argv[4])
+    setTimeout(release, Number(process.argv[4]));
+  else
+    process.on('message', release);
+} else if (mode === 'abandon-read') {
+  lock.waitRead();
+  process.exit(0);
+} else if (mode === 'abandon-write') {
+  lock.waitWrite();
+  process.exit(0);
+} else if (mode === 'count') {
+  const counter = map.view(addon.RwLock.size(), 8);
+  const n = Number(process.argv[4]);
+
+  for (let i = 0; i < n; ++i) {
+    lock.waitWrite();
+    // Two copies, so a reader can tell if it ever sees a write half done
+    const value = counter.readInt32LE(0) + 1;
+    counter.writeInt32LE(value, 0);
+    counter.writeInt32LE(value, 4);
+    lock.releaseWrite();
+
+    lock.waitRead();
+    if (counter.readInt32LE(0) !== counter.readInt32LE(4))
+      process.exit(1);
+    lock.releaseRead();
+  }
+}
@@ -0,0 +1,25 @@
+// Child process side of seq-lock.test.js
+//   <name> <ms>   for ms, keep publishing 4 KB where every 32 bit word holds
+//                 the same counter, to the SeqLock at offset 0
+const addon = require('../..');
+
+const map = new addon.FileMapping();
+const seq = new addon.SeqLock();
+map.openMapping(process.argv[2], 0);
+seq.open(map, 0);
+
+const end = Date.now() + Number(process.argv[3]);
+const value = Buffer.alloc(4096);
+let counter = 0;
+
+process.send('started');
+
+while (Date.now() < end) {
+  counter++;
+  for (let i = 0; i < value.length; i += 4)
+    value.writeUInt32LE(counter, i);
+  seq.publish(value);
+}
+
+seq.close();
+map.closeMapping();
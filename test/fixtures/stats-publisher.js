@@ -0,0 +1,23 @@
+// Child process side of the readStats test in stats.test.js
+//   <mapping> <mutex>   publish stats, make a mapping and a mutex and use
+//                       them, send back the segment name, and stay up until
+//                       told to exit
+const addon = require('../..');
+
+const segment = addon.publishStats();
+
+const map = new addon.FileMapping();
+map.createMapping(null, process.argv[2], 4096);
+map.writeBuffer(Buffer.alloc(100), 0, 0, 100);
+
+const lock = new addon.Mutex();
+lock.create(process.argv[3]);
+lock.wait();
+lock.release();
+
+process.send(segment);
+process.on('message', function () {
+  map.closeMapping();
+  lock.close();
+  process.exit(0);
+});
@@ -0,0 +1,7 @@
+// The schema struct-view.test.js and its writer both open
+exports.PARTICLE = {
+  id: 'uint32',
+  x: 'float64',
+  y: 'float32',
+  flags: { type: 'uint8', length: 4 }
+};
@@ -0,0 +1,21 @@
+// Child process side of struct-view.test.js
+//   <name> <layout>   fill every particle in the mapping's StructView with
+//                     values derived from its index, then exit
+const addon = require('../..');
+const { PARTICLE } = require('./struct-view-schema');
+
+const map = new addon.FileMapping();
+const view = new addon.StructView();
+map.openMapping(process.argv[2], 0);
+view.open(map, 64, PARTICLE, 100, { layout: process.argv[3] });
+
+for (let i = 0; i < view.count(); ++i) {
+  const p = view.at(i);
+  p.id = i;
+  p.x = i * 0.5;
+  p.y = -i;
+  p.flags = [i & 0xFF, 1, 2, 3];
+}
+
+view.close();
+map.closeMapping();
@@ -0,0 +1,23 @@
+// Child process side of triple-buffer.test.js
+//   <name> <frames>   publish frames to the TripleBuffer at offset 0, writing
+//                     each frame's sequence number into every 32 bit word
+const addon = require('../..');
+
+const map = new addon.FileMapping();
+const triple = new addon.TripleBuffer();
+map.openMapping(process.argv[2], 0);
+triple.open(map, 0);
+
+const count = Number(process.argv[3]);
+
+process.send('started');
+
+for (let i = 1; i <= count; ++i) {
+  const frame = triple.acquireWrite();
+  for (let j = 0; j < frame.length; j += 4)
+    frame.writeUInt32LE(i, j);
+  triple.publish();
+}
+
+triple.close();
+map.closeMapping();
@@ -0,0 +1,62 @@
+// Child process side of work-queue.test.js
+//   produce <name> <id> <n>   push n messages made by message(id, i)
+//   consume <name>            pop until a 'stop' message, then send the
+//                             list of messages received
+//   exit                      exit straight away (for a pid that's dead)
+const addon = require('../..');
+
+const mode = process.argv[2];
+
+function message(id, i) {
+  // Sizes from 0 to 299 bytes, so some go through the overflow arena
+  const body = id + ':' + i + ':';
+  return Buffer.from(body + 'x'.repeat(i % 300)).slice(0, Math.max(body.length, i % 300));
+}
+
+if (mode === 'exit') {
+  process.exit(0);
+}
+
+const map = new addon.FileMapping();
+const queue = new addon.WorkQueue();
+map.openMapping(process.argv[3], 0);
+queue.open(map, 0);
+
+if (mode === 'produce') {
+  const id = process.argv[4];
+  const n = Number(process.argv[5]);
+  let i = 0;
+
+  (function produce() {
+    for (; i < n; ++i) {
+      if (!queue.push(message(id, i))) {
+        setImmediate(produce);
+        return;
+      }
+    }
+    process.exit(0);
+  })();
+} else if (mode === 'consume') {
+  const received = [];
+
+  (function consume() {
+    for (;;) {
+      const item = queue.pop();
+      if (item === null) {
+        setImmediate(consume);
+        return;
+      }
+
+      const text = item.toString();
+      if (text === 'stop') {
+        process.send(received, function () { process.exit(0); });
+        return;
+      }
+
+      const parts = text.split(':');
+      if (!item.equals(message(parts[0], Number(parts[1]))))
+        throw new Error('Corrupt message ' + text);
+      received.push(parts[0] + ':' + parts[1]);
+    }
+  })();
+}
@@ -0,0 +1,122 @@
+// Runs node_filemap in worker_threads for worker-threads.test.js. Started
+// with --experimental-worker where node needs it. Reports what it saw with
+// process.send and exits.
+//   share <name> <workers>   each worker opens the mapping <name> and writes
+//                            its number into it, then reports how many times
+//                            the mapping shows up in /proc/self/maps
+//   async <name>             a worker waits asynchronously on a Mutex held by
+//                            the main thread, then another is terminated in
+//                            the middle of the same wait
+const { Worker, isMainThread, parentPort, workerData } = require('worker_threads');
+const fs = require('fs');
+const addon = require('../..');
+
+function mapCount(name) {
+  if (process.platform !== 'linux')
+    return -1;
+
+  return fs.readFileSync('/proc/self/maps', 'utf8').split('\n').filter(function (line) {
+    return line.endsWith('/' + name) || line.endsWith('/' + name + ' (deleted)');
+  }).length;
+}
+
+function start(data) {
+  const worker = new Worker(__filename, { workerData: data });
+  const exited = new Promise(function (resolve) { worker.on('exit', resolve); });
+  return { worker: worker, exited: exited };
+}
+
+function message(worker) {
+  return new Promise(function (resolve) { worker.once('message', resolve); });
+}
+
+async function share(name, count) {
+  const map = new addon.FileMapping();
+  map.createMapping(null, name, 4096);
+
+  const workers = [];
+  for (let i = 0; i < count; ++i)
+    workers.push(start({ mode: 'share', name: name, index: i }));
+
+  const counts = await Promise.all(workers.map(function (it) { return message(it.worker); }));
+
+  const values = [];
+  const value = Buffer.alloc(4);
+  for (let i = 0; i < count; ++i) {
+    map.readInto(i * 4, 4, value);
+    values.push(value.readInt32LE(0));
+  }
+
+  const whileOpen = mapCount(name);
+
+  // Our close doesn't remove the name while the workers still use it
+  map.closeMapping();
+  const reopen = new addon.FileMapping();
+  reopen.openMapping(name, 4096);
+  reopen.closeMapping();
+
+  workers.forEach(function (it) { it.worker.postMessage('close'); });
+  const codes = await Promise.all(workers.map(function (it) { return it.exited; }));
+
+  let removed = true;
+  try {
+    new addon.FileMapping().openMapping(name, 4096);
+    removed = false;
+  } catch (err) {
+  }
+
+  return { counts: counts, values: values, whileOpen: whileOpen, codes: codes, removed: removed };
+}
+
+async function asyncWaits(name) {
+  const lock = new addon.Mutex();
+  lock.create(name);
+  lock.wait();
+
+  const waiter = start({ mode: 'wait', name: name });
+  const stuck = start({ mode: 'wait', name: name });
+  await Promise.all([message(waiter.worker), message(stuck.worker)]);
+
+  // Gone while its wait is still on the pool
+  stuck.worker.terminate();
+  const stuckCode = await stuck.exited;
+
+  const result = message(waiter.worker);
+  lock.release();
+  const waitResult = await result;
+  const waiterCode = await waiter.exited;
+
+  lock.close();
+  return { waitResult: waitResult, waiterCode: waiterCode, stuckCode: stuckCode };
+}
+
+if (isMainThread) {
+  const run = process.argv[2] === 'share' ? share(process.argv[3], Number(process.argv[4])) : asyncWaits(process.argv[3]);
+  run.then(function (result) {
+    process.send(result, function () { process.exit(0); });
+  }, function (err) {
+    console.error(err);
+    process.exit(1);
+  });
+} else if (workerData.mode === 'share') {
+  const map = new addon.FileMapping();
+  map.openMapping(workerData.name, 4096);
+  map.writeBuffer(Buffer.from(new Int32Array([workerData.index + 1]).buffer), workerData.index * 4, 0, 4);
+
+  parentPort.postMessage(mapCount(workerData.name));
+  parentPort.once('message', function () {
+    map.closeMapping();
+    parentPort.close();
+  });
+} else {
+  const lock = new addon.Mutex();
+  lock.open(workerData.name);
+
+  lock.waitAsync(10000).then(function (result) {
+    lock.release();
+    lock.close();
+    parentPort.postMessage(result);
+    parentPort.close();
+  });
+  parentPort.postMessage('waiting');
+}
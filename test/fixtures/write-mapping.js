@@ -0,0 +1,10 @@
+// Opens a mapping by name and writes an Int32 to offset 0
+const addon = require('../..');
+
+const map = new addon.FileMapping();
+const buffer = Buffer.alloc(4);
+
+map.openMapping(process.argv[2], Number(process.argv[3]));
+buffer.writeInt32LE(Number(process.argv[4]));
+map.writeBuffer(buffer, 0, 0, 4);
+map.closeMapping();
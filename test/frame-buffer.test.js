@@ -0,0 +1,153 @@
+const assert = require('assert');
+const path = require('path');
+const { execFileSync, fork } = require('child_process');
+const { test, uniqueName, createInMapping } = require('./harness');
+const addon = require('..');
+
+const producer = path.join(__dirname, 'fixtures', 'frame-buffer-producer.js');
+const compare = path.join(__dirname, 'fixtures', 'frame-buffer-compare.js');
+
+test('FrameBuffer only publishes and reads the tiles that changed', function () {
+  const { map, object: frames } = createInMapping(addon.FrameBuffer, [4096 + 100, 256], [4096 + 100, 256]);
+  const consumer = Buffer.alloc(4196);
+  const frame = Buffer.alloc(4196);
+
+  assert.ok(['avx2', 'sse2', 'scalar'].includes(addon.FrameBuffer.SIMD));
+  assert.strictEqual(frames.publishDelta(frame), 0);
+  assert.strictEqual(frames.generation(), 0);
+  assert.strictEqual(frames.readDirty(consumer), 0);
+
+  frame[0] = 1;
+  frame[300] = 2;
+  frame[511] = 3;
+  frame[4195] = 4; // In the short last tile
+  assert.strictEqual(frames.publishDelta(frame), 3);
+  assert.strictEqual(frames.generation(), 1);
+
+  frame[1000] = 5;
+  assert.strictEqual(frames.publishDelta(frame), 1);
+  assert.strictEqual(frames.publishDelta(frame), 0);
+  assert.strictEqual(frames.generation(), 2);
+
+  consumer.fill(0xee, 2048, 2304); // A tile nobody touched stays as it is
+  assert.strictEqual(frames.readDirty(consumer), 4);
+  assert.strictEqual(frames.readDirty(consumer), 0);
+  consumer.fill(0, 2048, 2304);
+  assert.ok(consumer.equals(frame));
+
+  map.closeMapping();
+});
+
+test('FrameBuffer.open finds an existing frame buffer', function () {
+  const { name, map, object: frames } = createInMapping(addon.FrameBuffer, [65536], [65536]);
+  const other = new addon.FileMapping();
+  const reader = new addon.FrameBuffer();
+
+  assert.strictEqual(addon.FrameBuffer.size(65536), addon.FrameBuffer.size(65536, 1024));
+  other.openMapping(name, 0);
+  assert.throws(function () { reader.open(other, 64); }, /No FrameBuffer|too small/);
+  reader.open(other, 0);
+
+  const frame = Buffer.alloc(65536);
+  frame.write('hello', 40000);
+  frames.publishDelta(frame);
+
+  const into = Buffer.alloc(65536);
+  assert.strictEqual(reader.readDirty(into), 1);
+  assert.ok(into.equals(frame));
+  assert.strictEqual(reader.generation(), 1);
+
+  other.closeMapping();
+  map.closeMapping();
+});
+
+test('FrameBuffer.readAll brings a consumer that lost track up to date', function () {
+  const { map, object: frames } = createInMapping(addon.FrameBuffer, [4096 + 100, 256], [4096 + 100, 256]);
+  const frame = Buffer.alloc(4196);
+
+  frame.fill(7, 0, 1000);
+  frames.publishDelta(frame);
+  frame[4195] = 9;
+  frames.publishDelta(frame);
+
+  // Starts from garbage rather than zeros, and still ends up with the frame
+  const consumer = Buffer.alloc(4196, 0xee);
+  assert.strictEqual(frames.readAll(consumer), 17);
+  assert.ok(consumer.equals(frame));
+
+  // Nothing is left marked for readDirty to copy again
+  assert.strictEqual(frames.readDirty(consumer), 0);
+  frame[2000] = 1;
+  frames.publishDelta(frame);
+  assert.strictEqual(frames.readDirty(consumer), 1);
+  assert.ok(consumer.equals(frame));
+
+  assert.throws(function () { frames.readAll(Buffer.alloc(10)); }, RangeError);
+  map.closeMapping();
+});
+
+test('FrameBuffer finds every changed byte with each compare', function () {
+  const kinds = ['scalar'];
+  if (process.arch === 'x64' || process.arch === 'ia32')
+    kinds.push('sse2');
+
+  for (const kind of kinds) {
+    const env = Object.assign({}, process.env, { NODE_FILEMAP_SIMD: kind });
+    const result = JSON.parse(execFileSync(process.execPath, [compare], { env: env }));
+    assert.deepStrictEqual(result, { simd: kind, wrong: [] });
+  }
+});
+
+test('FrameBuffer checks its arguments', function () {
+  const map = new addon.FileMapping();
+  const frames = new addon.FrameBuffer();
+  map.createMapping(null, uniqueName('frame_args'), 8192);
+
+  assert.throws(function () { addon.FrameBuffer.size(); }, /Not enough arguments/);
+  assert.throws(function () { addon.FrameBuffer.size(1024, 100); }, RangeError);
+  assert.throws(function () { addon.FrameBuffer.size(0); }, RangeError);
+  assert.throws(function () { frames.create(map, 0); }, /Not enough arguments/);
+  assert.throws(function () { frames.create(map, 0, -1); }, /Wrong type/);
+  assert.throws(function () { frames.create(map, 0, 8192); }, /too small/);
+  assert.throws(function () { frames.publishDelta(Buffer.alloc(1)); }, /Not attached/);
+
+  frames.create(map, 0, 4096);
+  assert.throws(function () { frames.publishDelta('frame'); }, /Wrong type/);
+  assert.throws(function () { frames.publishDelta(Buffer.alloc(4095)); }, RangeError);
+  assert.throws(function () { frames.readDirty(); }, /Not enough arguments/);
+
+  map.closeMapping();
+  assert.throws(function () { frames.generation(); }, /closed/);
+});
+
+test('FrameBuffer keeps a consumer in another process up to date', async function () {
+  const { name, map, object: frames } = createInMapping(addon.FrameBuffer, [65536], [65536]);
+  const child = fork(producer, [name, '20000']);
+  const exited = new Promise(function (resolve) { child.on('exit', resolve); });
+  await new Promise(function (resolve) { child.once('message', resolve); });
+
+  const consumer = Buffer.alloc(65536);
+  let running = true;
+  exited.then(function () { running = false; });
+
+  while (running) {
+    frames.readDirty(consumer);
+    await new Promise(function (resolve) { setImmediate(resolve); });
+  }
+
+  assert.strictEqual(await exited, 0);
+  frames.readDirty(consumer);
+
+  // Every frame writes a fresh byte, but writing a 0 doesn't change anything
+  const expected = Buffer.alloc(65536);
+  let changes = 0;
+  for (let i = 1; i <= 20000; ++i) {
+    expected[(i * 1031) % expected.length] = i & 0xff;
+    if ((i & 0xff) !== 0)
+      changes++;
+  }
+  assert.ok(consumer.equals(expected));
+  assert.strictEqual(frames.generation(), changes);
+
+  map.closeMapping();
+});
@@ -0,0 +1,90 @@
+const { EventEmitter } = require('events');
+const addon = require('..');
+
+// Minimal test harness - register tests with test(name, fn), where fn may
+// return a promise. run.js loads every *.test.js file and runs them in order.
+
+const tests = [];
+
+function test(name, fn) {
+  tests.push({ name: name, fn: fn });
+}
+
+test.skip = function (name) {
+  tests.push({ name: name, skip: true });
+};
+
+// Shared memory names are global to the machine, so keep them unique per run
+function uniqueName(prefix) {
+  return 'node_filemap_' + prefix + '_' + process.pid + '_' + Math.floor(Math.random() * 1e9);
+}
+
+// Creates a Class object in a new uniquely named mapping, with
+// create(map, offset, ...createArgs). size is the mapping's size in bytes past
+// the offset, or an array of arguments for Class.size(). options.name names
+// the mapping instead, and options.offset places the object further into it.
+function createInMapping(Class, size, createArgs, options) {
+  options = options || {};
+  const name = options.name || uniqueName(Class.name.toLowerCase());
+  const offset = options.offset || 0;
+  const map = new addon.FileMapping();
+  const object = new Class();
+  map.createMapping(null, name, offset + (Array.isArray(size) ? Class.size.apply(Class, size) : size));
+  object.create.apply(object, [map, offset].concat(createArgs || []));
+  return { name: name, map: map, object: object };
+}
+
+// Resolves with a child process's exit code once it exits
+function exited(child) {
+  return new Promise(function (resolve) { child.on('exit', resolve); });
+}
+
+// AbortController only exists from node 15 on, so stand in for it before that
+function abortController() {
+  if (typeof AbortController !== 'undefined')
+    return new AbortController();
+
+  const events = new EventEmitter();
+  const signal = {
+    aborted: false,
+    addEventListener: function (type, fn) { events.on(type, fn); },
+    removeEventListener: function (type, fn) { events.removeListener(type, fn); },
+    listenerCount: function () { return events.listenerCount('abort'); }
+  };
+  return {
+    signal: signal,
+    abort: function () { signal.aborted = true; events.emit('abort'); }
+  };
+}
+
+async function run() {
+  let failed = 0;
+
+  for (const t of tests) {
+    if (t.skip) {
+      console.log('skip ' + t.name);
+      continue;
+    }
+
+    try {
+      await t.fn();
+      console.log('ok   ' + t.name);
+    } catch (err) {
+      failed++;
+      console.log('FAIL ' + t.name);
+      console.log(err && err.stack ? err.stack : err);
+    }
+  }
+
+  console.log('\n' + (tests.length - failed) + '/' + tests.length + ' passed');
+  return failed;
+}
+
+module.exports = {
+  test: test,
+  uniqueName: uniqueName,
+  createInMapping: createInMapping,
+  exited: exited,
+  abortController: abortController,
+  run: run
+};
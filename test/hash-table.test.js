@@ -0,0 +1,182 @@
+const assert = require('assert');
+const path = require('path');
+const { fork, spawnSync } = require('child_process');
+const { test, uniqueName, createInMapping } = require('./harness');
+const addon = require('..');
+
+const worker = path.join(__dirname, 'fixtures', 'hash-table-worker.js');
+
+test('HashTable sets, gets and deletes binary keys', function () {
+  const { map, object: table } = createInMapping(addon.HashTable, [64, 1 << 16], [64, 1 << 16]);
+
+  assert.strictEqual(table.get('missing'), null);
+  assert.strictEqual(table.set('one', Buffer.from('first')), true);
+  assert.strictEqual(table.set(Buffer.from([0, 1, 2]), 'binary key'), true);
+  assert.strictEqual(table.count(), 2);
+
+  assert.strictEqual(table.get('one').toString(), 'first');
+  assert.strictEqual(table.get(Buffer.from('one')).toString(), 'first');
+  assert.strictEqual(table.get(Buffer.from([0, 1, 2])).toString(), 'binary key');
+  assert.strictEqual(table.get(Buffer.from([0, 1])), null);
+  assert.strictEqual(table.has('one'), true);
+
+  // Replacing keeps the count and can change the size
+  assert.strictEqual(table.set('one', 'a much longer value than before'), true);
+  assert.strictEqual(table.get('one').toString(), 'a much longer value than before');
+  assert.strictEqual(table.count(), 2);
+
+  assert.strictEqual(table.delete('one'), true);
+  assert.strictEqual(table.delete('one'), false);
+  assert.strictEqual(table.has('one'), false);
+  assert.strictEqual(table.count(), 1);
+
+  // Empty keys and values are fine
+  assert.strictEqual(table.set('', ''), true);
+  assert.strictEqual(table.get('').length, 0);
+
+  map.closeMapping();
+});
+
+test('HashTable.getInto copies into a Buffer and returns the length', function () {
+  const { map, object: table } = createInMapping(addon.HashTable, [64, 1 << 16], [64, 1 << 16]);
+  table.set('key', 'hello world');
+
+  const into = Buffer.alloc(32);
+  assert.strictEqual(table.getInto('key', into), 11);
+  assert.strictEqual(into.toString('utf8', 0, 11), 'hello world');
+
+  // Too small gets as much as fits, and the length says how much to allocate
+  const small = Buffer.alloc(5);
+  assert.strictEqual(table.getInto('key', small), 11);
+  assert.strictEqual(small.toString(), 'hello');
+
+  assert.strictEqual(table.getInto('nope', into), -1);
+  map.closeMapping();
+});
+
+test('HashTable reports when it is full', function () {
+  const { map, object: table } = createInMapping(addon.HashTable, [8, 1 << 16], [8, 1 << 16]);
+
+  for (let i = 0; i < 8; ++i)
+    assert.strictEqual(table.set('k' + i, 'v'), true);
+  assert.strictEqual(table.set('k8', 'v'), false);
+  assert.strictEqual(table.count(), 8);
+
+  // Still replaces keys it has
+  assert.strictEqual(table.set('k3', 'new'), true);
+  assert.strictEqual(table.get('k3').toString(), 'new');
+
+  // And the data heap can run out before the slots do
+  table.delete('k0');
+  assert.strictEqual(table.set('big', Buffer.alloc(1 << 17)), false);
+  assert.strictEqual(table.has('big'), false);
+
+  map.closeMapping();
+});
+
+test('HashTable.compact clears out deleted slots', function () {
+  const { map, object: table } = createInMapping(addon.HashTable, [16, 1 << 16], [16, 1 << 16]);
+
+  for (let round = 0; round < 20; ++round) {
+    for (let i = 0; i < 10; ++i)
+      assert.strictEqual(table.set('r' + round + '_' + i, String(i)), true);
+    for (let i = 0; i < 10; ++i)
+      table.delete('r' + round + '_' + i);
+  }
+
+  table.set('kept', 'yes');
+  table.compact();
+  assert.strictEqual(table.get('kept').toString(), 'yes');
+  assert.strictEqual(table.count(), 1);
+  assert.strictEqual(table.get('r0_0'), null);
+
+  map.closeMapping();
+});
+
+test('HashTable.open finds an existing table', function () {
+  const { name, map, object: table } = createInMapping(addon.HashTable, [64, 1 << 16], [64, 1 << 16]);
+  const other = new addon.FileMapping();
+  const reader = new addon.HashTable();
+
+  table.set('shared', 'value');
+
+  other.openMapping(name, 0);
+  assert.throws(function () { reader.open(other, 64); }, /No HashTable/);
+  reader.open(other, 0);
+  assert.strictEqual(reader.get('shared').toString(), 'value');
+  reader.set('back', 'again');
+  assert.strictEqual(table.get('back').toString(), 'again');
+
+  other.closeMapping();
+  map.closeMapping();
+});
+
+test('HashTable checks its arguments', function () {
+  const map = new addon.FileMapping();
+  const table = new addon.HashTable();
+  map.createMapping(null, uniqueName('table_args'), addon.HashTable.size(64, 1 << 16));
+
+  assert.throws(function () { addon.HashTable.size(64); }, /Not enough arguments/);
+  assert.throws(function () { addon.HashTable.size(63, 1 << 16); }, RangeError);
+  assert.throws(function () { addon.HashTable.size(64, 100); }, RangeError);
+  assert.throws(function () { table.create(map, 0, 64); }, /Not enough arguments/);
+  assert.throws(function () { table.create(map, 0, 'many', 1 << 16); }, /Wrong type/);
+  assert.throws(function () { table.create(map, 8, 64, 1 << 16); }, /Misaligned/);
+  assert.throws(function () { table.create(map, 0, 4096, 1 << 16); }, /too small/);
+  assert.throws(function () { table.get('x'); }, /Not attached/);
+
+  table.create(map, 0, 64, 1 << 16);
+  assert.throws(function () { table.get(); }, /Not enough arguments/);
+  assert.throws(function () { table.get(5); }, /Wrong type/);
+  assert.throws(function () { table.set('x'); }, /Not enough arguments/);
+  assert.throws(function () { table.set('x', {}); }, /Wrong type/);
+  assert.throws(function () { table.getInto('x', 'into'); }, /Wrong type/);
+
+  map.closeMapping();
+  assert.throws(function () { table.count(); }, /closed/);
+});
+
+test('HashTable takes over a stripe whose writer died', function () {
+  const { map, object: table } = createInMapping(addon.HashTable, [64, 1 << 16], [64, 1 << 16]);
+  table.set('before', 'crash');
+
+  // Leave every stripe locked by a process that's gone, mid write
+  const pid = spawnSync(process.execPath, ['-e', '']).pid;
+
+  const stripes = map.view(64, 4 * 64);
+  for (let i = 0; i < 4; ++i) {
+    stripes.writeUInt32LE(1, i * 64);
+    stripes.writeUInt32LE(pid, i * 64 + 4);
+  }
+
+  assert.strictEqual(table.get('before').toString(), 'crash');
+  assert.strictEqual(table.set('after', 'recovered'), true);
+  assert.strictEqual(table.get('after').toString(), 'recovered');
+
+  map.closeMapping();
+});
+
+test('HashTable stays consistent with writers and readers in several processes', async function () {
+  const { name, map, object: table } = createInMapping(addon.HashTable, [1024, 1 << 20], [1024, 1 << 20]);
+
+  const children = [];
+  for (let i = 1; i <= 4; ++i)
+    children.push(fork(worker, [name, String(i), '20000']));
+
+  const exited = Promise.all(children.map(function (child) {
+    return new Promise(function (resolve) { child.on('exit', resolve); });
+  }));
+  const results = await Promise.all(children.map(function (child) {
+    return new Promise(function (resolve) { child.once('message', resolve); });
+  }));
+  assert.deepStrictEqual(await exited, [0, 0, 0, 0]);
+
+  for (const result of results) {
+    assert.strictEqual(result.errors, 0);
+    assert.ok(result.reads > 0);
+  }
+
+  // Every worker left keys it didn't delete last
+  assert.ok(table.count() > 0);
+  map.closeMapping();
+});
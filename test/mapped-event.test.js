@@ -0,0 +1,238 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName, createInMapping, exited, abortController } = require('./harness');
+const addon = require('..');
+
+const signaller = path.join(__dirname, 'fixtures', 'mapped-event-signaller.js');
+
+if (!addon.MappedEvent) {
+  test.skip('MappedEvent is only available on Windows and Linux');
+  return;
+}
+
+// Signals the event from a child process after delay ms. Resolves once the
+// child is running, with a promise for its exit code.
+async function startSignaller(name, delay, count, offset) {
+  const child = fork(signaller, [name, String(delay), String(count || 1), String(offset || 0)]);
+  const done = exited(child);
+  await new Promise(function (resolve) { child.once('message', resolve); });
+  return { exited: done };
+}
+
+test('MappedEvent counts signals', function () {
+  const { name, map, object: event } = createInMapping(addon.MappedEvent, 4096);
+  const other = new addon.FileMapping();
+  const reader = new addon.MappedEvent();
+
+  assert.strictEqual(addon.MappedEvent.SIZE, 64);
+  assert.strictEqual(event.generation(), 0);
+  assert.strictEqual(event.signal(), 1);
+  assert.strictEqual(event.signal(), 2);
+
+  other.openMapping(name, 0);
+  assert.throws(function () { reader.open(other, 64); }, /No MappedEvent/);
+  reader.open(other, 0);
+  assert.strictEqual(reader.generation(), 2);
+
+  // A generation that has already moved on returns straight away
+  assert.strictEqual(reader.waitForChange(0), 2);
+  assert.strictEqual(reader.waitForChange(2, 0), 2);
+
+  const start = Date.now();
+  assert.strictEqual(reader.waitForChange(2, 50), 2);
+  assert.ok(Date.now() - start >= 45);
+
+  reader.close();
+  other.closeMapping();
+  map.closeMapping();
+});
+
+test('MappedEvent checks its arguments', function () {
+  const map = new addon.FileMapping();
+  const event = new addon.MappedEvent();
+  map.createMapping(null, uniqueName('event_args'), 4096);
+
+  assert.throws(function () { event.create(map); }, /Not enough arguments/);
+  assert.throws(function () { event.create(map, 8); }, /Misaligned/);
+  assert.throws(function () { event.signal(); }, /Not attached/);
+
+  event.create(map, 0);
+  assert.throws(function () { event.waitForChange(); }, /Not enough arguments/);
+  assert.throws(function () { event.waitForChange('0'); }, /Wrong type/);
+  assert.throws(function () { event.waitForChange(0, 'soon'); }, /Wrong type/);
+  assert.throws(function () { event.waitForChangeAsync(0, 10, 'signal'); }, /Wrong type/);
+  assert.throws(function () { addon.MappedEvent.waitMultiple([event], [0]); }, /Not enough arguments/);
+  assert.throws(function () { addon.MappedEvent.waitMultiple([{}], [0], false); }, /Wrong type/);
+  assert.throws(function () { addon.MappedEvent.waitMultiple([event], ['0'], false); }, /Wrong type/);
+  assert.throws(function () { addon.MappedEvent.waitMultiple([event], [0, 1], false); }, RangeError);
+  assert.throws(function () { addon.MappedEvent.waitMultiple([], [], false); }, RangeError);
+
+  map.closeMapping();
+  assert.throws(function () { event.generation(); }, /closed/);
+});
+
+test('MappedEvent.waitForChange wakes when another process signals', async function () {
+  const { name, map, object: event } = createInMapping(addon.MappedEvent, 4096);
+  const { exited } = await startSignaller(name, 50, 1);
+
+  const start = Date.now();
+  assert.strictEqual(event.waitForChange(0, 5000), 1);
+  assert.ok(Date.now() - start < 2000);
+
+  assert.strictEqual(await exited, 0);
+  map.closeMapping();
+});
+
+test('MappedEvent.waitMultiple wakes for whichever event is signalled', async function () {
+  const { name, map, object: event } = createInMapping(addon.MappedEvent, 4096);
+  const second = new addon.MappedEvent();
+  second.create(map, 64);
+
+  assert.strictEqual(addon.MappedEvent.waitMultiple([event, second], [0, 0], false, 10), addon.WAIT_TIMEOUT);
+
+  const { exited } = await startSignaller(name, 50, 1, 64);
+
+  const start = Date.now();
+  assert.strictEqual(addon.MappedEvent.waitMultiple([event, second], [0, 0], false, 5000), addon.WAIT_OBJECT_0 + 1);
+  assert.ok(Date.now() - start < 2000);
+
+  // Already moved on, so no wait at all
+  assert.strictEqual(addon.MappedEvent.waitMultiple([event, second], [0, 0], false, 0), addon.WAIT_OBJECT_0 + 1);
+
+  assert.strictEqual(await exited, 0);
+  map.closeMapping();
+});
+
+test('MappedEvent.waitMultiple waits for all of them to change', async function () {
+  const { name, map, object: event } = createInMapping(addon.MappedEvent, 4096);
+  const second = new addon.MappedEvent();
+  second.create(map, 64);
+
+  const first = await startSignaller(name, 50, 1, 0);
+  const other = await startSignaller(name, 200, 1, 64);
+
+  assert.strictEqual(addon.MappedEvent.waitMultiple([event, second], [0, 0], true, 5000), addon.WAIT_OBJECT_0);
+  assert.strictEqual(event.generation(), 1);
+  assert.strictEqual(second.generation(), 1);
+
+  assert.strictEqual(await first.exited, 0);
+  assert.strictEqual(await other.exited, 0);
+  map.closeMapping();
+});
+
+test('MappedEvent.waitForChangeAsync resolves with the new generation', async function () {
+  const { name, map, object: event } = createInMapping(addon.MappedEvent, 4096);
+  const { exited } = await startSignaller(name, 200, 3);
+
+  // The event loop keeps running while we wait
+  let ticks = 0;
+  const timer = setInterval(function () { ticks++; }, 5);
+
+  let last = 0;
+  while (last < 3)
+    last = await event.waitForChangeAsync(last, 5000);
+
+  clearInterval(timer);
+  assert.strictEqual(last, 3);
+  assert.ok(ticks > 0);
+
+  assert.strictEqual(await exited, 0);
+  map.closeMapping();
+});
+
+test('MappedEvent.waitForChangeAsync resolves with the same generation on timeout', async function () {
+  const { map, object: event } = createInMapping(addon.MappedEvent, 4096);
+  event.signal();
+
+  assert.strictEqual(await event.waitForChangeAsync(0), 1);
+  assert.strictEqual(await event.waitForChangeAsync(1, 0), 1);
+
+  const start = Date.now();
+  assert.strictEqual(await event.waitForChangeAsync(1, 50), 1);
+  assert.ok(Date.now() - start >= 45);
+
+  map.closeMapping();
+});
+
+test('MappedEvent waits take Infinity and timeouts past 2 ** 32 ms at their word', async function () {
+  const { name, map, object: event } = createInMapping(addon.MappedEvent, 4096);
+
+  let signaller = await startSignaller(name, 100, 1);
+  assert.strictEqual(event.waitForChange(0, Infinity), 1);
+  assert.strictEqual(await signaller.exited, 0);
+
+  signaller = await startSignaller(name, 100, 1);
+  assert.strictEqual(addon.MappedEvent.waitMultiple([event], [1], false, 2 ** 32 + 50), addon.WAIT_OBJECT_0);
+  assert.strictEqual(await signaller.exited, 0);
+
+  signaller = await startSignaller(name, 100, 1);
+  assert.strictEqual(await event.waitForChangeAsync(2, Infinity), 3);
+  assert.strictEqual(await signaller.exited, 0);
+
+  signaller = await startSignaller(name, 100, 1);
+  assert.strictEqual(await event.waitForChangeAsync(3, 2 ** 32 + 50), 4);
+  assert.strictEqual(await signaller.exited, 0);
+
+  map.closeMapping();
+});
+
+test('MappedEvent.waitForChangeAsync waits don\'t queue behind each other', async function () {
+  const created = [];
+  for (let i = 0; i < 64; ++i)
+    created.push(createInMapping(addon.MappedEvent, 4096));
+
+  const waits = created.map(function (it) { return it.object.waitForChangeAsync(0, 5000); });
+  await new Promise(function (resolve) { setTimeout(resolve, 50); });
+
+  // Every wait has a thread of its own, so the last one wakes as soon as the
+  // first would
+  const start = Date.now();
+  created[created.length - 1].object.signal();
+  assert.strictEqual(await waits[waits.length - 1], 1);
+  assert.ok(Date.now() - start < 100);
+
+  for (const it of created)
+    it.object.signal();
+  await Promise.all(waits);
+
+  for (const it of created)
+    it.map.closeMapping();
+});
+
+test('MappedEvent.waitForChangeAsync can be aborted', async function () {
+  const { map, object: event } = createInMapping(addon.MappedEvent, 4096);
+
+  const controller = abortController();
+  const waiting = event.waitForChangeAsync(0, addon.INFINITE, controller.signal);
+  setTimeout(function () { controller.abort(); }, 20);
+
+  await assert.rejects(waiting, function (err) {
+    return err.name === 'AbortError' && err.code === 'ABORT_ERR';
+  });
+
+  // Already aborted never starts
+  await assert.rejects(event.waitForChangeAsync(0, addon.INFINITE, controller.signal), /aborted/);
+
+  map.closeMapping();
+});
+
+test('MappedEvent.close rejects waits in progress', async function () {
+  const { map, object: event } = createInMapping(addon.MappedEvent, 4096);
+
+  const waiting = event.waitForChangeAsync(0, addon.INFINITE);
+  setTimeout(function () { event.close(); }, 20);
+
+  await assert.rejects(waiting, /closed while waiting/);
+  map.closeMapping();
+});
+
+test('MappedEvent waits survive the mapping being closed', async function () {
+  const { map, object: event } = createInMapping(addon.MappedEvent, 4096);
+
+  const waiting = event.waitForChangeAsync(0, 50);
+  map.closeMapping();
+
+  assert.strictEqual(await waiting, 0);
+  assert.throws(function () { event.signal(); }, /closed/);
+});
@@ -0,0 +1,153 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName, createInMapping, exited } = require('./harness');
+const addon = require('..');
+
+const worker = path.join(__dirname, 'fixtures', 'mapped-mutex-worker.js');
+
+if (process.platform !== 'linux') {
+  test.skip('MappedMutex (Linux only)');
+  return;
+}
+
+test('MappedMutex reserves one cache line', function () {
+  assert.strictEqual(addon.MappedMutex.SIZE, 64);
+});
+
+test('MappedMutex waits and releases, recursively like a Win32 mutex', function () {
+  const { map, object: lock } = createInMapping(addon.MappedMutex, 4096);
+
+  assert.strictEqual(lock.wait(), addon.WAIT_OBJECT_0);
+  assert.strictEqual(lock.wait(0), addon.WAIT_OBJECT_0);
+  lock.release();
+  lock.release();
+  assert.throws(function () { lock.release(); }, /doesn't own/);
+
+  map.closeMapping();
+});
+
+test('MappedMutex times out while another process holds it', async function () {
+  const name = uniqueName('mm_hold');
+  const { map, object: lock } = createInMapping(addon.MappedMutex, 4096, [], { name: name });
+
+  const child = fork(worker, ['hold', name, '300']);
+  await new Promise(function (resolve) { child.once('message', resolve); });
+
+  assert.strictEqual(lock.wait(0), addon.WAIT_TIMEOUT);
+  assert.strictEqual(lock.wait(20), addon.WAIT_TIMEOUT);
+  assert.strictEqual(lock.wait(5000), addon.WAIT_OBJECT_0);
+  lock.release();
+
+  await exited(child);
+  map.closeMapping();
+});
+
+test('MappedMutex reports WAIT_ABANDONED when the owner dies holding it', async function () {
+  const name = uniqueName('mm_abandon');
+  const { map, object: lock } = createInMapping(addon.MappedMutex, 4096, [], { name: name });
+
+  await exited(fork(worker, ['abandon', name]));
+
+  assert.strictEqual(lock.wait(1000), addon.WAIT_ABANDONED);
+  lock.release();
+  assert.strictEqual(lock.wait(1000), addon.WAIT_OBJECT_0);
+  lock.release();
+
+  map.closeMapping();
+});
+
+test('closing the mapping abandons a MappedMutex the thread holds', function () {
+  const held = createInMapping(addon.MappedMutex, 4096);
+  const { map, object: lock } = createInMapping(addon.MappedMutex, 4096);
+  assert.strictEqual(held.object.wait(0), addon.WAIT_OBJECT_0);
+  held.map.closeMapping();
+
+  // Taking another lock links it into the thread's robust list, which
+  // mustn't still point into the closed mapping
+  assert.strictEqual(lock.wait(0), addon.WAIT_OBJECT_0);
+  lock.release();
+
+  map.closeMapping();
+});
+
+test('MappedMutex serializes increments from several processes', async function () {
+  const name = uniqueName('mm_count');
+  const { map } = createInMapping(addon.MappedMutex, 4096, [], { name: name });
+  const perChild = 20000;
+
+  const children = [0, 1, 2].map(function () {
+    return exited(fork(worker, ['count', name, String(perChild)]));
+  });
+  await Promise.all(children);
+
+  const counter = Buffer.alloc(4);
+  map.readInto(64, 4, counter);
+  assert.strictEqual(counter.readInt32LE(0), perChild * 3);
+
+  map.closeMapping();
+});
+
+test('MappedMutex.waitMultiple takes whichever mutex is released first', async function () {
+  const name = uniqueName('mm_any');
+  const { map, object: lock } = createInMapping(addon.MappedMutex, 4096, [], { name: name });
+  const second = new addon.MappedMutex();
+  second.create(map, 128);
+
+  const child = fork(worker, ['pair', name, '2000', '100']);
+  await new Promise(function (resolve) { child.once('message', resolve); });
+
+  assert.strictEqual(lock.waitMultiple([lock, second], false, 0), addon.WAIT_TIMEOUT);
+
+  const start = Date.now();
+  assert.strictEqual(lock.waitMultiple([lock, second], false, 5000), addon.WAIT_OBJECT_0 + 1);
+  assert.ok(Date.now() - start < 1500);
+  second.release();
+
+  await exited(child);
+  map.closeMapping();
+});
+
+test('MappedMutex.waitMultiple waits for all of them without holding any', async function () {
+  const name = uniqueName('mm_all');
+  const { map, object: lock } = createInMapping(addon.MappedMutex, 4096, [], { name: name });
+  const second = new addon.MappedMutex();
+  second.create(map, 128);
+
+  const child = fork(worker, ['pair', name, '300', '100']);
+  await new Promise(function (resolve) { child.once('message', resolve); });
+
+  assert.strictEqual(lock.waitMultiple([lock, second], true, 20), addon.WAIT_TIMEOUT);
+  assert.strictEqual(lock.waitMultiple([lock, second], true, 5000), addon.WAIT_OBJECT_0);
+  lock.release();
+  second.release();
+
+  await exited(child);
+  map.closeMapping();
+});
+
+test('MappedMutex throws once its mapping is closed', function () {
+  const { map, object: lock } = createInMapping(addon.MappedMutex, 4096);
+  map.closeMapping();
+
+  assert.throws(function () { lock.wait(); }, /closed/);
+  assert.throws(function () { lock.create(map, 0); }, RangeError);
+});
+
+test('MappedMutex checks its arguments', function () {
+  const map = new addon.FileMapping();
+  const lock = new addon.MappedMutex();
+  map.createMapping(null, uniqueName('mm_args'), 128);
+
+  assert.throws(function () { lock.create({}, 0); }, TypeError);
+  assert.throws(function () { lock.create(map, 3); }, RangeError);
+  assert.throws(function () { lock.create(map, 96); }, RangeError);
+  assert.throws(function () { lock.wait(); }, /Not attached/);
+
+  assert.throws(function () { lock.waitMultiple([lock]); }, /Not enough arguments/);
+  assert.throws(function () { lock.waitMultiple([{}], false, 0); }, TypeError);
+  assert.throws(function () { lock.waitMultiple([], false, 0); }, RangeError);
+  assert.throws(function () { lock.waitMultiple([lock], false, 0); }, /Not attached/);
+
+  map.closeMapping();
+});
@@ -0,0 +1,274 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName, exited, abortController } = require('./harness');
+const addon = require('..');
+
+const worker = path.join(__dirname, 'fixtures', 'mutex-worker.js');
+
+function createMutex(name) {
+  const lock = new addon.Mutex();
+  lock.create(name || uniqueName('mutex'));
+  return lock;
+}
+
+// Holds a mutex in a child process until ms have passed
+async function holdElsewhere(name, ms) {
+  const child = fork(worker, ['hold', name, String(ms)]);
+  await new Promise(function (resolve) { child.once('message', resolve); });
+  return new Promise(function (resolve) { child.on('exit', resolve); });
+}
+
+function tryElsewhere(name) {
+  const child = fork(worker, ['try', name]);
+  return new Promise(function (resolve) { child.once('message', resolve); });
+}
+
+test('Mutex waits, releases and is recursive', function () {
+  const lock = createMutex();
+
+  assert.strictEqual(lock.wait(), addon.WAIT_OBJECT_0);
+  assert.strictEqual(lock.wait(0), addon.WAIT_OBJECT_0);
+  lock.release();
+  lock.release();
+  lock.close();
+});
+
+test('Mutex.waitMultiple waits for any or all of the list', function () {
+  const a = createMutex();
+  const b = createMutex();
+
+  assert.strictEqual(a.waitMultiple([a, b], false, 0), addon.WAIT_OBJECT_0);
+  assert.strictEqual(a.waitMultiple([a, b], true, 0), addon.WAIT_OBJECT_0);
+  a.release();
+  a.release();
+  b.release();
+
+  assert.throws(function () { a.waitMultiple([], false, 1000); }, RangeError);
+  assert.throws(function () { a.waitMultiple([], true, 0); }, RangeError);
+
+  a.close();
+  b.close();
+});
+
+test('Mutex.waitMultiple returns the index of the mutex it got', async function () {
+  const name = uniqueName('mutex_multi');
+  const a = createMutex(name);
+  const b = createMutex();
+
+  const held = holdElsewhere(name, 200);
+  await new Promise(function (resolve) { setTimeout(resolve, 50); });
+
+  assert.strictEqual(a.waitMultiple([a, b], false, 0), addon.WAIT_OBJECT_0 + 1);
+  b.release();
+  assert.strictEqual(a.waitMultiple([a, b], true, 0), addon.WAIT_TIMEOUT);
+  assert.strictEqual(a.waitMultiple([a, b], true, 5000), addon.WAIT_OBJECT_0);
+  a.release();
+  b.release();
+
+  await held;
+  a.close();
+  b.close();
+});
+
+test('waitAsync resolves straight away when the mutex is free', async function () {
+  const lock = createMutex();
+
+  assert.strictEqual(await lock.waitAsync(), addon.WAIT_OBJECT_0);
+  lock.release();
+  lock.close();
+});
+
+test('waitAsync does not block the event loop while it waits', async function () {
+  const name = uniqueName('mutex_async');
+  const lock = createMutex(name);
+  const held = holdElsewhere(name, 300);
+
+  await new Promise(function (resolve) { setTimeout(resolve, 50); });
+
+  let ticks = 0;
+  const timer = setInterval(function () { ticks++; }, 10);
+  const result = await lock.waitAsync(5000);
+  clearInterval(timer);
+
+  assert.strictEqual(result, addon.WAIT_OBJECT_0);
+  assert.ok(ticks >= 5, 'timers kept running, ticked ' + ticks + ' times');
+
+  // The calling process owns it now
+  assert.strictEqual(await tryElsewhere(name), addon.WAIT_TIMEOUT);
+  lock.release();
+  assert.strictEqual(await tryElsewhere(name), addon.WAIT_OBJECT_0);
+
+  await held;
+  lock.close();
+});
+
+test('waitAsync times out', async function () {
+  const name = uniqueName('mutex_timeout');
+  const lock = createMutex(name);
+  const held = holdElsewhere(name, 400);
+
+  await new Promise(function (resolve) { setTimeout(resolve, 50); });
+  assert.strictEqual(await lock.waitAsync(0), addon.WAIT_TIMEOUT);
+  assert.strictEqual(await lock.waitAsync(50), addon.WAIT_TIMEOUT);
+
+  await held;
+  lock.close();
+});
+
+test('waitAsync can be cancelled with an AbortSignal', async function () {
+  const name = uniqueName('mutex_abort');
+  const lock = createMutex(name);
+  const held = holdElsewhere(name, 400);
+  await new Promise(function (resolve) { setTimeout(resolve, 50); });
+
+  const controller = abortController();
+  const waiting = lock.waitAsync(addon.INFINITE, controller.signal);
+  setTimeout(function () { controller.abort(); }, 20);
+
+  await assert.rejects(waiting, function (err) {
+    return err.name === 'AbortError' && err.code === 'ABORT_ERR';
+  });
+
+  await assert.rejects(lock.waitAsync(addon.INFINITE, controller.signal), { name: 'AbortError' });
+
+  await held;
+  lock.close();
+});
+
+test('waitAsync reports WAIT_ABANDONED', async function () {
+  const name = uniqueName('mutex_abandon');
+  const lock = createMutex(name);
+
+  const child = fork(worker, ['abandon', name]);
+  await new Promise(function (resolve) { child.on('exit', resolve); });
+
+  assert.strictEqual(await lock.waitAsync(1000), addon.WAIT_ABANDONED);
+  lock.release();
+  lock.close();
+});
+
+if (process.platform === 'linux') {
+  test('closing a Mutex the thread holds abandons it', function () {
+    const name = uniqueName('mutex_close_held');
+    const lock = createMutex(name);
+    const other = new addon.Mutex();
+    other.open(name);
+
+    assert.strictEqual(lock.wait(), addon.WAIT_OBJECT_0);
+    assert.strictEqual(lock.wait(), addon.WAIT_OBJECT_0);
+    lock.close();
+
+    assert.strictEqual(other.wait(0), addon.WAIT_ABANDONED);
+    other.release();
+    assert.strictEqual(other.wait(0), addon.WAIT_OBJECT_0);
+    other.release();
+    other.close();
+  });
+}
+
+test('a Mutex name lasts until its last user closes it', async function () {
+  const name = uniqueName('mutex_name');
+  const creator = createMutex(name);
+  const opener = new addon.Mutex();
+  opener.open(name);
+  creator.close();
+
+  const reopened = new addon.Mutex();
+  reopened.open(name);
+  assert.strictEqual(reopened.wait(0), addon.WAIT_OBJECT_0);
+  const child = fork(worker, ['try', name]);
+  const result = new Promise(function (resolve) { child.once('message', resolve); });
+  const gone = exited(child);
+  assert.strictEqual(await result, addon.WAIT_TIMEOUT);
+  await gone;
+  reopened.release();
+
+  opener.close();
+  reopened.close();
+  assert.throws(function () { new addon.Mutex().open(name); });
+});
+
+test('closing a Mutex rejects async waits on it', async function () {
+  const name = uniqueName('mutex_close');
+  const lock = createMutex(name);
+  const held = holdElsewhere(name, 300);
+  await new Promise(function (resolve) { setTimeout(resolve, 50); });
+
+  const waiting = lock.waitAsync();
+  lock.close();
+  await assert.rejects(waiting, /closed/);
+
+  await held;
+});
+
+test('waitMultipleAsync waits for all of the list', async function () {
+  const name = uniqueName('mutex_all');
+  const a = createMutex(name);
+  const b = createMutex();
+  const held = holdElsewhere(name, 200);
+  await new Promise(function (resolve) { setTimeout(resolve, 50); });
+
+  const results = await Promise.all([
+    a.waitMultipleAsync([a, b], true, 5000),
+    new Promise(function (resolve) { setTimeout(resolve, 10, 'timer'); })
+  ]);
+  assert.deepStrictEqual(results, [addon.WAIT_OBJECT_0, 'timer']);
+  a.release();
+  b.release();
+
+  await held;
+  a.close();
+  b.close();
+});
+
+test('many concurrent async waits share the waiter pool', async function () {
+  const names = [0, 1, 2, 3, 4, 5, 6, 7].map(function () { return uniqueName('mutex_pool'); });
+  const locks = names.map(function (name) { return createMutex(name); });
+
+  // Wait until every child holds its mutex, so all the waits have to block
+  const children = names.map(function (name) { return fork(worker, ['hold', name, '300']); });
+  await Promise.all(children.map(function (child) {
+    return new Promise(function (resolve) { child.once('message', resolve); });
+  }));
+  const exited = Promise.all(children.map(function (child) {
+    return new Promise(function (resolve) { child.on('exit', resolve); });
+  }));
+
+  const results = await Promise.all(locks.map(function (lock) { return lock.waitAsync(5000); }));
+  results.forEach(function (result) { assert.strictEqual(result, addon.WAIT_OBJECT_0); });
+
+  locks.forEach(function (lock) { lock.release(); lock.close(); });
+  await exited;
+});
+
+if (process.platform === 'linux') {
+  test('async waits share a few pool threads however many there are', async function () {
+    const fs = require('fs');
+    const name = uniqueName('mutex_threads');
+    const locks = [createMutex(name)];
+
+    const child = fork(worker, ['hold', name, '500']);
+    await new Promise(function (resolve) { child.once('message', resolve); });
+    const gone = exited(child);
+
+    // Far more waits than the pool has threads, all stuck until they time out
+    const before = fs.readdirSync('/proc/self/task').length;
+    const waits = [];
+    for (let i = 0; i < 64; ++i) {
+      const lock = new addon.Mutex();
+      lock.open(name);
+      locks.push(lock);
+      waits.push(lock.waitAsync(200));
+    }
+
+    await new Promise(function (resolve) { setTimeout(resolve, 100); });
+    assert(fs.readdirSync('/proc/self/task').length - before <= 4);
+
+    const results = await Promise.all(waits);
+    results.forEach(function (result) { assert.strictEqual(result, addon.WAIT_TIMEOUT); });
+
+    locks.forEach(function (lock) { lock.close(); });
+    await gone;
+  });
+}
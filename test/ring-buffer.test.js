@@ -0,0 +1,136 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName, createInMapping } = require('./harness');
+const addon = require('..');
+
+const producer = path.join(__dirname, 'fixtures', 'ring-producer.js');
+
+test('RingBuffer pushes and pops records in order', function () {
+  const { map, object: ring } = createInMapping(addon.RingBuffer, addon.RingBuffer.HEADER_SIZE + 4096, [4096]);
+
+  assert.strictEqual(ring.capacity(), 4096);
+  assert.strictEqual(ring.pop(), null);
+
+  assert.strictEqual(ring.push(Buffer.from('one')), true);
+  assert.strictEqual(ring.push(Buffer.alloc(0)), true);
+  assert.strictEqual(ring.pushBatch([Buffer.from('three'), Buffer.from('four')]), 2);
+  assert.ok(ring.used() > 0);
+
+  assert.strictEqual(ring.pop().toString(), 'one');
+  assert.strictEqual(ring.pop().length, 0);
+  assert.deepStrictEqual(ring.popBatch().map(String), ['three', 'four']);
+  assert.strictEqual(ring.pop(), null);
+  assert.strictEqual(ring.used(), 0);
+
+  map.closeMapping();
+});
+
+test('RingBuffer reports when it is full and wraps around', function () {
+  const { map, object: ring } = createInMapping(addon.RingBuffer, addon.RingBuffer.HEADER_SIZE + 256, [256]);
+  const record = Buffer.alloc(50, 1);
+
+  // 56 bytes a record, so four fit
+  let pushed = 0;
+  while (ring.push(record))
+    pushed++;
+  assert.strictEqual(pushed, 4);
+
+  // Records never straddle the end, so this one goes back to the start
+  for (let i = 0; i < 20; ++i) {
+    ring.pop();
+    assert.strictEqual(ring.push(Buffer.alloc(50, i)), true);
+  }
+
+  const left = ring.popBatch();
+  assert.strictEqual(left.length, 4);
+  assert.deepStrictEqual(left.map(function (b) { return b[0]; }), [16, 17, 18, 19]);
+
+  assert.throws(function () { ring.push(Buffer.alloc(125)); }, RangeError);
+  assert.strictEqual(ring.push(Buffer.alloc(124)), true);
+
+  map.closeMapping();
+});
+
+test('RingBuffer.peek hands out records without copying them', function () {
+  const { map, object: ring } = createInMapping(addon.RingBuffer, addon.RingBuffer.HEADER_SIZE + 1024, [1024]);
+
+  ring.pushBatch([Buffer.from('a'), Buffer.from('bb'), Buffer.from('ccc')]);
+
+  const first = ring.peek();
+  assert.strictEqual(first.toString(), 'a');
+  assert.strictEqual(ring.peek().toString(), 'a');
+
+  const views = ring.peekBatch(2);
+  assert.deepStrictEqual(views.map(String), ['a', 'bb']);
+  assert.strictEqual(ring.consume(2), 2);
+  assert.strictEqual(ring.peek().toString(), 'ccc');
+  assert.strictEqual(ring.consume(5), 1);
+  assert.strictEqual(ring.peek(), null);
+
+  // Views point into the mapping, so they go away with it
+  map.closeMapping();
+  assert.strictEqual(first.length, 0);
+  assert.throws(function () { ring.pop(); }, /closed/);
+});
+
+test('RingBuffer.open finds an existing ring', function () {
+  const { name, map, object: ring } = createInMapping(addon.RingBuffer, addon.RingBuffer.HEADER_SIZE + 512, [512]);
+  const other = new addon.FileMapping();
+  const reader = new addon.RingBuffer();
+
+  other.openMapping(name, 0);
+  assert.throws(function () { reader.open(other, 64); }, /No RingBuffer/);
+  reader.open(other, 0);
+  assert.strictEqual(reader.capacity(), 512);
+
+  ring.push(Buffer.from('across mappings'));
+  assert.strictEqual(reader.pop().toString(), 'across mappings');
+
+  other.closeMapping();
+  map.closeMapping();
+});
+
+test('RingBuffer checks its arguments', function () {
+  const map = new addon.FileMapping();
+  const ring = new addon.RingBuffer();
+  map.createMapping(null, uniqueName('ring_args'), 4096);
+
+  assert.throws(function () { ring.create(map, 0); }, /Not enough arguments/);
+  assert.throws(function () { ring.create(map, 0, 100); }, RangeError);
+  assert.throws(function () { ring.create(map, 32, 1024); }, /Misaligned/);
+  assert.throws(function () { ring.create(map, 0, 8192); }, /too small/);
+  assert.throws(function () { ring.pop(); }, /Not attached/);
+
+  ring.create(map, 64, 1024);
+  assert.throws(function () { ring.push('text'); }, /Wrong type/);
+  assert.throws(function () { ring.pushBatch([Buffer.alloc(1), 'text']); }, /Wrong type/);
+  assert.strictEqual(ring.pop(), null);
+
+  map.closeMapping();
+});
+
+test('RingBuffer streams messages from another process', async function () {
+  const { name, map, object: ring } = createInMapping(addon.RingBuffer, addon.RingBuffer.HEADER_SIZE + 4096, [4096]);
+  const n = 20000;
+
+  const child = fork(producer, [name, String(n)]);
+  const exited = new Promise(function (resolve) { child.on('exit', resolve); });
+
+  let expected = 0;
+  while (expected < n) {
+    const batch = ring.popBatch(256);
+    if (batch.length === 0) {
+      await new Promise(function (resolve) { setImmediate(resolve); });
+      continue;
+    }
+
+    batch.forEach(function (message) {
+      assert.strictEqual(message.toString(), 'message ' + expected);
+      expected++;
+    });
+  }
+
+  assert.strictEqual(await exited, 0);
+  map.closeMapping();
+});
@@ -0,0 +1,17 @@
+const fs = require('fs');
+const path = require('path');
+const harness = require('./harness');
+
+const filter = process.argv[2];
+
+fs.readdirSync(__dirname)
+  .filter(function (file) { return file.endsWith('.test.js'); })
+  .filter(function (file) { return !filter || file.indexOf(filter) >= 0; })
+  .sort()
+  .forEach(function (file) {
+    require(path.join(__dirname, file));
+  });
+
+harness.run().then(function (failed) {
+  process.exit(failed ? 1 : 0);
+});
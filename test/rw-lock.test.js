@@ -0,0 +1,167 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName, createInMapping, exited } = require('./harness');
+const addon = require('..');
+
+const worker = path.join(__dirname, 'fixtures', 'rw-lock-worker.js');
+
+// Starts a worker and resolves with it once it has the lock. With ms it lets
+// go by itself after that long.
+async function holding(mode, name, ms) {
+  const child = fork(worker, ms === undefined ? [mode, name] : [mode, name, String(ms)]);
+  child.result = await new Promise(function (resolve) { child.once('message', resolve); });
+  return child;
+}
+
+test('RwLock is a header and a cache line per reader slot', function () {
+  assert.strictEqual(addon.RwLock.size(), 64 + 64 * 64);
+  assert.strictEqual(addon.RwLock.size(4), 64 + 4 * 64);
+});
+
+test('RwLock shares reads and excludes writes', function () {
+  const { map, object: lock } = createInMapping(addon.RwLock, 65536);
+
+  assert.strictEqual(lock.waitRead(), addon.WAIT_OBJECT_0);
+  assert.strictEqual(lock.waitRead(0), addon.WAIT_OBJECT_0);
+  assert.strictEqual(lock.waitWrite(0), addon.WAIT_TIMEOUT);
+  lock.releaseRead();
+  lock.releaseRead();
+  assert.throws(function () { lock.releaseRead(); }, /doesn't hold a read lock/);
+
+  assert.strictEqual(lock.waitWrite(), addon.WAIT_OBJECT_0);
+  assert.strictEqual(lock.waitRead(0), addon.WAIT_TIMEOUT);
+  assert.throws(function () { lock.waitWrite(); }, /holds the write lock/);
+  lock.releaseWrite();
+  assert.throws(function () { lock.releaseWrite(); }, /doesn't hold the write lock/);
+
+  map.closeMapping();
+});
+
+test('RwLock readers in other processes share the lock', async function () {
+  const name = uniqueName('rw');
+  const { map, object: lock } = createInMapping(addon.RwLock, 65536, [], { name: name });
+
+  const a = await holding('read', name);
+  const b = await holding('read', name);
+  assert.strictEqual(a.result, addon.WAIT_OBJECT_0);
+  assert.strictEqual(b.result, addon.WAIT_OBJECT_0);
+
+  assert.strictEqual(lock.waitRead(0), addon.WAIT_OBJECT_0);
+  lock.releaseRead();
+  assert.strictEqual(lock.waitWrite(50), addon.WAIT_TIMEOUT);
+
+  a.send('release');
+  b.send('release');
+  await Promise.all([exited(a), exited(b)]);
+
+  assert.strictEqual(lock.waitWrite(1000), addon.WAIT_OBJECT_0);
+  lock.releaseWrite();
+  map.closeMapping();
+});
+
+test('RwLock turns new readers away while a writer waits', async function () {
+  const name = uniqueName('rw');
+  const { map, object: lock } = createInMapping(addon.RwLock, 65536, [], { name: name });
+
+  assert.strictEqual(lock.waitRead(), addon.WAIT_OBJECT_0);
+
+  // The writer queues up behind our read lock...
+  const writer = fork(worker, ['write', name]);
+  const granted = new Promise(function (resolve) { writer.once('message', resolve); });
+  await new Promise(function (resolve) { setTimeout(resolve, 200); });
+
+  // ...and a new reader has to wait for it, even though we only read
+  const reader = fork(worker, ['read', name]);
+  let readerGot = false;
+  const readerGranted = new Promise(function (resolve) { reader.once('message', resolve); }).then(function (result) {
+    readerGot = true;
+    return result;
+  });
+  await new Promise(function (resolve) { setTimeout(resolve, 200); });
+  assert.strictEqual(readerGot, false);
+
+  lock.releaseRead();
+  assert.strictEqual(await granted, addon.WAIT_OBJECT_0);
+  assert.strictEqual(readerGot, false);
+
+  writer.send('release');
+  assert.strictEqual(await readerGranted, addon.WAIT_OBJECT_0);
+  reader.send('release');
+  await Promise.all([exited(writer), exited(reader)]);
+
+  map.closeMapping();
+});
+
+test('RwLock reports WAIT_ABANDONED when a writer dies holding it', async function () {
+  const name = uniqueName('rw');
+  const { map, object: lock } = createInMapping(addon.RwLock, 65536, [], { name: name });
+
+  await exited(fork(worker, ['abandon-write', name]));
+
+  assert.strictEqual(lock.waitRead(5000), addon.WAIT_ABANDONED);
+  lock.releaseRead();
+  assert.strictEqual(lock.waitWrite(0), addon.WAIT_OBJECT_0);
+  lock.releaseWrite();
+
+  map.closeMapping();
+});
+
+test('RwLock drops the read locks of a reader that died', async function () {
+  const name = uniqueName('rw');
+  const { map, object: lock } = createInMapping(addon.RwLock, 65536, [], { name: name });
+
+  await exited(fork(worker, ['abandon-read', name]));
+
+  assert.strictEqual(lock.waitWrite(5000), addon.WAIT_OBJECT_0);
+  lock.releaseWrite();
+
+  map.closeMapping();
+});
+
+test('RwLock waits take Infinity and timeouts past 2 ** 32 ms at their word', async function () {
+  const name = uniqueName('rw');
+  const { map, object: lock } = createInMapping(addon.RwLock, 65536, [], { name: name });
+
+  let child = await holding('read', name, 100);
+  assert.strictEqual(lock.waitWrite(Infinity), addon.WAIT_OBJECT_0);
+  lock.releaseWrite();
+  await exited(child);
+
+  child = await holding('write', name, 100);
+  assert.strictEqual(lock.waitRead(2 ** 32 + 50), addon.WAIT_OBJECT_0);
+  lock.releaseRead();
+  await exited(child);
+
+  map.closeMapping();
+});
+
+test('RwLock checks its arguments', function () {
+  const { map, object: lock } = createInMapping(addon.RwLock, 65536);
+
+  assert.throws(function () { lock.waitRead('1'); }, TypeError);
+  assert.throws(function () { lock.waitWrite({}); }, TypeError);
+  assert.throws(function () { addon.RwLock.size(0); }, TypeError);
+  assert.throws(function () { new addon.RwLock().create(map, 0, 5000); }, TypeError);
+  assert.throws(function () { new addon.RwLock().open(map, 8192); }, /No RwLock/);
+  assert.throws(function () { new addon.RwLock().create(map, 8); }, RangeError);
+
+  map.closeMapping();
+  assert.throws(function () { lock.waitRead(); }, /closed/);
+});
+
+test('RwLock keeps writers in several processes apart', async function () {
+  const name = uniqueName('rw');
+  const { map, object: lock } = createInMapping(addon.RwLock, 65536, [], { name: name });
+  const counter = map.view(addon.RwLock.size(), 8);
+
+  const children = [];
+  for (let i = 0; i < 4; ++i)
+    children.push(fork(worker, ['count', name, '500']));
+
+  const codes = await Promise.all(children.map(exited));
+  assert.deepStrictEqual(codes, [0, 0, 0, 0]);
+  assert.strictEqual(counter.readInt32LE(0), 2000);
+
+  map.closeMapping();
+});
@@ -0,0 +1,129 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName, createInMapping } = require('./harness');
+const addon = require('..');
+
+const writer = path.join(__dirname, 'fixtures', 'seq-lock-writer.js');
+
+test('SeqLock publishes and snapshots a value', function () {
+  const { map, object: seq } = createInMapping(addon.SeqLock, addon.SeqLock.HEADER_SIZE + 16, [16]);
+  const into = Buffer.alloc(16);
+
+  assert.strictEqual(seq.size(), 16);
+  assert.strictEqual(seq.sequence(), 0);
+  assert.strictEqual(seq.snapshot(into), 0);
+  assert.ok(into.equals(Buffer.alloc(16)));
+
+  assert.strictEqual(seq.publish(Buffer.from('0123456789abcdef')), 2);
+  assert.strictEqual(seq.publish(Buffer.from('XY'), 4), 4);
+  assert.strictEqual(seq.sequence(), 4);
+
+  assert.strictEqual(seq.snapshot(into), 4);
+  assert.strictEqual(into.toString(), '0123XY6789abcdef');
+
+  // A short buffer gets the start of the region, a long one only the region
+  const short = Buffer.alloc(4);
+  seq.snapshot(short);
+  assert.strictEqual(short.toString(), '0123');
+
+  const long = Buffer.alloc(20, '-');
+  seq.snapshot(long);
+  assert.strictEqual(long.toString(), '0123XY6789abcdef----');
+
+  map.closeMapping();
+});
+
+test('SeqLock.open finds an existing region', function () {
+  const { name, map, object: seq } = createInMapping(addon.SeqLock, addon.SeqLock.HEADER_SIZE + 64, [64]);
+  const other = new addon.FileMapping();
+  const reader = new addon.SeqLock();
+
+  other.openMapping(name, 0);
+  assert.throws(function () { reader.open(other, 64); }, /No SeqLock|too small/);
+  reader.open(other, 0);
+  assert.strictEqual(reader.size(), 64);
+
+  seq.publish(Buffer.from('shared'));
+  const into = Buffer.alloc(6);
+  assert.strictEqual(reader.snapshot(into), 2);
+  assert.strictEqual(into.toString(), 'shared');
+
+  other.closeMapping();
+  map.closeMapping();
+});
+
+test('SeqLock.snapshot gives up on a writer that died mid publish', function () {
+  const { map, object: seq } = createInMapping(addon.SeqLock, addon.SeqLock.HEADER_SIZE + 16, [16]);
+  seq.publish(Buffer.from('before'));
+
+  // Leave the sequence odd, like a writer killed halfway through
+  map.writeBuffer(Buffer.from([3]), 0, 0, 1);
+  const into = Buffer.alloc(6);
+  assert.strictEqual(seq.snapshot(into, 0), null);
+
+  const start = Date.now();
+  assert.strictEqual(seq.snapshot(into, 50), null);
+  assert.ok(Date.now() - start >= 45);
+
+  assert.strictEqual(seq.publish(Buffer.from('after!')), 4);
+  assert.strictEqual(seq.snapshot(into, 0), 4);
+  assert.strictEqual(into.toString(), 'after!');
+
+  assert.throws(function () { seq.snapshot(into, 'soon'); }, /Wrong type/);
+  map.closeMapping();
+});
+
+test('SeqLock checks its arguments', function () {
+  const map = new addon.FileMapping();
+  const seq = new addon.SeqLock();
+  map.createMapping(null, uniqueName('seq_args'), 4096);
+
+  assert.throws(function () { seq.create(map, 0); }, /Not enough arguments/);
+  assert.throws(function () { seq.create(map, 0, -1); }, /Wrong type/);
+  assert.throws(function () { seq.create(map, 8, 64); }, /Misaligned/);
+  assert.throws(function () { seq.create(map, 0, 4096); }, /too small/);
+  assert.throws(function () { seq.snapshot(Buffer.alloc(1)); }, /Not attached/);
+
+  seq.create(map, 0, 64);
+  assert.throws(function () { seq.publish('text'); }, /Wrong type/);
+  assert.throws(function () { seq.publish(Buffer.alloc(65)); }, RangeError);
+  assert.throws(function () { seq.publish(Buffer.alloc(8), 60); }, RangeError);
+  assert.throws(function () { seq.snapshot(); }, /Not enough arguments/);
+
+  map.closeMapping();
+  assert.throws(function () { seq.sequence(); }, /closed/);
+});
+
+test('SeqLock snapshots are never torn by a writer in another process', async function () {
+  const { name, map, object: seq } = createInMapping(addon.SeqLock, addon.SeqLock.HEADER_SIZE + 4096, [4096]);
+  const child = fork(writer, [name, '500']);
+  const exited = new Promise(function (resolve) { child.on('exit', resolve); });
+  await new Promise(function (resolve) { child.once('message', resolve); });
+
+  const into = Buffer.alloc(4096);
+  let reads = 0;
+  let last = 0;
+  let running = true;
+  exited.then(function () { running = false; });
+
+  while (running) {
+    for (let n = 0; n < 1000; ++n) {
+      const sequence = seq.snapshot(into);
+      assert.strictEqual(sequence % 2, 0);
+      assert.ok(sequence >= last);
+      last = sequence;
+
+      const first = into.readUInt32LE(0);
+      for (let i = 4; i < into.length; i += 4)
+        assert.strictEqual(into.readUInt32LE(i), first);
+      reads++;
+    }
+    await new Promise(function (resolve) { setImmediate(resolve); });
+  }
+
+  assert.strictEqual(await exited, 0);
+  assert.ok(reads > 0);
+  assert.ok(last > 0);
+  map.closeMapping();
+});
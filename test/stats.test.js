@@ -0,0 +1,130 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName } = require('./harness');
+const addon = require('..');
+
+const publisher = path.join(__dirname, 'fixtures', 'stats-publisher.js');
+const worker = path.join(__dirname, 'fixtures', 'mutex-worker.js');
+
+test('FileMapping.stats counts calls and bytes', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('stats'), 4096);
+
+  const data = Buffer.alloc(100, 1);
+  map.writeBuffer(data, 0, 0, 100);
+  map.writev([{ buffer: data, destOffset: 100 }, { buffer: data, destOffset: 200, length: 50 }]);
+  map.readInto(0, 64, Buffer.alloc(64));
+  map.view(0, 16);
+
+  assert.deepStrictEqual(map.stats(), {
+    readCalls: 1,
+    writeCalls: 2,
+    bytesRead: 64,
+    bytesWritten: 250,
+    flushCalls: 0,
+    viewCalls: 1
+  });
+
+  // Still readable once closed, and cleared by the next open
+  const name = uniqueName('stats');
+  map.closeMapping();
+  assert.strictEqual(map.stats().bytesWritten, 250);
+  map.createMapping(null, name, 4096);
+  assert.strictEqual(map.stats().bytesWritten, 0);
+  map.closeMapping();
+});
+
+test('Mutex.stats counts acquisitions, timeouts and releases', function () {
+  const lock = new addon.Mutex();
+  lock.create(uniqueName('stats'));
+
+  lock.wait();
+  lock.wait(0);
+  lock.release();
+  lock.release();
+  lock.release(); // Not held any more, so not counted
+
+  const stats = lock.stats();
+  assert.strictEqual(stats.acquisitions, 2);
+  assert.strictEqual(stats.releases, 2);
+  assert.strictEqual(stats.contended, 0);
+  assert.strictEqual(stats.timeouts, 0);
+  assert.strictEqual(stats.waitHistogram.length, 24);
+
+  lock.close();
+  assert.throws(function () { lock.stats(); }, Error);
+});
+
+test('Mutex.stats times contended waits', async function () {
+  const name = uniqueName('stats');
+  const lock = new addon.Mutex();
+  lock.create(name);
+
+  const child = fork(worker, ['hold', name, '200']);
+  await new Promise(function (resolve) { child.once('message', resolve); });
+
+  assert.strictEqual(lock.wait(0), addon.WAIT_TIMEOUT);
+  assert.strictEqual(lock.wait(), addon.WAIT_OBJECT_0);
+  lock.release();
+  await new Promise(function (resolve) { child.on('exit', resolve); });
+
+  const stats = lock.stats();
+  assert.strictEqual(stats.timeouts, 1);
+  assert.strictEqual(stats.acquisitions, 1);
+  assert.strictEqual(stats.contended, 1);
+  assert.ok(stats.waitNs >= 50e6, 'waited ' + stats.waitNs + 'ns');
+  assert.strictEqual(stats.waitHistogram.reduce(function (a, b) { return a + b; }), 1);
+
+  // Somewhere in [65 ms, 1 s)
+  const bucket = stats.waitHistogram.findIndex(function (n) { return n === 1; });
+  assert.ok(bucket >= 17 && bucket <= 20, 'bucket ' + bucket);
+
+  lock.close();
+});
+
+test('Mutex.stats counts async waits', async function () {
+  const lock = new addon.Mutex();
+  lock.create(uniqueName('stats'));
+
+  assert.strictEqual(await lock.waitAsync(), addon.WAIT_OBJECT_0);
+  lock.release();
+
+  const stats = lock.stats();
+  assert.strictEqual(stats.acquisitions, 1);
+  assert.strictEqual(stats.contended, 0);
+
+  lock.close();
+});
+
+test('readStats reads another process\'s published stats', async function () {
+  const mapName = uniqueName('stats');
+  const mutexName = uniqueName('stats');
+
+  const child = fork(publisher, [mapName, mutexName]);
+  const segment = await new Promise(function (resolve) { child.once('message', resolve); });
+  assert.strictEqual(segment, 'node_filemap_stats_' + child.pid);
+
+  const stats = addon.readStats(segment);
+  assert.strictEqual(stats.pid, child.pid);
+
+  const map = stats.objects.find(function (o) { return o.name === mapName; });
+  assert.strictEqual(map.kind, 'mapping');
+  assert.strictEqual(map.writeCalls, 1);
+  assert.strictEqual(map.bytesWritten, 100);
+
+  const lock = stats.objects.find(function (o) { return o.name === mutexName; });
+  assert.strictEqual(lock.kind, 'mutex');
+  assert.strictEqual(lock.acquisitions, 1);
+  assert.strictEqual(lock.releases, 1);
+
+  child.send('exit');
+  await new Promise(function (resolve) { child.on('exit', resolve); });
+});
+
+test('publishStats and readStats check their arguments', function () {
+  assert.throws(function () { addon.publishStats(1); }, TypeError);
+  assert.throws(function () { addon.readStats(); }, TypeError);
+  assert.throws(function () { addon.readStats(1); }, TypeError);
+  assert.throws(function () { addon.readStats(uniqueName('stats')); }, Error);
+});
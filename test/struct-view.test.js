@@ -0,0 +1,212 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName } = require('./harness');
+const { PARTICLE } = require('./fixtures/struct-view-schema');
+const addon = require('..');
+
+const writer = path.join(__dirname, 'fixtures', 'struct-view-writer.js');
+
+test('StructView lays records out like a C struct', function () {
+  // id at 0, x at 8, y at 16, flags at 20..24, padded to 24
+  assert.strictEqual(addon.StructView.size(PARTICLE), 24);
+  assert.strictEqual(addon.StructView.size(PARTICLE, 10), 240);
+  assert.strictEqual(addon.StructView.size(PARTICLE, 10, { align: 64 }), 640);
+
+  // One 64 byte aligned column per field
+  assert.strictEqual(addon.StructView.size(PARTICLE, 10, { layout: 'soa' }), 256 + 40);
+  assert.strictEqual(addon.StructView.size(PARTICLE, 10, { layout: 'soa', align: 8 }), 40 + 80 + 40 + 40);
+
+  const map = new addon.FileMapping();
+  const view = new addon.StructView();
+  map.createMapping(null, uniqueName('struct_layout'), 4096);
+
+  view.open(map, 64, PARTICLE, 10);
+  assert.strictEqual(view.count(), 10);
+  assert.strictEqual(view.size(), 240);
+  assert.strictEqual(view.offsetOf('id'), 64);
+  assert.strictEqual(view.offsetOf('x', 1), 64 + 24 + 8);
+  assert.strictEqual(view.offsetOf('flags', 2), 64 + 48 + 20);
+
+  view.open(map, 64, PARTICLE, 10, { layout: 'soa' });
+  assert.strictEqual(view.offsetOf('id', 3), 64 + 12);
+  assert.strictEqual(view.offsetOf('x', 1), 64 + 64 + 8);
+  assert.strictEqual(view.offsetOf('y', 0), 64 + 192);
+  assert.strictEqual(view.offsetOf('flags', 2), 64 + 256 + 8);
+
+  view.close();
+  map.closeMapping();
+});
+
+test('StructView records read and write the mapping in place', function () {
+  const map = new addon.FileMapping();
+  const view = new addon.StructView();
+  map.createMapping(null, uniqueName('struct_rw'), 4096);
+  view.open(map, 0, PARTICLE, 4);
+
+  const p = view.at(1);
+  p.id = 7;
+  p.x = Math.PI;
+  p.y = 0.1;
+  p.flags = [1, 2, 3, 300];
+
+  assert.strictEqual(p.id, 7);
+  assert.strictEqual(p.x, Math.PI);
+  assert.strictEqual(p.y, Math.fround(0.1));
+  assert.deepStrictEqual(Array.from(p.flags), [1, 2, 3, 44]);
+
+  // Straight in the mapping, where the other accessors see it
+  assert.strictEqual(map.readUint32(view.offsetOf('id', 1)), 7);
+  assert.strictEqual(map.readFloat64(view.offsetOf('x', 1)), Math.PI);
+  map.writeUint32(view.offsetOf('id', 1), 8);
+  assert.strictEqual(view.at(1).id, 8);
+
+  // Integers wrap like a DataView
+  p.id = -1;
+  assert.strictEqual(p.id, 0xFFFFFFFF);
+
+  // Fixed arrays come back as typed arrays over the mapping
+  const flags = p.flags;
+  assert.ok(flags instanceof Uint8Array);
+  flags[0] = 9;
+  assert.strictEqual(view.at(1).flags[0], 9);
+  p.flags = new Uint8Array([4, 3, 2, 1]);
+  assert.deepStrictEqual(Array.from(flags), [4, 3, 2, 1]);
+
+  // Neighbours are untouched
+  assert.strictEqual(view.at(0).id, 0);
+  assert.strictEqual(view.at(2).x, 0);
+
+  // A record is a cursor: move it by setting index
+  assert.strictEqual(p.index, 1);
+  p.index = 3;
+  p.id = 33;
+  assert.strictEqual(view.at(3).id, 33);
+  p.index = 4;
+  assert.strictEqual(p.id, undefined);
+
+  // Closing the mapping takes the memory away from records and arrays
+  map.closeMapping();
+  assert.strictEqual(flags.length, 0);
+  p.index = 0;
+  assert.strictEqual(p.id, undefined);
+});
+
+test('StructView soa columns are typed arrays over every record', function () {
+  const map = new addon.FileMapping();
+  const view = new addon.StructView();
+  map.createMapping(null, uniqueName('struct_soa'), 4096);
+  view.open(map, 0, PARTICLE, 8, { layout: 'soa' });
+
+  for (let i = 0; i < 8; ++i) {
+    view.at(i).x = i * 2;
+    view.at(i).flags = [i, i, i, i];
+  }
+
+  const xs = view.column('x');
+  assert.ok(xs instanceof Float64Array);
+  assert.deepStrictEqual(Array.from(xs), [0, 2, 4, 6, 8, 10, 12, 14]);
+
+  xs[3] = 99;
+  assert.strictEqual(view.at(3).x, 99);
+
+  const flags = view.column('flags');
+  assert.strictEqual(flags.length, 32);
+  assert.deepStrictEqual(Array.from(flags.subarray(8, 12)), [2, 2, 2, 2]);
+
+  assert.throws(function () { view.column('nope'); }, RangeError);
+  view.open(map, 0, PARTICLE, 8);
+  assert.throws(function () { view.column('x'); }, /soa/);
+
+  map.closeMapping();
+});
+
+test('StructView records stop working when the view is closed or reopened', function () {
+  const map = new addon.FileMapping();
+  const view = new addon.StructView();
+  map.createMapping(null, uniqueName('struct_stale'), 4096);
+
+  view.open(map, 0, PARTICLE, 2);
+  const p = view.at(0);
+  p.id = 5;
+
+  view.open(map, 0, { id: 'uint32' }, 2);
+  assert.strictEqual(p.id, undefined);
+  assert.strictEqual(p.x, undefined);
+  assert.strictEqual(view.at(0).id, 5);
+  assert.strictEqual(view.at(0).x, undefined);
+
+  const q = view.at(1);
+  const ids = view.at(0);
+  view.close();
+  q.id = 1;
+  assert.strictEqual(q.id, undefined);
+  assert.strictEqual(ids.id, undefined);
+  assert.throws(function () { view.at(0); }, /Not attached/);
+  assert.throws(function () { view.count(); }, /Not attached/);
+
+  map.closeMapping();
+});
+
+test('StructView checks its arguments', function () {
+  const map = new addon.FileMapping();
+  const view = new addon.StructView();
+  map.createMapping(null, uniqueName('struct_args'), 256);
+
+  assert.throws(function () { addon.StructView.size(); }, /Not enough arguments/);
+  assert.throws(function () { addon.StructView.size({}); }, /no fields/);
+  assert.throws(function () { addon.StructView.size({ a: 'int64' }); }, /field 'a'/);
+  assert.throws(function () { addon.StructView.size({ a: { type: 'uint8', length: 0 } }); }, /field 'a'/);
+  assert.throws(function () { addon.StructView.size({ a: { type: 'uint8', align: 3 } }); }, /field 'a'/);
+  assert.throws(function () { addon.StructView.size({ a: 'uint8' }, 0); }, TypeError);
+  assert.throws(function () { addon.StructView.size({ a: 'uint8' }, 1, { layout: 'columns' }); }, /aos' or 'soa/);
+  assert.throws(function () { addon.StructView.size({ a: 'uint8' }, 1, { align: 48 }); }, /power of two/);
+  assert.throws(function () { addon.StructView.size({ index: 'uint8' }); }, /reserved/);
+
+  assert.throws(function () { view.open(map, 0); }, /Not enough arguments/);
+  assert.throws(function () { view.open(map, 4, PARTICLE); }, /Misaligned/);
+  assert.throws(function () { view.open(map, 0, PARTICLE, 11); }, /too small/);
+
+  view.open(map, 0, PARTICLE, 10);
+  assert.throws(function () { view.at(10); }, RangeError);
+  assert.throws(function () { view.at(-1); }, TypeError);
+  assert.throws(function () { view.at(1.5); }, TypeError);
+  assert.throws(function () { view.offsetOf('z'); }, RangeError);
+
+  // Values convert the way they would storing into a typed array
+  const p = view.at(0);
+  p.id = '12';
+  assert.strictEqual(p.id, 12);
+  p.y = 'x';
+  assert.ok(Number.isNaN(p.y));
+
+  assert.throws(function () { p.flags = [1, 2, 3]; }, /Wrong length/);
+  assert.throws(function () { p.flags = 1; }, /Wrong length/);
+  assert.throws(function () { p.flags = null; }, /Wrong length/);
+
+  map.closeMapping();
+});
+
+['aos', 'soa'].forEach(function (layout) {
+  test('StructView shares records with another process (' + layout + ')', async function () {
+    const name = uniqueName('struct_share');
+    const map = new addon.FileMapping();
+    const view = new addon.StructView();
+    map.createMapping(null, name, 64 + addon.StructView.size(PARTICLE, 100, { layout: layout }));
+    view.open(map, 64, PARTICLE, 100, { layout: layout });
+
+    const child = fork(writer, [name, layout]);
+    const code = await new Promise(function (resolve) { child.on('exit', resolve); });
+    assert.strictEqual(code, 0);
+
+    for (let i = 0; i < 100; ++i) {
+      const p = view.at(i);
+      assert.strictEqual(p.id, i);
+      assert.strictEqual(p.x, i * 0.5);
+      assert.strictEqual(p.y, -i);
+      assert.deepStrictEqual(Array.from(p.flags), [i & 0xFF, 1, 2, 3]);
+    }
+
+    map.closeMapping();
+  });
+});
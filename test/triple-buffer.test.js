@@ -0,0 +1,110 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName, createInMapping } = require('./harness');
+const addon = require('..');
+
+const writer = path.join(__dirname, 'fixtures', 'triple-buffer-writer.js');
+
+test('TripleBuffer hands the reader the newest published frame', function () {
+  const { map, object: triple } = createInMapping(addon.TripleBuffer, [16], [16]);
+
+  assert.strictEqual(triple.acquireLatest(), null);
+  assert.strictEqual(triple.sequence(), 0);
+
+  const frame = triple.acquireWrite();
+  assert.strictEqual(frame.length, 16);
+  frame.write('first');
+  assert.strictEqual(triple.publish(5), 1);
+
+  let latest = triple.acquireLatest();
+  assert.strictEqual(latest.toString(), 'first');
+  assert.strictEqual(triple.sequence(), 1);
+
+  // The writer never waits: two more frames and the reader skips to the last
+  assert.strictEqual(triple.publish(Buffer.from('second')), 2);
+  assert.strictEqual(triple.publish(Buffer.from('third')), 3);
+  assert.strictEqual(latest.toString(), 'first');
+
+  latest = triple.acquireLatest();
+  assert.strictEqual(latest.toString(), 'third');
+  assert.strictEqual(triple.sequence(), 3);
+
+  // Nothing new, so the reader keeps the frame it has
+  assert.strictEqual(triple.acquireLatest().toString(), 'third');
+  assert.strictEqual(triple.sequence(), 3);
+
+  map.closeMapping();
+});
+
+test('TripleBuffer.open finds an existing triple buffer', function () {
+  const { name, map, object: triple } = createInMapping(addon.TripleBuffer, [100], [100]);
+  const other = new addon.FileMapping();
+  const reader = new addon.TripleBuffer();
+
+  other.openMapping(name, 0);
+  assert.throws(function () { reader.open(other, 64); }, /No TripleBuffer|too small/);
+  reader.open(other, 0);
+
+  triple.publish(Buffer.from('across mappings'));
+  assert.strictEqual(reader.acquireLatest().toString(), 'across mappings');
+
+  other.closeMapping();
+  map.closeMapping();
+});
+
+test('TripleBuffer checks its arguments', function () {
+  const map = new addon.FileMapping();
+  const triple = new addon.TripleBuffer();
+  map.createMapping(null, uniqueName('triple_args'), 4096);
+
+  assert.throws(function () { addon.TripleBuffer.size(); }, /Not enough arguments/);
+  assert.throws(function () { addon.TripleBuffer.size(0); }, RangeError);
+  assert.throws(function () { triple.create(map, 0); }, /Not enough arguments/);
+  assert.throws(function () { triple.create(map, 0, 'big'); }, /Wrong type/);
+  assert.throws(function () { triple.create(map, 0, 4096); }, /too small/);
+  assert.throws(function () { triple.acquireWrite(); }, /Not attached/);
+
+  triple.create(map, 0, 64);
+  assert.throws(function () { triple.publish('frame'); }, /Wrong type/);
+  assert.throws(function () { triple.publish(65); }, RangeError);
+  assert.throws(function () { triple.publish(Buffer.alloc(65)); }, RangeError);
+
+  map.closeMapping();
+  assert.throws(function () { triple.acquireLatest(); }, /closed/);
+});
+
+test('TripleBuffer frames are never torn by a writer in another process', async function () {
+  const { name, map, object: triple } = createInMapping(addon.TripleBuffer, [4096], [4096]);
+  const child = fork(writer, [name, '20000']);
+  const exited = new Promise(function (resolve) { child.on('exit', resolve); });
+  await new Promise(function (resolve) { child.once('message', resolve); });
+
+  let reads = 0;
+  let last = 0;
+  let running = true;
+  exited.then(function () { running = false; });
+
+  while (running) {
+    for (let n = 0; n < 100; ++n) {
+      const frame = triple.acquireLatest();
+      if (frame === null)
+        continue;
+
+      const sequence = triple.sequence();
+      assert.ok(sequence >= last);
+      last = sequence;
+
+      for (let i = 0; i < frame.length; i += 4)
+        assert.strictEqual(frame.readUInt32LE(i), sequence);
+      reads++;
+    }
+    await new Promise(function (resolve) { setImmediate(resolve); });
+  }
+
+  assert.strictEqual(await exited, 0);
+  assert.strictEqual(triple.acquireLatest().readUInt32LE(0), 20000);
+  assert.strictEqual(triple.sequence(), 20000);
+  assert.ok(reads > 0);
+  map.closeMapping();
+});
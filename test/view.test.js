@@ -0,0 +1,67 @@
+const assert = require('assert');
+const { test, uniqueName } = require('./harness');
+const addon = require('..');
+
+test('view aliases the mapping without copying', function () {
+  const name = uniqueName('view');
+  const map = new addon.FileMapping();
+  const other = new addon.FileMapping();
+  map.createMapping(null, name, 4096);
+  other.openMapping(name, 4096);
+
+  const view = map.view(128, 16);
+  assert.ok(Buffer.isBuffer(view));
+  assert.strictEqual(view.length, 16);
+
+  view.write('in place');
+
+  const dst = Buffer.alloc(8);
+  other.readInto(128, 8, dst);
+  assert.strictEqual(dst.toString(), 'in place');
+
+  other.writeBuffer(Buffer.from([0xAB]), 143, 0, 1);
+  assert.strictEqual(view[15], 0xAB);
+
+  other.closeMapping();
+  map.closeMapping();
+});
+
+test('closeMapping detaches outstanding views', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('detach'), 4096);
+
+  const view = map.view(0, 4096);
+  const slice = view.subarray(10, 20);
+  const u32 = new Uint32Array(view.buffer, view.byteOffset, 16);
+
+  map.closeMapping();
+
+  assert.strictEqual(view.length, 0);
+  assert.strictEqual(slice.length, 0);
+  assert.strictEqual(u32.length, 0);
+  assert.strictEqual(view[0], undefined);
+});
+
+test('reopening detaches views of the previous mapping', function () {
+  const map = new addon.FileMapping();
+  map.createMapping(null, uniqueName('reopen'), 64);
+  const view = map.view(0, 64);
+
+  map.createMapping(null, uniqueName('reopen'), 64);
+  assert.strictEqual(view.length, 0);
+  assert.strictEqual(map.view(0, 64).length, 64);
+
+  map.closeMapping();
+});
+
+test('view rejects ranges outside the mapping', function () {
+  const map = new addon.FileMapping();
+  assert.throws(function () { map.view(0, 1); }, /closed mapping/);
+
+  map.createMapping(null, uniqueName('range'), 64);
+  assert.throws(function () { map.view(60, 8); }, RangeError);
+  assert.throws(function () { map.view(65, 0); }, RangeError);
+  assert.strictEqual(map.view(64, 0).length, 0);
+
+  map.closeMapping();
+});
@@ -0,0 +1,96 @@
+const assert = require('assert');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+const { test, uniqueName } = require('./harness');
+const addon = require('..');
+
+const WINDOW = 64 * 1024;
+
+function tempFile() {
+  return path.join(os.tmpdir(), uniqueName('windowed') + '.bin');
+}
+
+test('WindowedFile copies across window boundaries', function () {
+  const file = tempFile();
+  const windowed = new addon.WindowedFile();
+  windowed.open(file, { windowSize: WINDOW, budget: 2 * WINDOW, size: 4 * WINDOW });
+  assert.strictEqual(windowed.size(), 4 * WINDOW);
+
+  // Straddles the first and second windows
+  const data = Buffer.alloc(1000);
+  for (let i = 0; i < data.length; i++)
+    data[i] = i & 0xff;
+  windowed.writeBuffer(data, WINDOW - 500, 0, data.length);
+
+  const out = Buffer.alloc(1000);
+  windowed.readInto(WINDOW - 500, 1000, out);
+  assert.deepStrictEqual(out, data);
+
+  windowed.close();
+
+  // And it really went to the file
+  const contents = fs.readFileSync(file);
+  assert.strictEqual(contents.length, 4 * WINDOW);
+  assert.deepStrictEqual(contents.slice(WINDOW - 500, WINDOW + 500), data);
+  fs.unlinkSync(file);
+});
+
+test('WindowedFile keeps the most recently used windows within budget', function () {
+  const file = tempFile();
+  const windowed = new addon.WindowedFile();
+  windowed.open(file, { windowSize: WINDOW, budget: 2 * WINDOW, size: 4 * WINDOW });
+
+  const byte = Buffer.alloc(1);
+  windowed.readInto(0, 1, byte);          // miss 0
+  windowed.readInto(WINDOW, 1, byte);     // miss 1
+  windowed.readInto(10, 1, byte);         // hit 0
+  windowed.readInto(2 * WINDOW, 1, byte); // miss 2, evicts 1
+  windowed.readInto(20, 1, byte);         // hit 0
+  windowed.readInto(WINDOW, 1, byte);     // miss 1, evicts 2
+
+  const stats = windowed.stats();
+  assert.strictEqual(stats.windowSize, WINDOW);
+  assert.strictEqual(stats.maxWindows, 2);
+  assert.strictEqual(stats.mapped, 2);
+  assert.strictEqual(stats.hits, 2);
+  assert.strictEqual(stats.misses, 4);
+  assert.strictEqual(stats.evictions, 2);
+  assert.deepStrictEqual(stats.windows, [
+    { offset: 0, hits: 2 },
+    { offset: WINDOW, hits: 0 }
+  ]);
+
+  windowed.close();
+  fs.unlinkSync(file);
+});
+
+test('WindowedFile maps a short last window', function () {
+  const file = tempFile();
+  fs.writeFileSync(file, Buffer.alloc(WINDOW + 100, 7));
+
+  const windowed = new addon.WindowedFile();
+  windowed.open(file, { windowSize: WINDOW, readOnly: true });
+  assert.strictEqual(windowed.size(), WINDOW + 100);
+
+  const out = Buffer.alloc(200);
+  windowed.readInto(WINDOW - 100, 200, out);
+  assert.deepStrictEqual(out, Buffer.alloc(200, 7));
+
+  assert.throws(function () { windowed.writeBuffer(out, 0, 0, 1); }, /read only/);
+  assert.throws(function () { windowed.readInto(WINDOW, 101, out); }, RangeError);
+
+  windowed.close();
+  fs.unlinkSync(file);
+});
+
+test('WindowedFile checks its arguments', function () {
+  const windowed = new addon.WindowedFile();
+
+  assert.throws(function () { windowed.open(); }, TypeError);
+  assert.throws(function () { windowed.open(tempFile(), { windowSize: 0 }); }, TypeError);
+  assert.throws(function () { windowed.open(tempFile(), { readOnly: true, size: 10 }); }, TypeError);
+  assert.throws(function () { windowed.open(tempFile()); }, /Failed to open file/);
+  assert.throws(function () { windowed.readInto(0, 1, Buffer.alloc(1)); }, /closed file/);
+  assert.throws(function () { windowed.readInto(0, 1); }, TypeError);
+});
@@ -0,0 +1,179 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName, createInMapping, exited } = require('./harness');
+const addon = require('..');
+
+const worker = path.join(__dirname, 'fixtures', 'work-queue-worker.js');
+
+// The pid of a process that has already exited
+async function deadPid() {
+  const child = fork(worker, ['exit']);
+  await exited(child);
+  return child.pid;
+}
+
+// Slot states are the lap in the high 32 bits, then the phase (1 writing,
+// 3 reading) in the top 2 bits of the low 32 and the owner's pid below that
+function setSlotState(map, slotStride, index, lap, phase, pid) {
+  const state = map.view(256 + index * slotStride, 8);
+  state.writeUInt32LE(((phase << 30) | pid) >>> 0, 0);
+  state.writeUInt32LE(lap, 4);
+}
+
+function setPosition(map, which, position) {
+  map.view(which === 'enqueue' ? 64 : 128, 4).writeUInt32LE(position, 0);
+}
+
+test('WorkQueue pushes and pops in order', function () {
+  const { map, object: queue } = createInMapping(addon.WorkQueue, [4, 64, 8, 128], [4, 64, 8, 128]);
+
+  assert.strictEqual(queue.pop(), null);
+  assert.strictEqual(queue.push(Buffer.from('small')), true);
+  assert.strictEqual(queue.push(Buffer.alloc(500, 7)), true);
+  assert.strictEqual(queue.push(Buffer.alloc(0)), true);
+  assert.strictEqual(queue.length(), 3);
+
+  assert.strictEqual(queue.pop().toString(), 'small');
+  assert.ok(queue.pop().equals(Buffer.alloc(500, 7)));
+  assert.strictEqual(queue.pop().length, 0);
+  assert.strictEqual(queue.pop(), null);
+  assert.strictEqual(queue.length(), 0);
+
+  map.closeMapping();
+});
+
+test('WorkQueue reports when the slots or the overflow arena are full', function () {
+  const { map, object: queue } = createInMapping(addon.WorkQueue, [4, 16, 4, 64], [4, 16, 4, 64]);
+
+  for (let i = 0; i < 4; ++i)
+    assert.strictEqual(queue.push(Buffer.from('item ' + i)), true);
+  assert.strictEqual(queue.push(Buffer.from('one too many')), false);
+
+  for (let lap = 0; lap < 3; ++lap) {
+    for (let i = 0; i < 4; ++i) {
+      assert.strictEqual(queue.pop().toString(), 'item ' + i);
+      assert.strictEqual(queue.push(Buffer.from('item ' + i)), true);
+    }
+  }
+  while (queue.pop() !== null);
+
+  // 56 bytes fit in a block, so this takes all four
+  assert.strictEqual(queue.push(Buffer.alloc(224, 1)), true);
+  assert.strictEqual(queue.push(Buffer.alloc(20)), false);
+  assert.strictEqual(queue.push(Buffer.alloc(16)), true);
+  assert.throws(function () { queue.push(Buffer.alloc(225)); }, RangeError);
+
+  assert.strictEqual(queue.pop().length, 224);
+  assert.strictEqual(queue.push(Buffer.alloc(20, 2)), true);
+  assert.strictEqual(queue.pop().length, 16);
+  assert.ok(queue.pop().equals(Buffer.alloc(20, 2)));
+
+  map.closeMapping();
+});
+
+test('WorkQueue.open finds an existing queue', function () {
+  const { name, map, object: queue } = createInMapping(addon.WorkQueue, [8, 32, 0, 0], [8, 32, 0, 0]);
+  const other = new addon.FileMapping();
+  const reader = new addon.WorkQueue();
+
+  other.openMapping(name, 0);
+  assert.throws(function () { reader.open(other, 64); }, /No WorkQueue/);
+  reader.open(other, 0);
+
+  queue.push(Buffer.from('across mappings'));
+  assert.strictEqual(reader.pop().toString(), 'across mappings');
+
+  other.closeMapping();
+  map.closeMapping();
+});
+
+test('WorkQueue checks its arguments', function () {
+  const map = new addon.FileMapping();
+  const queue = new addon.WorkQueue();
+  map.createMapping(null, uniqueName('queue_args'), 4096);
+
+  assert.strictEqual(addon.WorkQueue.size(4, 64), 256 + 4 * 128);
+  assert.throws(function () { addon.WorkQueue.size(3, 64); }, RangeError);
+  assert.throws(function () { addon.WorkQueue.size(4, 64, 2, 100); }, RangeError);
+  assert.throws(function () { queue.create(map, 0, 4); }, /Not enough arguments/);
+  assert.throws(function () { queue.create(map, 0, 'four', 64); }, /Wrong type/);
+  assert.throws(function () { queue.create(map, 8, 4, 64); }, /Misaligned/);
+  assert.throws(function () { queue.create(map, 0, 64, 64); }, /too small/);
+  assert.throws(function () { queue.pop(); }, /Not attached/);
+
+  queue.create(map, 0, 4, 64);
+  assert.throws(function () { queue.push('text'); }, /Wrong type/);
+  assert.throws(function () { queue.push(Buffer.alloc(65)); }, RangeError);
+
+  map.closeMapping();
+  assert.throws(function () { queue.pop(); }, /closed/);
+});
+
+test('WorkQueue skips a message whose producer died writing it', async function () {
+  const { map, object: queue } = createInMapping(addon.WorkQueue, [4, 64, 0, 0], [4, 64, 0, 0]);
+  const pid = await deadPid();
+
+  // A producer claimed position 0 and died before publishing it
+  setSlotState(map, 128, 0, 0, 1, pid);
+  setPosition(map, 'enqueue', 1);
+
+  assert.strictEqual(queue.pop(), null);
+  assert.strictEqual(queue.push(Buffer.from('after')), true);
+  assert.strictEqual(queue.pop().toString(), 'after');
+
+  map.closeMapping();
+});
+
+test('WorkQueue reclaims a slot whose consumer died reading it', async function () {
+  const { map, object: queue } = createInMapping(addon.WorkQueue, [4, 64, 4, 64], [4, 64, 4, 64]);
+  const pid = await deadPid();
+
+  assert.strictEqual(queue.push(Buffer.alloc(200, 1)), true);
+
+  // A consumer claimed position 0 and died before releasing it
+  setSlotState(map, 128, 0, 0, 3, pid);
+  setPosition(map, 'dequeue', 1);
+
+  for (let i = 1; i <= 4; ++i)
+    assert.strictEqual(queue.push(Buffer.from('item ' + i)), true);
+
+  for (let i = 1; i <= 4; ++i)
+    assert.strictEqual(queue.pop().toString(), 'item ' + i);
+
+  // Its overflow blocks went back on the free list too
+  assert.strictEqual(queue.push(Buffer.alloc(200, 2)), true);
+  assert.ok(queue.pop().equals(Buffer.alloc(200, 2)));
+
+  map.closeMapping();
+});
+
+test('WorkQueue delivers every message once across processes', async function () {
+  const { name, map, object: queue } = createInMapping(addon.WorkQueue, [64, 64, 256, 128], [64, 64, 256, 128]);
+  const producers = 4;
+  const consumers = 4;
+  const n = 5000;
+
+  const consumed = [];
+  for (let i = 0; i < consumers; ++i) {
+    const child = fork(worker, ['consume', name]);
+    consumed.push(new Promise(function (resolve) { child.once('message', resolve); }));
+  }
+
+  const produced = [];
+  for (let i = 0; i < producers; ++i)
+    produced.push(exited(fork(worker, ['produce', name, 'p' + i, String(n)])));
+
+  assert.deepStrictEqual(await Promise.all(produced), [0, 0, 0, 0]);
+
+  for (let i = 0; i < consumers; ++i) {
+    while (!queue.push(Buffer.from('stop')))
+      await new Promise(function (resolve) { setTimeout(resolve, 1); });
+  }
+
+  const received = [].concat.apply([], await Promise.all(consumed));
+  assert.strictEqual(received.length, producers * n);
+  assert.strictEqual(new Set(received).size, producers * n);
+
+  map.closeMapping();
+});
@@ -0,0 +1,86 @@
+const assert = require('assert');
+const path = require('path');
+const { fork } = require('child_process');
+const { test, uniqueName } = require('./harness');
+const addon = require('..');
+
+const host = path.join(__dirname, 'fixtures', 'worker-threads.js');
+
+// worker_threads is behind a flag before node 11.7
+const [major, minor] = process.versions.node.split('.').map(Number);
+const workerFlags = major < 10 || (major === 10 && minor < 5) ? null : major < 11 || (major === 11 && minor < 7) ? ['--experimental-worker'] : [];
+
+function runHost(args) {
+  return new Promise(function (resolve, reject) {
+    const child = fork(host, args, { execArgv: workerFlags });
+    let result = null;
+    child.on('message', function (message) { result = message; });
+    child.on('exit', function (code) {
+      if (code !== 0 || result === null)
+        reject(new Error('worker host exited with ' + code));
+      else
+        resolve(result);
+    });
+  });
+}
+
+test('FileMappings opening the same name in one process share a single mapping', function () {
+  const name = uniqueName('shared');
+  const creator = new addon.FileMapping();
+  const reader = new addon.FileMapping();
+  creator.createMapping(null, name, 4096);
+  reader.openMapping(name, 0);
+
+  assert.strictEqual(reader.size(), 4096);
+  const text = Buffer.alloc(6);
+  creator.writeBuffer(Buffer.from('shared'), 0, 0, 6);
+  reader.readInto(0, 6, text);
+  assert.strictEqual(text.toString(), 'shared');
+
+  // A smaller view of the same section
+  const small = new addon.FileMapping();
+  small.openMapping(name, 64);
+  assert.strictEqual(small.size(), 64);
+  small.closeMapping();
+
+  // The name outlives the creator's close while someone still has it open
+  creator.closeMapping();
+  text.fill(0);
+  reader.readInto(0, 6, text);
+  assert.strictEqual(text.toString(), 'shared');
+  const again = new addon.FileMapping();
+  again.openMapping(name, 4096);
+  again.closeMapping();
+
+  reader.closeMapping();
+
+  if (process.platform !== 'win32')
+    assert.throws(function () { new addon.FileMapping().openMapping(name, 4096); }, /Failed to open/);
+});
+
+if (!workerFlags || !addon.Mutex) {
+  test.skip('worker_threads need node 10.5 or later');
+  return;
+}
+
+test('worker_threads share one mapping for the same name', async function () {
+  const name = uniqueName('workers');
+  const result = await runHost(['share', name, '3']);
+
+  assert.deepStrictEqual(result.values, [1, 2, 3]);
+  assert.deepStrictEqual(result.codes, [0, 0, 0]);
+  assert.ok(result.removed);
+
+  if (process.platform === 'linux') {
+    result.counts.forEach(function (count) { assert.strictEqual(count, 1); });
+    assert.strictEqual(result.whileOpen, 1);
+  }
+});
+
+test('worker_threads finish async waits on their own thread, and can stop in the middle of one', async function () {
+  const result = await runHost(['async', uniqueName('workers_async')]);
+
+  assert.strictEqual(result.waitResult, addon.WAIT_OBJECT_0);
+  assert.strictEqual(result.waiterCode, 0);
+  assert.strictEqual(result.stuckCode, 1);
+});